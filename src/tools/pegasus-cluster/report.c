@@ -33,7 +33,7 @@ static char* identifier;
 struct utsname uname_cache;
 
 #define KS_FLAGS_ARG "ioelnNRBLTIwWSsKk"
-#define KS_FLAGS_NOARG "HVXFfqctzZ"
+#define KS_FLAGS_NOARG "HVXFfqctzZg"
 
 static char* create_identifier() {
     char buffer[128];
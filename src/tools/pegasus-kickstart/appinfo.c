@@ -43,6 +43,9 @@
 
 #define YAML_SCHEMA_VERSION "3.0"
 
+/* Size of the stdio buffer for the invocation record */
+#define YAML_BUFFER_SIZE (1024*1024)
+
 extern char **environ;
 
 /* Return non-zero if any part of the job failed */
@@ -63,12 +66,12 @@ static void printJobIDs(FILE *out) {
 
     char *condor = getenv("CONDOR_JOBID");
     if (condor) {
-        fprintf(out, "    condor: %s\n", condor);
+        yamlstr(out, 4, "condor", condor);
     }
 
     char *gram = getenv("GLOBUS_GRAM_JOB_CONTACT");
     if (gram) {
-        fprintf(out, "    gram: %s\n", gram);
+        yamlstr(out, 4, "gram", gram);
     }
 
     /* We assume that there is only going to be one LRM job ID */
@@ -76,37 +79,37 @@ static void printJobIDs(FILE *out) {
 
     lrm = getenv("SLURM_JOBID");
     if (lrm) {
-        fprintf(out, "    lrmtype: slurm\n");
-        fprintf(out, "    lrm: %s\n", lrm);
+        yamlstr(out, 4, "lrmtype", "slurm");
+        yamlstr(out, 4, "lrm", lrm);
         goto end;
     }
 
     lrm = getenv("COBALT_JOBID");
     if (lrm) {
-        fprintf(out, "    lrmtype: cobalt\n");
-        fprintf(out, "    lrm: %s\n", lrm);
+        yamlstr(out, 4, "lrmtype", "cobalt");
+        yamlstr(out, 4, "lrm", lrm);
         goto end;
     }
 
     lrm = getenv("JOB_ID");
     if (lrm) {
-        fprintf(out, "    lrmtype: sge\n");
-        fprintf(out, "    lrm: %s\n", lrm);
+        yamlstr(out, 4, "lrmtype", "sge");
+        yamlstr(out, 4, "lrm", lrm);
         goto end;
     }
 
     lrm = getenv("LSB_JOBID");
     if (lrm) {
-        fprintf(out, "    lrmtype: lsf\n");
-        fprintf(out, "    lrm: %s\n", lrm);
+        yamlstr(out, 4, "lrmtype", "lsf");
+        yamlstr(out, 4, "lrm", lrm);
         goto end;
     }
 
     /* Do PBS last so that a more specific LRM is identified, if possible */
     lrm = getenv("PBS_JOBID");
     if (lrm) {
-        fprintf(out, "    lrmtype: pbs\n");
-        fprintf(out, "    lrm: %s\n", lrm);
+        yamlstr(out, 4, "lrmtype", "pbs");
+        yamlstr(out, 4, "lrm", lrm);
         goto end;
     }
 
@@ -119,6 +122,35 @@ static int comparator(const void* a, const void* b) {
   return strcmp(*((const char**) a), *((const char**)b));
 }
 
+static double job_duration(const JobInfo* job) {
+    if (job->isValid != 1) {
+        return 0.0;
+    }
+    return doubletime(job->finish) - doubletime(job->start);
+}
+
+static void printSelfTiming(FILE *out, const AppInfo* run) {
+    /* purpose: show where kickstart spent its own time, the overhead is
+     *          the time kickstart ran minus the time the jobs ran
+     * paramtr: out (IO): the stream
+     *          run (IN): the timings of the phases
+     */
+    static const char* phase_names[MAX_PHASE] = {
+        "tempfiles", "machine", "interface", "limits", "startup",
+        "final", "checksums", "hostname", "record"
+    };
+    double jobs = job_duration(&run->setup) + job_duration(&run->prejob) +
+                  job_duration(&run->application) + job_duration(&run->postjob) +
+                  job_duration(&run->cleanup);
+    double record = monotime() - run->phase[PHASE_RECORD];
+
+    fprintf(out, "  overhead:\n");
+    for (KickstartPhase p=PHASE_TEMPFILES; p<MAX_PHASE; ++p) {
+        yamlfixed(out, 4, phase_names[p], p == PHASE_RECORD ? record : run->phase[p], 6);
+    }
+    yamlfixed(out, 4, "total", monotime() - run->monoStart - jobs, 6);
+}
+
 static size_t convert2YAML(FILE *out, const AppInfo* run) {
     size_t i;
     size_t error_count = 0;
@@ -129,72 +161,62 @@ static size_t convert2YAML(FILE *out, const AppInfo* run) {
                  "  version: " YAML_SCHEMA_VERSION "\n");
 
     /* start */
-    fprintf(out, "  start: %s\n", fmtisodate(run->start.tv_sec,
-                                             run->start.tv_usec));
+    yamlstr(out, 2, "start", fmtisodate(run->start.tv_sec, run->start.tv_usec));
 
     /* duration */
-    fprintf(out, "  duration: %.3f\n",
-            doubletime(run->finish) - doubletime(run->start));
+    yamlfixed(out, 2, "duration", doubletime(run->finish) - doubletime(run->start), 3);
 
     /* optional attributes for root element: transformation fqdn */
     if (run->xformation && strlen(run->xformation)) {
-        fprintf(out, "  transformation: \"");
-        yamlquote(out, run->xformation, strlen(run->xformation));
-        fprintf(out, "\"\n");
+        yamlquoted(out, 2, "transformation", run->xformation);
     }
 
     /* optional attributes for root element: derivation fqdn */
     if (run->derivation && strlen(run->derivation)) {
-        fprintf(out, "  derivation: \"");
-        yamlquote(out, run->derivation, strlen(run->derivation));
-        fprintf(out, "\"\n");
+        yamlquoted(out, 2, "derivation", run->derivation);
     }
 
     /* optional attributes for root element: name of remote site */
     if (run->sitehandle && strlen(run->sitehandle)) {
-        fprintf(out, "  resource: \"");
-        yamlquote(out, run->sitehandle, strlen(run->sitehandle));
-        fprintf(out, "\"\n");
+        yamlquoted(out, 2, "resource", run->sitehandle);
     }
 
     /* optional attribute for workflow label: name of workflow */
     if (run->wf_label && strlen(run->wf_label)) {
-        fprintf(out, "  wf-label: \"");
-        yamlquote(out, run->wf_label, strlen(run->wf_label));
-        fprintf(out, "\"\n");
+        yamlquoted(out, 2, "wf-label", run->wf_label);
     }
     if (run->wf_stamp && strlen(run->wf_stamp)) {
-        fprintf(out, "  wf-stamp: \"");
-        yamlquote(out, run->wf_stamp, strlen(run->wf_stamp));
-        fprintf(out, "\"\n");
+        yamlquoted(out, 2, "wf-stamp", run->wf_stamp);
     }
 
     /* optional attributes for root element: host address dotted quad */
     if (isdigit(run->ipv4[0])) {
-        struct hostent* h;
-        in_addr_t address = inet_addr(run->ipv4);
-        fprintf(out, "  interface: %s\n", run->prif);
-        fprintf(out, "  hostaddr: %s\n", run->ipv4);
-        if ((h = gethostbyaddr((const char*) &address, sizeof(in_addr_t), AF_INET))) {
-            fprintf(out, "  hostname: %s\n", h->h_name);
+        char hostname[NI_MAXHOST];
+        double t = monotime();
+        int found = finishHostLookup(hostname, sizeof(hostname));
+        ((AppInfo*) run)->phase[PHASE_HOSTNAME] = monotime() - t;
+        yamlstr(out, 2, "interface", run->prif);
+        yamlstr(out, 2, "hostaddr", run->ipv4);
+        if (found) {
+            yamlstr(out, 2, "hostname", hostname);
         }
     }
 
     /* optional attributes for root element: application process id */
     if (run->child != 0) {
-        fprintf(out, "  pid: %d\n", run->child);
+        yamlint(out, 2, "pid", run->child);
     }
 
     /* user info about who ran this thing */
-    fprintf(out, "  uid: %d\n", getuid());
+    yamlint(out, 2, "uid", (int) getuid());
     if (user) {
-        fprintf(out, "  user: %s\n", user->pw_name);
+        yamlstr(out, 2, "user", user->pw_name);
     }
 
     /* group info about who ran this thing */
-    fprintf(out, "  gid: %d\n", getgid());
+    yamlint(out, 2, "gid", (int) getgid());
     if (group) {
-        fprintf(out, "  group: %s\n", group->gr_name);
+        yamlstr(out, 2, "group", group->gr_name);
     }
 
     /* currently active umask settings */
@@ -213,7 +235,7 @@ static size_t convert2YAML(FILE *out, const AppInfo* run) {
     /* <cwd> */
     fprintf(out, "  cwd: ");
     if (run->workdir != NULL) {
-        fprintf(out, "%s", run->workdir);
+        fputs(run->workdir, out);
     }
     fprintf(out, "\n");
 
@@ -238,9 +260,24 @@ static size_t convert2YAML(FILE *out, const AppInfo* run) {
         }
     }
     if (run->fcount && run->final) {
+        double t = monotime();
+        /* Checksum all the final files in parallel before printing them */
+        const char **names = calloc(run->fcount, sizeof(char *));
+        if (names != NULL) {
+            size_t n = 0;
+            for (i=0; i<run->fcount; ++i) {
+                if (run->final[i].error == 0 && run->final[i].file.name != NULL) {
+                    names[n++] = run->final[i].file.name;
+                }
+            }
+            pegasus_integrity_prefetch(names, n);
+            free(names);
+        }
         for (i=0; i<run->fcount; ++i) {
             error_count += printYAMLStatInfo(out, 4, "final", &run->final[i], includeData, useCDATA, 1);
         }
+        pegasus_integrity_release();
+        ((AppInfo*) run)->phase[PHASE_CHECKSUMS] = monotime() - t;
     }
 
     /* If yaml blob file exists (for example, created via pegasus-transfer), include it */
@@ -280,11 +317,11 @@ static size_t convert2YAML(FILE *out, const AppInfo* run) {
             char *s;
             if (key && (s = strchr(key, '='))) {
                 *s = '\0'; /* temporarily cut string here */
-                fprintf(out, "    \"");
+                fputs("    \"", out);
                 yamlquote(out, key, strlen(key));
-                fprintf(out, "\": \"");
+                fputs("\": \"", out);
                 yamlquote(out, s+1, strlen(s+1));
-                fprintf(out, "\"\n");
+                fputs("\"\n", out);
                 *s = '='; /* reset string to original */
             }
         }
@@ -295,6 +332,10 @@ static size_t convert2YAML(FILE *out, const AppInfo* run) {
 
     } /* run->status || run->fullInfo */
 
+    if (run->selfTiming) {
+        printSelfTiming(out, run);
+    }
+
     if (error_count > 0)
         return -1;
     return 0;
@@ -322,33 +363,49 @@ int initAppInfo(AppInfo* appinfo, int argc, char* const* argv) {
     /* find a suitable directory for temporary files */
     const char* tempdir = getTempDir();
 
+    double t;
+    char* selftiming;
+    char* capture;
+
     /* reset everything */
     memset(appinfo, 0, sizeof(AppInfo));
 
     /* init timestamps with defaults */
     now(&appinfo->start);
     appinfo->finish = appinfo->start;
+    appinfo->monoStart = monotime();
+    selftiming = getenv("KICKSTART_SELF_TIMING");
+    appinfo->selfTiming = selftiming != NULL && strcmp(selftiming, "0") != 0;
 
     /* obtain umask */
     appinfo->umask = umask(0);
     umask(appinfo->umask);
 
     /* obtain system information */
+    t = monotime();
     initMachineInfo(&appinfo->machine);
+    appinfo->phase[PHASE_MACHINE] = monotime() - t;
 
     /* initialize some data for myself */
     initStatInfoFromName(&appinfo->kickstart, argv[0], O_RDONLY, 0);
 
     /* default for stdin */
+    t = monotime();
     initStatInfoFromName(&appinfo->input, "/dev/null", O_RDONLY, 0);
 
+    /* stdout and stderr are only captured in memory on request */
+    capture = getenv("KICKSTART_CAPTURE_MEMORY");
+    if (capture != NULL && *capture) {
+        capture_memory_size = strtoul(capture, NULL, 0);
+    }
+
     /* default for stdout */
     pattern(tempname, tempsize, tempdir, "/", "ks.out.XXXXXX");
-    initStatInfoAsTemp(&appinfo->output, tempname);
+    initStatInfoAsMemory(&appinfo->output, tempname);
 
     /* default for stderr */
     pattern(tempname, tempsize, tempdir, "/", "ks.err.XXXXXX");
-    initStatInfoAsTemp(&appinfo->error, tempname);
+    initStatInfoAsMemory(&appinfo->error, tempname);
 
     /* default for stdlog */
     initStatInfoFromHandle(&appinfo->logfile, STDOUT_FILENO);
@@ -360,18 +417,22 @@ int initAppInfo(AppInfo* appinfo, int argc, char* const* argv) {
     /* integrity data */
     pattern(tempname, tempsize, tempdir, "/", "ks.integrity.XXXXXX");
     initStatInfoAsTemp(&appinfo->integritydata, tempname);
+    appinfo->phase[PHASE_TEMPFILES] = monotime() - t;
 
     /* original argument vector */
     appinfo->argc = argc;
     appinfo->argv = argv;
 
     /* where do I run -- guess the primary interface IPv4 dotted quad */
-    /* find out where we run at (might stall LATER for some time on DNS) */
+    t = monotime();
     whoami(appinfo->ipv4, sizeof(appinfo->ipv4),
            appinfo->prif, sizeof(appinfo->prif));
+    appinfo->phase[PHASE_INTERFACE] = monotime() - t;
 
     /* record resource limits */
+    t = monotime();
     initLimitInfo(&appinfo->limits);
+    appinfo->phase[PHASE_LIMITS] = monotime() - t;
 
     /* which process is me */
     appinfo->child = getpid();
@@ -423,6 +484,10 @@ int printAppInfo(AppInfo* run) {
         goto exit;
     }
 
+    /* The record is written by many small calls, let them fill a large
+     * buffer and write it out in a few system calls. */
+    setvbuf(out, NULL, _IOFBF, YAML_BUFFER_SIZE);
+
     /* what about myself? Update stat info on log file */
     updateStatInfo(&run->logfile);
 
@@ -435,6 +500,9 @@ int printAppInfo(AppInfo* run) {
     /* stop the clock */
     now(&run->finish);
 
+    /* the record is timed until it is complete, this is the start */
+    run->phase[PHASE_RECORD] = monotime();
+
     /* print the invocation record */
     result = convert2YAML(out, run);
 
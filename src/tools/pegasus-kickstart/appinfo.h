@@ -26,6 +26,20 @@
 #include "limitinfo.h"
 #include "machine.h"
 
+/* Parts of kickstart's own work, timed for KICKSTART_SELF_TIMING */
+typedef enum {
+    PHASE_TEMPFILES,    /* create the temporary files for stdio */
+    PHASE_MACHINE,      /* collect the machine information */
+    PHASE_INTERFACE,    /* find the primary interface */
+    PHASE_LIMITS,       /* read the resource limits */
+    PHASE_STARTUP,      /* everything before the first job */
+    PHASE_FINAL,        /* stat the files given with -S and -s */
+    PHASE_CHECKSUMS,    /* checksum the files given with -s */
+    PHASE_HOSTNAME,     /* wait for the host name */
+    PHASE_RECORD,       /* write the invocation record */
+    MAX_PHASE
+} KickstartPhase;
+
 typedef struct {
     struct timeval start;          /* point of time that app was started */
     struct timeval finish;         /* point of time that app was reaped */
@@ -36,6 +50,7 @@ typedef struct {
     int            enableSysTrace; /* Enable system call tracing */
     int            omitData;       /* Omit <data> for stdout and stderr if job succeeds */
     int            enableLibTrace; /* Enable library tracing */
+    int            enableCgroup;   /* Account resource usage with a cgroup */
     int            termTimeout;    /* Time to allow job to run before sending sigterm */
     int            killTimeout;    /* Time to allow job to handle sigterm before sending sigkill */
     pid_t          currentChild;   /* The current child process (setup, pre, main, post, cleanup) */
@@ -80,6 +95,10 @@ typedef struct {
     MachineInfo    machine;        /* more system information */
 
     int            status;         /* The final status of the job */
+
+    int            selfTiming;     /* Report the time spent in kickstart */
+    double         monoStart;      /* monotonic time when kickstart started */
+    double         phase[MAX_PHASE]; /* seconds spent in each phase */
 } AppInfo;
 
 extern int initAppInfo(AppInfo* appinfo, int argc, char* const* argv);
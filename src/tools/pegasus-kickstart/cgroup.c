@@ -0,0 +1,436 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <inttypes.h>
+
+#include "cgroup.h"
+#include "utils.h"
+#include "error.h"
+
+#ifdef LINUX
+
+/* Read a small file into buf and terminate it. Returns the length or -1 */
+static ssize_t read_file(int dirfd, const char *name, char *buf, size_t size) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t len = 0;
+    while (len < size - 1) {
+        ssize_t n = read(fd, buf + len, size - 1 - len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        len += n;
+    }
+    close(fd);
+    buf[len] = '\0';
+    return len;
+}
+
+static int write_file(const char *dir, const char *name, const char *value) {
+    char path[PATH_MAX];
+    if (snprintf(path, sizeof(path), "%s/%s", dir, name) >= (int) sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+/* Find the directory of the cgroup of this process in the cgroup v2
+ * hierarchy */
+static int find_own_cgroup(char *dir, size_t size) {
+    char buf[8192];
+    int fd;
+    char *cgroup = NULL, *mount = NULL, *root = NULL;
+
+    /* The line of the v2 hierarchy is "0::/path" */
+    fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = read(fd, buf, sizeof(buf) - 1);
+    close(fd);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+    for (char *line = buf; line != NULL && *line != '\0'; ) {
+        char *next = strchr(line, '\n');
+        if (next != NULL) {
+            *next++ = '\0';
+        }
+        if (strncmp(line, "0::", 3) == 0) {
+            cgroup = strdup(line + 3);
+            break;
+        }
+        line = next;
+    }
+    if (cgroup == NULL) {
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* The mount point of the hierarchy: "id parent dev root mountpoint
+     * options... - cgroup2 source options" */
+    FILE *mountinfo = fopen("/proc/self/mountinfo", "r");
+    if (mountinfo == NULL) {
+        free(cgroup);
+        return -1;
+    }
+    while (fgets(buf, sizeof(buf), mountinfo) != NULL) {
+        char *sep = strstr(buf, " - cgroup2 ");
+        if (sep == NULL) {
+            continue;
+        }
+        *sep = '\0';
+        char *save = NULL;
+        strtok_r(buf, " ", &save);
+        strtok_r(NULL, " ", &save);
+        strtok_r(NULL, " ", &save);
+        root = strtok_r(NULL, " ", &save);
+        mount = strtok_r(NULL, " ", &save);
+        break;
+    }
+    fclose(mountinfo);
+    if (mount == NULL || root == NULL) {
+        free(cgroup);
+        errno = ENOENT;
+        return -1;
+    }
+
+    /* The path is relative to the root of the mount, which is not "/" if
+     * only a part of the hierarchy is mounted */
+    const char *relative = cgroup;
+    size_t rootlen = strlen(root);
+    if (strcmp(root, "/") != 0 && strncmp(cgroup, root, rootlen) == 0) {
+        relative += rootlen;
+    }
+    if (strcmp(relative, "/") == 0) {
+        relative = "";
+    }
+    n = snprintf(dir, size, "%s%s", mount, relative);
+    free(cgroup);
+    if (n >= (ssize_t) size) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    return 0;
+}
+
+/* Move this process into a leaf below its cgroup, so that controllers
+ * can be enabled for the children of its cgroup. A cgroup other than the
+ * root cannot have both processes and children with controllers. */
+static int leave_own_cgroup(const char *own) {
+    char leaf[PATH_MAX];
+    char value[32];
+    if (snprintf(leaf, sizeof(leaf), "%s/supervisor", own) >= (int) sizeof(leaf)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (mkdir(leaf, 0755) < 0 && errno != EEXIST) {
+        return -1;
+    }
+    snprintf(value, sizeof(value), "%d", getpid());
+    return write_file(leaf, "cgroup.procs", value);
+}
+
+/* Enable the controllers that kickstart reads for the children of dir,
+ * if they are available there */
+static int enable_controllers(const char *dir) {
+    char buf[1024];
+    char value[32];
+
+    int dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        return -1;
+    }
+    ssize_t n = read_file(dirfd, "cgroup.controllers", buf, sizeof(buf));
+    close(dirfd);
+    if (n < 0) {
+        return -1;
+    }
+
+    char *save = NULL;
+    for (char *tok = strtok_r(buf, " \n", &save); tok != NULL; tok = strtok_r(NULL, " \n", &save)) {
+        if (strcmp(tok, "cpu") != 0 && strcmp(tok, "memory") != 0 &&
+                strcmp(tok, "io") != 0 && strcmp(tok, "pids") != 0) {
+            continue;
+        }
+        snprintf(value, sizeof(value), "+%s", tok);
+        if (write_file(dir, "cgroup.subtree_control", value) < 0) {
+            int saved = errno;
+            printerr("Unable to enable the %s controller in %s: %s\n",
+                     tok, dir, strerror(errno));
+            errno = saved;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int createCgroup(Cgroup *cg) {
+    /* purpose: create a cgroup for a job
+     * paramtr: cg (OUT): the new cgroup
+     * returns: 0 on success, -1 if cgroups are not available or not
+     *          writable
+     */
+    static int jobs = 0;
+    static char parent[PATH_MAX] = "";
+    char own[PATH_MAX];
+    char path[PATH_MAX];
+
+    cg->dirfd = -1;
+    cg->path = NULL;
+
+    /* The cgroup of the jobs is only set up for the first one, kickstart
+     * may have moved itself out of it */
+    if (parent[0] == '\0') {
+        if (find_own_cgroup(own, sizeof(own)) < 0) {
+            return -1;
+        }
+
+        /* The user may give a delegated cgroup, otherwise the job cgroups
+         * are created below the cgroup of kickstart */
+        char *env = getenv("KICKSTART_CGROUP");
+        if (env != NULL && env[0] != '\0') {
+            if (strlen(env) >= sizeof(parent)) {
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+            strcpy(path, env);
+        } else {
+            strcpy(path, own);
+        }
+
+        /* kickstart has to leave its cgroup before the controllers can
+         * be enabled, except in the root, which has no cgroup.type */
+        if (strcmp(path, own) == 0) {
+            char type[PATH_MAX];
+            if (snprintf(type, sizeof(type), "%s/cgroup.type", own) >= (int) sizeof(type)) {
+                errno = ENAMETOOLONG;
+                return -1;
+            }
+            if (access(type, F_OK) == 0 && leave_own_cgroup(own) < 0) {
+                return -1;
+            }
+        }
+
+        /* This fails if other processes are still in the cgroup */
+        if (enable_controllers(path) < 0) {
+            return -1;
+        }
+        strcpy(parent, path);
+    }
+
+    if (snprintf(path, sizeof(path), "%s/kickstart.%d.%d", parent, getpid(), jobs++) >= (int) sizeof(path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (mkdir(path, 0755) < 0) {
+        return -1;
+    }
+    cg->dirfd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    cg->path = strdup(path);
+    if (cg->dirfd < 0 || cg->path == NULL) {
+        deleteCgroup(cg);
+        return -1;
+    }
+    return 0;
+}
+
+int joinCgroup(Cgroup *cg, pid_t pid) {
+    /* purpose: move a process into the cgroup
+     * paramtr: cg (IN): the cgroup
+     *          pid (IN): the process, which must not have started the job
+     *          yet, so that it has no children in the old cgroup
+     * returns: 0 on success, -1 on error
+     */
+    char value[32];
+    snprintf(value, sizeof(value), "%d", pid);
+    int fd = openat(cg->dirfd, "cgroup.procs", O_WRONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    ssize_t n = write(fd, value, strlen(value));
+    int saved = errno;
+    close(fd);
+    errno = saved;
+    return n < 0 ? -1 : 0;
+}
+
+/* Parse "key value" lines, e.g. cpu.stat */
+static uint64_t find_value(const char *buf, const char *key) {
+    size_t len = strlen(key);
+    const char *line = buf;
+    while (line != NULL) {
+        if (strncmp(line, key, len) == 0 && line[len] == ' ') {
+            return strtoull(line + len + 1, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+    return 0;
+}
+
+int readCgroup(Cgroup *cg, CgroupUsage *usage) {
+    /* purpose: read the counters of the cgroup after the job has finished
+     * paramtr: cg (IN): the cgroup
+     *          usage (OUT): the counters
+     * returns: 0 on success, -1 if nothing could be read
+     */
+    char buf[8192];
+
+    memset(usage, 0, sizeof(CgroupUsage));
+
+    if (read_file(cg->dirfd, "cpu.stat", buf, sizeof(buf)) > 0) {
+        usage->user_usec = find_value(buf, "user_usec");
+        usage->system_usec = find_value(buf, "system_usec");
+        usage->fields |= CGROUP_CPU;
+    }
+
+    if (read_file(cg->dirfd, "memory.peak", buf, sizeof(buf)) > 0) {
+        usage->memory_peak = strtoull(buf, NULL, 10);
+        usage->fields |= CGROUP_MEMORY;
+    }
+
+    /* One line per device: "8:0 rbytes=1 wbytes=2 rios=3 wios=4 ..." */
+    if (read_file(cg->dirfd, "io.stat", buf, sizeof(buf)) >= 0) {
+        char *save = NULL;
+        for (char *tok = strtok_r(buf, " \n", &save); tok != NULL; tok = strtok_r(NULL, " \n", &save)) {
+            char *eq = strchr(tok, '=');
+            if (eq == NULL) {
+                continue;
+            }
+            uint64_t value = strtoull(eq + 1, NULL, 10);
+            *eq = '\0';
+            if (strcmp(tok, "rbytes") == 0) {
+                usage->rbytes += value;
+            } else if (strcmp(tok, "wbytes") == 0) {
+                usage->wbytes += value;
+            } else if (strcmp(tok, "rios") == 0) {
+                usage->rios += value;
+            } else if (strcmp(tok, "wios") == 0) {
+                usage->wios += value;
+            }
+        }
+        usage->fields |= CGROUP_IO;
+    }
+
+    if (read_file(cg->dirfd, "pids.peak", buf, sizeof(buf)) > 0) {
+        usage->pids_peak = strtoull(buf, NULL, 10);
+        usage->fields |= CGROUP_PIDS;
+    }
+
+    return usage->fields == 0 ? -1 : 0;
+}
+
+void deleteCgroup(Cgroup *cg) {
+    /* purpose: remove the cgroup, unless processes of the job are still
+     *          running in it
+     * paramtr: cg (IO): the cgroup
+     */
+    if (cg->dirfd >= 0) {
+        close(cg->dirfd);
+        cg->dirfd = -1;
+    }
+    if (cg->path != NULL) {
+        if (rmdir(cg->path) < 0) {
+            printerr("Unable to remove cgroup %s: %s\n", cg->path, strerror(errno));
+        }
+        free(cg->path);
+        cg->path = NULL;
+    }
+}
+
+#else
+
+int createCgroup(Cgroup *cg) {
+    cg->dirfd = -1;
+    cg->path = NULL;
+    errno = ENOSYS;
+    return -1;
+}
+
+int joinCgroup(Cgroup *cg, pid_t pid) {
+    errno = ENOSYS;
+    return -1;
+}
+
+int readCgroup(Cgroup *cg, CgroupUsage *usage) {
+    memset(usage, 0, sizeof(CgroupUsage));
+    errno = ENOSYS;
+    return -1;
+}
+
+void deleteCgroup(Cgroup *cg) {
+}
+
+#endif
+
+int printYAMLCgroupUsage(FILE *out, int indent, const char *id,
+                         const CgroupUsage *usage) {
+    /* purpose: write the counters of the job cgroup
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): indentation level
+     *          id (IN): name of the section
+     *          usage (IN): the counters
+     * returns: 0
+     */
+    if (usage->fields == 0) {
+        return 0;
+    }
+
+    yamlindent(out, indent);
+    fputs(id, out);
+    fputs(":\n", out);
+    if (usage->fields & CGROUP_CPU) {
+        yamlfixed(out, indent+2, "utime", usage->user_usec / 1e6, 3);
+        yamlfixed(out, indent+2, "stime", usage->system_usec / 1e6, 3);
+    }
+    if (usage->fields & CGROUP_MEMORY) {
+        yamluint(out, indent+2, "mempeak", usage->memory_peak / 1024);
+    }
+    if (usage->fields & CGROUP_IO) {
+        yamluint(out, indent+2, "rbytes", usage->rbytes);
+        yamluint(out, indent+2, "wbytes", usage->wbytes);
+        yamluint(out, indent+2, "rios", usage->rios);
+        yamluint(out, indent+2, "wios", usage->wios);
+    }
+    if (usage->fields & CGROUP_PIDS) {
+        yamluint(out, indent+2, "pidspeak", usage->pids_peak);
+    }
+    return 0;
+}
@@ -0,0 +1,61 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _CGROUP_H
+#define _CGROUP_H
+
+/* Resource accounting with cgroup v2. The job is moved into a new cgroup
+ * below the one of kickstart before it starts, and the counters of the
+ * cgroup are read when it has finished. This covers every process of the
+ * job without tracing it. The cgroup can only be created if kickstart is
+ * allowed to write to its own cgroup, e.g. when the batch system or
+ * systemd delegated it. Memory, I/O and process counts are only available
+ * if those controllers are enabled for the subtree.
+ */
+
+#include <sys/types.h>
+#include <stdio.h>
+#include <stdint.h>
+
+/* Counters that were found */
+#define CGROUP_CPU      0x01
+#define CGROUP_MEMORY   0x02
+#define CGROUP_IO       0x04
+#define CGROUP_PIDS     0x08
+
+typedef struct {
+    int fields;             /* CGROUP_* flags, 0 if the job had no cgroup */
+    uint64_t user_usec;     /* cpu.stat */
+    uint64_t system_usec;
+    uint64_t memory_peak;   /* memory.peak in bytes */
+    uint64_t rbytes;        /* io.stat, summed over all devices */
+    uint64_t wbytes;
+    uint64_t rios;
+    uint64_t wios;
+    uint64_t pids_peak;     /* pids.peak */
+} CgroupUsage;
+
+typedef struct {
+    int dirfd;              /* Directory of the job cgroup, or -1 */
+    char *path;
+} Cgroup;
+
+extern int createCgroup(Cgroup *cg);
+extern int joinCgroup(Cgroup *cg, pid_t pid);
+extern int readCgroup(Cgroup *cg, CgroupUsage *usage);
+extern void deleteCgroup(Cgroup *cg);
+extern int printYAMLCgroupUsage(FILE *out, int indent, const char *id,
+                                const CgroupUsage *usage);
+
+#endif /* _CGROUP_H */
@@ -20,14 +20,342 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
 #include <time.h>
 #include <sys/time.h>
 #include "sha2.h"
+#include "hashtable.h"
+#include "uring.h"
+#include "checksumcache.h"
 
 #include "checksum.h"
 
 #define BUFSIZE 4096
 
+/* Files are read with read() into a large aligned buffer. O_DIRECT and
+ * mmap are not used: the outputs were usually just written by the job, so
+ * they are in the page cache, and O_DIRECT would force them to be read
+ * back from disk. */
+#define CHECKSUM_BUFSIZE (1024 * 1024)
+
+/* Upper limit for the number of threads used by pegasus_integrity_prefetch */
+#define CHECKSUM_MAX_THREADS 16
+
+typedef struct {
+    const char *path;                       /* Name given to the prefetch */
+    char *name;                             /* Real path of the file */
+    int ok;                                 /* 1 if the checksum was computed */
+    unsigned char hval[SHA256_DIGEST_SIZE];
+    double duration;                        /* Seconds spent reading and hashing */
+    uint64_t bytes;                         /* Number of bytes hashed */
+} Checksum;
+
+/* Checksums computed by pegasus_integrity_prefetch */
+static Checksum *prefetched = NULL;
+static size_t nprefetched = 0;
+static size_t nextprefetch = 0;
+static HashTable prefetchindex;         /* Checksums that are ok, by name */
+
+static int prefetch_match(const void *value, const void *key) {
+    return strcmp(((const Checksum *)value)->name, (const char *)key) == 0;
+}
+
+/* A checksum that libinterpose computed while the file was written */
+typedef struct {
+    char *name;
+    int ndigests;                           /* Number of digests reported */
+    int nwriters;                           /* Number of times it was written */
+    unsigned char hval[SHA256_DIGEST_SIZE];
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    double duration;
+} Streamed;
+
+/* Streamed checksums by file name */
+static HashTable streamed;
+
+static int streamed_match(const void *value, const void *key) {
+    return strcmp(((const Streamed *)value)->name, (const char *)key) == 0;
+}
+
+static Streamed *get_streamed(const char *fname) {
+    uint64_t hash = hashString(fname);
+    Streamed *s = findHashEntry(&streamed, hash, streamed_match, fname);
+    if (s != NULL) {
+        return s;
+    }
+    s = calloc(1, sizeof(Streamed));
+    if (s == NULL) {
+        return NULL;
+    }
+    s->name = strdup(fname);
+    if (s->name == NULL || addHashEntry(&streamed, hash, s) < 0) {
+        free(s->name);
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+void pegasus_integrity_streamed(const char *fname, const unsigned char *hval,
+                                uint64_t size, int64_t mtime_sec, int64_t mtime_nsec,
+                                double duration) {
+    /* purpose: remember a checksum that was computed while the file was
+     *          written, so that the file does not have to be read again
+     * paramtr: fname (IN): real path of the file
+     *          hval (IN): SHA-256 digest of the file
+     *          size (IN): size of the file when the digest was computed
+     *          mtime_sec, mtime_nsec (IN): modification time at that moment
+     *          duration (IN): seconds spent computing the digest
+     */
+    Streamed *s = get_streamed(fname);
+    if (s == NULL) {
+        return;
+    }
+    s->ndigests++;
+    memcpy(s->hval, hval, SHA256_DIGEST_SIZE);
+    s->size = size;
+    s->mtime_sec = mtime_sec;
+    s->mtime_nsec = mtime_nsec;
+    s->duration = duration;
+}
+
+void pegasus_integrity_writer(const char *fname) {
+    /* purpose: record that a traced process wrote to a file. A streamed
+     *          checksum is only used if a single writer produced the file.
+     * paramtr: fname (IN): real path of the file
+     */
+    Streamed *s = get_streamed(fname);
+    if (s != NULL) {
+        s->nwriters++;
+    }
+}
+
+/* Use the streamed checksum of fname if the file did not change since */
+static int find_streamed(const char *fname, Checksum *sum) {
+    struct stat st;
+    Streamed *s;
+
+    if (streamed.count == 0) {
+        return 0;
+    }
+    s = findHashEntry(&streamed, hashString(fname), streamed_match, fname);
+    if (s == NULL || s->ndigests != 1 || s->nwriters > 1) {
+        return 0;
+    }
+    if (stat(fname, &st) != 0 || (uint64_t)st.st_size != s->size ||
+            st.st_mtim.tv_sec != s->mtime_sec || st.st_mtim.tv_nsec != s->mtime_nsec) {
+        return 0;
+    }
+
+    memcpy(sum->hval, s->hval, SHA256_DIGEST_SIZE);
+    sum->duration = s->duration;
+    sum->bytes = s->size;
+    sum->ok = 1;
+    return 1;
+}
+
+/* A file whose status changed this recently may still be written within
+ * the resolution of the timestamps, so its checksum is not cached */
+#define CACHE_MIN_AGE 2.0
+
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+
+static void open_cache(void) {
+    const char *path = getenv("KICKSTART_CHECKSUM_CACHE");
+    if (path != NULL && path[0] != '\0') {
+        openChecksumCache(path);
+    }
+}
+
+static int same_file(const struct stat *a, const struct stat *b) {
+    return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+           a->st_size == b->st_size &&
+           a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+           a->st_mtim.tv_nsec == b->st_mtim.tv_nsec &&
+           a->st_ctim.tv_sec == b->st_ctim.tv_sec &&
+           a->st_ctim.tv_nsec == b->st_ctim.tv_nsec;
+}
+
+static int checksum_file(const char *fname, Checksum *sum) {
+    unsigned char *buf;
+    sha256_ctx ctx[1];
+    ssize_t len;
+    double start_ts;
+    struct stat st, after;
+    int regular;
+    UringReader *reader = NULL;
+    int fd;
+
+    sum->ok = 0;
+    sum->bytes = 0;
+    start_ts = get_ts();
+
+    if ((fd = open(fname, O_RDONLY)) < 0) {
+        return 0;
+    }
+    regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    /* The file may have been hashed before by another job on this node */
+    pthread_once(&cache_once, open_cache);
+    if (regular && lookupChecksumCache(&st, sum->hval)) {
+        close(fd);
+        sum->bytes = st.st_size;
+        sum->duration = 0;
+        sum->ok = 1;
+        return 1;
+    }
+
+    sha256_begin(ctx);
+    if (regular && st.st_size >= 2 * CHECKSUM_BUFSIZE &&
+            (reader = uringOpenReader(fd, CHECKSUM_BUFSIZE)) != NULL) {
+        /* Large files are read ahead with io_uring, so that reading the
+         * next block overlaps with hashing the current one */
+        const unsigned char *data;
+        while ((len = uringRead(reader, &data)) > 0) {
+            sha256_hash(data, (unsigned long)len, ctx);
+            sum->bytes += len;
+        }
+        uringCloseReader(reader);
+    } else {
+#ifdef POSIX_FADV_SEQUENTIAL
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+        if (posix_memalign((void **)&buf, 4096, CHECKSUM_BUFSIZE) != 0) {
+            close(fd);
+            return 0;
+        }
+        for (;;) {
+            len = read(fd, buf, CHECKSUM_BUFSIZE);
+            if (len < 0 && errno == EINTR) {
+                continue;
+            }
+            if (len <= 0) {
+                break;
+            }
+            sha256_hash(buf, (unsigned long)len, ctx);
+            sum->bytes += len;
+        }
+        free(buf);
+    }
+    if (len < 0) {
+        close(fd);
+        return 0;
+    }
+    sha256_end(sum->hval, ctx);
+    sum->duration = get_ts() - start_ts;
+    sum->ok = 1;
+
+    /* Only cache files that did not change while they were read */
+    if (regular && start_ts - st.st_ctim.tv_sec > CACHE_MIN_AGE &&
+            fstat(fd, &after) == 0 && same_file(&st, &after)) {
+        addChecksumCache(&st, sum->hval);
+    }
+    close(fd);
+
+    return 1;
+}
+
+static void *prefetch_thread(void *arg) {
+    size_t i;
+    while ((i = __sync_fetch_and_add(&nextprefetch, 1)) < nprefetched) {
+        /* resolving the name is a metadata round trip too */
+        prefetched[i].name = realpath(prefetched[i].path, NULL);
+        if (prefetched[i].name != NULL && !find_streamed(prefetched[i].name, &prefetched[i])) {
+            checksum_file(prefetched[i].name, &prefetched[i]);
+        }
+    }
+    return NULL;
+}
+
+void pegasus_integrity_prefetch(const char **fnames, size_t n) {
+    /* purpose: compute the checksums of several files in parallel, so that
+     *          pegasus_integrity_yaml can return them without reading the
+     *          files again
+     * paramtr: fnames (IN): names of the files
+     *          n (IN): number of files
+     */
+    pthread_t threads[CHECKSUM_MAX_THREADS];
+    size_t nthreads, started, i;
+    long ncpus;
+
+    pegasus_integrity_release();
+    if (n < 2) {
+        /* Nothing to gain */
+        return;
+    }
+
+    prefetched = calloc(n, sizeof(Checksum));
+    if (prefetched == NULL) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        prefetched[i].path = fnames[i];
+    }
+    nprefetched = n;
+    nextprefetch = 0;
+
+    /* probe once, before the threads need it */
+    uringAvailable();
+    pthread_once(&cache_once, open_cache);
+
+    /* Reading overlaps with hashing, so use a few more threads than CPUs */
+    ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (ncpus < 1) {
+        ncpus = 1;
+    }
+    nthreads = 2 * ncpus;
+    if (nthreads > n) {
+        nthreads = n;
+    }
+    if (nthreads > CHECKSUM_MAX_THREADS) {
+        nthreads = CHECKSUM_MAX_THREADS;
+    }
+
+    for (started = 0; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, prefetch_thread, NULL) != 0) {
+            break;
+        }
+    }
+    /* If no thread could be started, do the work here */
+    if (started == 0) {
+        prefetch_thread(NULL);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+
+    /* pegasus_integrity_yaml looks up every final file */
+    for (i = 0; i < n; i++) {
+        if (prefetched[i].ok) {
+            addHashEntry(&prefetchindex, hashString(prefetched[i].name), &prefetched[i]);
+        }
+    }
+}
+
+void pegasus_integrity_release() {
+    /* purpose: free the checksums computed by pegasus_integrity_prefetch */
+    size_t i;
+    for (i = 0; i < nprefetched; i++) {
+        free(prefetched[i].name);
+    }
+    free(prefetched);
+    prefetched = NULL;
+    nprefetched = 0;
+    deleteHashTable(&prefetchindex);
+}
+
+static Checksum *find_prefetched(const char *fname) {
+    if (prefetchindex.count == 0) {
+        return NULL;
+    }
+    return findHashEntry(&prefetchindex, hashString(fname), prefetch_match, fname);
+}
+
 
 int pegasus_integrity_yaml(const char *fname, char *yaml) {
     /* purpose: calculate the checksum of a file
@@ -35,49 +363,43 @@ int pegasus_integrity_yaml(const char *fname, char *yaml) {
      *          yaml: the buffer for the calculated checksum
      * returns: 1 on success
      */
-    FILE          *inf;
+    Checksum      computed;
+    Checksum      *sum;
     char          buf[BUFSIZE];
-    sha256_ctx    ctx[1];
-    unsigned char hval[SHA256_DIGEST_SIZE];
     char          chksum_str[(SHA256_DIGEST_SIZE * 2) + 1];
     char          *chksum_cur;
-    int           i, len;
-    double        start_ts, duration;
+    int           i;
 
     /* in case of failure */
     *yaml = '\0';
     chksum_str[0] = '\0';
 
-    start_ts = get_ts(); 
-    if (!(inf = fopen(fname, "r"))) {
+    if (fname == NULL) {
         return 0;
     }
-
-    sha256_begin(ctx);
-    len = 0;
-    do
-    {   
-        len = (int)fread(buf, 1, BUFSIZE, inf);
-        if (len) {
-            sha256_hash((unsigned char*)buf, len, ctx);
+    if ((sum = find_prefetched(fname)) == NULL) {
+        sum = &computed;
+        if (!find_streamed(fname, sum) && !checksum_file(fname, sum)) {
+            return 0;
         }
     }
-    while (len);
-    fclose(inf);
-    sha256_end(hval, ctx);
-    duration = get_ts() - start_ts;
 
     chksum_cur = chksum_str;
     for (i = 0; i < SHA256_DIGEST_SIZE; ++i) {
-        sprintf(chksum_cur, "%02x", hval[i]);
+        sprintf(chksum_cur, "%02x", sum->hval[i]);
         chksum_cur += 2;
     }
     chksum_str[SHA256_DIGEST_SIZE * 2] = '\0';
    
     sprintf(buf, "      sha256: %s\n", chksum_str);
     strcat(yaml, buf);
-    sprintf(buf, "      checksum_timing: %0.2f\n", duration);
+    sprintf(buf, "      checksum_timing: %0.2f\n", sum->duration);
     strcat(yaml, buf);
+    /* GB/s, only if the time is long enough to be meaningful */
+    if (sum->duration > 0.0001) {
+        sprintf(buf, "      checksum_throughput: %0.3f\n", sum->bytes / sum->duration / 1e9);
+        strcat(yaml, buf);
+    }
 
     return 1;
 }
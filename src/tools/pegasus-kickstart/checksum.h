@@ -15,8 +15,21 @@
 #ifndef _CHECKSUM_H
 #define _CHECKSUM_H
 
+#include <stddef.h>
+#include <stdint.h>
+
 extern int pegasus_integrity_yaml(const char *fname, char *xml);
 
+extern void pegasus_integrity_prefetch(const char **fnames, size_t n);
+
+extern void pegasus_integrity_release();
+
+extern void pegasus_integrity_streamed(const char *fname, const unsigned char *hval,
+                                       uint64_t size, int64_t mtime_sec, int64_t mtime_nsec,
+                                       double duration);
+
+extern void pegasus_integrity_writer(const char *fname);
+
 extern int print_pegasus_integrity_yaml_blob(FILE *out, const char *fname);
 
 extern double get_ts();
@@ -0,0 +1,185 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+
+#include "checksumcache.h"
+#include "hashtable.h"
+#include "error.h"
+
+static CacheHeader *cache = NULL;
+static uint32_t *buckets;
+static CacheEntry *entries;
+
+static size_t cache_size(uint32_t nbuckets, uint32_t capacity) {
+    return sizeof(CacheHeader) + nbuckets * sizeof(uint32_t) +
+           (size_t) capacity * sizeof(CacheEntry);
+}
+
+int openChecksumCache(const char *path) {
+    /* purpose: map the cache file, and create it if it does not exist
+     * paramtr: path (IN): name of the cache file
+     * returns: 0 on success, -1 if the cache cannot be used
+     */
+    struct stat st;
+    CacheHeader header;
+    void *map;
+    int fd;
+
+    if (cache != NULL) {
+        return 0;
+    }
+
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        printerr("Unable to open checksum cache %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    /* The first process initializes the file, the lock makes the others
+     * wait until the header is complete */
+    if (flock(fd, LOCK_EX) != 0 || fstat(fd, &st) != 0) {
+        goto error;
+    }
+    if (st.st_size == 0) {
+        memset(&header, 0, sizeof(header));
+        header.magic = CHECKSUM_CACHE_MAGIC;
+        header.version = CHECKSUM_CACHE_VERSION;
+        header.nbuckets = CHECKSUM_CACHE_BUCKETS;
+        header.capacity = CHECKSUM_CACHE_ENTRIES;
+        if (ftruncate(fd, cache_size(header.nbuckets, header.capacity)) != 0 ||
+                pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            goto error;
+        }
+        st.st_size = cache_size(header.nbuckets, header.capacity);
+    } else if (pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+        goto error;
+    }
+    flock(fd, LOCK_UN);
+
+    if (header.magic != CHECKSUM_CACHE_MAGIC ||
+            header.version != CHECKSUM_CACHE_VERSION ||
+            header.nbuckets == 0 ||
+            (header.nbuckets & (header.nbuckets - 1)) != 0 ||
+            header.nbuckets > (1 << 24) || header.capacity > (1 << 28) ||
+            (size_t) st.st_size < cache_size(header.nbuckets, header.capacity)) {
+        printerr("Ignoring invalid checksum cache %s\n", path);
+        close(fd);
+        return -1;
+    }
+
+    map = mmap(NULL, cache_size(header.nbuckets, header.capacity),
+               PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        printerr("Unable to map checksum cache %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    buckets = (uint32_t *)((char *) map + sizeof(CacheHeader));
+    entries = (CacheEntry *)(buckets + header.nbuckets);
+    cache = map;
+    return 0;
+
+error:
+    printerr("Unable to initialize checksum cache %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+}
+
+static int64_t nanoseconds(const struct timespec *t) {
+    return (int64_t) t->tv_sec * 1000000000 + t->tv_nsec;
+}
+
+static uint32_t *bucket(const struct stat *st) {
+    uint64_t hash = hashInteger((uint64_t) st->st_ino ^ ((uint64_t) st->st_dev << 40));
+    return &buckets[hash & (cache->nbuckets - 1)];
+}
+
+static int matches(const CacheEntry *e, const struct stat *st) {
+    return e->ino == (uint64_t) st->st_ino &&
+           e->dev == (uint64_t) st->st_dev &&
+           e->size == (uint64_t) st->st_size &&
+           e->mtime_ns == nanoseconds(&st->st_mtim) &&
+           e->ctime_ns == nanoseconds(&st->st_ctim);
+}
+
+int lookupChecksumCache(const struct stat *st, uint8_t sha256[32]) {
+    /* purpose: find the checksum of a file that has not changed since it
+     *          was added to the cache
+     * paramtr: st (IN): stat of the open file
+     *          sha256 (OUT): the checksum
+     * returns: 1 if found, 0 if not
+     */
+    uint32_t capacity, index, steps;
+
+    if (cache == NULL) {
+        return 0;
+    }
+    capacity = cache->capacity;
+    index = __atomic_load_n(bucket(st), __ATOMIC_ACQUIRE);
+    /* the file may be corrupt, so the walk is bounded */
+    for (steps = 0; index != 0 && index <= capacity && steps < capacity; steps++) {
+        const CacheEntry *e = &entries[index - 1];
+        if (__atomic_load_n(&e->valid, __ATOMIC_ACQUIRE) && matches(e, st)) {
+            memcpy(sha256, e->sha256, 32);
+            return 1;
+        }
+        index = e->next;
+    }
+    return 0;
+}
+
+void addChecksumCache(const struct stat *st, const uint8_t sha256[32]) {
+    /* purpose: remember the checksum of a file
+     * paramtr: st (IN): stat of the file, taken before it was read, and
+     *                   still the same after
+     *          sha256 (IN): the checksum
+     */
+    uint32_t index, head;
+    uint32_t *b;
+    CacheEntry *e;
+
+    if (cache == NULL) {
+        return;
+    }
+    index = __atomic_fetch_add(&cache->count, 1, __ATOMIC_RELAXED);
+    if (index >= cache->capacity) {
+        /* full, keep the count from wrapping around */
+        __atomic_store_n(&cache->count, cache->capacity, __ATOMIC_RELAXED);
+        return;
+    }
+
+    e = &entries[index];
+    e->dev = st->st_dev;
+    e->ino = st->st_ino;
+    e->size = st->st_size;
+    e->mtime_ns = nanoseconds(&st->st_mtim);
+    e->ctime_ns = nanoseconds(&st->st_ctim);
+    memcpy(e->sha256, sha256, 32);
+    __atomic_store_n(&e->valid, 1, __ATOMIC_RELEASE);
+
+    b = bucket(st);
+    head = __atomic_load_n(b, __ATOMIC_ACQUIRE);
+    do {
+        e->next = head;
+    } while (!__atomic_compare_exchange_n(b, &head, index + 1, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
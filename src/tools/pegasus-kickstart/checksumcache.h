@@ -0,0 +1,71 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _CHECKSUMCACHE_H
+#define _CHECKSUMCACHE_H
+
+/* Persistent cache of file checksums, shared by all kickstart processes
+ * that use the same cache file (KICKSTART_CHECKSUM_CACHE).
+ *
+ * A file is identified by its device, inode, size, modification time and
+ * change time, all of which must match for a lookup to succeed. Writing
+ * to a file, truncating it or replacing it changes at least one of them,
+ * and the change time cannot be set by the user, so an entry can only
+ * match the content it was computed from.
+ *
+ * The cache file is mapped into memory. It consists of a CacheHeader, an
+ * array of buckets and an array of entries. New entries are appended by
+ * reserving the next free one with an atomic add on the count in the
+ * header, filling it in, setting its valid flag, and then pushing it onto
+ * the list of its bucket with compare-and-swap. Readers never take a lock.
+ * Entries are never removed. When the entries are used up, the cache
+ * stops growing and only serves lookups.
+ */
+
+#include <sys/stat.h>
+#include <stdint.h>
+
+#define CHECKSUM_CACHE_MAGIC 0x4b53484153484331ULL
+#define CHECKSUM_CACHE_VERSION 1
+
+/* Sizes of a new cache file. The file is sparse, only the pages that
+ * are used take up space. */
+#define CHECKSUM_CACHE_BUCKETS 65536
+#define CHECKSUM_CACHE_ENTRIES 131072
+
+typedef struct {
+    uint64_t magic;         /* CHECKSUM_CACHE_MAGIC */
+    uint32_t version;       /* CHECKSUM_CACHE_VERSION */
+    uint32_t nbuckets;      /* Number of buckets, a power of two */
+    uint32_t capacity;      /* Number of entries */
+    uint32_t count;         /* Entries reserved so far, may exceed capacity */
+    uint32_t reserved[10];
+} CacheHeader;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    uint8_t sha256[32];
+    uint32_t next;          /* Next entry in the bucket + 1, 0 at the end */
+    uint32_t valid;         /* Set after the other fields are filled in */
+} CacheEntry;
+
+extern int openChecksumCache(const char *path);
+extern int lookupChecksumCache(const struct stat *st, uint8_t sha256[32]);
+extern void addChecksumCache(const struct stat *st, const uint8_t sha256[32]);
+
+#endif /* _CHECKSUMCACHE_H */
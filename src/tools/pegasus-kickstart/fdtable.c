@@ -0,0 +1,216 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "fdtable.h"
+
+/* Number of descriptors to use if the limit is unknown */
+#define FDTABLE_DEFAULT 1024
+
+/* Upper bound on the size of the table, this is the largest value
+ * of /proc/sys/fs/nr_open on Linux */
+#define FDTABLE_MAX (INT_MAX & ~(FDTABLE_CHUNK - 1))
+
+int initFDTable(FDTable *table, size_t elemsize) {
+    /* purpose: set the descriptor limit of a table. Nothing is allocated
+     *          until an entry is used.
+     * paramtr: table (OUT): table to initialize
+     *          elemsize (IN): size of one entry
+     * returns: 0 on success
+     */
+    int maxfds = FDTABLE_DEFAULT;
+
+    /* Use the hard limit because the process can raise the soft limit */
+    struct rlimit nofile;
+    if (getrlimit(RLIMIT_NOFILE, &nofile) == 0) {
+        if (nofile.rlim_max == RLIM_INFINITY || nofile.rlim_max > FDTABLE_MAX) {
+            maxfds = FDTABLE_MAX;
+        } else if (nofile.rlim_max > maxfds) {
+            maxfds = nofile.rlim_max;
+        }
+    }
+
+    table->elemsize = elemsize;
+    __atomic_store_n(&table->maxfds,
+                     (maxfds + FDTABLE_CHUNK - 1) / FDTABLE_CHUNK * FDTABLE_CHUNK,
+                     __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Find the level and the position in the level of the chunk of fd */
+static inline int chunkLevel(int fd, size_t *pos) {
+    unsigned int n = (unsigned int) fd / FDTABLE_CHUNK + 1;
+    int level = 31 - __builtin_clz(n);
+    *pos = n - (1u << level);
+    return level;
+}
+
+void *findFDEntry(FDTable *table, int fd) {
+    /* purpose: find the entry for fd without allocating anything
+     * paramtr: table (IN): descriptor table
+     *          fd (IN): descriptor
+     * returns: the entry, or NULL if fd is invalid or its chunk does not
+     *          exist yet, which means the entry was never used
+     */
+    if (fd < 0 || fd >= __atomic_load_n(&table->maxfds, __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+
+    size_t pos;
+    int level = chunkLevel(fd, &pos);
+    void **chunks = __atomic_load_n(&table->levels[level], __ATOMIC_ACQUIRE);
+    if (chunks == NULL) {
+        return NULL;
+    }
+
+    char *chunk = __atomic_load_n(&chunks[pos], __ATOMIC_ACQUIRE);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    return chunk + (fd % FDTABLE_CHUNK) * table->elemsize;
+}
+
+/* Get *slot, or allocate it with calloc if it is NULL. If another
+ * thread allocates it at the same time, its allocation is used. */
+static void *getSlot(void **slot, size_t n, size_t size) {
+    void *p = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    if (p == NULL) {
+        void *newp = calloc(n, size);
+        if (newp == NULL) {
+            return NULL;
+        }
+        if (__atomic_compare_exchange_n(slot, &p, newp, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            p = newp;
+        } else {
+            free(newp);
+        }
+    }
+    return p;
+}
+
+void *getFDEntry(FDTable *table, int fd) {
+    /* purpose: get the entry for fd, allocating its chunk if necessary.
+     *          New entries are zeroed.
+     * paramtr: table (IO): descriptor table
+     *          fd (IN): descriptor
+     * returns: the entry, or NULL if fd is out of range or allocation failed
+     */
+    if (__atomic_load_n(&table->maxfds, __ATOMIC_ACQUIRE) == 0) {
+        initFDTable(table, table->elemsize);
+    }
+
+    if (fd < 0 || fd >= table->maxfds) {
+        return NULL;
+    }
+
+    size_t pos;
+    int level = chunkLevel(fd, &pos);
+    void **chunks = (void **)getSlot((void **)&table->levels[level],
+                                     (size_t)1 << level, sizeof(void *));
+    if (chunks == NULL) {
+        return NULL;
+    }
+
+    char *chunk = (char *)getSlot(&chunks[pos], FDTABLE_CHUNK, table->elemsize);
+    if (chunk == NULL) {
+        return NULL;
+    }
+
+    return chunk + (fd % FDTABLE_CHUNK) * table->elemsize;
+}
+
+int nextFDEntry(FDTable *table, int fd) {
+    /* purpose: iterate over the entries that have been allocated
+     * paramtr: table (IN): descriptor table
+     *          fd (IN): descriptor to start from
+     * returns: the first descriptor >= fd that has an entry, or -1
+     */
+    if (fd < 0) {
+        return -1;
+    }
+
+    while (fd < table->maxfds) {
+        size_t pos;
+        int level = chunkLevel(fd, &pos);
+        void **chunks = __atomic_load_n(&table->levels[level], __ATOMIC_ACQUIRE);
+        long next;
+        if (chunks == NULL) {
+            /* Skip to the first chunk of the next level */
+            next = ((1L << (level + 1)) - 1) * FDTABLE_CHUNK;
+        } else if (__atomic_load_n(&chunks[pos], __ATOMIC_ACQUIRE) != NULL) {
+            return fd;
+        } else {
+            /* Skip to the start of the next chunk */
+            next = ((long)fd / FDTABLE_CHUNK + 1) * FDTABLE_CHUNK;
+        }
+        if (next >= table->maxfds) {
+            break;
+        }
+        fd = next;
+    }
+
+    return -1;
+}
+
+size_t sizeOfFDTable(FDTable *table) {
+    /* purpose: determine how much memory a table uses
+     * paramtr: table (IN): descriptor table
+     * returns: number of bytes allocated for the table
+     */
+    size_t size = 0;
+    for (int level = 0; level < FDTABLE_LEVELS; level++) {
+        void **chunks = table->levels[level];
+        if (chunks == NULL) {
+            continue;
+        }
+        size_t n = (size_t)1 << level;
+        size += n * sizeof(void *);
+        for (size_t i = 0; i < n; i++) {
+            if (chunks[i] != NULL) {
+                size += FDTABLE_CHUNK * table->elemsize;
+            }
+        }
+    }
+
+    return size;
+}
+
+void deleteFDTable(FDTable *table) {
+    /* purpose: free all the memory used by a table. The table is empty
+     *          and can be used again afterwards.
+     * paramtr: table (IO): descriptor table
+     */
+    for (int level = 0; level < FDTABLE_LEVELS; level++) {
+        void **chunks = table->levels[level];
+        if (chunks == NULL) {
+            continue;
+        }
+        for (size_t i = 0; i < ((size_t)1 << level); i++) {
+            free(chunks[i]);
+        }
+        free(chunks);
+        table->levels[level] = NULL;
+    }
+
+    table->maxfds = 0;
+}
@@ -0,0 +1,62 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _FDTABLE_H
+#define _FDTABLE_H
+
+/* Sparse table indexed by file descriptor, used by both libinterpose and
+ * the ptrace syscall tracer. Entries are stored in chunks of FDTABLE_CHUNK
+ * entries, and the pointers to the chunks are stored in levels that double
+ * in size: level 0 points to chunk 0, level 1 to chunks 1-2, level 2 to
+ * chunks 3-6, and so on. A level is only allocated when a descriptor that
+ * it covers is used, so a process with a few low descriptors needs one
+ * pointer no matter how high RLIMIT_NOFILE is. Levels and chunks never
+ * move, so the address of an entry stays valid until the table is deleted,
+ * and lookups don't need a lock.
+ *
+ * A table that is all zeros except for elemsize (e.g. part of a calloc'd
+ * struct) is valid and empty, the limit is set by the first call to
+ * getFDEntry. After that, getFDEntry can be called from several threads
+ * at once.
+ */
+
+#include <stddef.h>
+
+#define FDTABLE_CHUNK 256
+
+/* Enough levels for INT_MAX descriptors */
+#define FDTABLE_LEVELS 24
+
+/* libinterpose is preloaded into arbitrary applications, so keep these
+ * functions out of its dynamic symbol table */
+#if defined(__GNUC__) && !defined(__APPLE__)
+#define FDTABLE_HIDDEN __attribute__((visibility("hidden")))
+#else
+#define FDTABLE_HIDDEN
+#endif
+
+typedef struct {
+    size_t elemsize;        /* Size of an entry in bytes */
+    int maxfds;             /* Number of descriptors the table can hold */
+    void **levels[FDTABLE_LEVELS]; /* Level i has 2^i chunk pointers */
+} FDTable;
+
+extern FDTABLE_HIDDEN int initFDTable(FDTable *table, size_t elemsize);
+extern FDTABLE_HIDDEN void *findFDEntry(FDTable *table, int fd);
+extern FDTABLE_HIDDEN void *getFDEntry(FDTable *table, int fd);
+extern FDTABLE_HIDDEN int nextFDEntry(FDTable *table, int fd);
+extern FDTABLE_HIDDEN size_t sizeOfFDTable(FDTable *table);
+extern FDTABLE_HIDDEN void deleteFDTable(FDTable *table);
+
+#endif /* _FDTABLE_H */
@@ -19,17 +19,17 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
 
+#include <sys/stat.h>
 #include <sys/utsname.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-
-#include <sys/ioctl.h>
-
-#ifdef DARWIN
-#include <sys/sockio.h>
-#endif
+#include <netdb.h>
+#include <ifaddrs.h>
 
 #include "getif.h"
 #include "utils.h"
@@ -60,133 +60,34 @@ static void singleton_init(void) {
     }
 }
 
-int interface_list(struct ifconf* ifc) {
-    /* purpose: returns the list of interfaces
-     * paramtr: ifc (IO): initializes structure with buffer and length
-     * returns: sockfd for further queries, or -1 to indicate an error. 
-     * warning: caller must free memory in ifc.ifc_buf
-     *          caller must close sockfd (result value)
-     */
-#if defined(SIOCGLIFNUM)
-    struct lifnum ifnr;
-#endif
-    char *buf = 0;
-    int lastlen, len, sockfd = 0;
-
-    /* create a socket */
-    if ((sockfd = socket(AF_INET, SOCK_DGRAM, 0)) == -1) { 
-        int saverr = errno; 
-        printerr("ERROR: socket DGRAM: %d: %s\n",
-                errno, strerror(errno));
-        errno = saverr; 
-        return -1;
-    }
-
-    /*
-     * phase 1: guestimate size of buffer necessary to contain all interface
-     * information records. 
+static int primary_address(struct sockaddr_in* address, char* name, size_t size) {
+    /* purpose: obtain the address and name of the primary interface
+     * paramtr: address (OUT): IPv4 address of the interface
+     *          name (OUT): name of the interface
+     *          size (IN): capacity of name
+     * returns: 0 on success, -1 if there is no interface that is up
      */
-#if defined(SIOCGLIFNUM)
-    /* API exists to determine the correct buffer size */
-    memset(&ifnr, 0, sizeof(ifnr));
-    ifnr.lifn_family = AF_INET;
-    if (ioctl(sockfd, SIOCGLIFNUM, &ifnr) < 0) {
-        printerr("ERROR: ioctl SIOCGLIFNUM: %d: %s\n",
-                errno, strerror(errno));
-
-        if (errno != EINVAL) {
-            int saverr = errno;
-            close(sockfd);
-            errno = saverr; 
-            return -1; 
-        }
-    } else {
-        len = lastlen = ifnr.lifn_count * sizeof(struct ifreq);
-    }
-#else /* does not have SIOCGLIFNUM */
-    /* determine by repetitive guessing a buffer size */
-    lastlen = len = 3.5 * sizeof(struct ifreq); /* 1st guesstimate */
-#endif
-    /* POST CONDITION: some buffer size determined */
-
-    /* FIXME: Missing upper bound */
-    for (;;) {
-        /* guestimate correct buffer length */
-        buf = (char*) malloc(len);
-        if (buf == NULL) {
-            printerr("malloc: %s\n", strerror(errno));
-            return -1;
-        }
-        memset(buf, 0, len);
-        ifc->ifc_len = len;
-        ifc->ifc_buf = buf;
-        if (ioctl(sockfd, SIOCGIFCONF, ifc) < 0) {
-            printerr("WARN: ioctl SIOCGIFCONF: %d: %s\n",
-                    errno, strerror(errno));
-            if (errno != EINVAL || lastlen != 0) {
-                int saverr = errno; 
-                close(sockfd);
-                errno = saverr; 
-                return -1; 
-            }
-        } else {
-            if (ifc->ifc_len == lastlen) break; /* success */
-            lastlen = ifc->ifc_len;
-        }
-        len <<= 1;
-        free((void*) buf);
-    }
-    /* POST CONDITION: Now the buffer contains list of all interfaces */
+    struct ifaddrs* list;
+    struct ifaddrs* ifa;
+    struct ifaddrs* primary = NULL;
 
-    return sockfd; 
-}
-
-struct ifreq* primary_interface(void) {
-    /* purpose: obtain the primary interface information
-     * returns: a newly-allocated structure containing the interface info,
-     *          or NULL to indicate an error. 
-     */
-    struct sockaddr_in sa;
-    struct ifconf ifc;
-    struct ifreq result, primary;
-    struct ifreq* ifrcopy = NULL;
-    char *ptr;
-    int sockfd, flag = 0;
-
-    /*
-     * phase 0: init
-     */
-    memset(&result, 0, sizeof(result));
-    memset(&primary, 0, sizeof(primary));
     singleton_init();
 
-    /* 
-     * phase 1: obtain list of interfaces 
-     */
-    if ((sockfd = interface_list(&ifc)) == -1) {
-        return NULL;
+    if (getifaddrs(&list) == -1) {
+        printerr("ERROR: getifaddrs: %d: %s\n", errno, strerror(errno));
+        return -1;
     }
 
-    /*
-     * phase 2: walk interface list until a good interface is reached
-     */ 
-    /* Notice: recycle meaning of "len" in here */
-    for (ptr = ifc.ifc_buf; ptr < ifc.ifc_buf + ifc.ifc_len; ) {
-        struct ifreq* ifr = (struct ifreq*) ptr;
-#ifndef _SIZEOF_ADDR_IFREQ
-        size_t len = sizeof(*ifr);
-#else
-        size_t len = _SIZEOF_ADDR_IFREQ(*ifr);
-#endif /* _SIZEOF_ADDR_IFREQ */
-
-        ptr += len;
-
-        /* interested in IPv4 interfaces only */
-        if (ifr->ifr_addr.sa_family != AF_INET) {
+    for (ifa = list; ifa != NULL; ifa = ifa->ifa_next) {
+        struct sockaddr_in sa;
+
+        /* interested in IPv4 interfaces that are up only */
+        if (ifa->ifa_addr == NULL || ifa->ifa_addr->sa_family != AF_INET ||
+                !(ifa->ifa_flags & IFF_UP)) {
             continue;
         }
 
-        memcpy(&sa, &(ifr->ifr_addr), sizeof(struct sockaddr_in));
+        memcpy(&sa, ifa->ifa_addr, sizeof(struct sockaddr_in));
 
         /* Do not use localhost aka loopback interfaces. While loopback
          * interfaces traditionally start with "lo", this is not mandatory.
@@ -196,49 +97,123 @@ struct ifreq* primary_interface(void) {
             continue;
         }
 
-        /* prime candidate - check, if interface is UP */
-        result = *ifr;
-        ioctl(sockfd, SIOCGIFFLAGS, &result);
-
-        /* interface is up - our work is done. Or is it? */
-        if ((result.ifr_flags & IFF_UP)) {
-            if (! flag) {
-                /* remember first found primary interface */
-                primary = result;
-                flag = 1;
-            }
-
-            /* check for VPNs */
-            if ((sa.sin_addr.s_addr & vpn_netmask[1]) == vpn_network[1] ||
-                (sa.sin_addr.s_addr & vpn_netmask[2]) == vpn_network[2] ||
-                (sa.sin_addr.s_addr & vpn_netmask[3]) == vpn_network[3] ||
-                (sa.sin_addr.s_addr & vpn_netmask[4]) == vpn_network[4] ||
-                (sa.sin_addr.s_addr & vpn_netmask[5]) == vpn_network[5]) {
-                /* Nothing */
-            } else {
-                flag = 2;
-                break;
-            }
+        /* remember first found primary interface */
+        if (primary == NULL) {
+            primary = ifa;
+        }
+
+        /* check for VPNs, a public address is the best choice */
+        if (!((sa.sin_addr.s_addr & vpn_netmask[1]) == vpn_network[1] ||
+              (sa.sin_addr.s_addr & vpn_netmask[2]) == vpn_network[2] ||
+              (sa.sin_addr.s_addr & vpn_netmask[3]) == vpn_network[3] ||
+              (sa.sin_addr.s_addr & vpn_netmask[4]) == vpn_network[4] ||
+              (sa.sin_addr.s_addr & vpn_netmask[5]) == vpn_network[5])) {
+            primary = ifa;
+            break;
         }
     }
 
-    /* check for loop exceeded - if yes, fall back on first primary */
-    if (flag == 1 && ptr >= ifc.ifc_buf + ifc.ifc_len) {
-        result = primary;
+    if (primary != NULL) {
+        memcpy(address, primary->ifa_addr, sizeof(struct sockaddr_in));
+        snprintf(name, size, "%s", primary->ifa_name);
     }
+    freeifaddrs(list);
+
+    return primary == NULL ? -1 : 0;
+}
+
+/* The host name is looked up in a thread while the job runs, so that a
+ * slow or broken resolver does not hold up kickstart. The result is only
+ * waited for until a deadline. */
+enum { LOOKUP_NONE, LOOKUP_RUNNING, LOOKUP_DONE };
 
-    /* clean up */
-    free((void*) ifc.ifc_buf);
-    close(sockfd);
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+    int state;
+    int cached;                 /* result came from the host cache */
+    struct timespec deadline;   /* CLOCK_REALTIME */
+    struct sockaddr_in address;
+    char interface[16];
+    char hostname[NI_MAXHOST];  /* empty if the address has no name */
+} lookup = { PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER, LOOKUP_NONE };
+
+#define HOST_CACHE_TTL 600
+#define RESOLVE_TIMEOUT 2.0
+
+static const char* host_cache(void) {
+    const char* fn = getenv("KICKSTART_HOST_CACHE");
+    return fn != NULL && *fn ? fn : NULL;
+}
+
+static int read_host_cache(char* abuffer, size_t asize, char* ibuffer, size_t isize) {
+    /* purpose: use the interface and host name found by another kickstart
+     *          on this node, if they are recent
+     * returns: 1 if the cache was used, 0 if not
+     */
+    const char* fn = host_cache();
+    char* s = getenv("KICKSTART_HOST_CACHE_TTL");
+    long ttl = s != NULL ? atol(s) : HOST_CACHE_TTL;
+    char address[16], interface[16], hostname[NI_MAXHOST];
+    struct stat st;
+    FILE* f;
+    int n;
 
-    /* create a freshly allocated copy */
-    ifrcopy = (struct ifreq*) malloc(sizeof(struct ifreq));
-    if (ifrcopy == NULL) {
-        printerr("malloc: %s\n", strerror(errno));
-        return NULL;
+    if (fn == NULL || (f = fopen(fn, "r")) == NULL) {
+        return 0;
+    }
+    /* "address interface hostname", the hostname is "-" if unknown */
+    n = fstat(fileno(f), &st) == 0 && time(NULL) - st.st_mtime < ttl ?
+        fscanf(f, "%15s %15s %1024s", address, interface, hostname) : 0;
+    fclose(f);
+    if (n != 3 || inet_pton(AF_INET, address, &lookup.address.sin_addr) != 1) {
+        return 0;
+    }
+
+    lookup.address.sin_family = AF_INET;
+    strncpy(abuffer, address, asize);
+    strncpy(ibuffer, interface, isize);
+    if (strcmp(hostname, "-") != 0) {
+        strcpy(lookup.hostname, hostname);
+    }
+    lookup.state = LOOKUP_DONE;
+    lookup.cached = 1;
+    return 1;
+}
+
+static void write_host_cache(void) {
+    /* purpose: share the interface and host name with the other kickstarts
+     *          on this node. The file is written under a temporary name in
+     *          the same directory and renamed, so that readers never see a
+     *          partial file.
+     */
+    const char* fn = host_cache();
+    char tmp[4096];
+    FILE* f;
+    int fd;
+
+    /* The cache may be in a shared directory, so the temporary file gets
+     * an unpredictable name and is never opened if it already exists */
+    if (fn == NULL || snprintf(tmp, sizeof(tmp), "%s.XXXXXX", fn) >= sizeof(tmp)) {
+        return;
+    }
+    if ((fd = mkstemp(tmp)) < 0) {
+        printerr("Unable to write host cache %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    /* mkstemp creates it readable by the owner only */
+    if (fchmod(fd, 0644) != 0 || (f = fdopen(fd, "w")) == NULL) {
+        printerr("Unable to write host cache %s: %s\n", tmp, strerror(errno));
+        close(fd);
+        unlink(tmp);
+        return;
+    }
+    fprintf(f, "%s %s %s\n", inet_ntoa(lookup.address.sin_addr), lookup.interface,
+            *lookup.hostname ? lookup.hostname : "-");
+    if (fclose(f) != 0 || rename(tmp, fn) != 0) {
+        printerr("Unable to write host cache %s: %s\n", fn, strerror(errno));
+        unlink(tmp);
     }
-    memcpy(ifrcopy, &result, sizeof(struct ifreq));
-    return ifrcopy;
 }
 
 void whoami(char* abuffer, size_t asize, char* ibuffer, size_t isize) {
@@ -248,22 +223,132 @@ void whoami(char* abuffer, size_t asize, char* ibuffer, size_t isize) {
      *          ibuffer (OUT): start of buffer to put the primary if name
      *          isize (IN): maximum capacity the ibuffer is willing to accept
      * returns: the modified buffers. */
+    if (read_host_cache(abuffer, asize, ibuffer, isize)) {
+        return;
+    }
+
     /* enumerate interfaces, and guess primary one */
-    struct ifreq* ifr = primary_interface();
-    if (ifr != NULL) {
-        struct sockaddr_in sa;
-        if (abuffer) {
-            memcpy(&sa, &(ifr->ifr_addr), sizeof(struct sockaddr));
-            strncpy(abuffer, inet_ntoa(sa.sin_addr), asize);
-        }
-        if (ibuffer) {
-            strncpy(ibuffer, ifr->ifr_name, isize);
-        }
-        free((void*) ifr);
+    if (primary_address(&lookup.address, lookup.interface, sizeof(lookup.interface)) == 0) {
+        strncpy(abuffer, inet_ntoa(lookup.address.sin_addr), asize);
+        strncpy(ibuffer, lookup.interface, isize);
     } else {
         /* error while trying to determine address of primary interface */
-        if (abuffer) strncpy(abuffer, "0.0.0.0", asize);
-        if (ibuffer) strncpy(ibuffer, "(none)", isize); 
+        strncpy(abuffer, "0.0.0.0", asize);
+        strncpy(ibuffer, "(none)", isize);
+    }
+}
+
+static void* lookup_thread(void* arg) {
+    char hostname[NI_MAXHOST];
+
+    if (getnameinfo((struct sockaddr*) &lookup.address, sizeof(lookup.address),
+                    hostname, sizeof(hostname), NULL, 0, NI_NAMEREQD) != 0) {
+        hostname[0] = 0;
     }
+
+    pthread_mutex_lock(&lookup.lock);
+    strcpy(lookup.hostname, hostname);
+    lookup.state = LOOKUP_DONE;
+    pthread_cond_broadcast(&lookup.done);
+    pthread_mutex_unlock(&lookup.lock);
+
+    return NULL;
 }
 
+void startHostLookup(void) {
+    /* purpose: start looking up the name of the address found by whoami
+     *          in the background. The lookup is given KICKSTART_RESOLVE_TIMEOUT
+     *          seconds (default 2) from now, 0 turns it off. Call it after
+     *          forking the main job, so that the job does not start from a
+     *          process with several threads. Only the first call counts.
+     */
+    char* s = getenv("KICKSTART_RESOLVE_TIMEOUT");
+    double timeout = s != NULL ? atof(s) : RESOLVE_TIMEOUT;
+    sigset_t all, old;
+    pthread_attr_t attr;
+    pthread_t thread;
+    int rc;
+
+    if (lookup.state != LOOKUP_NONE || lookup.address.sin_family != AF_INET) {
+        return;
+    }
+    if (timeout <= 0) {
+        /* nothing to wait for, and nothing worth caching */
+        lookup.state = LOOKUP_DONE;
+        lookup.cached = 1;
+        return;
+    }
+
+    clock_gettime(CLOCK_REALTIME, &lookup.deadline);
+    lookup.deadline.tv_sec += (time_t) timeout;
+    lookup.deadline.tv_nsec += (long) ((timeout - (time_t) timeout) * 1E9);
+    if (lookup.deadline.tv_nsec >= 1000000000) {
+        lookup.deadline.tv_sec++;
+        lookup.deadline.tv_nsec -= 1000000000;
+    }
+
+    /* The signals that kickstart handles must not end up in this thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    lookup.state = LOOKUP_RUNNING;
+    if ((rc = pthread_create(&thread, &attr, lookup_thread, NULL)) != 0) {
+        printerr("pthread_create: %s\n", strerror(rc));
+        lookup.state = LOOKUP_NONE;
+    }
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (lookup.state == LOOKUP_NONE) {
+        /* resolve it right away */
+        lookup_thread(NULL);
+    }
+}
+
+/* Wait for the lookup until its deadline. The caller holds lookup.lock */
+static void wait_lookup(void) {
+    while (lookup.state == LOOKUP_RUNNING) {
+        if (pthread_cond_timedwait(&lookup.done, &lookup.lock, &lookup.deadline) == ETIMEDOUT) {
+            break;
+        }
+    }
+}
+
+void waitHostLookup(void) {
+    /* purpose: wait for a running lookup until its deadline, so that the
+     *          jobs after the main job are, if possible, forked from a
+     *          process with one thread
+     */
+    pthread_mutex_lock(&lookup.lock);
+    wait_lookup();
+    pthread_mutex_unlock(&lookup.lock);
+}
+
+int finishHostLookup(char* buffer, size_t size) {
+    /* purpose: get the name of the address found by whoami, waiting for
+     *          the lookup until its deadline
+     * paramtr: buffer (OUT): the host name
+     *          size (IN): capacity of buffer
+     * returns: 1 if the name is known, 0 if not
+     */
+    int found;
+
+    /* No main job was started */
+    startHostLookup();
+
+    pthread_mutex_lock(&lookup.lock);
+    wait_lookup();
+    found = lookup.state == LOOKUP_DONE && *lookup.hostname;
+    if (found) {
+        strncpy(buffer, lookup.hostname, size);
+        buffer[size-1] = 0;
+    }
+    if (lookup.state == LOOKUP_DONE && !lookup.cached) {
+        write_host_cache();
+        lookup.cached = 1;
+    }
+    pthread_mutex_unlock(&lookup.lock);
+
+    return found;
+}
@@ -21,8 +21,9 @@
 #include <sys/socket.h>
 #include <net/if.h>
 
-extern int interface_list( struct ifconf* ifc );
-extern struct ifreq* primary_interface();
 extern void whoami( char* abuffer, size_t asize, char* ibuffer, size_t isize );
+extern void startHostLookup( void );
+extern void waitHostLookup( void );
+extern int finishHostLookup( char* buffer, size_t size );
 
 #endif /* _GETIF_H */
@@ -0,0 +1,174 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "hashtable.h"
+
+/* Initial number of slots */
+#define HASH_MIN_SIZE 16
+
+uint64_t hashString(const char *str) {
+    /* purpose: compute the hash of a string (64-bit FNV-1a)
+     * paramtr: str (IN): NUL-terminated string
+     * returns: hash value
+     */
+    uint64_t hash = 14695981039346656037ULL;
+    for (const unsigned char *p = (const unsigned char *)str; *p; p++) {
+        hash ^= *p;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+uint64_t hashInteger(uint64_t value) {
+    /* purpose: compute the hash of an integer such as a pid. Consecutive
+     *          integers are spread over the whole table.
+     * paramtr: value (IN): integer
+     * returns: hash value
+     */
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+/* Insert a value that is known not to be in the table, which must
+ * have at least one empty slot */
+static void insertHashSlot(HashTable *table, uint64_t hash, void *value) {
+    size_t mask = table->size - 1;
+    size_t i = hash & mask;
+    while (table->slots[i].value != NULL) {
+        i = (i + 1) & mask;
+    }
+    table->slots[i].hash = hash;
+    table->slots[i].value = value;
+}
+
+static int resizeHashTable(HashTable *table, size_t size) {
+    HashSlot *slots = (HashSlot *)calloc(size, sizeof(HashSlot));
+    if (slots == NULL) {
+        return -1;
+    }
+
+    HashSlot *old = table->slots;
+    size_t oldsize = table->size;
+
+    table->slots = slots;
+    table->size = size;
+    for (size_t i = 0; i < oldsize; i++) {
+        if (old[i].value != NULL) {
+            insertHashSlot(table, old[i].hash, old[i].value);
+        }
+    }
+
+    free(old);
+    return 0;
+}
+
+/* Find the slot that holds the value for key, or return -1 */
+static long findHashSlot(HashTable *table, uint64_t hash, HashMatch match, const void *key) {
+    if (table->count == 0) {
+        return -1;
+    }
+
+    size_t mask = table->size - 1;
+    for (size_t i = hash & mask; table->slots[i].value != NULL; i = (i + 1) & mask) {
+        if (table->slots[i].hash == hash && match(table->slots[i].value, key)) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void *findHashEntry(HashTable *table, uint64_t hash, HashMatch match, const void *key) {
+    /* purpose: find the value for a key
+     * paramtr: table (IN): hash table
+     *          hash (IN): hash of key
+     *          match (IN): function that compares a value with key
+     *          key (IN): key to look for
+     * returns: the value, or NULL if there is no value for key
+     */
+    long i = findHashSlot(table, hash, match, key);
+    return i < 0 ? NULL : table->slots[i].value;
+}
+
+int addHashEntry(HashTable *table, uint64_t hash, void *value) {
+    /* purpose: add a value to the table. The caller must make sure that
+     *          there is no other value with the same key.
+     * paramtr: table (IO): hash table
+     *          hash (IN): hash of the key of value
+     *          value (IN): value to add, must not be NULL
+     * returns: 0 on success, -1 if the table could not be grown
+     */
+    /* Keep the load factor under 3/4 */
+    if ((table->count + 1) * 4 > table->size * 3) {
+        size_t size = table->size == 0 ? HASH_MIN_SIZE : table->size * 2;
+        if (resizeHashTable(table, size) < 0) {
+            return -1;
+        }
+    }
+
+    insertHashSlot(table, hash, value);
+    table->count++;
+    return 0;
+}
+
+void *removeHashEntry(HashTable *table, uint64_t hash, HashMatch match, const void *key) {
+    /* purpose: remove the value for a key from the table
+     * paramtr: table (IO): hash table
+     *          hash (IN): hash of key
+     *          match (IN): function that compares a value with key
+     *          key (IN): key to remove
+     * returns: the value that was removed, or NULL if there was none
+     */
+    long found = findHashSlot(table, hash, match, key);
+    if (found < 0) {
+        return NULL;
+    }
+
+    void *value = table->slots[found].value;
+    table->count--;
+
+    /* Shift back the values that follow in the same run so that the
+     * lookups do not stop at the hole */
+    size_t mask = table->size - 1;
+    size_t hole = found;
+    size_t i = (hole + 1) & mask;
+    while (table->slots[i].value != NULL) {
+        size_t home = table->slots[i].hash & mask;
+        /* Move the value if its home is not between the hole and i */
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+        i = (i + 1) & mask;
+    }
+    table->slots[hole].value = NULL;
+    table->slots[hole].hash = 0;
+
+    return value;
+}
+
+void deleteHashTable(HashTable *table) {
+    /* purpose: free the memory used by the table, but not the values
+     * paramtr: table (IO): hash table, which is empty afterwards
+     */
+    free(table->slots);
+    memset(table, 0, sizeof(HashTable));
+}
@@ -0,0 +1,51 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _HASHTABLE_H
+#define _HASHTABLE_H
+
+/* Hash table of pointers, used to index the lists of ProcInfo and
+ * FileInfo by pid and by filename. The table does not own the values or
+ * know their keys: the caller computes the hash of a key and provides a
+ * function that checks whether a value matches a key. The lists remain
+ * the authority on the order of the records, the table only speeds up the
+ * lookups. A table that is all zeros is valid and empty.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    uint64_t hash;
+    void *value;            /* NULL if the slot is empty */
+} HashSlot;
+
+typedef struct {
+    size_t size;            /* Number of slots, a power of two */
+    size_t count;           /* Number of values in the table */
+    HashSlot *slots;
+} HashTable;
+
+/* Returns non-zero if value has the given key */
+typedef int (*HashMatch)(const void *value, const void *key);
+
+extern uint64_t hashString(const char *str);
+extern uint64_t hashInteger(uint64_t value);
+
+extern void *findHashEntry(HashTable *table, uint64_t hash, HashMatch match, const void *key);
+extern int addHashEntry(HashTable *table, uint64_t hash, void *value);
+extern void *removeHashEntry(HashTable *table, uint64_t hash, HashMatch match, const void *key);
+extern void deleteHashTable(HashTable *table);
+
+#endif /* _HASHTABLE_H */
@@ -21,12 +21,31 @@
 #include <sys/syscall.h>
 #include <pthread.h>
 #include <signal.h>
+#include <wchar.h>
 #ifdef HAS_PAPI
 #include <papi.h>
 #endif
+#if !defined(HAS_PAPI) && defined(LINUX) && defined(__has_include)
+#if __has_include(<linux/perf_event.h>)
+#define HAS_PERF_EVENT 1
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#endif
+#endif
 #include <fnmatch.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <time.h>
+
+#include "tracefile.h"
+#include "fdtable.h"
+#include "procfs.h"
+#include "sha2.h"
+
+/* <stdio.h> defines these as macros when optimizing */
+#undef fread_unlocked
+#undef fwrite_unlocked
 
-/* TODO Unlocked I/O (e.g. fwrite_unlocked) */
 /* TODO Handle directories */
 /* TODO Interpose accept (for network servers) */
 /* TODO Is it necessary to interpose shutdown? Would that help the DNS issue? */
@@ -37,16 +56,16 @@
 /* TODO Create extensive test cases */
 /* TODO Interpose fcntl(..., F_DUPFD, ...) */
 /* TODO Interpose mknod for S_IFREG */
-/* TODO Interpose wide character I/O functions */
+/* TODO getc_unlocked, putc_unlocked and the other _unlocked character
+ *      functions are inline in <stdio.h> when a program is optimized,
+ *      only calls that are not inlined can be traced */
 /* TODO Handle I/O for stdout/stderr? */
-/* TODO asynchronous I/O from librt? */
+/* TODO asynchronous I/O from librt? io_uring submissions are counted, but
+ *      not attributed to files */
 /* TODO Add r/w/a mode support? */
 /* TODO What happens if one interposed library function calls another (e.g.
  *      fopen calls fopen64)? I think internal calls are not traced.
  */
-/* TODO What about mmap? Probably nothing we can do besides interpose
- *      mmap and assume that the total size being mapped is read/written
- */
 
 static int myerr = STDERR_FILENO;
 
@@ -61,6 +80,31 @@ static int myerr = STDERR_FILENO;
 #define debug(format, args...)
 #endif
 
+/* Checksum of a file that is computed while it is being written. It is
+ * only started for regular files that are empty when they are opened for
+ * writing, and it is only valid as long as all the writes go to the end
+ * of the file through one kind of interface. Anything else, such as a
+ * seek or a read, makes it invalid. Descriptors created with dup share
+ * the offset, so they share the checksum. The lock is held across the
+ * write and the update of the digest, so that the digest sees the data in
+ * the same order as the file. */
+typedef struct {
+    pthread_mutex_t lock;
+    int refs;           /* Number of descriptors, under descriptor_mutex */
+    int mode;           /* CHECKSUM_* of the writes so far */
+    int valid;          /* 0 if the digest can not be used */
+    uint64_t size;      /* Number of bytes hashed, the expected offset */
+    double duration;    /* Seconds spent hashing */
+    sha256_ctx ctx[1];
+} Checksum;
+
+enum {
+    CHECKSUM_NONE = 0,
+    CHECKSUM_FD,        /* write, writev */
+    CHECKSUM_POS,       /* pwrite, pwritev */
+    CHECKSUM_STDIO      /* fwrite, fputc, fputs, fprintf */
+};
+
 typedef struct {
     char type;
     char *path;
@@ -70,15 +114,20 @@ typedef struct {
     size_t nwrite;
     size_t bseek;
     size_t nseek;
+    size_t bmap;        /* Bytes of the file mapped into memory */
+    Checksum *checksum; /* Inline checksum, or NULL */
+    unsigned long serial; /* Changed when the entry is reused */
 } Descriptor;
 
 const char DTYPE_NONE = 0;
 const char DTYPE_FILE = 1;
 const char DTYPE_SOCK = 2;
 
-/* File descriptor table */
-static Descriptor *descriptors = NULL;
-static int max_descriptors = 0;
+/* File descriptor table. Entries are allocated in chunks that never
+ * move, so that the I/O wrappers can update the counters of a descriptor
+ * with atomic operations without taking descriptor_mutex.
+ */
+static FDTable descriptors = { sizeof(Descriptor), 0, { NULL } };
 static pthread_mutex_t descriptor_mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
 
 #define lock_descriptors() do { \
@@ -119,8 +168,24 @@ static pthread_mutex_t thread_track_mutex = PTHREAD_MUTEX_INITIALIZER;
 
 static int mypid = 0;
 
+/* Compute checksums of output files while they are written? */
+static int stream_checksums = 0;
+
 /* This is the trace file where we write information about the process */
-static FILE* trace = NULL;
+static int trace = -1;
+
+/* Records are collected here and written to the trace file when the buffer
+ * is full or the trace file is closed. This keeps our own writes out of the
+ * I/O counters of the process, and a record is never split between two
+ * write() calls. */
+static uint64_t trace_buffer[65536 / sizeof(uint64_t)];
+static size_t trace_buffer_used = 0;
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Shared-memory ring from kickstart, if there is one. If use_ring is
+ * set, then records go to the ring instead of the trace file. */
+static TraceRing *ring = NULL;
+static int use_ring = 0;
 
 #ifdef HAS_PAPI
 int papi_ok = 0;
@@ -140,15 +205,50 @@ char *papi_events[] = {
 
 #endif
 
+#ifdef HAS_PERF_EVENT
+/* Hardware counters from perf_event_open, used when there is no PAPI.
+ * Each thread counts its own events in a group, and the whole group is
+ * read with one read() when the thread exits. The first event is the
+ * group leader, the others are left out if the CPU does not have them. */
+static const struct {
+    uint64_t config;
+    const char *name;
+} perf_events[] = {
+    { PERF_COUNT_HW_CPU_CYCLES, "PERF_CYCLES" },
+    { PERF_COUNT_HW_INSTRUCTIONS, "PERF_INSTRUCTIONS" },
+    { PERF_COUNT_HW_CACHE_MISSES, "PERF_CACHE_MISSES" },
+    { PERF_COUNT_HW_BRANCH_MISSES, "PERF_BRANCH_MISSES" },
+};
+
+#define n_perf_events (sizeof(perf_events) / sizeof(perf_events[0]))
+
+typedef struct {
+    int nfds;                   /* Number of open events, 0 if unused */
+    int fds[n_perf_events];     /* Descriptors, the leader is first */
+    int events[n_perf_events];  /* Index in perf_events of each one */
+    dev_t dev;                  /* Identity of the descriptors, in case */
+    ino_t inos[n_perf_events];  /* the program closes and reuses them */
+} PerfGroup;
+
+static int perf_ok = 0;
+static int perf_main = -1;          /* Group leader of the main thread */
+static FDTable perf_groups;         /* PerfGroup of each leader */
+static uint64_t perf_totals[n_perf_events];
+static int perf_seen[n_perf_events];
+static pthread_mutex_t perf_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
 typedef struct {
     void *(*start_routine)(void *);
     void *arg;
     pthread_key_t cleanup;
+#ifdef HAS_PERF_EVENT
+    int perf_group;             /* Group leader of the thread, or -1 */
+#endif
 } interpose_pthread_wrapper_arg;
 
 static FILE *fopen_untraced(const char *path, const char *mode);
 static int vfprintf_untraced(FILE *stream, const char *format, va_list ap);
-static char *fgets_untraced(char *s, int size, FILE *stream);
 static size_t fread_untraced(void *ptr, size_t size, size_t nmemb, FILE *stream);
 static int fclose_untraced(FILE *fp);
 static int dup_untraced(int fd);
@@ -161,49 +261,302 @@ static pid_t gettid(void) {
 }
 #endif
 
-/* Open the trace file */
-static int topen() {
-    debug("Open trace file");
+/* Every libc function we interpose. The original of each one is looked up
+ * with dlsym(RTLD_NEXT) once and cached in orig_symbols so that the wrappers
+ * don't pay for a symbol table search on every call. */
+#define ORIGINAL_SYMBOLS(X) \
+    X(dup) X(dup2) X(dup3) X(open) X(open64) X(openat) X(openat64) X(creat) \
+    X(creat64) X(fopen) X(fopen64) X(freopen) X(freopen64) X(close) X(fclose) \
+    X(read) X(write) X(fread) X(fwrite) X(pread) X(pread64) X(pwrite) \
+    X(pwrite64) X(readv) X(preadv) X(preadv64) X(writev) X(pwritev) \
+    X(pwritev64) X(fgetc) X(fputc) X(fgets) X(fputs) X(vfscanf) X(vfprintf) \
+    X(connect) X(send) X(sendfile) X(sendto) X(sendmsg) X(recv) X(recvfrom) \
+    X(recvmsg) X(truncate) X(mkstemp) X(mkostemp) X(mkstemps) X(mkostemps) \
+    X(tmpfile) X(lseek) X(lseek64) X(fseek) X(fseeko) X(pthread_create) \
+    X(execv) X(execvp) X(execve) X(fork) X(_exit) X(mmap) X(mmap64) \
+    X(copy_file_range) X(splice) X(tee) X(sendfile64) X(preadv2) X(pwritev2) \
+    X(syscall) X(getc) X(putc) X(fgetc_unlocked) X(fputc_unlocked) \
+    X(getc_unlocked) X(putc_unlocked) X(fread_unlocked) X(fwrite_unlocked) \
+    X(fgets_unlocked) X(fputs_unlocked) X(fgetwc) X(fputwc) X(getwc) \
+    X(putwc) X(fgetwc_unlocked) X(fputwc_unlocked) X(getwc_unlocked) \
+    X(putwc_unlocked) X(fgetws) X(fputws) X(fgetws_unlocked) \
+    X(fputws_unlocked)
+
+#define SYMBOL_ID(name) SYM_##name,
+enum { ORIGINAL_SYMBOLS(SYMBOL_ID) NUM_ORIGINAL_SYMBOLS };
+
+#define SYMBOL_NAME(name) #name,
+static const char *orig_symbol_names[] = { ORIGINAL_SYMBOLS(SYMBOL_NAME) };
+
+static void *orig_symbols[NUM_ORIGINAL_SYMBOLS];
+
+/* Resolve all the original symbols. Symbols that don't exist in this libc
+ * are left NULL, and only cause an error if the application actually calls
+ * the corresponding wrapper. */
+static void init_symbols() {
+    for (int i=0; i<NUM_ORIGINAL_SYMBOLS; i++) {
+        if (__atomic_load_n(&orig_symbols[i], __ATOMIC_ACQUIRE) == NULL) {
+            __atomic_store_n(&orig_symbols[i], dlsym(RTLD_NEXT, orig_symbol_names[i]),
+                             __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* Look up a symbol that was not resolved yet. This happens when a wrapper
+ * is called before interpose_init, e.g. from another library's constructor.
+ * dlsym always returns the same address, so it does not matter if two
+ * threads race to fill in the same slot. */
+static void *resolve_symbol(int id) {
+    const char *name = orig_symbol_names[id];
+    void *orig_symbol = dlsym(RTLD_NEXT, name);
+    if (orig_symbol == NULL) {
+        printerr("FATAL ERROR: Unable to locate symbol %s: %s\n", name, dlerror());
+        abort();
+    }
+    __atomic_store_n(&orig_symbols[id], orig_symbol, __ATOMIC_RELEASE);
+    return orig_symbol;
+}
 
+static inline void *lookup_symbol(int id) {
+    void *orig_symbol = __atomic_load_n(&orig_symbols[id], __ATOMIC_ACQUIRE);
+    if (__builtin_expect(orig_symbol == NULL, 0)) {
+        orig_symbol = resolve_symbol(id);
+    }
+    return orig_symbol;
+}
+
+/* Get a pointer to the original version of function name */
+#define osym(name) ((typeof(name) *)lookup_symbol(SYM_##name))
+
+/* Get the name of the trace file for this process */
+static int trace_filename(char *filename, size_t size) {
     char *kickstart_prefix = getenv("KICKSTART_PREFIX");
     if (kickstart_prefix == NULL) {
         printerr("Unable to open trace file: KICKSTART_PREFIX not set in environment\n");
         return -1;
     }
 
+    snprintf(filename, size, "%s.%d", kickstart_prefix, getpid());
+
+    return 0;
+}
+
+/* Open the trace file */
+static int topen_file() {
+    debug("Open trace file");
+
     char filename[BUFSIZ];
-    snprintf(filename, BUFSIZ, "%s.%d", kickstart_prefix, getpid());
+    if (trace_filename(filename, BUFSIZ) < 0) {
+        return -1;
+    }
 
-    trace = fopen_untraced(filename, "a");
-    if (trace == NULL) {
-        printerr("Unable to open trace file\n");
+    trace = (*osym(open))(filename, O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0600);
+    if (trace < 0) {
+        printerr("Unable to open trace file: %s\n", strerror(errno));
         return -1;
     }
 
     return 0;
 }
 
-/* Print something to the trace file if it is open */
-static int tprintf(const char *format, ...) {
-    if (trace == NULL) {
+/* Map the shared-memory ring passed in by kickstart, if any */
+static void init_ring() {
+    /* A forked child inherits the mapping of the parent */
+    if (ring != NULL) {
+        return;
+    }
+
+    char *ringfd = getenv("KICKSTART_TRACE_FD");
+    if (ringfd == NULL) {
+        return;
+    }
+
+    /* The application may have closed the descriptor, or reused the
+     * number for something else, so check that it looks like a ring */
+    int fd = atoi(ringfd);
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size <= sizeof(TraceRing)) {
+        return;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        return;
+    }
+
+    TraceRing *r = (TraceRing *)map;
+    if (r->magic != TRACE_RING_MAGIC || r->size + sizeof(TraceRing) != st.st_size) {
+        munmap(map, st.st_size);
+        return;
+    }
+
+    ring = r;
+}
+
+/* Open the trace, either the shared-memory ring or the trace file */
+static int topen() {
+    init_ring();
+
+    if (ring != NULL) {
+        /* If this process already wrote to the trace file before it
+         * called exec, then keep using the file so that kickstart gets
+         * all of its records in the right order */
+        char filename[BUFSIZ];
+        if (trace_filename(filename, BUFSIZ) == 0 && access(filename, F_OK) < 0) {
+            use_ring = 1;
+            return 0;
+        }
+    }
+
+    return topen_file();
+}
+
+/* Append a record to the shared-memory ring. Returns 0 on success, or -1
+ * if the ring is full. See tracefile.h for a description of the protocol. */
+static int ring_write(const void *body, size_t size, const char *str, size_t len, size_t total) {
+    uint64_t mask = ring->size - 1;
+    uint64_t head, offset, pad;
+    do {
+        head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        offset = head & mask;
+        pad = offset + total > ring->size ? ring->size - offset : 0;
+        if (head + pad + total - tail > ring->size) {
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&ring->head, &head, head + pad + total,
+                                          0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+
+    char *data = TRACE_RING_DATA(ring);
+    if (pad > 0) {
+        /* The pad may be smaller than a TraceHeader, only set size and type */
+        TraceHeader *h = (TraceHeader *)(data + offset);
+        h->type = TRACE_PAD;
+        __atomic_store_n(&h->size, pad, __ATOMIC_RELEASE);
+        offset = 0;
+    }
+
+    /* The space was zeroed by the consumer, so the padding at the end of
+     * the record is already there. Copy everything except the size, and
+     * then set the size to mark the record complete. */
+    char *record = data + offset;
+    memcpy(record + sizeof(uint32_t), (const char *)body + sizeof(uint32_t), size - sizeof(uint32_t));
+    if (len > 0) {
+        memcpy(record + size, str, len);
+    }
+    __atomic_store_n((uint32_t *)record, (uint32_t)total, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Write the buffered records to the trace file */
+/* Note: You must be holding trace_mutex when you call this */
+static int tflush() {
+    int rc = 0;
+    if (trace >= 0 && trace_buffer_used > 0) {
+        if ((*osym(write))(trace, trace_buffer, trace_buffer_used) != (ssize_t)trace_buffer_used) {
+            printerr("Error writing trace records: %s\n", strerror(errno));
+            rc = -1;
+        }
+    }
+    trace_buffer_used = 0;
+    return rc;
+}
+
+/* Add a record to the trace file if it is open. The record starts with
+ * a body of size bytes (including the TraceHeader), and is followed by
+ * len bytes of str, if str is not NULL. */
+static int twrite(void *body, size_t size, int type, const char *str, size_t len) {
+    if (trace < 0 && !use_ring) {
         return 0;
     }
-    va_list args;
-    va_start(args, format);
-    int rc = vfprintf_untraced(trace, format, args);
-    va_end(args);
+
+    if (str == NULL) {
+        len = 0;
+    }
+    size_t total = TRACE_ROUND(size + len);
+    if (total > TRACE_MAX_RECORD) {
+        printerr("Trace record too large: %lu bytes\n", total);
+        return -1;
+    }
+
+    TraceHeader *h = (TraceHeader *)body;
+    h->size = total;
+    h->type = type;
+    h->flags = 0;
+    h->pid = getpid();
+    h->reserved = 0;
+
+    int rc = 0;
+    pthread_mutex_lock(&trace_mutex);
+
+    if (use_ring) {
+        if (ring_write(body, size, str, len, total) == 0) {
+            goto unlock;
+        }
+
+        /* The ring is full, use the trace file from now on */
+        use_ring = 0;
+        if (topen_file() < 0) {
+            rc = -1;
+            goto unlock;
+        }
+    }
+
+    if (trace_buffer_used + total > sizeof(trace_buffer)) {
+        rc = tflush();
+    }
+
+    char *record = (char *)trace_buffer + trace_buffer_used;
+    memcpy(record, body, size);
+    if (len > 0) {
+        memcpy(record + size, str, len);
+    }
+    memset(record + size + len, 0, total - size - len);
+    trace_buffer_used += total;
+
+unlock:
+    pthread_mutex_unlock(&trace_mutex);
+
     return rc;
 }
 
+/* Write a record that only consists of a string */
+static int twrite_string(int type, const char *str) {
+    TraceString r;
+    memset(&r, 0, sizeof(r));
+    r.len = strlen(str);
+    return twrite(&r, sizeof(r), type, str, r.len);
+}
+
 /* Close trace file */
 static int tclose() {
-    if (trace == NULL) {
+    use_ring = 0;
+
+    if (trace < 0) {
         return 0;
     }
 
     debug("Close trace file");
 
-    return fclose_untraced(trace);
+    pthread_mutex_lock(&trace_mutex);
+    tflush();
+    int rc = (*osym(close))(trace);
+    trace = -1;
+    pthread_mutex_unlock(&trace_mutex);
+    return rc;
+}
+
+/* Close the trace file inherited from the parent after a fork without
+ * writing the records that the parent has buffered */
+static void tabandon() {
+    pthread_mutex_init(&trace_mutex, NULL);
+    use_ring = 0;
+    trace_buffer_used = 0;
+    if (trace >= 0) {
+        (*osym(close))(trace);
+        trace = -1;
+    }
 }
 
 /* Get the current time in seconds since the epoch */
@@ -232,16 +585,30 @@ static char *get_addr(const struct sockaddr *addr, socklen_t addrlen) {
 }
 
 static void trace_file(const char *path, int fd);
+static void checksum_open(int fd);
+static void checksum_drop(Checksum *c);
+static void stdio_reset(void);
+
+/* Free all the entries in the descriptor table */
+static void free_descriptors() {
+    for (int fd = nextFDEntry(&descriptors, 0); fd >= 0; fd = nextFDEntry(&descriptors, fd + 1)) {
+        Descriptor *d = (Descriptor *)findFDEntry(&descriptors, fd);
+        free(d->path);
+        checksum_drop(d->checksum);
+    }
+    deleteFDTable(&descriptors);
+}
 
 /* Initialize the descriptor table */
 static void init_descriptors() {
 
     lock_descriptors();
 
-    /* Get file descriptor limit and allocate descriptor table */
-    max_descriptors = 256;
-    descriptors = (Descriptor *)calloc(sizeof(Descriptor), max_descriptors);
-    if (descriptors == NULL) {
+    /* A forked child inherits the table of its parent, start over */
+    stdio_reset();
+    free_descriptors();
+
+    if (initFDTable(&descriptors, sizeof(Descriptor)) < 0) {
         printerr("Error allocating descriptor table: calloc: %s\n", strerror(errno));
         abort();
     }
@@ -282,6 +649,7 @@ static void init_descriptors() {
         }
 
         trace_file(linkpath, fd);
+        checksum_open(fd);
     }
 
     closedir(fddir);
@@ -290,49 +658,14 @@ unlock:
     unlock_descriptors();
 }
 
-/* Make sure the descriptor table is large enough to hold fd */
-/* Note: You must be holding the descriptor mutex when you call this */
-static void ensure_descriptor(int fd) {
-    debug("ensure_descriptor %d", fd);
-
-    if (descriptors == NULL) {
-        printerr("Descriptor table not initialized\n");
-        abort();
-    }
-
-    if (fd < 0) {
-        printerr("Invalid descriptor: %d\n", fd);
-        abort();
-    }
-
-    if (fd < max_descriptors) {
-        return;
-    }
-
-    /* Determine what the new size of the table should be */
-    int newmax = max_descriptors * 2;
-    while (fd >= newmax) {
-        newmax = newmax * 2;
-    }
-
-    /* Allocate a new descriptor table */
-    Descriptor *newdescriptors = realloc(descriptors, sizeof(Descriptor) * newmax);
-    if (newdescriptors == NULL) {
-        printerr("Error reallocating new descriptor table with %d entries: realloc: %s\n",
-                 newmax, strerror(errno));
-        /* This is a fatal error */
-        abort();
-    }
-
-    /* Clear the newly allocated entries */
-    bzero(&(newdescriptors[max_descriptors]), (newmax-max_descriptors)*sizeof(Descriptor));
-
-    /* Use the new table */
-    descriptors = newdescriptors;
-    max_descriptors = newmax;
+/* Find the entry for fd without allocating anything. This does not
+ * require the descriptor mutex, and returns NULL if the chunk containing
+ * fd was never allocated, which means that fd is not being traced. */
+static inline Descriptor *find_descriptor(int fd) {
+    return (Descriptor *)findFDEntry(&descriptors, fd);
 }
 
-/* Get a reference to the given descriptor if it exists */
+/* Get a reference to the given descriptor, allocating its chunk if needed */
 /* Note: You must be holding the descriptor mutex when you call this */
 static Descriptor *get_descriptor(int fd) {
     debug("get_descriptor %d", fd);
@@ -344,14 +677,23 @@ static Descriptor *get_descriptor(int fd) {
      * it is loaded before this library. This check will make sure
      * that any descriptor we try to access is valid.
      */
-    if (descriptors == NULL || fd < 0) {
+    if (descriptors.maxfds == 0 || fd < 0) {
         return NULL;
     }
 
-    /* Make sure that the descriptor table contains this object */
-    ensure_descriptor(fd);
+    if (fd >= descriptors.maxfds) {
+        printerr("Descriptor %d is larger than the descriptor limit\n", fd);
+        return NULL;
+    }
 
-    return &(descriptors[fd]);
+    Descriptor *d = (Descriptor *)getFDEntry(&descriptors, fd);
+    if (d == NULL) {
+        printerr("Error allocating descriptor table: calloc: %s\n", strerror(errno));
+        /* This is a fatal error */
+        abort();
+    }
+
+    return d;
 }
 
 static void read_cmdline() {
@@ -417,7 +759,7 @@ static void read_cmdline() {
                 result[j++] = args[i];
             }
         }
-        tprintf("cmd:%s\n", result);
+        twrite_string(TRACE_CMD, result);
         free(result);
     }
 
@@ -425,20 +767,14 @@ static void read_cmdline() {
 }
 
 /* Read /proc/self/exe to get path to executable */
-static void read_exe() {
+static void read_exe(int dirfd) {
     debug("Reading exe");
     char exe[BUFSIZ];
-    int size = readlink("/proc/self/exe", exe, BUFSIZ);
-    if (size < 0) {
+    if (procReadExe(dirfd, exe, BUFSIZ) < 0) {
         printerr("libinterpose: Unable to readlink /proc/self/exe: %s\n", strerror(errno));
         return;
     }
-    if (size == BUFSIZ) {
-        printerr("Unable to readlink /proc/self/exe: Real path is too long\n");
-        return;
-    }
-    exe[size] = '\0';
-    tprintf("exe: %s\n", exe);
+    twrite_string(TRACE_EXE, exe);
 }
 
 /* Return 1 if line begins with tok */
@@ -447,124 +783,84 @@ static int startswith(const char *line, const char *tok) {
 }
 
 /* Read memory information from /proc/self/status */
-static void read_status() {
+static void read_status(int dirfd) {
     debug("Reading status file");
 
-    char statf[] = "/proc/self/status";
-
+    ProcStatus status;
+    int rc = procReadStatus(dirfd, &status);
+    if (rc < 0) {
+        perror("libinterpose: Unable to read /proc/self/status");
+    }
     /* If the status file is missing, then just skip it */
-    if (access(statf, F_OK) < 0) {
+    if (rc <= 0) {
         return;
     }
 
-    FILE *f = fopen_untraced(statf, "r");
-    if (f == NULL) {
-        perror("libinterpose: Unable to fopen /proc/self/status");
-        return;
-    }
+    TraceMemory r;
+    memset(&r, 0, sizeof(r));
+    r.vmpeak = status.vmpeak;
+    r.rsspeak = status.rsspeak;
 
-    char line[BUFSIZ];
-    while (fgets_untraced(line, BUFSIZ, f) != NULL) {
-        if (startswith(line,"VmPeak")) {
-            tprintf(line);
-        } else if (startswith(line,"VmHWM")) {
-            tprintf(line);
-        }
-    }
-
-    fclose_untraced(f);
+    twrite(&r, sizeof(r), TRACE_MEMORY, NULL, 0);
 }
 
 /* Read CPU usage */
-static void read_rusage() {
+static void read_rusage(TraceCPU *r) {
     struct rusage ru;
     if (getrusage(RUSAGE_SELF, &ru) < 0) {
         printerr("Error getting resource usage: %s\n", strerror(errno));
         return;
     }
-    tprintf("utime: %.3lf\n", (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec/1.0e6);
-    tprintf("stime: %.3lf\n", (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec/1.0e6);
+    r->utime = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec/1.0e6;
+    r->stime = (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec/1.0e6;
 }
 
 /* Read /proc/self/stat to get performance stats */
-static void read_stat() {
+static void read_stat(int dirfd, TraceCPU *r) {
     debug("Reading stat file");
 
-    char statf[] = "/proc/self/stat";
-
-    /* If the stat file is missing, then just skip it */
-    if (access(statf, F_OK) < 0) {
-        return;
+    ProcStat stat;
+    int rc = procReadStat(dirfd, &stat);
+    if (rc < 0) {
+        perror("libinterpose: Unable to read /proc/self/stat");
     }
-
-    FILE *f = fopen_untraced(statf,"r");
-    if (f == NULL) {
-        perror("libinterpose: Unable to fopen /proc/self/stat");
+    if (rc <= 0) {
         return;
     }
 
-    unsigned long long iowait = 0; //delayacct_blkio_ticks
-
-    //pid comm state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
-    //cmajflt utime stime cutime cstime priority nice num_threads itrealvalue
-    //starttime vsize rss rsslim startcode endcode startstack kstkesp kstkeip
-    //signal blocked sigignore sigcatch wchan nswap cnswap exit_signal
-    //processor rt_priority policy delayacct_blkio_ticks guest_time cguest_time
-    fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %*u "
-              "%*u %*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u "
-              "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d "
-              "%*d %*u %*u %llu %*u %*d",
-              &iowait);
-
-    fclose_untraced(f);
-
     /* Adjust by number of clock ticks per second */
     long clocks = sysconf(_SC_CLK_TCK);
-    double real_iowait = ((double)iowait) / clocks;
-
-    tprintf("iowait: %.3lf\n", real_iowait);
+    r->iowait = ((double)stat.iowait) / clocks;
 }
 
 /* Read /proc/self/io to get I/O usage */
-static void read_io() {
+static void read_io(int dirfd) {
     debug("Reading io file");
 
-    char iofile[] = "/proc/self/io";
-
     /* This proc file was added in Linux 2.6.20. It won't be
      * there on older kernels, or on kernels without task IO 
      * accounting. If it is missing, just bail out.
      */
-    if (access(iofile, F_OK) < 0) {
-        return;
+    ProcIO io;
+    int rc = procReadIO(dirfd, &io);
+    if (rc < 0) {
+        perror("libinterpose: Unable to read /proc/self/io");
     }
-
-    FILE *f = fopen_untraced(iofile, "r");
-    if (f == NULL) {
-        perror("libinterpose: Unable to fopen /proc/self/io");
+    if (rc <= 0) {
         return;
     }
 
-    char line[BUFSIZ];
-    while (fgets_untraced(line, BUFSIZ, f) != NULL) {
-        if (startswith(line, "rchar")) {
-            tprintf(line);
-        } else if (startswith(line, "wchar")) {
-            tprintf(line);
-        } else if (startswith(line,"syscr")) {
-            tprintf(line);
-        } else if (startswith(line,"syscw")) {
-            tprintf(line);
-        } else if (startswith(line,"read_bytes")) {
-            tprintf(line);
-        } else if (startswith(line,"write_bytes")) {
-            tprintf(line);
-        } else if (startswith(line,"cancelled_write_bytes")) {
-            tprintf(line);
-        }
-    }
+    TraceIO r;
+    memset(&r, 0, sizeof(r));
+    r.rchar = io.rchar;
+    r.wchar = io.wchar;
+    r.syscr = io.syscr;
+    r.syscw = io.syscw;
+    r.read_bytes = io.read_bytes;
+    r.write_bytes = io.write_bytes;
+    r.cancelled_write_bytes = io.cancelled_write_bytes;
 
-    fclose_untraced(f);
+    twrite(&r, sizeof(r), TRACE_IO, NULL, 0);
 }
 
 static int path_matches_patterns(const char *path, const char *patterns) {
@@ -667,6 +963,8 @@ static void trace_file(const char *path, int fd) {
         goto unlock;
     }
 
+    checksum_drop(f->checksum);
+    f->checksum = NULL;
     f->type = DTYPE_FILE;
     f->path = temp;
     f->bread = 0;
@@ -675,11 +973,203 @@ static void trace_file(const char *path, int fd) {
     f->nwrite = 0;
     f->bseek = 0;
     f->nseek = 0;
+    f->bmap = 0;
+    __atomic_store_n(&f->serial, f->serial + 1, __ATOMIC_RELEASE);
 
 unlock:
     unlock_descriptors();
 }
 
+/* Get the time from a monotonic clock in seconds */
+static double get_monotonic_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ((double)ts.tv_nsec / 1e9);
+}
+
+/* Start an inline checksum for fd if it is an empty regular file that
+ * is open for writing at offset 0. This includes descriptors inherited
+ * from the parent, such as the output of a shell redirection. */
+static void checksum_open(int fd) {
+    if (!stream_checksums) {
+        return;
+    }
+
+    lock_descriptors();
+
+    Descriptor *f = find_descriptor(fd);
+    if (f == NULL || f->type != DTYPE_FILE || f->checksum != NULL) {
+        goto unlock;
+    }
+
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || (flags & O_ACCMODE) == O_RDONLY) {
+        goto unlock;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size != 0 ||
+            (*osym(lseek))(fd, 0, SEEK_CUR) != 0) {
+        goto unlock;
+    }
+
+    Checksum *c = (Checksum *)calloc(1, sizeof(Checksum));
+    if (c == NULL) {
+        printerr("calloc: %s\n", strerror(errno));
+        goto unlock;
+    }
+    pthread_mutex_init(&c->lock, NULL);
+    c->refs = 1;
+    c->valid = 1;
+    sha256_begin(c->ctx);
+
+    __atomic_store_n(&f->checksum, c, __ATOMIC_RELEASE);
+
+unlock:
+    unlock_descriptors();
+}
+
+/* The checksum that this thread has locked. If a signal handler writes
+ * to the same file in the middle of a write, the order of the data is
+ * unknown, and the checksum is made invalid instead of deadlocking. */
+static __thread Checksum *checksum_held __attribute__((tls_model("initial-exec")));
+
+static Checksum *find_checksum(int fd) {
+    Descriptor *f = find_descriptor(fd);
+    if (f == NULL) {
+        return NULL;
+    }
+    return __atomic_load_n(&f->checksum, __ATOMIC_ACQUIRE);
+}
+
+/* Get the checksum of fd before a write of the given mode. If it returns
+ * a checksum, the checksum is locked, and the caller must pass the data
+ * that was written to checksum_update and call checksum_release. */
+static Checksum *checksum_acquire(int fd, int mode) {
+    Checksum *c = find_checksum(fd);
+    if (c == NULL || !__atomic_load_n(&c->valid, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    if (c == checksum_held) {
+        c->valid = 0;
+        return NULL;
+    }
+
+    pthread_mutex_lock(&c->lock);
+    if (c->valid && (c->mode == CHECKSUM_NONE || c->mode == mode)) {
+        c->mode = mode;
+        checksum_held = c;
+        return c;
+    }
+    c->valid = 0;
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+/* Add data that was written to the end of the file to the checksum */
+static void checksum_update(Checksum *c, const void *buf, size_t len) {
+    if (!c->valid || len == 0) {
+        return;
+    }
+    double start = get_monotonic_time();
+    sha256_hash((const unsigned char *)buf, len, c->ctx);
+    c->duration += get_monotonic_time() - start;
+    c->size += len;
+}
+
+static void checksum_update_iov(Checksum *c, const struct iovec *iov, int iovcnt, size_t len) {
+    for (int i = 0; i < iovcnt && len > 0; i++) {
+        size_t n = iov[i].iov_len < len ? iov[i].iov_len : len;
+        checksum_update(c, iov[i].iov_base, n);
+        len -= n;
+    }
+}
+
+/* Unlock a checksum, ok is 0 if the write went wrong */
+static void checksum_release(Checksum *c, int ok) {
+    if (!ok) {
+        c->valid = 0;
+    }
+    checksum_held = NULL;
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* The file position of fd was changed to offset, or to an unknown
+ * position if offset is -1. The checksum is still valid if it is the end
+ * of the data that was hashed (e.g. ftell) */
+static void checksum_seek(int fd, off_t offset) {
+    Checksum *c = find_checksum(fd);
+    if (c == NULL) {
+        return;
+    }
+    if (c == checksum_held) {
+        c->valid = 0;
+        return;
+    }
+    pthread_mutex_lock(&c->lock);
+    if (offset < 0 || (uint64_t)offset != c->size || c->mode == CHECKSUM_POS) {
+        c->valid = 0;
+    }
+    pthread_mutex_unlock(&c->lock);
+}
+
+/* Make the checksum of fd invalid */
+static inline void checksum_invalidate(int fd) {
+    checksum_seek(fd, -1);
+}
+
+/* Release a reference to a checksum without reporting it. This is used
+ * when the descriptor table is thrown away after a fork. */
+static void checksum_drop(Checksum *c) {
+    if (c != NULL && --c->refs == 0) {
+        free(c);
+    }
+}
+
+/* Report the checksum of a file when its last descriptor is closed, and
+ * free it */
+/* Note: You must be holding the descriptor mutex when you call this */
+static void checksum_close(Descriptor *f) {
+    Checksum *c = f->checksum;
+    if (c == NULL) {
+        return;
+    }
+    f->checksum = NULL;
+    if (--c->refs > 0) {
+        return;
+    }
+
+    if (c == checksum_held) {
+        /* Closed by a signal handler in the middle of a write, the
+         * interrupted write still uses c, so it can not be freed */
+        c->valid = 0;
+        return;
+    }
+
+    /* Wait for writes that are still in progress */
+    pthread_mutex_lock(&c->lock);
+    pthread_mutex_unlock(&c->lock);
+
+    /* A process that inherited an empty file and did not write to it
+     * has nothing to report */
+    struct stat st;
+    if (c->valid && c->size > 0 && f->type == DTYPE_FILE &&
+            stat(f->path, &st) == 0 && (uint64_t)st.st_size == c->size) {
+        TraceChecksum r;
+        memset(&r, 0, sizeof(r));
+        r.size = c->size;
+        r.mtime_sec = st.st_mtim.tv_sec;
+        r.mtime_nsec = st.st_mtim.tv_nsec;
+        r.duration = c->duration;
+        sha256_end(r.sha256, c->ctx);
+        r.len = strlen(f->path);
+        twrite(&r, sizeof(r), TRACE_CHECKSUM, f->path, r.len);
+    }
+
+    pthread_mutex_destroy(&c->lock);
+    free(c);
+}
+
 static void trace_open(const char *path, int fd) {
     debug("trace_open %s %d", path, fd);
 
@@ -691,6 +1181,7 @@ static void trace_open(const char *path, int fd) {
     }
 
     trace_file(fullpath, fd);
+    checksum_open(fd);
 
     free(fullpath);
 }
@@ -717,60 +1208,226 @@ static void trace_openat(int fd) {
     fullpath[len] = '\0';
 
     trace_file(fullpath, fd);
+    checksum_open(fd);
 }
 
 static void trace_read(int fd, ssize_t amount) {
     debug("trace_read %d %lu", fd, amount);
 
-    lock_descriptors();
-
-    Descriptor *f = get_descriptor(fd);
+    Descriptor *f = find_descriptor(fd);
     if (f == NULL) {
-        goto unlock;
+        return;
     }
-    f->bread += amount;
-    f->nread += 1;
+    __atomic_fetch_add(&f->bread, amount, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->nread, 1, __ATOMIC_RELAXED);
 
-unlock:
-    unlock_descriptors();
+    /* Reading moves the offset of the writes */
+    if (__atomic_load_n(&f->checksum, __ATOMIC_RELAXED) != NULL) {
+        checksum_invalidate(fd);
+    }
 }
 
 static void trace_write(int fd, ssize_t amount) {
     debug("trace_write %d %lu", fd, amount);
 
-    lock_descriptors();
-
-    Descriptor *f = get_descriptor(fd);
+    Descriptor *f = find_descriptor(fd);
     if (f == NULL) {
-        goto unlock;
+        return;
     }
-    f->bwrite += amount;
-    f->nwrite += 1;
-
-unlock:
-    unlock_descriptors();
+    __atomic_fetch_add(&f->bwrite, amount, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->nwrite, 1, __ATOMIC_RELAXED);
 }
 
 static void trace_seek(int fd, off_t offset) {
     debug("trace_seek %d %ld", fd, offset);
 
+    Descriptor *f = find_descriptor(fd);
+    if (f == NULL) {
+        return;
+    }
+    __atomic_fetch_add(&f->bseek, offset > 0 ? offset : -offset, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->nseek, 1, __ATOMIC_RELAXED);
+}
+
+/* Per-thread cache for the functions that read or write one character
+ * at a time (getc, putc, their _unlocked and wide variants). Each slot
+ * remembers the descriptor of a stream and counts the characters in
+ * thread-local memory, so a call costs a few loads instead of a table
+ * lookup and atomic adds on a shared counter. The counts are added to
+ * the descriptor when a slot is reused, after STDIO_BATCH calls, when
+ * the thread exits, and at exit. The serial number of the descriptor
+ * tells whether it was closed and reused since the slot was filled.
+ * The caches of the threads are in a list, so that trace_close can add
+ * the counts of all threads before it reports a descriptor. Streams
+ * with an inline checksum are not cached, because their data has to be
+ * hashed in order. */
+#define STDIO_SLOTS 4
+#define STDIO_BATCH 4096
+
+/* The counts are changed by the owning thread without the lock, and read
+ * by trace_close in other threads, so they are accessed with relaxed
+ * atomics. The other fields only change with the descriptor lock held. */
+typedef struct {
+    FILE *stream;
+    Descriptor *desc;
+    unsigned long serial;
+    size_t bread;
+    size_t bwrite;
+    size_t nread;
+    size_t nwrite;
+} StdioSlot;
+
+typedef struct StdioCache {
+    StdioSlot slots[STDIO_SLOTS];
+    unsigned next;              /* Slot to reuse on a miss */
+    struct StdioCache *link;    /* Next thread in stdio_caches */
+    struct StdioCache **prev;   /* Link to this one, NULL if not listed */
+} StdioCache;
+
+static __thread StdioCache stdio_cache __attribute__((tls_model("initial-exec")));
+static StdioCache *stdio_caches = NULL;     /* Protected by descriptor_mutex */
+
+/* Add amount to a count of the calling thread, returns the new value */
+static inline size_t stdio_add(size_t *count, size_t amount) {
+    size_t value = __atomic_load_n(count, __ATOMIC_RELAXED) + amount;
+    __atomic_store_n(count, value, __ATOMIC_RELAXED);
+    return value;
+}
+
+/* Add the counts of a slot to its descriptor, if that is still open */
+static void stdio_publish(StdioSlot *s, Descriptor *f) {
+    if (s->desc != f || __atomic_load_n(&f->serial, __ATOMIC_ACQUIRE) != s->serial) {
+        return;
+    }
+    __atomic_fetch_add(&f->bread, __atomic_load_n(&s->bread, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->nread, __atomic_load_n(&s->nread, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->bwrite, __atomic_load_n(&s->bwrite, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+    __atomic_fetch_add(&f->nwrite, __atomic_load_n(&s->nwrite, __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+}
+
+static void stdio_flush(StdioSlot *s) {
+    if (__atomic_load_n(&s->nread, __ATOMIC_RELAXED) +
+            __atomic_load_n(&s->nwrite, __ATOMIC_RELAXED) == 0) {
+        return;
+    }
+    /* Counts for a descriptor that was closed since were already added
+     * by trace_close */
     lock_descriptors();
+    stdio_publish(s, s->desc);
+    __atomic_store_n(&s->bread, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->nread, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->bwrite, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->nwrite, 0, __ATOMIC_RELAXED);
+    unlock_descriptors();
+}
 
-    Descriptor *f = get_descriptor(fd);
-    if (f == NULL) {
-        goto unlock;
+static void stdio_flush_all(void) {
+    for (int i = 0; i < STDIO_SLOTS; i++) {
+        stdio_flush(&stdio_cache.slots[i]);
+    }
+}
+
+/* Add the cache of the calling thread to the list. Only threads that
+ * remove it with stdio_unregister before they exit are added. */
+static void stdio_register(void) {
+    lock_descriptors();
+    if (stdio_cache.prev == NULL) {
+        stdio_cache.link = stdio_caches;
+        if (stdio_caches != NULL) {
+            stdio_caches->prev = &stdio_cache.link;
+        }
+        stdio_caches = &stdio_cache;
+        stdio_cache.prev = &stdio_caches;
     }
-    f->bseek += offset > 0 ? offset : -offset;
-    f->nseek += 1;
+    unlock_descriptors();
+}
 
-unlock:
+static void stdio_unregister(void) {
+    lock_descriptors();
+    if (stdio_cache.prev != NULL) {
+        *stdio_cache.prev = stdio_cache.link;
+        if (stdio_cache.link != NULL) {
+            stdio_cache.link->prev = stdio_cache.prev;
+        }
+        stdio_cache.link = NULL;
+        stdio_cache.prev = NULL;
+    }
     unlock_descriptors();
 }
 
+/* Forget the slots of the parent after fork, its descriptors and other
+ * threads are gone. The caller holds the descriptor lock. */
+static void stdio_reset(void) {
+    memset(&stdio_cache, 0, sizeof(stdio_cache));
+    stdio_caches = NULL;
+    stdio_register();
+}
+
+/* Get the slot of stream, or NULL if the caller has to use trace_read,
+ * trace_write and the checksum functions */
+static inline StdioSlot *stdio_slot(FILE *stream) {
+    StdioSlot *s = NULL;
+    for (int i = 0; i < STDIO_SLOTS; i++) {
+        if (stdio_cache.slots[i].stream == stream) {
+            s = &stdio_cache.slots[i];
+            break;
+        }
+    }
+
+    if (s == NULL || __atomic_load_n(&s->desc->serial, __ATOMIC_ACQUIRE) != s->serial) {
+        Descriptor *f = find_descriptor(fileno(stream));
+        if (f == NULL) {
+            return NULL;
+        }
+        if (s == NULL) {
+            s = &stdio_cache.slots[stdio_cache.next++ % STDIO_SLOTS];
+        }
+        lock_descriptors();
+        stdio_flush(s);
+        s->stream = stream;
+        s->desc = f;
+        s->serial = __atomic_load_n(&f->serial, __ATOMIC_ACQUIRE);
+        unlock_descriptors();
+    }
+
+    if (__atomic_load_n(&s->desc->checksum, __ATOMIC_RELAXED) != NULL) {
+        return NULL;
+    }
+    return s;
+}
+
+static inline void stdio_read(FILE *stream, size_t amount) {
+    StdioSlot *s = stdio_slot(stream);
+    if (s == NULL) {
+        trace_read(fileno(stream), amount);
+        return;
+    }
+    stdio_add(&s->bread, amount);
+    if (stdio_add(&s->nread, 1) >= STDIO_BATCH) {
+        stdio_flush(s);
+    }
+}
+
+/* Count a write to a stream that got slot s from stdio_slot before the
+ * write. A signal handler may have taken the slot over in between. */
+static inline void stdio_write(StdioSlot *s, FILE *stream, size_t amount) {
+    if (s->stream != stream) {
+        s = stdio_slot(stream);
+        if (s == NULL) {
+            trace_write(fileno(stream), amount);
+            return;
+        }
+    }
+    stdio_add(&s->bwrite, amount);
+    if (stdio_add(&s->nwrite, 1) >= STDIO_BATCH) {
+        stdio_flush(s);
+    }
+}
+
 static void trace_close(int fd) {
     lock_descriptors();
 
-    Descriptor *f = get_descriptor(fd);
+    Descriptor *f = find_descriptor(fd);
     if (f == NULL) {
         goto unlock;
     }
@@ -782,8 +1439,31 @@ static void trace_close(int fd) {
 
     debug("trace_close %d", fd);
 
+    /* Counts of all the threads that are still in their stdio caches. The
+     * new serial below makes the threads drop them afterwards. */
+    for (StdioCache *c = stdio_caches; c != NULL; c = c->link) {
+        for (int i = 0; i < STDIO_SLOTS; i++) {
+            stdio_publish(&c->slots[i], f);
+        }
+    }
+    if (stdio_cache.prev == NULL) {
+        for (int i = 0; i < STDIO_SLOTS; i++) {
+            stdio_publish(&stdio_cache.slots[i], f);
+        }
+    }
+
+    /* Take the counters and reset them in one step so that updates from
+     * other threads are either included here or start the next count */
+    size_t bread = __atomic_exchange_n(&f->bread, 0, __ATOMIC_RELAXED);
+    size_t bwrite = __atomic_exchange_n(&f->bwrite, 0, __ATOMIC_RELAXED);
+    size_t nread = __atomic_exchange_n(&f->nread, 0, __ATOMIC_RELAXED);
+    size_t nwrite = __atomic_exchange_n(&f->nwrite, 0, __ATOMIC_RELAXED);
+    size_t bseek = __atomic_exchange_n(&f->bseek, 0, __ATOMIC_RELAXED);
+    size_t nseek = __atomic_exchange_n(&f->nseek, 0, __ATOMIC_RELAXED);
+    size_t bmap = __atomic_exchange_n(&f->bmap, 0, __ATOMIC_RELAXED);
+
     /* Only report files that have ops on them */
-    if (f->type == DTYPE_FILE && (f->nread+f->nwrite+f->nseek) > 0) {
+    if (f->type == DTYPE_FILE && (nread+nwrite+nseek+bmap) > 0) {
         /* Try to get the final size of the file */
         size_t size = 0;
         struct stat st;
@@ -791,22 +1471,39 @@ static void trace_close(int fd) {
             size = st.st_size;
         }
 
-        tprintf("file: '%s' %lu %lu %lu %lu %lu %lu %lu\n",
-                f->path, size, f->bread, f->bwrite, f->nread, f->nwrite, f->bseek, f->nseek);
+        TraceFile r;
+        memset(&r, 0, sizeof(r));
+        r.size = size;
+        r.bread = bread;
+        r.bwrite = bwrite;
+        r.nread = nread;
+        r.nwrite = nwrite;
+        r.bseek = bseek;
+        r.nseek = nseek;
+        r.bmap = bmap;
+        r.len = strlen(f->path);
+        twrite(&r, sizeof(r), TRACE_FILE, f->path, r.len);
     } else if (f->type == DTYPE_SOCK) {
-        tprintf("socket: %s %lu %lu %lu %lu\n", f->path, f->bread, f->bwrite, f->nread, f->nwrite);
+        /* The path of a socket is "address port" */
+        TraceSocket r;
+        memset(&r, 0, sizeof(r));
+        r.brecv = bread;
+        r.bsend = bwrite;
+        r.nrecv = nread;
+        r.nsend = nwrite;
+        char *port = strrchr(f->path, ' ');
+        r.len = port == NULL ? strlen(f->path) : port - f->path;
+        r.port = port == NULL ? 0 : atoi(port+1);
+        twrite(&r, sizeof(r), TRACE_SOCKET, f->path, r.len);
     }
 
+    checksum_close(f);
+
     /* Reset the entry */
     free(f->path);
     f->type = DTYPE_NONE;
     f->path = NULL;
-    f->bread = 0;
-    f->bwrite = 0;
-    f->nread = 0;
-    f->nwrite = 0;
-    f->bseek = 0;
-    f->nseek = 0;
+    __atomic_store_n(&f->serial, f->serial + 1, __ATOMIC_RELEASE);
 
 unlock:
     unlock_descriptors();
@@ -846,6 +1543,7 @@ static void trace_sock(int sockfd, const struct sockaddr *addr, socklen_t addrle
         d->nwrite = 0;
         d->bseek = 0;
         d->nseek = 0;
+        d->bmap = 0;
 
         char *temp = strdup(addrstr);
         if (temp == NULL) {
@@ -871,16 +1569,7 @@ static void trace_dup(int oldfd, int newfd) {
 
     lock_descriptors();
 
-    /* XXX Be careful in this function. Calling get_descriptor with
-     * two different file descriptors can cause problems because
-     * the second get_descriptor can invalidate the pointer returned by
-     * the first! To avoid that, ensure that the descriptor table is
-     * large enough to contain both descriptors first.
-     */
-    ensure_descriptor(newfd);
-    ensure_descriptor(oldfd);
-
-    Descriptor *o = get_descriptor(oldfd);
+    Descriptor *o = find_descriptor(oldfd);
     if (o == NULL) {
         goto unlock;
     }
@@ -890,6 +1579,7 @@ static void trace_dup(int oldfd, int newfd) {
         goto unlock;
     }
 
+
     /* Just in case newfd is already open */
     trace_close(newfd);
 
@@ -906,17 +1596,81 @@ static void trace_dup(int oldfd, int newfd) {
     }
     n->type = o->type;
     n->path = temp;
+    if (o->checksum != NULL) {
+        /* The descriptors share the offset, so they share the checksum */
+        o->checksum->refs++;
+        __atomic_store_n(&n->checksum, o->checksum, __ATOMIC_RELEASE);
+    }
     n->bread = 0;
     n->bwrite = 0;
     n->nread = 0;
     n->nwrite = 0;
     n->bseek = 0;
     n->nseek = 0;
+    n->bmap = 0;
 
 unlock:
     unlock_descriptors();
 }
 
+/* The mapped part of a file is counted separately from reads and writes.
+ * Most mappings of whole files, e.g. by mmap-based readers, only touch a
+ * few pages, and which pages are accessed is not known. */
+static void trace_mmap(int fd, size_t length, int prot, int flags, off_t offset) {
+    debug("trace_mmap %d %lu", fd, length);
+
+    Descriptor *f = find_descriptor(fd);
+    if (f == NULL || f->type != DTYPE_FILE) {
+        return;
+    }
+
+    /* Pages past the end of the file are not I/O */
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        if (offset >= st.st_size) {
+            length = 0;
+        } else if (length > (size_t)(st.st_size - offset)) {
+            length = st.st_size - offset;
+        }
+    }
+
+    __atomic_fetch_add(&f->bmap, length, __ATOMIC_RELAXED);
+    if ((flags & MAP_SHARED) && (prot & PROT_WRITE)) {
+        /* Writes to the mapping bypass the inline checksum */
+        checksum_invalidate(fd);
+    }
+}
+
+/* Requests submitted to io_uring can not be attributed to files, so only
+ * the totals of the process are reported */
+static uint64_t uring_enters;
+static uint64_t uring_sqes;
+
+static void trace_uring_enter(unsigned int to_submit, long rc) {
+    debug("trace_uring_enter %u %ld", to_submit, rc);
+
+    __atomic_fetch_add(&uring_enters, 1, __ATOMIC_RELAXED);
+    if (to_submit > 0 && rc > 0) {
+        __atomic_fetch_add(&uring_sqes, rc, __ATOMIC_RELAXED);
+    }
+}
+
+static void report_counter(const char *name, uint64_t value) {
+    TraceCounter r;
+    memset(&r, 0, sizeof(r));
+    r.value = value;
+    r.len = strlen(name);
+    twrite(&r, sizeof(r), TRACE_COUNTER, name, r.len);
+}
+
+static void report_uring_counters() {
+    uint64_t enters = __atomic_load_n(&uring_enters, __ATOMIC_RELAXED);
+    if (enters > 0) {
+        report_counter("IO_URING_ENTER", enters);
+        report_counter("IO_URING_SQES", __atomic_load_n(&uring_sqes, __ATOMIC_RELAXED));
+    }
+}
+
 static void trace_truncate(const char *path, off_t length) {
     debug("trace_truncate %s %lu", path, length);
 
@@ -927,15 +1681,24 @@ static void trace_truncate(const char *path, off_t length) {
         return;
     }
 
-    tprintf("file: '%s' %lu 0 0 0 0\n", fullpath, length);
+    TraceFile r;
+    memset(&r, 0, sizeof(r));
+    r.size = length;
+    r.len = strlen(fullpath);
+    twrite(&r, sizeof(r), TRACE_FILE, fullpath, r.len);
 
     free(fullpath);
 }
 
 static void report_thread_counters() {
+    TraceThreads r;
+    memset(&r, 0, sizeof(r));
     lock_threads();
-    tprintf("threads: %d %d %d\n", cur_threads, max_threads, tot_threads);
+    r.fin_threads = cur_threads;
+    r.max_threads = max_threads;
+    r.tot_threads = tot_threads;
     unlock_threads();
+    twrite(&r, sizeof(r), TRACE_THREADS, NULL, 0);
 }
 
 static void thread_started() {
@@ -973,6 +1736,185 @@ static void init_threads() {
     thread_started();
 }
 
+#ifdef HAS_PERF_EVENT
+
+static int perf_open(uint64_t config, int group) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP |
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    /* User mode only, this is allowed with the default perf_event_paranoid */
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.disabled = group < 0;
+    return (int)syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Return 1 if fd is still the event that was opened */
+static int perf_owned(PerfGroup *group, int i) {
+    struct stat st;
+    return syscall(SYS_fstat, group->fds[i], &st) == 0 &&
+           st.st_dev == group->dev && st.st_ino == group->inos[i];
+}
+
+/* Open the counters for the calling thread. Returns the group leader,
+ * or -1 if there are no counters */
+static int start_perf() {
+    if (!perf_ok) {
+        return -1;
+    }
+
+    PerfGroup group;
+    memset(&group, 0, sizeof(group));
+    for (int i = 0; i < n_perf_events; i++) {
+        int fd = perf_open(perf_events[i].config, i == 0 ? -1 : group.fds[0]);
+        if (fd < 0) {
+            if (i == 0) {
+                return -1;
+            }
+            continue;
+        }
+        struct stat st;
+        if (syscall(SYS_fstat, fd, &st) != 0) {
+            st.st_dev = 0;
+            st.st_ino = 0;
+        }
+        group.dev = st.st_dev;
+        group.fds[group.nfds] = fd;
+        group.events[group.nfds] = i;
+        group.inos[group.nfds] = st.st_ino;
+        group.nfds++;
+    }
+
+    pthread_mutex_lock(&perf_mutex);
+    PerfGroup *entry = getFDEntry(&perf_groups, group.fds[0]);
+    if (entry != NULL) {
+        *entry = group;
+    }
+    pthread_mutex_unlock(&perf_mutex);
+    if (entry == NULL) {
+        for (int i = 0; i < group.nfds; i++) {
+            syscall(SYS_close, group.fds[i]);
+        }
+        return -1;
+    }
+
+    syscall(SYS_ioctl, group.fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    return group.fds[0];
+}
+
+/* Read the counters of a group with one read, add them to the totals,
+ * and close the group. The caller holds perf_mutex. */
+static void stop_perf_locked(int leader) {
+    PerfGroup *group = findFDEntry(&perf_groups, leader);
+    if (group == NULL || group->nfds == 0) {
+        return;
+    }
+
+    /* nr, time_enabled, time_running, then one value per event */
+    uint64_t values[3 + n_perf_events];
+    ssize_t size = (3 + group->nfds) * sizeof(uint64_t);
+    if (perf_owned(group, 0) && syscall(SYS_read, leader, values, size) == size &&
+            values[0] == group->nfds) {
+        uint64_t enabled = values[1];
+        uint64_t running = values[2];
+        for (int i = 0; i < group->nfds; i++) {
+            uint64_t value = values[3 + i];
+            /* The counters were shared with other groups part of the time */
+            if (running > 0 && running < enabled) {
+                value = (uint64_t)((double)value * enabled / running);
+            }
+            perf_totals[group->events[i]] += value;
+            perf_seen[group->events[i]] = 1;
+        }
+    }
+
+    for (int i = 0; i < group->nfds; i++) {
+        if (perf_owned(group, i)) {
+            syscall(SYS_close, group->fds[i]);
+        }
+    }
+    group->nfds = 0;
+}
+
+static void stop_perf(int leader) {
+    if (leader < 0) {
+        return;
+    }
+    pthread_mutex_lock(&perf_mutex);
+    stop_perf_locked(leader);
+    pthread_mutex_unlock(&perf_mutex);
+}
+
+/* Forget the groups of the parent after fork. The counters measure the
+ * threads of the parent, so the copies of their descriptors are closed
+ * without reading them. */
+static void reset_perf() {
+    /* Another thread of the parent may have held the lock */
+    pthread_mutex_init(&perf_mutex, NULL);
+    if (perf_ok) {
+        for (int fd = nextFDEntry(&perf_groups, 0); fd >= 0; fd = nextFDEntry(&perf_groups, fd + 1)) {
+            PerfGroup *group = findFDEntry(&perf_groups, fd);
+            for (int i = 0; i < group->nfds; i++) {
+                if (perf_owned(group, i)) {
+                    syscall(SYS_close, group->fds[i]);
+                }
+            }
+        }
+        deleteFDTable(&perf_groups);
+    }
+    perf_ok = 0;
+    perf_main = -1;
+    memset(perf_totals, 0, sizeof(perf_totals));
+    memset(perf_seen, 0, sizeof(perf_seen));
+}
+
+static void init_perf() {
+    /* A forked child inherits the groups of its parent, start over */
+    reset_perf();
+
+    char *env = getenv("KICKSTART_PERF_COUNTERS");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        return;
+    }
+    if (initFDTable(&perf_groups, sizeof(PerfGroup)) < 0) {
+        return;
+    }
+    perf_ok = 1;
+    perf_main = start_perf();
+    /* No hardware counters (virtual machine, or not allowed), so don't
+     * try again for every thread */
+    if (perf_main < 0) {
+        perf_ok = 0;
+    }
+}
+
+/* Read the groups of all the threads that are still running, and report
+ * the totals */
+static void fini_perf() {
+    if (!perf_ok) {
+        return;
+    }
+
+    pthread_mutex_lock(&perf_mutex);
+    for (int fd = nextFDEntry(&perf_groups, 0); fd >= 0; fd = nextFDEntry(&perf_groups, fd + 1)) {
+        stop_perf_locked(fd);
+    }
+    perf_ok = 0;
+    pthread_mutex_unlock(&perf_mutex);
+
+    for (int i = 0; i < n_perf_events; i++) {
+        if (perf_seen[i]) {
+            report_counter(perf_events[i].name, perf_totals[i]);
+        }
+    }
+}
+
+#endif
+
 #ifdef HAS_PAPI
 
 static long unsigned int papi_gettid() {
@@ -1093,7 +2035,11 @@ static void stop_papi(int eventset) {
     char eventname[256];
     for (int i=0; i<nevents; i++) {
         PAPI_event_code_to_name(events[i], eventname);
-        tprintf("%s: %lld\n", eventname, counters[i]);
+        TraceCounter r;
+        memset(&r, 0, sizeof(r));
+        r.value = counters[i];
+        r.len = strlen(eventname);
+        twrite(&r, sizeof(r), TRACE_COUNTER, eventname, r.len);
     }
 }
 
@@ -1111,10 +2057,13 @@ static void fini_papi() {
 
 #endif
 
+
 /* Library initialization function */
 static void __attribute__((constructor)) interpose_init(void) {
     mypid = getpid();
 
+    init_symbols();
+
     /* dup stderr because the program might close it. This is
      * untraced because the descriptor table has not been
      * initialized yet */
@@ -1123,13 +2072,18 @@ static void __attribute__((constructor)) interpose_init(void) {
     /* Open the trace file */
     topen();
 
+    char *checksums = getenv("KICKSTART_STREAM_CHECKSUMS");
+    stream_checksums = checksums != NULL && strcmp(checksums, "0") != 0;
+
     init_descriptors();
     init_threads();
 
-    tprintf("start: %lf\n", get_time());
+    TraceStart start;
+    memset(&start, 0, sizeof(start));
+    start.time = get_time();
+    start.ppid = getppid();
+    twrite(&start, sizeof(start), TRACE_START, NULL, 0);
 
-    tprintf("Pid: %d\n", getpid());
-    tprintf("PPid: %d\n", getppid());
     read_cmdline();
 
 #ifdef HAS_PAPI
@@ -1137,6 +2091,9 @@ static void __attribute__((constructor)) interpose_init(void) {
     /* Start papi counters for main thread */
     start_papi();
 #endif
+#ifdef HAS_PERF_EVENT
+    init_perf();
+#endif
 }
 
 /* Library finalizer function */
@@ -1147,23 +2104,47 @@ static void __attribute__((destructor)) interpose_fini(void) {
     }
 
     /* Look for descriptors not explicitly closed */
-    for(int i=0; i<max_descriptors; i++) {
-        trace_close(i);
+    stdio_flush_all();
+    for (int fd = nextFDEntry(&descriptors, 0); fd >= 0; fd = nextFDEntry(&descriptors, fd + 1)) {
+        trace_close(fd);
     }
 
     report_thread_counters();
+    report_uring_counters();
 
 #ifdef HAS_PAPI
     fini_papi();
 #endif
+#ifdef HAS_PERF_EVENT
+    fini_perf();
+#endif
+
+    /* The proc files are opened relative to one directory descriptor */
+    int procfd = procOpen(0);
+    if (procfd < 0) {
+        printerr("libinterpose: Unable to open /proc/self: %s\n", strerror(errno));
+    } else {
+        read_exe(procfd);
+        read_status(procfd);
+    }
 
-    read_exe();
-    read_status();
-    read_rusage();
-    read_stat();
-    read_io();
+    TraceCPU cpu;
+    memset(&cpu, 0, sizeof(cpu));
+    read_rusage(&cpu);
+    if (procfd >= 0) {
+        read_stat(procfd, &cpu);
+    }
+    twrite(&cpu, sizeof(cpu), TRACE_CPU, NULL, 0);
+
+    if (procfd >= 0) {
+        read_io(procfd);
+        procClose(procfd);
+    }
 
-    tprintf("stop: %lf\n", get_time());
+    TraceStop stop;
+    memset(&stop, 0, sizeof(stop));
+    stop.time = get_time();
+    twrite(&stop, sizeof(stop), TRACE_STOP, NULL, 0);
 
     /* Close trace file */
     tclose();
@@ -1171,18 +2152,9 @@ static void __attribute__((destructor)) interpose_fini(void) {
     mypid = 0;
 }
 
-static inline void *osym(const char *name) {
-    void *orig_symbol = dlsym(RTLD_NEXT, name);
-    if (orig_symbol == NULL) {
-        printerr("FATAL ERROR: Unable to locate symbol %s: %s\n", name, dlerror());
-        abort();
-    }
-    return orig_symbol;
-}
-
 /** INTERPOSED FUNCTIONS **/
 static int dup_untraced(int oldfd) {
-    typeof(dup) *orig_dup = osym("dup");
+    typeof(dup) *orig_dup = osym(dup);
     return (*orig_dup)(oldfd);
 }
 
@@ -1201,7 +2173,7 @@ int dup(int oldfd) {
 int dup2(int oldfd, int newfd) {
     debug("dup2");
 
-    typeof(dup2) *orig_dup2 = osym("dup2");
+    typeof(dup2) *orig_dup2 = osym(dup2);
 
     int rc = (*orig_dup2)(oldfd, newfd);
 
@@ -1216,7 +2188,7 @@ int dup2(int oldfd, int newfd) {
 int dup3(int oldfd, int newfd, int flags) {
     debug("dup3");
 
-    typeof(dup3) *orig_dup3 = osym("dup3");
+    typeof(dup3) *orig_dup3 = osym(dup3);
 
     int rc = (*orig_dup3)(oldfd, newfd, flags);
 
@@ -1231,7 +2203,7 @@ int dup3(int oldfd, int newfd, int flags) {
 int open(const char *path, int oflag, ...) {
     debug("open");
 
-    typeof(open) *orig_open = osym("open");
+    typeof(open) *orig_open = osym(open);
 
     mode_t mode = 0700;
     if (oflag & O_CREAT) {
@@ -1253,7 +2225,7 @@ int open(const char *path, int oflag, ...) {
 int open64(const char *path, int oflag, ...) {
     debug("open64");
 
-    typeof(open64) *orig_open64 = osym("open64");
+    typeof(open64) *orig_open64 = osym(open64);
 
     mode_t mode = 0700;
     if (oflag & O_CREAT) {
@@ -1275,7 +2247,7 @@ int open64(const char *path, int oflag, ...) {
 int openat(int dirfd, const char *path, int oflag, ...) {
     debug("openat");
 
-    typeof(openat) *orig_openat = osym("openat");
+    typeof(openat) *orig_openat = osym(openat);
 
     mode_t mode = 0700;
     if (oflag & O_CREAT) {
@@ -1297,7 +2269,7 @@ int openat(int dirfd, const char *path, int oflag, ...) {
 int openat64(int dirfd, const char *path, int oflag, ...) {
     debug("openat64");
 
-    typeof(openat64) *orig_openat64 = osym("openat64");
+    typeof(openat64) *orig_openat64 = osym(openat64);
 
     mode_t mode = 0700;
     if (oflag & O_CREAT) {
@@ -1319,7 +2291,7 @@ int openat64(int dirfd, const char *path, int oflag, ...) {
 int creat(const char *path, mode_t mode) {
     debug("creat");
 
-    typeof(creat) *orig_creat = osym("creat");
+    typeof(creat) *orig_creat = osym(creat);
 
     int rc = (*orig_creat)(path, mode);
 
@@ -1333,7 +2305,7 @@ int creat(const char *path, mode_t mode) {
 int creat64(const char *path, mode_t mode) {
     debug("creat64");
 
-    typeof(creat64) *orig_creat64 = osym("creat64");
+    typeof(creat64) *orig_creat64 = osym(creat64);
 
     int rc = (*orig_creat64)(path, mode);
 
@@ -1345,7 +2317,7 @@ int creat64(const char *path, mode_t mode) {
 }
 
 static FILE *fopen_untraced(const char *path, const char *mode) {
-    typeof(fopen) *orig_fopen = osym("fopen");
+    typeof(fopen) *orig_fopen = osym(fopen);
     return (*orig_fopen)(path, mode);
 }
 
@@ -1364,7 +2336,7 @@ FILE *fopen(const char *path, const char *mode) {
 FILE *fopen64(const char *path, const char *mode) {
     debug("fopen64");
 
-    typeof(fopen64) *orig_fopen64 = osym("fopen64");
+    typeof(fopen64) *orig_fopen64 = osym(fopen64);
     FILE *f = (*orig_fopen64)(path, mode);
 
     if (f != NULL) {
@@ -1377,7 +2349,7 @@ FILE *fopen64(const char *path, const char *mode) {
 FILE *freopen(const char *path, const char *mode, FILE *stream) {
     debug("freopen");
 
-    typeof(freopen) *orig_freopen = osym("freopen");
+    typeof(freopen) *orig_freopen = osym(freopen);
     FILE *f = orig_freopen(path, mode, stream);
 
     if (f != NULL) {
@@ -1390,7 +2362,7 @@ FILE *freopen(const char *path, const char *mode, FILE *stream) {
 FILE *freopen64(const char *path, const char *mode, FILE *stream) {
     debug("freopen64");
 
-    typeof(freopen64) *orig_freopen64 = osym("freopen64");
+    typeof(freopen64) *orig_freopen64 = osym(freopen64);
     FILE *f = orig_freopen64(path, mode, stream);
 
     if (f != NULL) {
@@ -1403,7 +2375,7 @@ FILE *freopen64(const char *path, const char *mode, FILE *stream) {
 int close(int fd) {
     debug("close");
 
-    typeof(close) *orig_close = osym("close");
+    typeof(close) *orig_close = osym(close);
     int rc = (*orig_close)(fd);
 
     if (fd >= 0) {
@@ -1414,7 +2386,7 @@ int close(int fd) {
 }
 
 static int fclose_untraced(FILE *fp) {
-    typeof(fclose) *orig_fclose = osym("fclose");
+    typeof(fclose) *orig_fclose = osym(fclose);
     return (*orig_fclose)(fp);
 }
 
@@ -1438,7 +2410,7 @@ int fclose(FILE *fp) {
 ssize_t read(int fd, void *buf, size_t count) {
     debug("read");
 
-    typeof(read) *orig_read = osym("read");
+    typeof(read) *orig_read = osym(read);
     ssize_t rc = (*orig_read)(fd, buf, count);
 
     if (rc > 0) {
@@ -1451,52 +2423,82 @@ ssize_t read(int fd, void *buf, size_t count) {
 ssize_t write(int fd, const void *buf, size_t count) {
     debug("write");
 
-    typeof(write) *orig_write = osym("write");
+    typeof(write) *orig_write = osym(write);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_FD);
     ssize_t rc = (*orig_write)(fd, buf, count);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        checksum_update(c, buf, rc > 0 ? rc : 0);
+        checksum_release(c, 1);
+    }
 
     return rc;
 }
 
 static size_t fread_untraced(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    typeof(fread) *orig_fread = osym("fread");
+    typeof(fread) *orig_fread = osym(fread);
     return (*orig_fread)(ptr, size, nmemb, stream);
 }
 
-size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    debug("fread");
-
-    size_t rc = fread_untraced(ptr, size, nmemb, stream);
+/* Common part of fread and fread_unlocked */
+static size_t fread_traced(size_t (*orig)(void *, size_t, size_t, FILE *),
+                           void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    size_t rc = (*orig)(ptr, size, nmemb, stream);
 
     if (rc > 0) {
-        /* rc is the number of objects written */
+        /* rc is the number of objects read */
         trace_read(fileno(stream), rc*size);
     }
 
     return rc;
 }
 
-size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
-    debug("fwrite");
+size_t fread(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    debug("fread");
+    return fread_traced(osym(fread), ptr, size, nmemb, stream);
+}
+
+size_t fread_unlocked(void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    debug("fread_unlocked");
+    return fread_traced(osym(fread_unlocked), ptr, size, nmemb, stream);
+}
 
-    typeof(fwrite) *orig_fwrite = osym("fwrite");
-    size_t rc = (*orig_fwrite)(ptr, size, nmemb, stream);
+/* Common part of fwrite and fwrite_unlocked */
+static size_t fwrite_traced(size_t (*orig)(const void *, size_t, size_t, FILE *),
+                            const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    Checksum *c = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    size_t rc = (*orig)(ptr, size, nmemb, stream);
 
     if (rc > 0) {
         /* rc is the number of objects written */
         trace_write(fileno(stream), rc*size);
     }
+    if (c != NULL) {
+        /* Part of an object may have been buffered after an error */
+        checksum_update(c, ptr, rc*size);
+        checksum_release(c, rc == nmemb);
+    }
 
     return rc;
 }
 
+size_t fwrite(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    debug("fwrite");
+    return fwrite_traced(osym(fwrite), ptr, size, nmemb, stream);
+}
+
+size_t fwrite_unlocked(const void *ptr, size_t size, size_t nmemb, FILE *stream) {
+    debug("fwrite_unlocked");
+    return fwrite_traced(osym(fwrite_unlocked), ptr, size, nmemb, stream);
+}
+
 ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
     debug("pread");
 
-    typeof(pread) *orig_pread = osym("pread");
+    typeof(pread) *orig_pread = osym(pread);
     ssize_t rc = (*orig_pread)(fd, buf, count, offset);
 
     if (rc > 0) {
@@ -1509,7 +2511,7 @@ ssize_t pread(int fd, void *buf, size_t count, off_t offset) {
 ssize_t pread64(int fd, void *buf, size_t count, off_t offset) {
     debug("pread64");
 
-    typeof(pread64) *orig_pread64 = osym("pread64");
+    typeof(pread64) *orig_pread64 = osym(pread64);
     ssize_t rc = (*orig_pread64)(fd, buf, count, offset);
 
     if (rc > 0) {
@@ -1522,12 +2524,18 @@ ssize_t pread64(int fd, void *buf, size_t count, off_t offset) {
 ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
     debug("pwrite");
 
-    typeof(pwrite) *orig_pwrite = osym("pwrite");
+    typeof(pwrite) *orig_pwrite = osym(pwrite);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_POS);
     ssize_t rc = (*orig_pwrite)(fd, buf, count, offset);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        int sequential = offset >= 0 && (uint64_t)offset == c->size;
+        checksum_update(c, buf, rc > 0 && sequential ? rc : 0);
+        checksum_release(c, sequential || rc <= 0);
+    }
 
     return rc;
 }
@@ -1535,12 +2543,18 @@ ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset) {
 ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset) {
     debug("pwrite64");
 
-    typeof(pwrite64) *orig_pwrite64 = osym("pwrite64");
+    typeof(pwrite64) *orig_pwrite64 = osym(pwrite64);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_POS);
     ssize_t rc = (*orig_pwrite64)(fd, buf, count, offset);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        int sequential = offset >= 0 && (uint64_t)offset == c->size;
+        checksum_update(c, buf, rc > 0 && sequential ? rc : 0);
+        checksum_release(c, sequential || rc <= 0);
+    }
 
     return rc;
 }
@@ -1548,7 +2562,7 @@ ssize_t pwrite64(int fd, const void *buf, size_t count, off_t offset) {
 ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
     debug("readv");
 
-    typeof(readv) *orig_readv = osym("readv");
+    typeof(readv) *orig_readv = osym(readv);
     ssize_t rc = (*orig_readv)(fd, iov, iovcnt);
 
     if (rc > 0) {
@@ -1562,7 +2576,7 @@ ssize_t readv(int fd, const struct iovec *iov, int iovcnt) {
 ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
     debug("preadv");
 
-    typeof(preadv) *orig_preadv = osym("preadv");
+    typeof(preadv) *orig_preadv = osym(preadv);
     ssize_t rc = (*orig_preadv)(fd, iov, iovcnt, offset);
 
     if (rc > 0) {
@@ -1577,7 +2591,7 @@ ssize_t preadv(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
 ssize_t preadv64(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
     debug("preadv64");
 
-    typeof(preadv64) *orig_preadv64 = osym("preadv64");
+    typeof(preadv64) *orig_preadv64 = osym(preadv64);
     ssize_t rc = (*orig_preadv64)(fd, iov, iovcnt, offset);
 
     if (rc > 0) {
@@ -1591,12 +2605,17 @@ ssize_t preadv64(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
 ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
     debug("writev");
 
-    typeof(writev) *orig_writev = osym("writev");
+    typeof(writev) *orig_writev = osym(writev);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_FD);
     ssize_t rc = (*orig_writev)(fd, iov, iovcnt);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        checksum_update_iov(c, iov, iovcnt, rc > 0 ? rc : 0);
+        checksum_release(c, 1);
+    }
 
     return rc;
 }
@@ -1605,12 +2624,18 @@ ssize_t writev(int fd, const struct iovec *iov, int iovcnt) {
 ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
     debug("pwritev");
 
-    typeof(pwritev) *orig_pwritev = osym("pwritev");
+    typeof(pwritev) *orig_pwritev = osym(pwritev);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_POS);
     ssize_t rc = (*orig_pwritev)(fd, iov, iovcnt, offset);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        int sequential = offset >= 0 && (uint64_t)offset == c->size;
+        checksum_update_iov(c, iov, iovcnt, rc > 0 && sequential ? rc : 0);
+        checksum_release(c, sequential || rc <= 0);
+    }
 
     return rc;
 }
@@ -1620,52 +2645,321 @@ ssize_t pwritev(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
 ssize_t pwritev64(int fd, const struct iovec *iov, int iovcnt, off_t offset) {
     debug("pwritev64");
 
-    typeof(pwritev64) *orig_pwritev64 = osym("pwritev64");
+    typeof(pwritev64) *orig_pwritev64 = osym(pwritev64);
+    Checksum *c = checksum_acquire(fd, CHECKSUM_POS);
     ssize_t rc = (*orig_pwritev64)(fd, iov, iovcnt, offset);
 
     if (rc > 0) {
         trace_write(fd, rc);
     }
+    if (c != NULL) {
+        int sequential = offset >= 0 && (uint64_t)offset == c->size;
+        checksum_update_iov(c, iov, iovcnt, rc > 0 && sequential ? rc : 0);
+        checksum_release(c, sequential || rc <= 0);
+    }
 
     return rc;
 }
 #endif
 
-int fgetc(FILE *stream) {
-    debug("fgetc");
+#ifdef RWF_HIPRI
+ssize_t preadv2(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags) {
+    debug("preadv2");
 
-    typeof(fgetc) *orig_fgetc = osym("fgetc");
-    int rc = (*orig_fgetc)(stream);
+    typeof(preadv2) *orig_preadv2 = osym(preadv2);
+    ssize_t rc = (*orig_preadv2)(fd, iov, iovcnt, offset, flags);
 
     if (rc > 0) {
-        trace_read(fileno(stream), 1);
+        trace_read(fd, rc);
     }
 
     return rc;
 }
 
-int fputc(int c, FILE *stream) {
-    debug("fputc");
+ssize_t pwritev2(int fd, const struct iovec *iov, int iovcnt, off_t offset, int flags) {
+    debug("pwritev2");
 
-    typeof(fputc) *orig_fputc = osym("fputc");
-    int rc = (*orig_fputc)(c, stream);
+    typeof(pwritev2) *orig_pwritev2 = osym(pwritev2);
+    /* An offset of -1 writes at the current offset, like writev */
+    Checksum *c = checksum_acquire(fd, offset == -1 ? CHECKSUM_FD : CHECKSUM_POS);
+    ssize_t rc = (*orig_pwritev2)(fd, iov, iovcnt, offset, flags);
 
     if (rc > 0) {
+        trace_write(fd, rc);
+    }
+    if (c != NULL) {
+        int sequential = offset == -1 || (offset >= 0 && (uint64_t)offset == c->size);
+        checksum_update_iov(c, iov, iovcnt, rc > 0 && sequential ? rc : 0);
+        checksum_release(c, sequential || rc <= 0);
+    }
+
+    return rc;
+}
+#endif
+
+/* Common part of fgetc, getc, getchar and their _unlocked variants */
+static int getc_traced(int (*orig)(FILE *), FILE *stream) {
+    int rc = (*orig)(stream);
+
+    if (rc != EOF) {
+        stdio_read(stream, 1);
+    }
+
+    return rc;
+}
+
+/* Common part of fputc, putc, putchar and their _unlocked variants */
+static int putc_traced(int (*orig)(int, FILE *), int c, FILE *stream) {
+    StdioSlot *s = stdio_slot(stream);
+    if (s != NULL) {
+        int rc = (*orig)(c, stream);
+        if (rc != EOF) {
+            stdio_write(s, stream, 1);
+        }
+        return rc;
+    }
+
+    Checksum *sum = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    int rc = (*orig)(c, stream);
+
+    if (rc != EOF) {
         trace_write(fileno(stream), 1);
     }
+    if (sum != NULL) {
+        unsigned char byte = (unsigned char)c;
+        checksum_update(sum, &byte, rc != EOF ? 1 : 0);
+        checksum_release(sum, rc != EOF);
+    }
 
     return rc;
 }
 
-static char *fgets_untraced(char *s, int size, FILE *stream) {
-    typeof(fgets) *orig_fgets = osym("fgets");
-    return (*orig_fgets)(s, size, stream);
+int fgetc(FILE *stream) {
+    debug("fgetc");
+    return getc_traced(osym(fgetc), stream);
 }
 
-char *fgets(char *s, int size, FILE *stream) {
-    debug("fgets");
+int getc(FILE *stream) {
+    debug("getc");
+    return getc_traced(osym(getc), stream);
+}
+
+int getchar(void) {
+    debug("getchar");
+    return getc_traced(osym(getc), stdin);
+}
+
+int fgetc_unlocked(FILE *stream) {
+    debug("fgetc_unlocked");
+    return getc_traced(osym(fgetc_unlocked), stream);
+}
+
+int getc_unlocked(FILE *stream) {
+    debug("getc_unlocked");
+    return getc_traced(osym(getc_unlocked), stream);
+}
+
+int getchar_unlocked(void) {
+    debug("getchar_unlocked");
+    return getc_traced(osym(getc_unlocked), stdin);
+}
+
+int fputc(int c, FILE *stream) {
+    debug("fputc");
+    return putc_traced(osym(fputc), c, stream);
+}
+
+int putc(int c, FILE *stream) {
+    debug("putc");
+    return putc_traced(osym(putc), c, stream);
+}
+
+int putchar(int c) {
+    debug("putchar");
+    return putc_traced(osym(putc), c, stdout);
+}
+
+int fputc_unlocked(int c, FILE *stream) {
+    debug("fputc_unlocked");
+    return putc_traced(osym(fputc_unlocked), c, stream);
+}
+
+int putc_unlocked(int c, FILE *stream) {
+    debug("putc_unlocked");
+    return putc_traced(osym(putc_unlocked), c, stream);
+}
+
+int putchar_unlocked(int c) {
+    debug("putchar_unlocked");
+    return putc_traced(osym(putc_unlocked), c, stdout);
+}
+
+/* Number of bytes of a wide character in the encoding of the locale.
+ * The stream may use a different encoding, so this is an estimate. */
+static size_t wide_bytes(wint_t wc) {
+    if (wc < 0x80) {
+        return 1;
+    }
+    char buf[MB_LEN_MAX];
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t len = wcrtomb(buf, wc, &state);
+    return len == (size_t)-1 ? 1 : len;
+}
+
+static size_t wide_string_bytes(const wchar_t *ws) {
+    mbstate_t state;
+    memset(&state, 0, sizeof(state));
+    size_t len = wcsrtombs(NULL, &ws, 0, &state);
+    return len == (size_t)-1 ? wcslen(ws) : len;
+}
+
+/* Common part of fgetwc, getwc, getwchar and their _unlocked variants */
+static wint_t getwc_traced(wint_t (*orig)(FILE *), FILE *stream) {
+    wint_t rc = (*orig)(stream);
+
+    if (rc != WEOF) {
+        stdio_read(stream, wide_bytes(rc));
+    }
+
+    return rc;
+}
+
+/* Common part of fputwc, putwc, putwchar and their _unlocked variants.
+ * The bytes that reach the file are not known, so a checksum of the
+ * stream can not be computed. */
+static wint_t putwc_traced(wint_t (*orig)(wchar_t, FILE *), wchar_t wc, FILE *stream) {
+    StdioSlot *s = stdio_slot(stream);
+    if (s != NULL) {
+        wint_t rc = (*orig)(wc, stream);
+        if (rc != WEOF) {
+            stdio_write(s, stream, wide_bytes(wc));
+        }
+        return rc;
+    }
+
+    Checksum *sum = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    wint_t rc = (*orig)(wc, stream);
+
+    if (rc != WEOF) {
+        trace_write(fileno(stream), wide_bytes(wc));
+    }
+    if (sum != NULL) {
+        checksum_release(sum, 0);
+    }
+
+    return rc;
+}
+
+wint_t fgetwc(FILE *stream) {
+    debug("fgetwc");
+    return getwc_traced(osym(fgetwc), stream);
+}
+
+wint_t getwc(FILE *stream) {
+    debug("getwc");
+    return getwc_traced(osym(getwc), stream);
+}
+
+wint_t getwchar(void) {
+    debug("getwchar");
+    return getwc_traced(osym(getwc), stdin);
+}
+
+wint_t fgetwc_unlocked(FILE *stream) {
+    debug("fgetwc_unlocked");
+    return getwc_traced(osym(fgetwc_unlocked), stream);
+}
+
+wint_t getwc_unlocked(FILE *stream) {
+    debug("getwc_unlocked");
+    return getwc_traced(osym(getwc_unlocked), stream);
+}
 
-    char *ret = fgets_untraced(s, size, stream);
+wint_t getwchar_unlocked(void) {
+    debug("getwchar_unlocked");
+    return getwc_traced(osym(getwc_unlocked), stdin);
+}
+
+wint_t fputwc(wchar_t wc, FILE *stream) {
+    debug("fputwc");
+    return putwc_traced(osym(fputwc), wc, stream);
+}
+
+wint_t putwc(wchar_t wc, FILE *stream) {
+    debug("putwc");
+    return putwc_traced(osym(putwc), wc, stream);
+}
+
+wint_t putwchar(wchar_t wc) {
+    debug("putwchar");
+    return putwc_traced(osym(putwc), wc, stdout);
+}
+
+wint_t fputwc_unlocked(wchar_t wc, FILE *stream) {
+    debug("fputwc_unlocked");
+    return putwc_traced(osym(fputwc_unlocked), wc, stream);
+}
+
+wint_t putwc_unlocked(wchar_t wc, FILE *stream) {
+    debug("putwc_unlocked");
+    return putwc_traced(osym(putwc_unlocked), wc, stream);
+}
+
+wint_t putwchar_unlocked(wchar_t wc) {
+    debug("putwchar_unlocked");
+    return putwc_traced(osym(putwc_unlocked), wc, stdout);
+}
+
+static wchar_t *getws_traced(wchar_t *(*orig)(wchar_t *, int, FILE *),
+                             wchar_t *ws, int n, FILE *stream) {
+    wchar_t *ret = (*orig)(ws, n, stream);
+
+    if (ret != NULL) {
+        trace_read(fileno(stream), wide_string_bytes(ret));
+    }
+
+    return ret;
+}
+
+static int putws_traced(int (*orig)(const wchar_t *, FILE *),
+                        const wchar_t *ws, FILE *stream) {
+    Checksum *sum = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    int rc = (*orig)(ws, stream);
+
+    if (rc != EOF) {
+        trace_write(fileno(stream), wide_string_bytes(ws));
+    }
+    if (sum != NULL) {
+        checksum_release(sum, 0);
+    }
+
+    return rc;
+}
+
+wchar_t *fgetws(wchar_t *ws, int n, FILE *stream) {
+    debug("fgetws");
+    return getws_traced(osym(fgetws), ws, n, stream);
+}
+
+wchar_t *fgetws_unlocked(wchar_t *ws, int n, FILE *stream) {
+    debug("fgetws_unlocked");
+    return getws_traced(osym(fgetws_unlocked), ws, n, stream);
+}
+
+int fputws(const wchar_t *ws, FILE *stream) {
+    debug("fputws");
+    return putws_traced(osym(fputws), ws, stream);
+}
+
+int fputws_unlocked(const wchar_t *ws, FILE *stream) {
+    debug("fputws_unlocked");
+    return putws_traced(osym(fputws_unlocked), ws, stream);
+}
+
+/* Common part of fgets and fgets_unlocked */
+static char *gets_traced(char *(*orig)(char *, int, FILE *), char *s, int size, FILE *stream) {
+    char *ret = (*orig)(s, size, stream);
 
     if (ret != NULL) {
         trace_read(fileno(stream), strlen(ret));
@@ -1674,23 +2968,46 @@ char *fgets(char *s, int size, FILE *stream) {
     return ret;
 }
 
-int fputs(const char *s, FILE *stream) {
-    debug("fputs");
+char *fgets(char *s, int size, FILE *stream) {
+    debug("fgets");
+    return gets_traced(osym(fgets), s, size, stream);
+}
+
+char *fgets_unlocked(char *s, int size, FILE *stream) {
+    debug("fgets_unlocked");
+    return gets_traced(osym(fgets_unlocked), s, size, stream);
+}
 
-    typeof(fputs) *orig_fputs = osym("fputs");
-    int rc = (*orig_fputs)(s, stream);
+/* Common part of fputs and fputs_unlocked */
+static int puts_traced(int (*orig)(const char *, FILE *), const char *s, FILE *stream) {
+    Checksum *c = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    int rc = (*orig)(s, stream);
 
-    if (rc > 0) {
+    if (rc != EOF) {
         trace_write(fileno(stream), strlen(s));
     }
+    if (c != NULL) {
+        checksum_update(c, s, rc != EOF ? strlen(s) : 0);
+        checksum_release(c, rc != EOF);
+    }
 
     return rc;
 }
 
+int fputs(const char *s, FILE *stream) {
+    debug("fputs");
+    return puts_traced(osym(fputs), s, stream);
+}
+
+int fputs_unlocked(const char *s, FILE *stream) {
+    debug("fputs_unlocked");
+    return puts_traced(osym(fputs_unlocked), s, stream);
+}
+
 int vfscanf(FILE *stream, const char *format, va_list ap) {
     debug("vfscanf");
 
-    typeof(vfscanf) *orig_vfscanf = osym("vfscanf");
+    typeof(vfscanf) *orig_vfscanf = osym(vfscanf);
 
     /* We need to get the offset because (v)fscanf returns
      * the number of items matched, not the number of bytes
@@ -1719,14 +3036,53 @@ int fscanf(FILE *stream, const char *format, ...) {
 }
 
 static int vfprintf_untraced(FILE *stream, const char *format, va_list ap) {
-    typeof(vfprintf) *orig_vfprintf = osym("vfprintf");
+    typeof(vfprintf) *orig_vfprintf = osym(vfprintf);
     return (*orig_vfprintf)(stream, format, ap);
 }
 
+/* Format the output into a buffer and write it with fwrite, so that the
+ * checksum sees the data */
+static int vfprintf_checksum(Checksum *c, FILE *stream, const char *format, va_list ap) {
+    char small[1024];
+    char *buf = small;
+    va_list copy;
+
+    va_copy(copy, ap);
+    int len = vsnprintf(small, sizeof(small), format, copy);
+    va_end(copy);
+    if (len >= (int)sizeof(small)) {
+        buf = (char *)malloc(len + 1);
+        if (buf != NULL) {
+            va_copy(copy, ap);
+            vsnprintf(buf, len + 1, format, copy);
+            va_end(copy);
+        }
+    }
+    if (len < 0 || buf == NULL) {
+        checksum_release(c, 0);
+        return vfprintf_untraced(stream, format, ap);
+    }
+
+    size_t written = (*osym(fwrite))(buf, 1, len, stream);
+    checksum_update(c, buf, written);
+    checksum_release(c, written == (size_t)len);
+    if (buf != small) {
+        free(buf);
+    }
+
+    return written == (size_t)len ? len : -1;
+}
+
 int vfprintf(FILE *stream, const char *format, va_list ap) {
     debug("vfprintf");
 
-    int rc = vfprintf_untraced(stream, format, ap);
+    int rc;
+    Checksum *c = checksum_acquire(fileno(stream), CHECKSUM_STDIO);
+    if (c != NULL) {
+        rc = vfprintf_checksum(c, stream, format, ap);
+    } else {
+        rc = vfprintf_untraced(stream, format, ap);
+    }
 
     if (rc > 0) {
         trace_write(fileno(stream), rc);
@@ -1748,7 +3104,7 @@ int fprintf(FILE *stream, const char *format, ...) {
 int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
     debug("connect");
 
-    typeof(connect) *orig_connect = osym("connect");
+    typeof(connect) *orig_connect = osym(connect);
     int rc = (*orig_connect)(sockfd, addr, addrlen);
 
     /* FIXME There are potential issues with non-blocking sockets here */
@@ -1764,7 +3120,7 @@ int connect(int sockfd, const struct sockaddr *addr, socklen_t addrlen) {
 ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
     debug("send");
 
-    typeof(send) *orig_send = osym("send");
+    typeof(send) *orig_send = osym(send);
     ssize_t rc = (*orig_send)(sockfd, buf, len, flags);
 
     if (rc > 0) {
@@ -1777,12 +3133,75 @@ ssize_t send(int sockfd, const void *buf, size_t len, int flags) {
 ssize_t sendfile(int out_fd, int in_fd, off_t *offset, size_t count) {
     debug("sendfile");
 
-    typeof(sendfile) *orig_sendfile = osym("sendfile");
+    typeof(sendfile) *orig_sendfile = osym(sendfile);
     ssize_t rc = (*orig_sendfile)(out_fd, in_fd, offset, count);
 
     if (rc > 0) {
         trace_read(in_fd, rc);
         trace_write(out_fd, rc);
+        checksum_invalidate(out_fd);
+    }
+
+    return rc;
+}
+
+ssize_t sendfile64(int out_fd, int in_fd, off64_t *offset, size_t count) {
+    debug("sendfile64");
+
+    typeof(sendfile64) *orig_sendfile64 = osym(sendfile64);
+    ssize_t rc = (*orig_sendfile64)(out_fd, in_fd, offset, count);
+
+    if (rc > 0) {
+        trace_read(in_fd, rc);
+        trace_write(out_fd, rc);
+        checksum_invalidate(out_fd);
+    }
+
+    return rc;
+}
+
+ssize_t copy_file_range(int infd, off64_t *pinoff, int outfd, off64_t *poutoff,
+                        size_t length, unsigned int flags) {
+    debug("copy_file_range");
+
+    typeof(copy_file_range) *orig_copy_file_range = osym(copy_file_range);
+    ssize_t rc = (*orig_copy_file_range)(infd, pinoff, outfd, poutoff, length, flags);
+
+    if (rc > 0) {
+        trace_read(infd, rc);
+        trace_write(outfd, rc);
+        checksum_invalidate(outfd);
+    }
+
+    return rc;
+}
+
+ssize_t splice(int fdin, off64_t *offin, int fdout, off64_t *offout,
+               size_t len, unsigned int flags) {
+    debug("splice");
+
+    typeof(splice) *orig_splice = osym(splice);
+    ssize_t rc = (*orig_splice)(fdin, offin, fdout, offout, len, flags);
+
+    if (rc > 0) {
+        trace_read(fdin, rc);
+        trace_write(fdout, rc);
+        checksum_invalidate(fdout);
+    }
+
+    return rc;
+}
+
+ssize_t tee(int fdin, int fdout, size_t len, unsigned int flags) {
+    debug("tee");
+
+    typeof(tee) *orig_tee = osym(tee);
+    ssize_t rc = (*orig_tee)(fdin, fdout, len, flags);
+
+    /* Both ends are pipes, this only counts if they are named pipes */
+    if (rc > 0) {
+        trace_read(fdin, rc);
+        trace_write(fdout, rc);
     }
 
     return rc;
@@ -1792,7 +3211,7 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
                const struct sockaddr *dest_addr, socklen_t addrlen) {
     debug("sendto");
 
-    typeof(sendto) *orig_sendto = osym("sendto");
+    typeof(sendto) *orig_sendto = osym(sendto);
     ssize_t rc = (*orig_sendto)(sockfd, buf, len, flags, dest_addr, addrlen);
 
     if (rc > 0) {
@@ -1807,7 +3226,7 @@ ssize_t sendto(int sockfd, const void *buf, size_t len, int flags,
 ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
     debug("sendmsg");
 
-    typeof(sendmsg) *orig_sendmsg = osym("sendmsg");
+    typeof(sendmsg) *orig_sendmsg = osym(sendmsg);
     ssize_t rc = (*orig_sendmsg)(sockfd, msg, flags);
 
     if (rc > 0) {
@@ -1824,7 +3243,7 @@ ssize_t sendmsg(int sockfd, const struct msghdr *msg, int flags) {
 ssize_t recv(int sockfd, void *buf, size_t len, int flags) {
     debug("recv");
 
-    typeof(recv) *orig_recv = osym("recv");
+    typeof(recv) *orig_recv = osym(recv);
     ssize_t rc = (*orig_recv)(sockfd, buf, len, flags);
 
     if (rc > 0) {
@@ -1838,7 +3257,7 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
                  struct sockaddr *src_addr, socklen_t *addrlen) {
     debug("recvfrom");
 
-    typeof(recvfrom) *orig_recvfrom = osym("recvfrom");
+    typeof(recvfrom) *orig_recvfrom = osym(recvfrom);
     ssize_t rc = (*orig_recvfrom)(sockfd, buf, len, flags, src_addr, addrlen);
 
     if (rc > 0) {
@@ -1853,7 +3272,7 @@ ssize_t recvfrom(int sockfd, void *buf, size_t len, int flags,
 ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     debug("recvmsg");
 
-    typeof(recvmsg) *orig_recvmsg = osym("recvmsg");
+    typeof(recvmsg) *orig_recvmsg = osym(recvmsg);
     ssize_t rc = (*orig_recvmsg)(sockfd, msg, flags);
 
     if (rc > 0) {
@@ -1867,10 +3286,63 @@ ssize_t recvmsg(int sockfd, struct msghdr *msg, int flags) {
     return rc;
 }
 
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) {
+    debug("mmap");
+
+    typeof(mmap) *orig_mmap = osym(mmap);
+    void *rc = (*orig_mmap)(addr, length, prot, flags, fd, offset);
+
+    if (rc != MAP_FAILED && fd >= 0 && !(flags & MAP_ANONYMOUS)) {
+        trace_mmap(fd, length, prot, flags, offset);
+    }
+
+    return rc;
+}
+
+void *mmap64(void *addr, size_t length, int prot, int flags, int fd, off64_t offset) {
+    debug("mmap64");
+
+    typeof(mmap64) *orig_mmap64 = osym(mmap64);
+    void *rc = (*orig_mmap64)(addr, length, prot, flags, fd, offset);
+
+    if (rc != MAP_FAILED && fd >= 0 && !(flags & MAP_ANONYMOUS)) {
+        trace_mmap(fd, length, prot, flags, offset);
+    }
+
+    return rc;
+}
+
+#ifdef SYS_io_uring_enter
+/* io_uring has no libc wrapper, so applications and liburing call it
+ * through syscall(). The arguments are passed on as they are, which works
+ * because every system call argument is a register-sized integer. */
+long syscall(long number, ...) {
+    va_list ap;
+    long a[6];
+
+    va_start(ap, number);
+    for (int i = 0; i < 6; i++) {
+        a[i] = va_arg(ap, long);
+    }
+    va_end(ap);
+
+    typeof(syscall) *orig_syscall = osym(syscall);
+    long rc = (*orig_syscall)(number, a[0], a[1], a[2], a[3], a[4], a[5]);
+
+    if (number == SYS_io_uring_enter) {
+        int saverr = errno;
+        trace_uring_enter((unsigned int)a[1], rc);
+        errno = saverr;
+    }
+
+    return rc;
+}
+#endif
+
 int truncate(const char *path, off_t length) {
     debug("truncate");
 
-    typeof(truncate) *orig_truncate = osym("truncate");
+    typeof(truncate) *orig_truncate = osym(truncate);
     int rc = (*orig_truncate)(path, length);
 
     if (rc == 0) {
@@ -1883,7 +3355,7 @@ int truncate(const char *path, off_t length) {
 int mkstemp(char *template) {
     debug("mkstemp");
 
-    typeof(mkstemp) *orig_mkstemp = osym("mkstemp");
+    typeof(mkstemp) *orig_mkstemp = osym(mkstemp);
     int rc = (*orig_mkstemp)(template);
 
     if (rc >= 0) {
@@ -1897,7 +3369,7 @@ int mkstemp(char *template) {
 int mkostemp(char *template, int flags) {
     debug("mkostemp");
 
-    typeof(mkostemp) *orig_mkostemp = osym("mkostemp");
+    typeof(mkostemp) *orig_mkostemp = osym(mkostemp);
     int rc = (*orig_mkostemp)(template, flags);
 
     if (rc >= 0) {
@@ -1912,7 +3384,7 @@ int mkostemp(char *template, int flags) {
 int mkstemps(char *template, int suffixlen) {
     debug("mkstemps");
 
-    typeof(mkstemps) *orig_mkstemps = osym("mkstemps");
+    typeof(mkstemps) *orig_mkstemps = osym(mkstemps);
     int rc = (*orig_mkstemps)(template, suffixlen);
 
     if (rc >= 0) {
@@ -1927,7 +3399,7 @@ int mkstemps(char *template, int suffixlen) {
 int mkostemps(char *template, int suffixlen, int flags) {
     debug("mkostemps");
 
-    typeof(mkostemps) *orig_mkostemps = osym("mkostemps");
+    typeof(mkostemps) *orig_mkostemps = osym(mkostemps);
     int rc = (*orig_mkostemps)(template, suffixlen, flags);
 
     if (rc >= 0) {
@@ -1941,7 +3413,7 @@ int mkostemps(char *template, int suffixlen, int flags) {
 FILE *tmpfile(void) {
     debug("tmpfile");
 
-    typeof(tmpfile) *orig_tmpfile = osym("tmpfile");
+    typeof(tmpfile) *orig_tmpfile = osym(tmpfile);
     FILE *f = (*orig_tmpfile)();
 
     if (f != NULL) {
@@ -1954,11 +3426,12 @@ FILE *tmpfile(void) {
 off_t lseek(int fd, off_t offset, int whence) {
     debug("lseek %d %ld %d", fd, offset, whence);
 
-    typeof(lseek) *orig_lseek = osym("lseek");
+    typeof(lseek) *orig_lseek = osym(lseek);
     off_t result = (*orig_lseek)(fd, offset, whence);
 
     if (result >= 0) {
         trace_seek(fd, offset);
+        checksum_seek(fd, result);
     }
 
     return result;
@@ -1968,11 +3441,12 @@ off_t lseek(int fd, off_t offset, int whence) {
 off64_t lseek64(int fd, off64_t offset, int whence) {
     debug("lseek64");
 
-    typeof(lseek64) *orig_lseek64 = osym("lseek64");
+    typeof(lseek64) *orig_lseek64 = osym(lseek64);
     off64_t result = (*orig_lseek64)(fd, offset, whence);
 
     if (result >= 0) {
         trace_seek(fd, offset);
+        checksum_seek(fd, result);
     }
 
     return result;
@@ -1982,11 +3456,14 @@ off64_t lseek64(int fd, off64_t offset, int whence) {
 int fseek(FILE *stream, long offset, int whence) {
     debug("fseek");
 
-    typeof(fseek) *orig_fseek = osym("fseek");
+    typeof(fseek) *orig_fseek = osym(fseek);
     int result = (*orig_fseek)(stream, offset, whence);
 
     if (result == 0) {
         trace_seek(fileno(stream), offset);
+        if (find_checksum(fileno(stream)) != NULL) {
+            checksum_seek(fileno(stream), ftello(stream));
+        }
     }
 
     return result;
@@ -1995,11 +3472,14 @@ int fseek(FILE *stream, long offset, int whence) {
 int fseeko(FILE *stream, off_t offset, int whence) {
     debug("fseeko");
 
-    typeof(fseeko) *orig_fseeko = osym("fseeko");
+    typeof(fseeko) *orig_fseeko = osym(fseeko);
     int result = (*orig_fseeko)(stream, offset, whence);
 
     if (result == 0) {
         trace_seek(fileno(stream), offset);
+        if (find_checksum(fileno(stream)) != NULL) {
+            checksum_seek(fileno(stream), ftello(stream));
+        }
     }
 
     return result;
@@ -2008,6 +3488,13 @@ int fseeko(FILE *stream, off_t offset, int whence) {
 static void interpose_pthread_cleanup(void *arg) {
     /* Update thread counters */
     thread_finished();
+    stdio_flush_all();
+    stdio_unregister();
+
+#ifdef HAS_PERF_EVENT
+    /* Add the hardware counters of this thread to the totals */
+    stop_perf(((interpose_pthread_wrapper_arg *)arg)->perf_group);
+#endif
 
     /* Free the pthread wrapper */
     free(arg);
@@ -2032,12 +3519,19 @@ static void *interpose_pthread_wrapper(void *arg) {
         abort();
     }
 
+#ifdef HAS_PERF_EVENT
+    info->perf_group = start_perf();
+#endif
+
     /* This sets up a key whose destructor cleans up the thread wrapper */
     if (pthread_key_create(&info->cleanup, interpose_pthread_cleanup) != 0) {
         printerr("Error creating cleanup key for thread %d\n", gettid());
     }
     if (pthread_setspecific(info->cleanup, arg) != 0) {
         printerr("Unable to set cleanup key for thread %d\n", gettid());
+    } else {
+        /* The cleanup removes the stdio cache of the thread again */
+        stdio_register();
     }
 
     return info->start_routine(info->arg);
@@ -2046,7 +3540,7 @@ static void *interpose_pthread_wrapper(void *arg) {
 int pthread_create(pthread_t *thread, const pthread_attr_t *attr, void *(*start_routine)(void *), void *arg) {
     debug("pthread_create");
 
-    typeof(pthread_create) *orig_pthread_create = osym("pthread_create");
+    typeof(pthread_create) *orig_pthread_create = osym(pthread_create);
 
     interpose_pthread_wrapper_arg *info = malloc(sizeof(interpose_pthread_wrapper_arg));
     if (info == NULL) {
@@ -2165,7 +3659,7 @@ int execle(const char *path, const char *arg, ... /*, char * const envp[]*/) {
 
 int execv(const char *path, char *const argv[]) {
     debug("execv");
-    typeof(execv) *orig_execv = osym("execv");
+    typeof(execv) *orig_execv = osym(execv);
     interpose_fini();
     int rc = (*orig_execv)(path, argv);
     interpose_init();
@@ -2174,7 +3668,7 @@ int execv(const char *path, char *const argv[]) {
 
 int execvp(const char *file, char *const argv[]) {
     debug("execvp");
-    typeof(execvp) *orig_execvp = osym("execvp");
+    typeof(execvp) *orig_execvp = osym(execvp);
     interpose_fini();
     int rc = (*orig_execvp)(file, argv);
     interpose_init();
@@ -2183,7 +3677,7 @@ int execvp(const char *file, char *const argv[]) {
 
 int execve(const char *filename, char *const argv[], char *const envp[]) {
     debug("execve");
-    typeof(execve) *orig_execve = osym("execve");
+    typeof(execve) *orig_execve = osym(execve);
     interpose_fini();
     int rc = (*orig_execve)(filename, argv, envp);
     interpose_init();
@@ -2196,17 +3690,18 @@ pid_t fork(void) {
      * with vfork basically can't do anything except call exec, in which
      * case libinterpose is going to be reinitialized anyway. */
 
-    typeof(fork) *orig_fork = osym("fork");
+    typeof(fork) *orig_fork = osym(fork);
     pid_t rc = (*orig_fork)();
 
     if (rc == 0) {
         /* Close the trace file since we inherited it */
-        tclose();
+        tabandon();
 
         /* Reinitialize libinterpose on a successful fork */
         interpose_init();
 
-        tprintf("fork\n");
+        TraceHeader r;
+        twrite(&r, sizeof(r), TRACE_FORK, NULL, 0);
     }
 
     return rc;
@@ -2217,7 +3712,7 @@ void _exit(int rc) {
      * have to do this manually */
     interpose_fini();
 
-    typeof(_exit) *orig__exit = osym("_exit");
+    typeof(_exit) *orig__exit = osym(_exit);
     (*orig__exit)(rc);
 
     /* unreachable */
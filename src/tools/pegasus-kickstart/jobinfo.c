@@ -282,28 +282,30 @@ int printYAMLJobInfo(FILE *out, int indent, const char* tag, const JobInfo* job)
 
     /* start tag with indentation */
     fprintf(out, "%*s%s:\n", indent, "", tag);
-    fprintf(out, "%*s  start: %s\n", indent, "", 
-            fmtisodate(job->start.tv_sec, job->start.tv_usec));
+    yamlstr(out, indent+2, "start", fmtisodate(job->start.tv_sec, job->start.tv_usec));
 
     /* ensure duration is always non-zero and greater than stime+utime */
     double duration = doubletime(job->finish) - doubletime(job->start);
     if (duration < 0.003) 
         duration = 0.003;
-    fprintf(out, "%*s  duration: %.3f\n", indent, "", duration);
+    yamlfixed(out, indent+2, "duration", duration, 3);
 
     /* optional attribute: application process id */
     if (job->child != 0) {
-        fprintf(out, "%*s  pid: %d\n", indent, "", job->child);
+        yamlint(out, indent+2, "pid", job->child);
     }
 
     /* <usage> */
     printYAMLUseInfo(out, indent+2, "usage", &job->use);
 
+    /* usage of all the processes of the job, from its cgroup */
+    printYAMLCgroupUsage(out, indent+2, "cgroup", &job->cgroup);
+
     int status = (int) job->status;
 
     /* <status>: open tag */
-    fprintf(out, "%*sstatus:\n%*sraw: %d\n",
-                 indent+2, "", indent+4, "", status);
+    fprintf(out, "%*sstatus:\n", indent+2, "");
+    yamlint(out, indent+4, "raw", status);
 
     /* <status>: cases of completion */
     if (status < 0) {
@@ -313,8 +315,7 @@ int printYAMLJobInfo(FILE *out, int indent, const char* tag, const JobInfo* job)
                      job->prefix && job->prefix[0] ? job->prefix : "",
                      strerror(job->saverr));
     } else if (WIFEXITED(status)) {
-        fprintf(out, "%*sregular_exitcode: %d\n", indent+4, "",
-                     WEXITSTATUS(status));
+        yamlint(out, indent+4, "regular_exitcode", WEXITSTATUS(status));
     } else if (WIFSIGNALED(status)) {
         /* result = 128 + WTERMSIG(status); */
         fprintf(out, "%*ssignalled_signal: %u\n", indent+4, "",
@@ -341,9 +342,10 @@ int printYAMLJobInfo(FILE *out, int indent, const char* tag, const JobInfo* job)
         /* content are the CLI args */
         int i;
         for (i=1; i<job->argc; ++i) {
-            fprintf(out, "%*s- \"", indent+4, "");
+            yamlindent(out, indent+4);
+            fputs("- \"", out);
             yamlquote(out, job->argv[i], strlen(job->argv[i]));
-            fprintf(out, "\"\n");
+            fputs("\"\n", out);
         }
     }
 
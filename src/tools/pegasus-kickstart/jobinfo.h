@@ -21,6 +21,7 @@
 #include <sys/resource.h>
 #include "statinfo.h"
 #include "procinfo.h"
+#include "cgroup.h"
 
 typedef struct {
   int            isValid;     /* 0: uninitialized, 1:valid, 2:app not found */
@@ -40,6 +41,7 @@ typedef struct {
   struct rusage  use;         /* rusage record from reaping application status */
 
   ProcInfo *     children;    /* per-process memory, I/O and CPU usage */
+  CgroupUsage    cgroup;      /* usage of the job cgroup, with -g */
 } JobInfo;
 
 /* if set to 1, make the application executable, no matter what. */
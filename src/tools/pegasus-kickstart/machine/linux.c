@@ -27,6 +27,9 @@
 #include <fcntl.h>
 #include <dirent.h>
 #include <inttypes.h>
+#include <time.h>
+
+#include <sys/stat.h>
 
 #include <signal.h> /* signal names */
 
@@ -81,17 +84,17 @@ static void parse_status_file(const char* fn, LinuxStatus* status) {
                         break;
                 }
             } else if (line[0] == 'V') {
-                unsigned long value;
-                char scale[4];
+                unsigned long value = 0;
+                char scale[4] = "";
                 if (strncmp(line, "VmSize:", 7) == 0) {
                     char* s = line+8;
                     while (*s && isspace(*s)) ++s;
-                    sscanf(s, "%lu %4s", &value, scale);
+                    sscanf(s, "%lu %3s", &value, scale);
                     status->size += unscale(value, scale[0]);
                 } else if (strncmp(line, "VmRSS:", 6) == 0) {
                     char* s = line+7;
                     while (*s && isspace(*s)) ++s;
-                    sscanf(s, "%lu %4s", &value, scale);
+                    sscanf(s, "%lu %3s", &value, scale);
                     status->rss += unscale(value, scale[0]);
                 }
             }
@@ -298,11 +301,22 @@ static void gather_proc_uptime(struct timeval* boottime, double* idletime) {
     }
 }
 
-static void gather_proc_cpuinfo(MachineLinuxInfo* machine) {
+static void gather_proc_cpuinfo(MachineLinuxInfo* machine, int all) {
+    /* purpose: collect the CPU model and the number of CPUs
+     * paramtr: machine (IO): the vendor, model, speed and count are set
+     *          all (IN): if 0, only the first CPU is read, and the count
+     *                    is left to the caller. /proc/cpuinfo is generated
+     *                    one CPU at a time, so this is much cheaper on a
+     *                    machine with many CPUs.
+     */
     FILE* f = fopen("/proc/cpuinfo", "r");
     if (f != NULL) {
         char line[256];
         while (fgets(line, 256, f)) {
+            if (!all && line[0] == '\n' && machine->cpu_count > 0) {
+                /* end of the first CPU */
+                break;
+            }
             if (*(machine->vendor_id) == 0 &&
                     strncmp(line, "vendor_id", 9) == 0) {
                 char* s = strchr(line, ':')+1;
@@ -333,6 +347,135 @@ static void gather_proc_cpuinfo(MachineLinuxInfo* machine) {
     }
 }
 
+static void gather_proc_stat(LinuxStatus* tasks) {
+    /* purpose: collect the system-wide task counts without looking at
+     *          every process
+     * paramtr: tasks (OUT): running and blocked tasks from /proc/stat, and
+     *                       the total number of tasks from /proc/loadavg
+     */
+    char line[256];
+    FILE* f;
+
+    if ((f = fopen("/proc/stat", "r"))) {
+        /* the per-CPU and interrupt lines come first, the interrupt line
+         * may be longer than the buffer, but a continuation never starts
+         * with a letter */
+        while (fgets(line, sizeof(line), f)) {
+            if (strncmp(line, "procs_running ", 14) == 0) {
+                tasks->state[S_RUNNING] = strtoul(line+14, NULL, 10);
+            } else if (strncmp(line, "procs_blocked ", 14) == 0) {
+                tasks->state[S_WAITING] = strtoul(line+14, NULL, 10);
+            }
+        }
+        fclose(f);
+    }
+
+    if ((f = fopen("/proc/loadavg", "r"))) {
+        /* e.g. "0.89 0.87 0.76 2/74 8717" */
+        if (fscanf(f, "%*f %*f %*f %*u/%u", &tasks->total) != 1) {
+            tasks->total = 0;
+        }
+        fclose(f);
+    }
+}
+
+/* Snapshot of the CPU description, shared by the kickstarts on a node
+ * through the file in KICKSTART_MACHINE_CACHE. Only facts that do not
+ * change while the node is up are kept, the memory, load and task counts
+ * are always read again. The file is only read by the kickstart that
+ * wrote it, or one built from the same source, so it is a plain copy of
+ * the structure. */
+typedef struct {
+    uint32_t          magic;
+    uint32_t          version;
+    uint32_t          full;       /* all the CPUs were counted */
+    unsigned short    cpu_count;
+    unsigned long     megahertz;
+    char              vendor_id[16];
+    char              model_name[80];
+} MachineCache;
+
+#define MACHINE_CACHE_MAGIC 0x4b534d43
+#define MACHINE_CACHE_VERSION 2
+#define MACHINE_CACHE_TTL 60
+
+static int read_machine_cache(const char* fn, int full, MachineLinuxInfo* machine) {
+    /* purpose: use the snapshot of another kickstart, if it is recent
+     * paramtr: fn (IN): name of the cache file
+     *          full (IN): 1 if all the CPUs have to be counted
+     *          machine (OUT): updated from the snapshot
+     * returns: 1 if the snapshot was used, 0 if not
+     */
+    MachineCache cache;
+    struct stat st;
+    long ttl = MACHINE_CACHE_TTL;
+    char* s = getenv("KICKSTART_MACHINE_CACHE_TTL");
+    int fd, ok;
+
+    if (s != NULL) {
+        ttl = atol(s);
+    }
+
+    if ((fd = open(fn, O_RDONLY)) < 0) {
+        return 0;
+    }
+    ok = fstat(fd, &st) == 0 && time(NULL) - st.st_mtime < ttl &&
+         read(fd, &cache, sizeof(cache)) == sizeof(cache) &&
+         cache.magic == MACHINE_CACHE_MAGIC &&
+         cache.version == MACHINE_CACHE_VERSION &&
+         (cache.full || !full);
+    close(fd);
+    if (!ok) {
+        return 0;
+    }
+
+    machine->cpu_count = cache.cpu_count;
+    machine->megahertz = cache.megahertz;
+    memcpy(machine->vendor_id, cache.vendor_id, sizeof(cache.vendor_id));
+    memcpy(machine->model_name, cache.model_name, sizeof(cache.model_name));
+    machine->vendor_id[sizeof(machine->vendor_id)-1] = 0;
+    machine->model_name[sizeof(machine->model_name)-1] = 0;
+    return 1;
+}
+
+static void write_machine_cache(const char* fn, int full, const MachineLinuxInfo* machine) {
+    /* purpose: share a snapshot with the other kickstarts on the node.
+     *          It is written to a temporary file in the same directory
+     *          and renamed, so that a reader never sees a partial snapshot.
+     * paramtr: fn (IN): name of the cache file
+     *          full (IN): 1 if all the CPUs were counted
+     *          machine (IN): the snapshot
+     */
+    MachineCache cache;
+    char tmp[4096];
+    int fd;
+
+    memset(&cache, 0, sizeof(cache));
+    cache.magic = MACHINE_CACHE_MAGIC;
+    cache.version = MACHINE_CACHE_VERSION;
+    cache.full = full;
+    cache.cpu_count = machine->cpu_count;
+    cache.megahertz = machine->megahertz;
+    memcpy(cache.vendor_id, machine->vendor_id, sizeof(cache.vendor_id));
+    memcpy(cache.model_name, machine->model_name, sizeof(cache.model_name));
+
+    /* The cache may be in a shared directory, so the temporary file gets
+     * an unpredictable name and is never opened if it already exists */
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", fn) >= sizeof(tmp)) {
+        return;
+    }
+    if ((fd = mkstemp(tmp)) < 0) {
+        printerr("Unable to write machine cache %s: %s\n", tmp, strerror(errno));
+        return;
+    }
+    /* mkstemp creates it readable by the owner only */
+    int ok = fchmod(fd, 0644) == 0 && write(fd, &cache, sizeof(cache)) == sizeof(cache);
+    if (close(fd) != 0 || !ok || rename(tmp, fn) != 0) {
+        printerr("Unable to write machine cache %s: %s\n", fn, strerror(errno));
+        unlink(tmp);
+    }
+}
+
 static unsigned long extract_version(const char* release) {
     /* purpose: extract a.b.c version from release string, ignoring extra junk
      * paramtr: release (IN): pointer to kernel release string (with junk)
@@ -351,6 +494,9 @@ void* initMachine(void) {
      * returns: initialized MachineLinuxInfo structure.
      */
     unsigned long version;
+    char* mode;
+    char* cache;
+    int full;
     MachineLinuxInfo* p = (MachineLinuxInfo*) calloc(1, sizeof(MachineLinuxInfo));
     if (p == NULL) {
         printerr("calloc: %s\n", strerror(errno));
@@ -365,15 +511,43 @@ void* initMachine(void) {
                    &p->ram_shared, &p->ram_buffer,
                    &p->swap_total, &p->swap_free);
     gather_loadavg(p->load);
-    gather_proc_cpuinfo(p);
     gather_proc_uptime(&p->boottime, &p->idletime);
 
+    /* The full mode looks at every process and thread on the node, which
+     * takes a long time on a busy node. The fast mode only reports the
+     * system-wide task counts. */
+    mode = getenv("KICKSTART_MACHINE_INFO");
+    full = mode == NULL || strcmp(mode, "fast") != 0;
+    cache = getenv("KICKSTART_MACHINE_CACHE");
+    if (cache != NULL && *cache == 0) {
+        cache = NULL;
+    }
+
+    if (!full) {
+        gather_proc_stat(&p->tasks);
+    }
+    if (cache == NULL || !read_machine_cache(cache, full, p)) {
+        if (full) {
+            gather_proc_cpuinfo(p, 1);
+        } else {
+            gather_proc_cpuinfo(p, 0);
+#ifdef _SC_NPROCESSORS_ONLN
+            p->cpu_count = p->basic->cpu_online;
+#endif /* _SC_NPROCESSORS_ONLN */
+        }
+        if (cache != NULL) {
+            write_machine_cache(cache, full, p);
+        }
+    }
+
     version = extract_version(p->basic->uname.release);
     /* This used to have an upper limit of 3.2 from PM-571, but it was 
      * removed because the Linux kernel is changing version numbers too
      * fast to keep updating it.
      */
-    if (version >= 2006000) {
+    if (!full) {
+        /* the task counts are already set */
+    } else if (version >= 2006000) {
         gather_linux_proc26(&p->procs, &p->tasks);
     } else if (version >= 2004000 && version <= 2004999) {
         gather_linux_proc24(&p->procs, &p->tasks);
@@ -425,7 +599,7 @@ int printLinuxInfo(FILE *out, int indent, const MachineLinuxInfo *ptr) {
             indent, "", ptr->load[1],
             indent, "", ptr->load[2]);
 
-    if (ptr->procs.total && ptr->tasks.total) {
+    if (ptr->procs.total) {
         /* <procs> element */
         fprintf(out, "%*sprocs_total: %u\n", indent, "", ptr->procs.total);
         for (LinuxState s=S_RUNNING; s<=S_OTHER; ++s) {
@@ -437,7 +611,9 @@ int printLinuxInfo(FILE *out, int indent, const MachineLinuxInfo *ptr) {
         fprintf(out, "%*sprocs_vmsize: %"PRIu64"\n%*sprocs_rss: %"PRIu64"\n",
                 indent, "", ptr->procs.size / 1024,
                 indent, "", ptr->procs.rss / 1024);
+    }
 
+    if (ptr->tasks.total) {
         /* <task> element */
         fprintf(out, "%*stask_total: %u\n", indent, "", ptr->tasks.total);
         for (LinuxState s=S_RUNNING; s<=S_OTHER; ++s) {
@@ -19,6 +19,7 @@
 #include <signal.h>
 #include <unistd.h>
 #include <string.h>
+#include <limits.h>
 #include <stdlib.h>
 #include <fcntl.h>
 #include <stdio.h>
@@ -31,6 +32,9 @@
 #include "mysystem.h"
 #include "procinfo.h"
 #include "error.h"
+#include "tracereader.h"
+#include "cgroup.h"
+#include "getif.h"
 
 /* Find the path to the interposition library */
 static int findInterposeLibrary(char *path, int pathsize) {
@@ -77,341 +81,22 @@ static int findInterposeLibrary(char *path, int pathsize) {
     return -1;
 }
 
-static FileInfo *readTraceFileRecord(const char *buf, FileInfo *files) {
-    char filename[BUFSIZ];
-    size_t size = 0;
-    size_t bread = 0;
-    size_t bwrite = 0;
-    size_t nread = 0;
-    size_t nwrite = 0;
-    size_t bseek = 0;
-    size_t nseek = 0;
-
-    if (sscanf(buf, "file: '%[^']' %lu %lu %lu %lu %lu %lu %lu\n",
-               filename, &size, &bread, &bwrite, &nread, &nwrite, &bseek, &nseek) != 8) {
-        printerr("Invalid file record: %s", buf);
-        return files;
-    }
-
-    /* Look for a duplicate file in the list of files */
-    FileInfo *file = NULL;
-    FileInfo *last = NULL;
-    for (file = files; file != NULL; file = file->next) {
-        if (strcmp(filename, file->filename) == 0) {
-            /* Found a duplicate */
-            break;
-        }
-
-        /* Keep track of the last file in the list */
-        last = file;
-    }
-
-    if (file == NULL) {
-        /* No duplicate found */
-        file = (FileInfo *)calloc(sizeof(FileInfo), 1);
-        if (file == NULL) {
-            printerr("calloc: %s\n", strerror(errno));
-            return files;
-        }
-        char *temp = strdup(filename);
-        if (temp == NULL) {
-            free(file);
-            printerr("strdup: %s\n", strerror(errno));
-            return files;
-        }
-        file->filename = temp;
-        file->size = size;
-        file->bread = bread;
-        file->bwrite = bwrite;
-        file->nread = nread;
-        file->nwrite = nwrite;
-        file->bseek = bseek;
-        file->nseek = nseek;
-
-        if (files == NULL) {
-            /* List was empty */
-            files = file;
-        } else {
-            /* Add to end of list */
-            last->next = file;
-        }
-    } else {
-        /* Duplicate found, increment counters */
-        file->size = file->size > size ? file->size : size; /* max */
-        file->bread += bread;
-        file->bwrite += bwrite;
-        file->nread += nread;
-        file->nwrite += nwrite;
-        file->bseek += bseek;
-        file->nseek += nseek;
-    }
-
-    return files;
-}
-
-static SockInfo *readTraceSocketRecord(const char *buf, SockInfo *sockets) {
-    char address[BUFSIZ];
-    int port = 0;
-    size_t brecv = 0;
-    size_t bsend = 0;
-    size_t nrecv = 0;
-    size_t nsend = 0;
-    if (sscanf(buf, "socket: %s %d %lu %lu %lu %lu\n", address, &port, &brecv, &bsend, &nrecv, &nsend) != 6) {
-        printerr("Invalid socket record: %s", buf);
-        return sockets;
-    }
-
-    /* Look for a duplicate socket in list of sockets */
-    SockInfo *sock = NULL;
-    SockInfo *last = NULL;
-    for (sock = sockets; sock != NULL; sock = sock->next) {
-        if (port == sock->port && strcmp(address, sock->address) == 0) {
-            /* Found a duplicate */
-            break;
-        }
-
-        /* Keep track of the last socket in the list */
-        last = sock;
-    }
-
-    if (sock == NULL) {
-        /* No duplicate found */
-        sock = (SockInfo *)calloc(sizeof(SockInfo), 1);
-        if (sock == NULL) {
-            printerr("calloc: %s\n", strerror(errno));
-            return sockets;
-        }
-        char *temp = strdup(address);
-        if (temp == NULL) {
-            free(sock);
-            printerr("strdup: %s\n", strerror(errno));
-            return sockets;
-        }
-        sock->address = temp;
-        sock->port = port;
-        sock->brecv = brecv;
-        sock->bsend = bsend;
-        sock->nrecv = nrecv;
-        sock->nsend = nsend;
-
-        if (sockets == NULL) {
-            /* List was empty */
-            sockets = sock;
-        } else {
-            /* Add to end of list */
-            last->next = sock;
-        }
-    } else {
-        /* Duplicate found, increment counters */
-        sock->brecv += brecv;
-        sock->bsend += bsend;
-        sock->nrecv += nrecv;
-        sock->nsend += nsend;
-    }
-
-    return sockets;
-}
-
-/* Return 1 if line begins with tok */
-static int startswith(const char *line, const char *tok) {
-    return strstr(line, tok) == line;
-}
-
-static ProcInfo *processTraceFile(const char *fullpath) {
-    FILE *trace = fopen(fullpath, "r");
-    if (trace == NULL) {
-        printerr("Unable to open trace file '%s': %s\n",
-                fullpath, strerror(errno));
-        return NULL;
-    }
-
-    ProcInfo *procs = NULL;
-    ProcInfo *proc = NULL;
-    ProcInfo *lastproc = NULL;
-
-    int fork = 0;
-
-    /* Read data from the trace file */
-    int lines = 0;
-    char line[BUFSIZ];
-    long long llval;
-    while (fgets(line, BUFSIZ, trace) != NULL) {
-        lines++;
-
-        if (proc == NULL) {
-            proc = (ProcInfo *)calloc(sizeof(ProcInfo), 1);
-            if (proc == NULL) {
-                printerr("calloc: %s\n", strerror(errno));
-                goto exit;
-            }
-            fork = 0;
-        }
-
-        if (proc != lastproc) {
-            if (procs == NULL) {
-                procs = proc;
-            }
-            if (lastproc != NULL) {
-                lastproc->next = proc;
-            }
-            proc->prev = lastproc;
-            lastproc = proc;
-        }
-
-        if (startswith(line, "file:")) {
-            proc->files = readTraceFileRecord(line, proc->files);
-        } else if (startswith(line, "socket:")) {
-            proc->sockets = readTraceSocketRecord(line, proc->sockets);
-        } else if (startswith(line, "exe:")) {
-            char exe[BUFSIZ];
-            sscanf(line, "exe: %s\n", exe);
-            proc->exe = strdup(exe);
-            if (proc->exe == NULL) {
-                printerr("strdup: %s\n", strerror(errno));
-                break;
-            }
-        } else if (startswith(line, "Pid")) {
-            sscanf(line, "Pid:%d\n", &(proc->pid));
-        } else if (startswith(line, "PPid")) {
-            sscanf(line,"PPid:%d\n", &(proc->ppid));
-        } else if (startswith(line,"VmPeak")) {
-            sscanf(line,"VmPeak:%d kB\n", &(proc->vmpeak));
-        } else if (startswith(line,"VmHWM")) {
-            sscanf(line,"VmHWM:%d kB\n", &(proc->rsspeak));
-        } else if (startswith(line, "threads")) {
-            sscanf(line,"threads: %d %d %d\n", &(proc->fin_threads),
-                    &(proc->max_threads), &(proc->tot_threads));
-        } else if (startswith(line, "utime:")) {
-            sscanf(line,"utime:%lf\n", &(proc->utime));
-        } else if (startswith(line, "stime:")) {
-            sscanf(line,"stime:%lf\n", &(proc->stime));
-        } else if (startswith(line, "iowait:")) {
-            sscanf(line,"iowait:%lf\n", &(proc->iowait));
-        } else if (startswith(line, "rchar")) {
-            sscanf(line,"rchar: %"SCNu64"\n", &(proc->rchar));
-        } else if (startswith(line, "wchar")) {
-            sscanf(line,"wchar: %"SCNu64"\n", &(proc->wchar));
-        } else if (startswith(line,"syscr")) {
-            sscanf(line,"syscr: %"SCNu64"\n", &(proc->syscr));
-        } else if (startswith(line,"syscw")) {
-            sscanf(line,"syscw: %"SCNu64"\n", &(proc->syscw));
-        } else if (startswith(line,"read_bytes")) {
-            sscanf(line,"read_bytes: %"SCNu64"\n",&(proc->read_bytes));
-        } else if (startswith(line,"write_bytes")) {
-            sscanf(line,"write_bytes: %"SCNu64"\n",&(proc->write_bytes));
-        } else if (startswith(line,"cancelled_write_bytes")) {
-            sscanf(line,"cancelled_write_bytes: %"SCNu64"\n",&(proc->cancelled_write_bytes));
-        } else if (startswith(line, "start:")) {
-            /* Only set the start time if it is not already set.
-             * This handles cases where fork() is called. */
-            if (proc->start == 0) {
-                sscanf(line, "start:%lf\n", &(proc->start));
-            }
-        } else if (startswith(line, "stop:")) {
-            sscanf(line,"stop:%lf\n", &(proc->stop));
-            if (fork == 0) {
-                /* Reset the pointer so that it creates a new object */
-                proc = NULL;
-            } else {
-                /* We skipped one exec, reset fork so we don't skip another */
-                fork = 0;
-            }
-        } else if (startswith(line, "PAPI_TOT_INS:")) {
-            sscanf(line,"PAPI_TOT_INS:%lld\n", &llval);
-            proc->PAPI_TOT_INS += llval;
-        } else if (startswith(line, "PAPI_LD_INS:")) {
-            sscanf(line,"PAPI_LD_INS:%lld\n", &llval);
-            proc->PAPI_LD_INS += llval;
-        } else if (startswith(line, "PAPI_SR_INS:")) {
-            sscanf(line,"PAPI_SR_INS:%lld\n", &llval);
-            proc->PAPI_SR_INS += llval;
-        } else if (startswith(line, "PAPI_FP_INS:")) {
-            sscanf(line,"PAPI_FP_INS:%lld\n", &llval);
-            proc->PAPI_FP_INS += llval;
-        } else if (startswith(line, "PAPI_FP_OPS:")) {
-            sscanf(line,"PAPI_FP_OPS:%lld\n", &llval);
-            proc->PAPI_FP_OPS += llval;
-        } else if (startswith(line, "PAPI_L3_TCM:")) {
-            sscanf(line,"PAPI_L3_TCM:%lld\n", &llval);
-            proc->PAPI_L3_TCM += llval;
-        } else if (startswith(line, "PAPI_L2_TCM:")) {
-            sscanf(line,"PAPI_L2_TCM:%lld\n", &llval);
-            proc->PAPI_L2_TCM += llval;
-        } else if (startswith(line, "PAPI_L1_TCM:")) {
-            sscanf(line,"PAPI_L1_TCM:%lld\n", &llval);
-            proc->PAPI_L1_TCM += llval;
-        } else if (startswith(line, "cmd:")) {
-            proc->cmd = strdup(line+4);
-            proc->cmd[strlen(proc->cmd)-1] = '\0';
-        } else if (startswith(line, "fork")) {
-            fork = 1;
-        } else {
-            printerr("Unrecognized libinterpose record: %s", line);
-        }
-    }
-
-exit:
-    fclose(trace);
-
-    /* Remove the file */
-    unlink(fullpath);
-
-    /* Empty file? */
-    if (lines == 0) {
-        printerr("Empty trace file: %s\n", fullpath);
-        return NULL;
-    }
-
-    return procs;
-}
-
-/* Go through all the files in tempdir and read all of the traces that begin with trace_file_prefix */
-static ProcInfo *processTraceFiles(const char *tempdir, const char *trace_file_prefix) {
-    DIR *tmp = opendir(tempdir);
-    if (tmp == NULL) {
-        printerr("Unable to open trace file directory: %s", tempdir);
-        return NULL;
-    }
-
-    ProcInfo *procs = NULL;
-    ProcInfo *lastproc = NULL;
-
-    struct dirent *d;
-    for (d = readdir(tmp); d!=NULL; d = readdir(tmp)) {
-        /* If the file name starts with the prefix */
-        if (strstr(d->d_name, trace_file_prefix) == d->d_name) {
-            char fullpath[BUFSIZ];
-            snprintf(fullpath, BUFSIZ, "%s/%s", tempdir, d->d_name);
-            ProcInfo *p = processTraceFile(fullpath);
-            if (p == NULL) {
-                continue;
-            }
-            p->prev = lastproc;
-            if (procs == NULL) {
-                procs = p;
-            } else {
-                lastproc->next = p;
-            }
-            lastproc = p;
-            /* If processTraceFile retuns a list of several procs */
-            while (lastproc->next != NULL) {
-                lastproc = lastproc->next;
-            }
-        }
-    }
-
-    closedir(tmp);
-
-    return procs;
-}
-
 /* Try to get a new environment for the child process that has the tracing vars */
-static void set_tracing_environment(const char *tempdir, const char *trace_file_prefix) {
+static void set_tracing_environment(const char *tracedir, TraceChannel *channel) {
     /* If KICKSTART_PREFIX or LD_PRELOAD are already set then we can't trace */
     if (getenv("KICKSTART_PREFIX") != NULL || getenv("LD_PRELOAD") != NULL) {
         return;
     }
 
+    /* Set KICKSTART_PREFIX to be tracedir/trace. A truncated prefix
+     * would make libinterpose write its trace files somewhere else. */
+    char kickstart_prefix[PATH_MAX + sizeof("/trace")];
+    int len = snprintf(kickstart_prefix, sizeof(kickstart_prefix), "%s/trace", tracedir);
+    if (len < 0 || (size_t)len >= sizeof(kickstart_prefix)) {
+        printerr("Trace directory name too long: %s\n", tracedir);
+        return;
+    }
+
     /* Set LD_PRELOAD to the interpose library */
     /* If the interpose library can't be found, then we can't trace */
     char ld_preload[BUFSIZ];
@@ -420,11 +105,14 @@ static void set_tracing_environment(const char *tempdir, const char *trace_file_
         return;
     }
     setenv("LD_PRELOAD", ld_preload, 1);
-
-    /* Set KICKSTART_PREFIX to be tempdir/prefix */
-    char kickstart_prefix[BUFSIZ];
-    snprintf(kickstart_prefix, BUFSIZ, "%s/%s", tempdir, trace_file_prefix);
     setenv("KICKSTART_PREFIX", kickstart_prefix, 1);
+
+    /* Tell libinterpose about the shared-memory ring */
+    if (channel->ring != NULL) {
+        char fd[32];
+        snprintf(fd, sizeof(fd), "%d", channel->fd);
+        setenv("KICKSTART_TRACE_FD", fd, 1);
+    }
 }
 
 /* Defined in pegasus-kickstart.c */
@@ -483,30 +171,88 @@ int mysystem(AppInfo* appinfo, JobInfo* jobinfo) {
         return -1;
     }
 
-    /* Prefix for trace files generated by this job */
-    char trace_file_prefix[128];
-    snprintf(trace_file_prefix, 128, "ks.trace.%d", getpid());
+    /* Private directory where trace files are stored for this job, so
+     * that we only have to look at our own files when the job is done */
+    char tracedir[BUFSIZ];
+    int libtrace = 0;
+    TraceChannel channel;
+    TraceDecoder decoder;
+    memset(&channel, 0, sizeof(channel));
+    channel.fd = -1;
+    if (appinfo->enableLibTrace) {
+        const char *tempdir = getTempDir();
+        if (tempdir == NULL) {
+            tempdir = "/tmp";
+        }
+        snprintf(tracedir, BUFSIZ, "%s/ks.trace.%d.XXXXXX", tempdir, getpid());
+        if (mkdtemp(tracedir) == NULL) {
+            printerr("Unable to create trace file directory %s: %s\n",
+                    tracedir, strerror(errno));
+        } else {
+            libtrace = 1;
+            initTraceDecoder(&decoder);
+
+            /* Use a shared-memory ring instead of files if requested.
+             * The value is the size of the ring in MB. */
+            char *ringsize = getenv("KICKSTART_TRACE_RING");
+            if (ringsize != NULL && atoi(ringsize) > 0) {
+                initTraceChannel(&channel, (size_t)atoi(ringsize) << 20, tracedir);
+            }
+        }
+    }
 
-    /* Temp dir where trace files are stored for this job */
-    const char *tempdir = getTempDir();
-    if (tempdir == NULL) {
-        tempdir = "/tmp";
+    /* Only stop the job on the system calls we trace, if possible */
+    int sysfilter = appinfo->enableSysTrace && procSyscallFilter();
+
+    /* Estimate the file I/O by sampling, if requested */
+    double sample = appinfo->enableSysTrace ? 0 : procSampleInterval();
+
+    /* Account the resource usage of the whole job with a cgroup, if
+     * requested. The parent moves the child into the cgroup before the
+     * child starts the job, and tells it over a pipe whether that
+     * worked. If it did not, then the job is traced with ptrace. */
+    int tracing = appinfo->enableTracing;
+    Cgroup cg;
+    int cgroup = 0;
+    int cgsync[2];
+    if (appinfo->enableCgroup) {
+        if (createCgroup(&cg) < 0) {
+            printerr("Unable to create a cgroup for the job, tracing it instead: %s\n",
+                     strerror(errno));
+            tracing = 1;
+        } else if (pipe(cgsync) < 0) {
+            printerr("pipe: %s\n", strerror(errno));
+            deleteCgroup(&cg);
+            tracing = 1;
+        } else {
+            cgroup = 1;
+        }
     }
 
+    /* A job after the main job should not start from a process that
+     * still has the host lookup thread */
+    waitHostLookup();
+
     /* start wall-clock */
     now(&(jobinfo->start));
 
     if ((jobinfo->child=fork()) < 0) {
         /* no more process table space */
         jobinfo->status = -1;
+        if (cgroup) {
+            close(cgsync[0]);
+            close(cgsync[1]);
+            deleteCgroup(&cg);
+            cgroup = 0;
+        }
     } else if (jobinfo->child == 0) {
         /* child */
         appinfo->isPrinted=1;
 
         /* If we are using library tracing, try to set the necessary
            environment variables */
-        if (appinfo->enableLibTrace) {
-            set_tracing_environment(tempdir, trace_file_prefix);
+        if (libtrace) {
+            set_tracing_environment(tracedir, &channel);
         }
 
         /* connect jobs stdio */
@@ -519,9 +265,20 @@ int mysystem(AppInfo* appinfo, JobInfo* jobinfo) {
         sigaction(SIGTERM, &saveterm, NULL);
         sigaction(SIGQUIT, &savequit, NULL);
 
+        /* Wait until the parent has moved us into the cgroup */
+        if (cgroup) {
+            char joined = 0;
+            close(cgsync[1]);
+            while (read(cgsync[0], &joined, 1) < 0 && errno == EINTR);
+            close(cgsync[0]);
+            if (joined != '1') {
+                tracing = 1;
+            }
+        }
+
         /* If we are tracing, then hand over control to the proc module */
-        if (appinfo->enableTracing) {
-            if (procChild()) _exit(126);
+        if (tracing) {
+            if (procChild(sysfilter)) _exit(126);
         }
 
         execv(jobinfo->argv[0], (char* const*) jobinfo->argv);
@@ -531,10 +288,43 @@ int mysystem(AppInfo* appinfo, JobInfo* jobinfo) {
         /* Track the current child process */
         appinfo->currentChild = jobinfo->child;
 
+        /* Read the trace ring while the job is running. The thread is
+         * started after fork so that the child does not inherit a
+         * process with several threads. */
+        if (channel.ring != NULL) {
+            startTraceConsumer(&channel, &decoder);
+        }
+
+        /* Find out the host name while the main job runs, DNS might be
+         * slow. This is also started after fork. */
+        if (jobinfo == &appinfo->application) {
+            startHostLookup();
+        }
+
+        /* Move the child into the cgroup and let it start the job */
+        if (cgroup) {
+            char joined = '1';
+            close(cgsync[0]);
+            if (joinCgroup(&cg, jobinfo->child) < 0) {
+                printerr("Unable to move the job into cgroup %s, tracing it instead: %s\n",
+                         cg.path, strerror(errno));
+                joined = '0';
+                tracing = 1;
+            }
+            if (write(cgsync[1], &joined, 1) < 0) {
+                printerr("write: %s\n", strerror(errno));
+            }
+            close(cgsync[1]);
+            if (joined != '1') {
+                deleteCgroup(&cg);
+                cgroup = 0;
+            }
+        }
+
         /* parent */
-        if (appinfo->enableTracing) {
+        if (tracing) {
             /* TODO If this returns an error, then we need to untrace all the children and try the wait instead */
-            procParentTrace(jobinfo->child, &jobinfo->status, &jobinfo->use, &(jobinfo->children), appinfo->enableSysTrace);
+            procParentTrace(jobinfo->child, &jobinfo->status, &jobinfo->use, &(jobinfo->children), appinfo->enableSysTrace, sysfilter, sample);
         } else {
             procParentWait(jobinfo->child, &jobinfo->status, &jobinfo->use, &(jobinfo->children));
         }
@@ -552,6 +342,12 @@ int mysystem(AppInfo* appinfo, JobInfo* jobinfo) {
     /* save any errors before anybody overwrites this */
     jobinfo->saverr = errno;
 
+    /* All the processes of the job have been accounted in its cgroup */
+    if (cgroup) {
+        readCgroup(&cg, &jobinfo->cgroup);
+        deleteCgroup(&cg);
+    }
+
     /* stop wall-clock */
     now(&(jobinfo->finish));
 
@@ -561,10 +357,20 @@ int mysystem(AppInfo* appinfo, JobInfo* jobinfo) {
     sigaction(SIGQUIT, &savequit, NULL);
 
     /* Look for trace files from libinterpose and add trace data to jobinfo */
-    if (appinfo->enableLibTrace) {
-        jobinfo->children = processTraceFiles(tempdir, trace_file_prefix);
+    if (libtrace) {
+        if (channel.ring != NULL) {
+            stopTraceConsumer(&channel);
+            deleteTraceChannel(&channel);
+        }
+        processTraceFiles(&decoder, tracedir);
+        jobinfo->children = finishTraceDecoder(&decoder);
     }
 
+    /* Move captured output that has grown too large for memory to disk
+     * before the next job adds to it */
+    spillStatInfo(&appinfo->output);
+    spillStatInfo(&appinfo->error);
+
     /* finalize */
     return jobinfo->status;
 }
@@ -104,9 +104,10 @@ static int prepareSideJob(JobInfo* scripting, const char* envval) {
 }
 
 /* Initialize the statlist and statlist size in appinfo. */
-StatInfo* initStatFromList(mylist_p list, size_t* size) {
+StatInfo* initStatFromList(mylist_p list, size_t* size, int resolve) {
     /* paramtr: list (IN): list of filenames
      *          size (OUT): statlist size to be set
+     *          resolve (IN): whether to resolve the real paths now
      * returns: a vector of initialized statinfo records, or NULL
      */
 
@@ -120,14 +121,25 @@ StatInfo* initStatFromList(mylist_p list, size_t* size) {
         return NULL;
     }
 
+    const char** names = (const char**) calloc(sizeof(char*), list->count);
+    if (names == NULL) {
+        printerr("calloc: %s\n", strerror(errno));
+        free(result);
+        return NULL;
+    }
+
     size_t i = 0;
     mylist_item_p item = list->head;
 
-    while (item && i < list->count) {
-        initStatInfoFromName(result+i, item->pfn, O_RDONLY, 0);
+    for (i = 0; item && i < list->count; ++i, item = item->next) {
+        names[i] = item->pfn;
+    }
+    /* the files are stat'ed concurrently, there may be thousands */
+    initStatInfoList(result, names, i, resolve);
+    free(names);
+
+    for (i = 0, item = list->head; item && i < list->count; ++i, item = item->next) {
         if (item->lfn != NULL) addLFNToStatInfo(result+i, item->lfn);
-        item = item->next;
-        ++i;
     }
 
     *size = list->count;
@@ -220,6 +232,7 @@ static void helpMe(const AppInfo* run) {
 #endif
 #ifdef LINUX
             " -Z\tEnable library call interposition to get files and I/O\n"
+            " -g\tAccount resource usage of the whole job with a cgroup, or with -t\n"
 #endif
             /* NOTE: If you add another flag to kickstart, please update
              * the argument skipping logic in
@@ -594,6 +607,9 @@ int main(int argc, char* argv[]) {
                 appinfo.enableTracing++;
                 appinfo.enableSysTrace++;
                 break;
+            case 'g':
+                appinfo.enableCgroup++;
+                break;
             case 'Z':
                 appinfo.enableLibTrace++;
                 break;
@@ -728,7 +744,7 @@ REDIR:
     updateStatInfo(&appinfo.logfile);
 
     /* stat pre files */
-    appinfo.initial = initStatFromList(&initial, &appinfo.icount);
+    appinfo.initial = initStatFromList(&initial, &appinfo.icount, 0);
     mylist_done(&initial);
 
     /* If there is a timeout, then set the alarm and a handler to kill the job */
@@ -745,6 +761,8 @@ REDIR:
         alarm(appinfo.termTimeout);
     }
 
+    appinfo.phase[PHASE_STARTUP] = monotime() - appinfo.monoStart;
+
     /* Our own initially: an independent setup job */
     char *SETUP = getenv("KICKSTART_SETUP");
     if (SETUP == NULL) { SETUP = getenv("GRIDSTART_SETUP"); }
@@ -793,8 +811,10 @@ REDIR:
     }
 
     /* stat post files */
-    appinfo.final = initStatFromList(&final, &appinfo.fcount);
+    double t = monotime();
+    appinfo.final = initStatFromList(&final, &appinfo.fcount, 1);
     mylist_done(&final);
+    appinfo.phase[PHASE_FINAL] = monotime() - t;
 
     /* If the timeout occurred, then set the result to SIGALRM */
     if (alarmed) {
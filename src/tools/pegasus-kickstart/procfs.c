@@ -0,0 +1,256 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+
+#include "procfs.h"
+
+/* The system calls are made directly, the libc functions are interposed
+ * in libinterpose */
+static int sys_openat(int dirfd, const char *path, int flags) {
+    return (int) syscall(SYS_openat, dirfd, path, flags);
+}
+
+static void sys_close(int fd) {
+    int saved = errno;
+    syscall(SYS_close, fd);
+    errno = saved;
+}
+
+int procOpen(pid_t pid) {
+    /* purpose: open the /proc directory of a process
+     * paramtr: pid (IN): process id, or 0 for the calling process
+     * returns: a descriptor for the other proc functions, -1 on error
+     */
+    char path[32] = "/proc/self";
+    if (pid > 0) {
+        char digits[16];
+        char *d = digits + sizeof(digits);
+        unsigned int n = (unsigned int) pid;
+        *--d = '\0';
+        do {
+            *--d = '0' + n % 10;
+            n /= 10;
+        } while (n > 0);
+        strcpy(path + 6, d);
+    }
+    return sys_openat(AT_FDCWD, path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+}
+
+void procClose(int dirfd) {
+    if (dirfd >= 0) {
+        sys_close(dirfd);
+    }
+}
+
+/* Read a whole proc file into buf and terminate it. The files are
+ * generated when they are read, so one read usually returns all of it.
+ * Returns the length, or -1 with errno set */
+static ssize_t read_file(int dirfd, const char *name, char *buf, size_t size) {
+    size_t len = 0;
+    int fd = sys_openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    while (len < size - 1) {
+        ssize_t n = syscall(SYS_read, fd, buf + len, size - 1 - len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            sys_close(fd);
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        len += n;
+    }
+    sys_close(fd);
+    buf[len] = '\0';
+    return len;
+}
+
+/* Parse the decimal number at *p after any blanks, and move *p past it */
+static uint64_t scan_uint(const char **p) {
+    const char *s = *p;
+    uint64_t value = 0;
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+    while (*s >= '0' && *s <= '9') {
+        value = value * 10 + (*s - '0');
+        s++;
+    }
+    *p = s;
+    return value;
+}
+
+/* A "name: value" line of a proc file and where to store the value */
+typedef struct {
+    const char *name;
+    size_t len;
+    size_t offset;
+} ProcKey;
+
+#define PROC_KEY(name, type, field) { name ":", sizeof(name), offsetof(type, field) }
+
+/* Store the values of the keys found in the lines of buf into the struct
+ * at out. The values are ints if wide is 0, uint64_t otherwise. */
+static void scan_keys(const char *buf, const ProcKey *keys, size_t nkeys,
+                      void *out, int wide) {
+    const char *p = buf;
+    size_t found = 0;
+    while (*p != '\0' && found < nkeys) {
+        for (size_t i = 0; i < nkeys; i++) {
+            if (p[0] == keys[i].name[0] &&
+                    strncmp(p, keys[i].name, keys[i].len) == 0) {
+                const char *v = p + keys[i].len;
+                uint64_t value = scan_uint(&v);
+                if (wide) {
+                    *(uint64_t *)((char *) out + keys[i].offset) = value;
+                } else {
+                    *(int *)((char *) out + keys[i].offset) = (int) value;
+                }
+                found++;
+                break;
+            }
+        }
+        p = strchr(p, '\n');
+        if (p == NULL) {
+            break;
+        }
+        p++;
+    }
+}
+
+ssize_t procReadExe(int dirfd, char *buf, size_t size) {
+    /* purpose: read the path of the executable of a process
+     * paramtr: dirfd (IN): descriptor from procOpen
+     *          buf (OUT): the path, terminated
+     *          size (IN): size of buf
+     * returns: the length of the path, or -1 on error
+     */
+    ssize_t n = syscall(SYS_readlinkat, dirfd, "exe", buf, size - 1);
+    if (n < 0) {
+        return -1;
+    }
+    if ((size_t) n == size - 1) {
+        /* The path may have been truncated */
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    buf[n] = '\0';
+    return n;
+}
+
+static const ProcKey status_keys[] = {
+    PROC_KEY("PPid", ProcStatus, ppid),
+    PROC_KEY("Threads", ProcStatus, threads),
+    PROC_KEY("VmPeak", ProcStatus, vmpeak),
+    PROC_KEY("VmHWM", ProcStatus, rsspeak),
+};
+
+int procReadStatus(int dirfd, ProcStatus *status) {
+    /* purpose: read the memory usage and threads of a process
+     * paramtr: dirfd (IN): descriptor from procOpen
+     *          status (OUT): fields of /proc/<pid>/status
+     * returns: 1 if read, 0 if the file is missing, -1 on error
+     */
+    char buf[PROCFS_BUFSIZE];
+    memset(status, 0, sizeof(ProcStatus));
+    if (read_file(dirfd, "status", buf, sizeof(buf)) < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    scan_keys(buf, status_keys, sizeof(status_keys) / sizeof(ProcKey), status, 0);
+    return 1;
+}
+
+int procReadStat(int dirfd, ProcStat *stat) {
+    /* purpose: read the CPU usage of a process
+     * paramtr: dirfd (IN): descriptor from procOpen
+     *          stat (OUT): fields of /proc/<pid>/stat
+     * returns: 1 if read, 0 if the file is missing, -1 on error
+     */
+    char buf[PROCFS_BUFSIZE];
+    memset(stat, 0, sizeof(ProcStat));
+    if (read_file(dirfd, "stat", buf, sizeof(buf)) < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+
+    /* The command (field 2) is in parentheses and may contain spaces
+     * and parentheses, so the fields are counted from the last ')' */
+    const char *p = strrchr(buf, ')');
+    if (p == NULL) {
+        errno = EINVAL;
+        return -1;
+    }
+    p++;
+    for (int field = 3; field <= 42 && *p != '\0'; field++) {
+        while (*p == ' ') {
+            p++;
+        }
+        switch (field) {
+        case 14:
+            stat->utime = scan_uint(&p);
+            break;
+        case 15:
+            stat->stime = scan_uint(&p);
+            break;
+        case 24:
+            stat->rss = scan_uint(&p);
+            break;
+        case 42:
+            stat->iowait = scan_uint(&p);
+            break;
+        default:
+            while (*p != ' ' && *p != '\0') {
+                p++;
+            }
+        }
+    }
+    return 1;
+}
+
+static const ProcKey io_keys[] = {
+    PROC_KEY("rchar", ProcIO, rchar),
+    PROC_KEY("wchar", ProcIO, wchar),
+    PROC_KEY("syscr", ProcIO, syscr),
+    PROC_KEY("syscw", ProcIO, syscw),
+    PROC_KEY("read_bytes", ProcIO, read_bytes),
+    PROC_KEY("write_bytes", ProcIO, write_bytes),
+    PROC_KEY("cancelled_write_bytes", ProcIO, cancelled_write_bytes),
+};
+
+int procReadIO(int dirfd, ProcIO *io) {
+    /* purpose: read the I/O counters of a process
+     * paramtr: dirfd (IN): descriptor from procOpen
+     *          io (OUT): fields of /proc/<pid>/io
+     * returns: 1 if read, 0 if the file is missing (kernels without task
+     *          I/O accounting), -1 on error
+     */
+    char buf[PROCFS_BUFSIZE];
+    memset(io, 0, sizeof(ProcIO));
+    if (read_file(dirfd, "io", buf, sizeof(buf)) < 0) {
+        return errno == ENOENT ? 0 : -1;
+    }
+    scan_keys(buf, io_keys, sizeof(io_keys) / sizeof(ProcKey), io, 1);
+    return 1;
+}
@@ -0,0 +1,78 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _PROCFS_H
+#define _PROCFS_H
+
+/* Readers for the per-process files in /proc, shared by the ptrace tracer
+ * and libinterpose. The directory of the process is opened once, each file
+ * is opened relative to it and read with one pread into a buffer on the
+ * stack, and the fields are picked out by hand instead of with stdio and
+ * sscanf. Only the raw system calls are used, so the reads are not traced
+ * when they are made from inside libinterpose.
+ *
+ * The read functions return 1 if the file was read, 0 if the file does
+ * not exist (e.g. /proc/<pid>/io without task I/O accounting), and -1 with
+ * errno set on error. Fields missing from the file are set to 0.
+ */
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/* libinterpose is preloaded into arbitrary applications, so keep these
+ * functions out of its dynamic symbol table */
+#if defined(__GNUC__) && !defined(__APPLE__)
+#define PROCFS_HIDDEN __attribute__((visibility("hidden")))
+#else
+#define PROCFS_HIDDEN
+#endif
+
+/* Large enough for status, stat and io */
+#define PROCFS_BUFSIZE 4096
+
+/* Fields of /proc/<pid>/status */
+typedef struct {
+    int ppid;               /* PPid */
+    int threads;            /* Threads */
+    int vmpeak;             /* VmPeak in KB */
+    int rsspeak;            /* VmHWM in KB */
+} ProcStatus;
+
+/* Fields of /proc/<pid>/stat, times in clock ticks */
+typedef struct {
+    uint64_t utime;
+    uint64_t stime;
+    uint64_t rss;           /* Resident set size in pages */
+    uint64_t iowait;        /* delayacct_blkio_ticks */
+} ProcStat;
+
+/* Fields of /proc/<pid>/io */
+typedef struct {
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t syscr;
+    uint64_t syscw;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t cancelled_write_bytes;
+} ProcIO;
+
+extern PROCFS_HIDDEN int procOpen(pid_t pid);
+extern PROCFS_HIDDEN void procClose(int dirfd);
+extern PROCFS_HIDDEN ssize_t procReadExe(int dirfd, char *buf, size_t size);
+extern PROCFS_HIDDEN int procReadStatus(int dirfd, ProcStatus *status);
+extern PROCFS_HIDDEN int procReadStat(int dirfd, ProcStat *stat);
+extern PROCFS_HIDDEN int procReadIO(int dirfd, ProcIO *io);
+
+#endif /* _PROCFS_H */
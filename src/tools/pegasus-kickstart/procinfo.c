@@ -31,19 +31,22 @@
 #include "procinfo.h"
 #include "utils.h"
 #include "syscall.h"
+#include "sampler.h"
 #include "error.h"
 
 #ifdef HAS_PTRACE
 
+#include "procfs.h"
+
 #include <sys/user.h> /* struct user_regs_struct */
 
-/* Find ProcInfo in a list by pid */
-static ProcInfo *proc_lookup(ProcInfo **list, pid_t pid) {
-    ProcInfo *cur;
-    for (cur = *list; cur!=NULL; cur = cur->next) {
-        if (cur->pid == pid) return cur;
-    }
-    return NULL;
+static int proc_match(const void *value, const void *key) {
+    return ((const ProcInfo *)value)->pid == *(const pid_t *)key;
+}
+
+/* Find the running process with pid in the index */
+static ProcInfo *proc_lookup(HashTable *index, pid_t pid) {
+    return (ProcInfo *)findHashEntry(index, hashInteger(pid), proc_match, &pid);
 }
 
 /* Create a ProcInfo object */
@@ -56,26 +59,44 @@ static ProcInfo *initProcInfo() {
     new->next = NULL;
     new->prev = NULL;
     new->exe = NULL;
+    /* The table is allocated when the first descriptor is opened */
+    new->fds.elemsize = sizeof(FileInfo *);
     return new;
 }
 
-/* Add a new ProcInfo object to the list */
-static ProcInfo *proc_add(ProcInfo **list, pid_t pid) {
+/* Add a new ProcInfo object to the end of the list and to the index */
+static ProcInfo *proc_add(ProcInfo **list, ProcInfo **tail, HashTable *index, pid_t pid) {
     ProcInfo *new = initProcInfo();
     if (new == NULL) return NULL;
     new->pid = pid;
-    if (*list == NULL) {
+    if (addHashEntry(index, hashInteger(pid), new) < 0) {
+        printerr("calloc: %s\n", strerror(errno));
+        free(new);
+        return NULL;
+    }
+    if (*tail == NULL) {
         *list = new;
     } else {
-        ProcInfo *cur;
-        for (cur = *list; cur->next!=NULL; cur = cur->next);
-        cur->next = new;
-        new->prev = cur;
+        (*tail)->next = new;
+        new->prev = *tail;
     }
+    *tail = new;
 
     return new;
 }
 
+/* Save the system call that the process is entering */
+static void proc_syscall_enter(ProcInfo *child, struct user_regs_struct *regs) {
+    child->sc_nr = SC_NR((*regs));
+    child->sc_args[0] = SC_ARG0((*regs));
+    child->sc_args[1] = SC_ARG1((*regs));
+    child->sc_args[2] = SC_ARG2((*regs));
+    child->sc_args[3] = SC_ARG3((*regs));
+    child->sc_args[4] = SC_ARG4((*regs));
+    child->sc_args[5] = SC_ARG5((*regs));
+    child->insyscall = 1;
+}
+
 /* Get the current time in seconds since the epoch */
 static double get_time() {
     struct timeval tv;
@@ -84,17 +105,13 @@ static double get_time() {
 }
 
 /* Read /proc/[pid]/exe */
-static int proc_read_exe(ProcInfo *item) {
-    char link[PATH_MAX];
+static int proc_read_exe(ProcInfo *item, int dirfd) {
     char exe[PATH_MAX];
-    int size;
-    sprintf(link, "/proc/%d/exe", item->pid);
-    size = readlink(link, exe, PATH_MAX);
+    ssize_t size = procReadExe(dirfd, exe, sizeof(exe));
     if (size < 0) {
         printerr("readlink: %s\n", strerror(errno));
         return -1;
     }
-    exe[size] = '\0';
     item->exe = strdup(exe);
     if (item->exe == NULL) {
         printerr("strdup: %s\n", strerror(errno));
@@ -103,165 +120,155 @@ static int proc_read_exe(ProcInfo *item) {
     return size;
 }
 
-/* Return 1 if line begins with tok */
-static int startswith(const char *line, const char *tok) {
-    return strncmp(line, tok, strlen(tok)) == 0;
-}
-
 /* Read /proc/[pid]/status to get memory usage */
-static int proc_read_meminfo(ProcInfo *item) {
-    char statf[BUFSIZ];
-    if (sprintf(statf,"/proc/%d/status", item->pid) < 0) {
-        perror("sprintf");
-        return -1;
-    }
-
-    /* If the status file is missing, then just skip it */
-    if (access(statf, F_OK) < 0) {
-        return 0;
-    }
-
-    FILE *f = fopen(statf,"r");
-    if (f == NULL) {
-        perror("fopen");
-        return -1;
-    }
-
-    char line[BUFSIZ];
-    while (fgets(line, BUFSIZ, f) != NULL) {
-        if (startswith(line, "PPid")) {
-            sscanf(line,"PPid:%d\n",&(item->ppid));
-        } else if (startswith(line, "Threads")) {
-            sscanf(line,"Threads:%d\n",&(item->fin_threads));
-        } else if (startswith(line,"VmPeak")) {
-            sscanf(line,"VmPeak:%d kB\n",&(item->vmpeak));
-        } else if (startswith(line,"VmHWM")) {
-            sscanf(line,"VmHWM:%d kB\n",&(item->rsspeak));
-        }
+static int proc_read_meminfo(ProcInfo *item, int dirfd) {
+    ProcStatus status;
+    int rc = procReadStatus(dirfd, &status);
+    if (rc > 0) {
+        item->ppid = status.ppid;
+        item->fin_threads = status.threads;
+        item->vmpeak = status.vmpeak;
+        item->rsspeak = status.rsspeak;
     }
-
-    if (ferror(f)) {
-        fclose(f);
-        return -1;
-    }
-
-    return fclose(f);
+    return rc;
 }
 
 /* Read /proc/[pid]/stat to get CPU usage */
-static int proc_read_statinfo(ProcInfo *item) {
-    char statf[BUFSIZ];
-    if (sprintf(statf,"/proc/%d/stat", item->pid) < 0) {
-        perror("sprintf");
-        return -1;
+static int proc_read_statinfo(ProcInfo *item, int dirfd) {
+    ProcStat stat;
+    int rc = procReadStat(dirfd, &stat);
+    if (rc > 0) {
+        /* Adjust by number of clock ticks per second */
+        long clocks = sysconf(_SC_CLK_TCK);
+        item->utime = ((double)stat.utime) / clocks;
+        item->stime = ((double)stat.stime) / clocks;
+        item->iowait = ((double)stat.iowait) / clocks;
     }
+    return rc;
+}
 
-    /* If the stat file is missing, then just skip it */
-    if (access(statf, F_OK) < 0) {
-        return 0;
+/* Read /proc/[pid]/io to get I/O usage. This proc file was added in
+ * Linux 2.6.20. It won't be there on older kernels, or on kernels
+ * without task IO accounting, and then it is skipped. */
+static int proc_read_io(ProcInfo *item, int dirfd) {
+    ProcIO io;
+    int rc = procReadIO(dirfd, &io);
+    if (rc > 0) {
+        item->rchar = io.rchar;
+        item->wchar = io.wchar;
+        item->syscr = io.syscr;
+        item->syscw = io.syscw;
+        item->read_bytes = io.read_bytes;
+        item->write_bytes = io.write_bytes;
+        item->cancelled_write_bytes = io.cancelled_write_bytes;
     }
+    return rc;
+}
 
-    FILE *f = fopen(statf,"r");
-    if (f == NULL) {
-        perror("fopen");
-        return -1;
+/* Add the current resource usage of a process to its series */
+static void proc_series_point(ProcInfo *p, int dirfd, int final) {
+    static long clocks = 0;
+    static long pagekb = 0;
+    if (clocks == 0) {
+        clocks = sysconf(_SC_CLK_TCK);
+        pagekb = sysconf(_SC_PAGESIZE) / 1024;
     }
 
-    unsigned long utime, stime = 0;
-    unsigned long long iowait = 0; //delayacct_blkio_ticks
-
-    //pid comm state ppid pgrp session tty_nr tpgid flags minflt cminflt majflt
-    //cmajflt utime stime cutime cstime priority nice num_threads itrealvalue
-    //starttime vsize rss rsslim startcode endcode startstack kstkesp kstkeip
-    //signal blocked sigignore sigcatch wchan nswap cnswap exit_signal
-    //processor rt_priority policy delayacct_blkio_ticks guest_time cguest_time
-    fscanf(f, "%*d %*s %*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu "
-              "%lu %*d %*d %*d %*d %*d %*d %*u %*u %*d %*u %*u "
-              "%*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*u %*d "
-              "%*d %*u %*u %llu %*u %*d",
-           &utime, &stime, &iowait);
-
-    /* Adjust by number of clock ticks per second */
-    long clocks = sysconf(_SC_CLK_TCK);
-    item->utime = ((double)utime) / clocks;
-    item->stime = ((double)stime) / clocks;
-    item->iowait = ((double)iowait) / clocks;
-
-    if (ferror(f)) {
-        fclose(f);
-        return -1;
+    ProcStat stat;
+    ProcIO io;
+    if (procReadStat(dirfd, &stat) <= 0) {
+        return;
     }
-
-    return fclose(f);
-}
-
-/* Read /proc/[pid]/io to get I/O usage */
-static int proc_read_io(ProcInfo *item) {
-    char iofile[BUFSIZ];
-    if (sprintf(iofile, "/proc/%d/io", item->pid) < 0) {
-        perror("sprintf");
-        return -1;
+    if (procReadIO(dirfd, &io) <= 0) {
+        memset(&io, 0, sizeof(io));
     }
 
-    /* This proc file was added in Linux 2.6.20. It won't be
-     * there on older kernels, or on kernels without task IO 
-     * accounting. If it is missing, just bail out.
-     */
-    if (access(iofile, F_OK) < 0) {
-        return 0;
-    }
+    SeriesPoint point;
+    double elapsed = get_time() - p->start;
+    point.time = elapsed > 0 ? (uint64_t)(elapsed * 1000) : 0;
+    point.utime = stat.utime * 1000 / clocks;
+    point.stime = stat.stime * 1000 / clocks;
+    point.rss = stat.rss * pagekb;
+    point.read_bytes = io.read_bytes;
+    point.write_bytes = io.write_bytes;
+    addSeriesPoint(p, &point, final);
+}
 
-    FILE *f = fopen(iofile, "r");
-    if (f == NULL) {
-        perror("fopen");
-        return -1;
+/* Take a series sample of all the running processes */
+static void proc_series(HashTable *index) {
+    for (size_t i = 0; i < index->size; i++) {
+        ProcInfo *p = (ProcInfo *)index->slots[i].value;
+        if (p != NULL) {
+            int dirfd = procOpen(p->pid);
+            if (dirfd >= 0) {
+                proc_series_point(p, dirfd, 0);
+                procClose(dirfd);
+            }
+        }
     }
+}
 
-    char line[BUFSIZ];
-    while (fgets(line, BUFSIZ, f) != NULL) {
-        if (startswith(line, "rchar")) {
-            sscanf(line,"rchar: %"SCNu64"\n", &(item->rchar));
-        } else if (startswith(line, "wchar")) {
-            sscanf(line,"wchar: %"SCNu64"\n", &(item->wchar));
-        } else if (startswith(line,"syscr")) {
-            sscanf(line,"syscr: %"SCNu64"\n", &(item->syscr));
-        } else if (startswith(line,"syscw")) {
-            sscanf(line,"syscw: %"SCNu64"\n", &(item->syscw));
-        } else if (startswith(line,"read_bytes")) {
-            sscanf(line,"read_bytes: %"SCNu64"\n",&(item->read_bytes));
-        } else if (startswith(line,"write_bytes")) {
-            sscanf(line,"write_bytes: %"SCNu64"\n",&(item->write_bytes));
-        } else if (startswith(line,"cancelled_write_bytes")) {
-            sscanf(line,"cancelled_write_bytes: %"SCNu64"\n",&(item->cancelled_write_bytes));
+/* Sample the files and I/O of all the running processes */
+static void proc_sample(HashTable *index) {
+    for (size_t i = 0; i < index->size; i++) {
+        ProcInfo *p = (ProcInfo *)index->slots[i].value;
+        if (p != NULL) {
+            sampleFileInfo(p, 0);
+            int dirfd = procOpen(p->pid);
+            if (dirfd >= 0) {
+                proc_read_io(p, dirfd);
+                procClose(dirfd);
+            }
         }
     }
+}
 
-    if (ferror(f)) {
-        fclose(f);
-        return -1;
-    }
+#endif
 
-    return fclose(f);
+int procSyscallFilter() {
+#ifdef HAS_PTRACE
+    return useSyscallFilter();
+#else
+    return 0;
+#endif
 }
+
+double procSampleInterval() {
+#ifdef HAS_PTRACE
+    return getSampleInterval();
+#else
+    return 0;
 #endif
+}
 
-int procChild() {
+int procChild(int filter) {
 #ifdef HAS_PTRACE
-    return ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+    if (ptrace(PTRACE_TRACEME, 0, NULL, NULL)) {
+        return -1;
+    }
+    /* Only stop on the system calls that syscall.c handles */
+    if (filter) {
+        return installSyscallFilter();
+    }
+    return 0;
 #else
     return 0;
 #endif
 }
 
 /* Do the parent part of fork() */
-int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, ProcInfo **procs, int interpose) {
+int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, ProcInfo **procs, int interpose, int filter, double sample) {
 #ifndef HAS_PTRACE
     return procParentWait(main, main_status, main_usage, procs);
 #else
 
-    /* If we are interposing system calls, then we need to call PTRACE_SYSCALL */
+    /* If we are interposing system calls, then we need to call PTRACE_SYSCALL.
+     * If the job has a seccomp filter, then it only stops on the system
+     * calls that the filter selects, and we use PTRACE_SYSCALL for those
+     * to see the system call exit.
+     */
     int PTRACE_NEXTSTOP = PTRACE_CONT;
-    if (interpose) {
+    if (interpose && !filter) {
         PTRACE_NEXTSTOP = PTRACE_SYSCALL;
     }
 
@@ -270,9 +277,50 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
      * hanging around in the t state
      */
 
+    /* The list keeps the processes in the order they were first seen,
+     * the index finds the running process for a pid. A pid is removed
+     * from the index when the process exits, so that a process that
+     * reuses the pid gets its own entry. */
+    HashTable index;
+    memset(&index, 0, sizeof(HashTable));
+    ProcInfo *tail = NULL;
+    for (tail = *procs; tail != NULL && tail->next != NULL; tail = tail->next);
+
+    int result = 0;
+
+    /* Sample the files of the running processes periodically, unless
+     * every system call is traced, and the resource usage series if
+     * requested. One timer ticks at the shorter interval. */
+    if (interpose) {
+        sample = 0;
+    }
+    double series = getSeriesInterval();
+    double tick = sample;
+    if (series > 0 && (tick <= 0 || series < tick)) {
+        tick = series;
+    }
+    if (tick > 0 && startSampleTimer(tick) < 0) {
+        sample = 0;
+        series = 0;
+        tick = 0;
+    }
+    unsigned long ticks = 0;
+    unsigned long sample_ticks = sample > 0 ? (unsigned long)(sample / tick + 0.5) : 0;
+    unsigned long series_ticks = series > 0 ? (unsigned long)(series / tick + 0.5) : 0;
+
     /* Event loop */
     while (1) {
 
+        if (tick > 0 && sampleDue()) {
+            ticks++;
+            if (sample_ticks > 0 && ticks % sample_ticks == 0) {
+                proc_sample(&index);
+            }
+            if (series_ticks > 0 && ticks % series_ticks == 0) {
+                proc_series(&index);
+            }
+        }
+
         /* Wait for a child to stop or exit */
         int status = 0;
         struct rusage usage;
@@ -287,17 +335,17 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
                 continue;
             } else {
                 perror("wait4");
-                return -1;
+                goto error;
             }
         }
 
         /* find the child */
-        ProcInfo *child = proc_lookup(procs, cpid);
+        ProcInfo *child = proc_lookup(&index, cpid);
 
         /* if not found, then it is new, so add it */
         if (child == NULL) {
-            child = proc_add(procs, cpid);
-            if (child == NULL) return -1;
+            child = proc_add(procs, &tail, &index, cpid);
+            if (child == NULL) goto error;
             child->start = get_time();
 
             /* TODO Trace exec so we can get the original exe path.
@@ -315,13 +363,16 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
             if (interpose) {
                 options |= PTRACE_O_TRACESYSGOOD;
             }
+            if (interpose && filter) {
+                options |= PTRACE_O_TRACESECCOMP;
+            }
 
             /* Set the tracing options for this child so that we
              * can see when it creates children and when it exits
              */
             if (ptrace(PTRACE_SETOPTIONS, cpid, NULL, options)) {
                 perror("ptrace(PTRACE_SETOPTIONS)");
-                return -1;
+                goto error;
             }
 
             /* The new child may have inherited some file descriptors
@@ -330,6 +381,9 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
             if (interpose) {
                 initFileInfo(child);
             }
+            if (sample > 0) {
+                sampleFileInfo(child, 1);
+            }
         }
 
         /* child exited */
@@ -342,11 +396,16 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
             }
 
             /* Now that the child is done, stat all the files it accessed */
-            if (interpose) {
+            if (interpose || sample > 0) {
                 finiFileInfo(child);
             }
         }
 
+        /* The pid can be reused from now on */
+        if (WIFEXITED(status) || WIFSIGNALED(status)) {
+            removeHashEntry(&index, hashInteger(cpid), proc_match, &cpid);
+        }
+
         /* child stopped */
         if (WIFSTOPPED(status)) {
 
@@ -356,17 +415,31 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
                 if (event == PTRACE_EVENT_EXIT) {
                     /* Child exited, grab its final stats */
                     child->stop = get_time();
-                    if (proc_read_exe(child) < 0) {
-                        perror("proc_read_exe");
+                    if (sample > 0) {
+                        sampleFileInfo(child, 0);
                     }
-                    if (proc_read_meminfo(child) < 0) {
-                        perror("proc_read_meminfo");
-                    }
-                    if (proc_read_statinfo(child) < 0) {
-                        perror("proc_read_statinfo");
-                    }
-                    if (proc_read_io(child) < 0) {
-                        perror("proc_read_io");
+                    /* All the files are opened relative to one
+                     * descriptor for the directory of the process */
+                    int dirfd = procOpen(cpid);
+                    if (dirfd < 0) {
+                        perror("procOpen");
+                    } else {
+                        if (proc_read_exe(child, dirfd) < 0) {
+                            perror("proc_read_exe");
+                        }
+                        if (proc_read_meminfo(child, dirfd) < 0) {
+                            perror("proc_read_meminfo");
+                        }
+                        if (proc_read_statinfo(child, dirfd) < 0) {
+                            perror("proc_read_statinfo");
+                        }
+                        if (proc_read_io(child, dirfd) < 0) {
+                            perror("proc_read_io");
+                        }
+                        if (series > 0) {
+                            proc_series_point(child, dirfd, 1);
+                        }
+                        procClose(dirfd);
                     }
 
                     /* If this is the main process, then get the exit status.
@@ -378,16 +451,31 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
                         unsigned long event_status;
                         if (ptrace(PTRACE_GETEVENTMSG, cpid, NULL, &event_status) < 0) {
                             perror("ptrace(PTRACE_GETEVENTMSG)");
-                            return -1;
+                            goto error;
                         }
                         *main_status = event_status;
                     }
                 }
 
+                /* The filter selected a system call, stop again when it exits */
+                if (event == PTRACE_EVENT_SECCOMP) {
+                    struct user_regs_struct regs;
+                    if (ptrace(PTRACE_GETREGS, cpid, NULL, &regs)) {
+                        perror("PTRACE_GETREGS");
+                        goto error;
+                    }
+                    proc_syscall_enter(child, &regs);
+                    if (ptrace(PTRACE_SYSCALL, cpid, NULL, NULL)) {
+                        perror("ptrace(PTRACE_SYSCALL)");
+                        goto error;
+                    }
+                    continue;
+                }
+
                 /* tell child to continue */
                 if (ptrace(PTRACE_NEXTSTOP, cpid, NULL, NULL)) {
                     perror("ptrace(PTRACE_NEXTSTOP)");
-                    return -1;
+                    goto error;
                 }
             }
 
@@ -399,7 +487,7 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
 
                 if (ptrace(PTRACE_GETREGS, cpid, NULL, &regs)) {
                     perror("PTRACE_GETREGS");
-                    return -1;
+                    goto error;
                 }
 
                 if (child->insyscall) {
@@ -412,19 +500,12 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
                     }
                     child->insyscall = 0;
                 } else {
-                    child->sc_nr = SC_NR(regs);
-                    child->sc_args[0] = SC_ARG0(regs);
-                    child->sc_args[1] = SC_ARG1(regs);
-                    child->sc_args[2] = SC_ARG2(regs);
-                    child->sc_args[3] = SC_ARG3(regs);
-                    child->sc_args[4] = SC_ARG4(regs);
-                    child->sc_args[5] = SC_ARG5(regs);
-                    child->insyscall = 1;
+                    proc_syscall_enter(child, &regs);
                 }
 
                 if (ptrace(PTRACE_NEXTSTOP, cpid, NULL, NULL)) {
                     perror("ptrace(PTRACE_NEXTSTOP)");
-                    return -1;
+                    goto error;
                 }
             }
 
@@ -453,13 +534,22 @@ int procParentTrace(pid_t main, int *main_status, struct rusage *main_usage, Pro
                 /* pass the signal on to the child */
                 if (ptrace(PTRACE_NEXTSTOP, cpid, NULL, signal)) {
                     perror("ptrace(PTRACE_NEXTSTOP)");
-                    return -1;
+                    goto error;
                 }
             }
         }
     }
 
-    return 0;
+    goto done;
+
+error:
+    result = -1;
+done:
+    if (tick > 0) {
+        stopSampleTimer();
+    }
+    deleteHashTable(&index);
+    return result;
 #endif
 }
 
@@ -481,16 +571,110 @@ int procParentWait(pid_t main, int *main_status,  struct rusage *main_usage, Pro
     return *main_status;
 }
 
+#ifdef HAS_PTRACE
+/* Append milliseconds as seconds with three decimals */
+static char *appendMillis(char *p, uint64_t ms) {
+    char digits[24];
+    char *s = fmtuint(digits + sizeof(digits), ms / 1000);
+    size_t n = digits + sizeof(digits) - s;
+    memcpy(p, s, n);
+    p += n;
+    *p++ = '.';
+    *p++ = '0' + (ms / 100) % 10;
+    *p++ = '0' + (ms / 10) % 10;
+    *p++ = '0' + ms % 10;
+    return p;
+}
+
+static char *appendUint(char *p, uint64_t value) {
+    char digits[24];
+    char *s = fmtuint(digits + sizeof(digits), value);
+    size_t n = digits + sizeof(digits) - s;
+    memcpy(p, s, n);
+    return p + n;
+}
+
+/* Write the resource usage series of a process, one flow sequence of
+ * [time, utime, stime, rss, rbytes, wbytes] per point */
+static void printSeries(FILE *out, int indent, const SampleSeries *series) {
+    SeriesPoint points[SERIES_MAX_POINTS];
+    int n = readSeries(series, points);
+    if (n == 0) {
+        return;
+    }
+
+    yamlindent(out, indent);
+    fputs("series:\n", out);
+    for (int i = 0; i < n; i++) {
+        char line[256];
+        char *p = line;
+        *p++ = '-';
+        *p++ = ' ';
+        *p++ = '[';
+        p = appendMillis(p, points[i].time);
+        *p++ = ',';
+        *p++ = ' ';
+        p = appendMillis(p, points[i].utime);
+        *p++ = ',';
+        *p++ = ' ';
+        p = appendMillis(p, points[i].stime);
+        *p++ = ',';
+        *p++ = ' ';
+        p = appendUint(p, points[i].rss);
+        *p++ = ',';
+        *p++ = ' ';
+        p = appendUint(p, points[i].read_bytes);
+        *p++ = ',';
+        *p++ = ' ';
+        p = appendUint(p, points[i].write_bytes);
+        *p++ = ']';
+        *p++ = '\n';
+        yamlindent(out, indent + 2);
+        fwrite(line, 1, p - line, out);
+    }
+}
+#endif
+
+static char *appendAttr(char *p, const char *name, uint64_t value) {
+    /* purpose: append "name=\"value\"" to a line, see printXMLFileInfo
+     * returns: the new end of the line */
+    char digits[24];
+    char *s = fmtuint(digits + sizeof(digits), value);
+    size_t n = strlen(name);
+    memcpy(p, name, n);
+    p += n;
+    *p++ = '=';
+    *p++ = '"';
+    memcpy(p, s, digits + sizeof(digits) - s);
+    p += digits + sizeof(digits) - s;
+    *p++ = '"';
+    return p;
+}
+
 static int printXMLFileInfo(FILE *out, int indent, FileInfo *files) {
     FileInfo *i;
     for (i = files; i != NULL; i = i->next) {
-        fprintf(out, "%*s<file name=\"%s\" "
-                "bread=\"%"PRIu64"\" nread=\"%"PRIu64"\" "
-                "bwrite=\"%"PRIu64"\" nwrite=\"%"PRIu64"\" "
-                "bseek=\"%"PRIu64"\" nseek=\"%"PRIu64"\" "
-                "size=\"%"PRIu64"\"/>\n",
-                indent, "", i->filename, i->bread, i->nread,
-                i->bwrite, i->nwrite, i->bseek, i->nseek, i->size);
+        /* the numbers are formatted into one buffer, 8 x (20 digits + name) */
+        char attrs[256];
+        char *p = attrs;
+        *p++ = '"';
+        p = appendAttr(p, " bread", i->bread);
+        p = appendAttr(p, " nread", i->nread);
+        p = appendAttr(p, " bwrite", i->bwrite);
+        p = appendAttr(p, " nwrite", i->nwrite);
+        p = appendAttr(p, " bseek", i->bseek);
+        p = appendAttr(p, " nseek", i->nseek);
+        if (i->bmap > 0) {
+            p = appendAttr(p, " bmap", i->bmap);
+        }
+        p = appendAttr(p, " size", i->size);
+        memcpy(p, "/>\n", 3);
+        p += 3;
+
+        yamlindent(out, indent);
+        fputs("<file name=\"", out);
+        fputs(i->filename, out);
+        fwrite(attrs, 1, p - attrs, out);
     }
     return 0;
 }
@@ -498,9 +682,19 @@ static int printXMLFileInfo(FILE *out, int indent, FileInfo *files) {
 static int printXMLSockInfo(FILE *out, int indent, SockInfo *sockets) {
     SockInfo *i;
     for (i = sockets; i != NULL; i = i->next) {
-        fprintf(out, "%*s<socket address=\"%s\" port=\"%d\" "
-                "brecv=\"%"PRIu64"\" bsend=\"%"PRIu64"\" nrecv=\"%"PRIu64"\" nsend=\"%"PRIu64"\"/>\n",
-                indent, "", i->address, i->port, i->brecv, i->bsend, i->nrecv, i->nsend);
+        char attrs[256];
+        char *p = attrs;
+        *p++ = '"';
+        p = appendAttr(p, " brecv", i->brecv);
+        p = appendAttr(p, " bsend", i->bsend);
+        p = appendAttr(p, " nrecv", i->nrecv);
+        p = appendAttr(p, " nsend", i->nsend);
+        memcpy(p, "/>\n", 3);
+        p += 3;
+
+        yamlindent(out, indent);
+        fprintf(out, "<socket address=\"%s\" port=\"%d", i->address, i->port);
+        fwrite(attrs, 1, p - attrs, out);
     }
     return 0;
 }
@@ -515,49 +709,46 @@ int printYAMLProcInfo(FILE *out, int indent, ProcInfo* procs) {
             printerr("Bad <proc> record: trace file may be incomplete");
         }
 
-        fprintf(out, "%*s  %d:\n"
-                     "%*s    ppid: %d\n"
-                     "%*s    pid: %d\n"
-                     "%*s    exe: %s\n"
-                     "%*s    start: %lf\n"
-                     "%*s    stop: %lf\n"
-                     "%*s    utime: %.3lf\n"
-                     "%*s    stime: %.3lf\n"
-                     "%*s    iowait: %.3lf\n"
-                     "%*s    finthreads: %d\n"
-                     "%*s    maxthreads: %d\n"
-                     "%*s    totthreads: %d\n"
-                     "%*s    vmpeak: %d\n"
-                     "%*s    rsspeak: %d\n"
-                     "%*s    rchar: %"PRIu64"\n"
-                     "%*s    wchar: %"PRIu64"\n"
-                     "%*s    rbytes: %"PRIu64"\n"
-                     "%*s    wbytes: %"PRIu64"\n"
-                     "%*s    cwbytes: %"PRIu64"\n"
-                     "%*s    syscr: %"PRIu64"\n"
-                     "%*s    syscw: %"PRIu64"\n",
-                     indent, "", i->pid,
-                     indent, "", i->ppid, 
-                     indent, "", i->pid, 
-                     indent, "", i->exe,
-                     indent, "", i->start,
-                     indent, "", i->stop,
-                     indent, "", i->utime,
-                     indent, "", i->stime,
-                     indent, "", i->iowait,
-                     indent, "", i->fin_threads, 
-                     indent, "", i->max_threads, 
-                     indent, "", i->tot_threads,
-                     indent, "", i->vmpeak, 
-                     indent, "", i->rsspeak,
-                     indent, "", i->rchar,
-                     indent, "", i->wchar,
-                     indent, "", i->read_bytes,
-                     indent, "", i->write_bytes,
-                     indent, "", i->cancelled_write_bytes,
-                     indent, "", i->syscr,
-                     indent, "", i->syscw
-        );
+        fprintf(out, "%*s  %d:\n", indent, "", i->pid);
+        yamlint(out, indent+4, "ppid", i->ppid);
+        yamlint(out, indent+4, "pid", i->pid);
+        yamlstr(out, indent+4, "exe", i->exe ? i->exe : "(null)");
+        yamlfixed(out, indent+4, "start", i->start, 6);
+        yamlfixed(out, indent+4, "stop", i->stop, 6);
+        yamlfixed(out, indent+4, "utime", i->utime, 3);
+        yamlfixed(out, indent+4, "stime", i->stime, 3);
+        yamlfixed(out, indent+4, "iowait", i->iowait, 3);
+        yamlint(out, indent+4, "finthreads", i->fin_threads);
+        yamlint(out, indent+4, "maxthreads", i->max_threads);
+        yamlint(out, indent+4, "totthreads", i->tot_threads);
+        yamlint(out, indent+4, "vmpeak", i->vmpeak);
+        yamlint(out, indent+4, "rsspeak", i->rsspeak);
+        yamluint(out, indent+4, "rchar", i->rchar);
+        yamluint(out, indent+4, "wchar", i->wchar);
+        yamluint(out, indent+4, "rbytes", i->read_bytes);
+        yamluint(out, indent+4, "wbytes", i->write_bytes);
+        yamluint(out, indent+4, "cwbytes", i->cancelled_write_bytes);
+        yamluint(out, indent+4, "syscr", i->syscr);
+        yamluint(out, indent+4, "syscw", i->syscw);
+        if (i->cycles > 0 && i->instructions > 0) {
+            /* Instructions per cycle, and cache misses per thousand
+             * instructions */
+            yamluint(out, indent+4, "cycles", i->cycles);
+            yamluint(out, indent+4, "instructions", i->instructions);
+            yamlfixed(out, indent+4, "ipc", (double)i->instructions / i->cycles, 3);
+            yamluint(out, indent+4, "cachemisses", i->cache_misses);
+            yamlfixed(out, indent+4, "cachempki", 1000.0 * i->cache_misses / i->instructions, 3);
+            yamluint(out, indent+4, "branchmisses", i->branch_misses);
+        }
+        if (i->uring_enters > 0) {
+            yamluint(out, indent+4, "uringenters", i->uring_enters);
+            yamluint(out, indent+4, "uringsqes", i->uring_sqes);
+        }
+#ifdef HAS_PTRACE
+        if (i->series != NULL) {
+            printSeries(out, indent+4, i->series);
+        }
+#endif
 #ifdef HAS_PAPI
         if (i->PAPI_TOT_INS > 0) {
             fprintf(out, " totins=\"%lld\"", i->PAPI_TOT_INS);
@@ -585,11 +776,12 @@ int printYAMLProcInfo(FILE *out, int indent, ProcInfo* procs) {
         }
 #endif
         if ( ! (i->cmd == NULL && i->files == NULL && i->sockets == NULL)) {
-            fprintf(out, ">\n");
+            fputs(">\n", out);
             if (i->cmd != NULL) {
-                fprintf(out, "%*s<cmd>", indent+2, "");
+                yamlindent(out, indent+2);
+                fputs("<cmd>", out);
                 yamlquote(out, i->cmd, strlen(i->cmd));
-                fprintf(out, "</cmd>\n");
+                fputs("</cmd>\n", out);
             }
             printXMLFileInfo(out, indent+2, i->files);
             printXMLSockInfo(out, indent+2, i->sockets);
@@ -598,6 +790,42 @@ int printYAMLProcInfo(FILE *out, int indent, ProcInfo* procs) {
     return 0;
 }
 
+static int file_match(const void *value, const void *key) {
+    return strcmp(((const FileInfo *)value)->filename, (const char *)key) == 0;
+}
+
+FileInfo *findFileInfo(ProcInfo *proc, const char *filename) {
+    /* purpose: find the entry for a file that the process accessed
+     * paramtr: proc (IN): process
+     *          filename (IN): path of the file
+     * returns: the FileInfo, or NULL if the process did not access it
+     */
+    return (FileInfo *)findHashEntry(&proc->fileindex, hashString(filename), file_match, filename);
+}
+
+int addFileInfo(ProcInfo *proc, FileInfo *file) {
+    /* purpose: add a file to the end of the list of files of a process.
+     *          There must not be an entry with the same name already.
+     * paramtr: proc (IO): process
+     *          file (IN): new entry
+     * returns: 0 on success, -1 if the index could not be grown
+     */
+    if (addHashEntry(&proc->fileindex, hashString(file->filename), file) < 0) {
+        printerr("calloc: %s\n", strerror(errno));
+        return -1;
+    }
+
+    file->next = NULL;
+    if (proc->lastfile == NULL) {
+        proc->files = file;
+    } else {
+        proc->lastfile->next = file;
+    }
+    proc->lastfile = file;
+
+    return 0;
+}
+
 /* Delete all the ProcInfo objects in a list */
 void deleteProcInfo(ProcInfo *procs) {
     while (procs != NULL) {
@@ -617,6 +845,15 @@ void deleteProcInfo(ProcInfo *procs) {
             sockets = sockets->next;
             free(s);
         }
+#ifdef HAS_PTRACE
+        if (p->series != NULL) {
+            free(p->series->data);
+            free(p->series);
+        }
+#endif
+        deleteFDTable(&p->fds);
+        deleteFDTable(&p->samples);
+        deleteHashTable(&p->fileindex);
         procs = procs->next;
         free(p);
     }
@@ -7,6 +7,8 @@
 #include <inttypes.h>
 
 #include "ptrace.h"
+#include "fdtable.h"
+#include "hashtable.h"
 
 #define SC_ARGS 6
 
@@ -19,6 +21,7 @@ typedef struct _FileInfo {
     uint64_t nwrite;        /* Number of write operations */
     uint64_t bseek;         /* Total seek distance */
     uint64_t nseek;         /* Number of seek operations */
+    uint64_t bmap;          /* Number of bytes mapped into memory */
     struct _FileInfo *next;
 } FileInfo;
 
@@ -32,6 +35,8 @@ typedef struct _SockInfo {
     struct _SockInfo *next;
 } SockInfo;
 
+typedef struct _SampleSeries SampleSeries;
+
 typedef struct _ProcInfo {
     pid_t pid;              /* Process ID */
     pid_t ppid;             /* Parent pid */
@@ -60,8 +65,15 @@ typedef struct _ProcInfo {
     long sc_args[SC_ARGS];  /* system call arguments */
     long sc_rval;           /* system call return value */
 
-    FileInfo *fds[1024];    /* File descriptor table TODO Make this dynamic. */
+    FDTable fds;            /* File descriptor table of FileInfo pointers */
+    FDTable samples;        /* FileSample table used by the sampler */
+    uint32_t nsamples;      /* Number of times the sampler looked at the process */
+    int nosample;           /* Don't sample this process (it is a thread) */
+    SampleSeries *series;   /* Resource usage over time, or NULL */
+
     FileInfo *files;        /* Linked list of files accessed */
+    FileInfo *lastfile;     /* Last file in the list */
+    HashTable fileindex;    /* Index of files by filename */
 
     SockInfo *sockets;      /* Linked list of sockets */
 
@@ -74,16 +86,28 @@ typedef struct _ProcInfo {
     long long PAPI_L2_TCM;  /* L2 cache misses */
     long long PAPI_L1_TCM;  /* L1 cache misses */
 
+    uint64_t cycles;        /* CPU cycles (perf_event) */
+    uint64_t instructions;  /* Instructions retired (perf_event) */
+    uint64_t cache_misses;  /* Last level cache misses (perf_event) */
+    uint64_t branch_misses; /* Mispredicted branches (perf_event) */
+
+    uint64_t uring_enters;  /* Calls to io_uring_enter */
+    uint64_t uring_sqes;    /* Requests submitted with io_uring_enter */
+
     char *cmd;              /* Command line */
 
     struct _ProcInfo *next;
     struct _ProcInfo *prev;
 } ProcInfo;
 
-int procChild();
-int procParentTrace(pid_t main, int* main_status, struct rusage* main_usage, ProcInfo** procs, int interpose);
+int procSyscallFilter();
+double procSampleInterval();
+int procChild(int filter);
+int procParentTrace(pid_t main, int* main_status, struct rusage* main_usage, ProcInfo** procs, int interpose, int filter, double sample);
 int procParentWait(pid_t main, int* main_status, struct rusage* main_usage, ProcInfo** procs);
 int printYAMLProcInfo(FILE *out, int indent, ProcInfo* procs);
 void deleteProcInfo(ProcInfo *list);
+FileInfo *findFileInfo(ProcInfo *proc, const char *filename);
+int addFileInfo(ProcInfo *proc, FileInfo *file);
 
 #endif /* _PROC_H */
@@ -46,6 +46,12 @@
     #define PTRACE_EVENT_EXIT       6
 #endif
 
+/* Prior to version 2.15 glibc did not have these */
+#if __GLIBC__ < 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ < 15)
+    #define PTRACE_O_TRACESECCOMP   0x00000080
+    #define PTRACE_EVENT_SECCOMP    7
+#endif
+
 #endif /* glibc */
 
 #endif /* Linux >= version */
@@ -0,0 +1,497 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+/* This module estimates the file I/O of the traced processes without
+ * stopping them on every system call. While the job is running, a timer
+ * interrupts the ptrace event loop in procinfo.c, which then samples the
+ * descriptors of every live process from /proc/[pid]/fd and
+ * /proc/[pid]/fdinfo. The growth of the offset of a descriptor between
+ * two samples is counted as bytes read or written, depending on how the
+ * file was opened, and a decrease is counted as a seek. The process is
+ * sampled once more when it exits.
+ *
+ * This is an estimate: I/O on a descriptor that is opened and closed
+ * between two samples is not seen, pread/pwrite and mmap do not move the
+ * offset, and the number of read and write operations is not known. A
+ * file opened for reading and writing is counted as written. Processes
+ * that share an offset, like a shell and its children writing to the same
+ * stdout, all see the I/O of the others.
+ *
+ * The same timer also drives the resource usage series: the CPU time,
+ * resident size and file I/O of every live process are sampled from
+ * /proc/[pid]/stat and /proc/[pid]/io and appended to a small
+ * delta-encoded buffer whose size is bounded (see SampleSeries).
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+
+#include "sampler.h"
+#include "error.h"
+
+#ifdef HAS_PTRACE
+
+#include <sys/syscall.h>
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+#ifndef SIGEV_THREAD_ID
+#define SIGEV_THREAD_ID 4
+#endif
+
+/* Smallest interval allowed, to bound the overhead */
+#define MIN_SAMPLE_INTERVAL 0.01
+
+static timer_t sample_timer;
+static int sample_timer_active = 0;
+static volatile sig_atomic_t sample_due = 0;
+static struct sigaction sample_saveact;
+
+static void on_sample_timer(int signal) {
+    sample_due = 1;
+}
+
+static double getInterval(const char *name) {
+    char *env = getenv(name);
+    if (env == NULL) {
+        return 0;
+    }
+
+    double interval = atof(env);
+    if (interval <= 0) {
+        return 0;
+    }
+    if (interval < MIN_SAMPLE_INTERVAL) {
+        interval = MIN_SAMPLE_INTERVAL;
+    }
+    return interval;
+}
+
+double getSampleInterval() {
+    /* purpose: get the sampling interval requested by the user
+     * returns: the interval in seconds, or 0 if sampling is disabled
+     */
+    return getInterval("KICKSTART_SAMPLE_INTERVAL");
+}
+
+double getSeriesInterval() {
+    /* purpose: get the interval of the resource usage series
+     * returns: the interval in seconds, or 0 if there are no series
+     */
+    return getInterval("KICKSTART_SERIES_INTERVAL");
+}
+
+int startSampleTimer(double interval) {
+    /* purpose: start a timer that interrupts the calling thread every
+     *          interval seconds, so that blocking calls like wait4 return
+     *          EINTR and sampleDue returns true
+     * paramtr: interval (IN): seconds between samples
+     * returns: 0 on success, -1 on error
+     */
+    struct sigaction handler;
+    memset(&handler, 0, sizeof(handler));
+    handler.sa_handler = on_sample_timer;
+    sigemptyset(&handler.sa_mask);
+    /* No SA_RESTART, the point is to interrupt wait4 */
+    handler.sa_flags = 0;
+    if (sigaction(SIGRTMIN, &handler, &sample_saveact) < 0) {
+        printerr("Unable to set handler for sample timer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    /* Only interrupt this thread, not the trace consumer */
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGRTMIN;
+    event.sigev_notify_thread_id = syscall(SYS_gettid);
+    if (timer_create(CLOCK_MONOTONIC, &event, &sample_timer) < 0) {
+        printerr("Unable to create sample timer: %s\n", strerror(errno));
+        sigaction(SIGRTMIN, &sample_saveact, NULL);
+        return -1;
+    }
+
+    struct itimerspec spec;
+    spec.it_interval.tv_sec = (time_t)interval;
+    spec.it_interval.tv_nsec = (long)((interval - (time_t)interval) * 1e9);
+    spec.it_value = spec.it_interval;
+    if (timer_settime(sample_timer, 0, &spec, NULL) < 0) {
+        printerr("Unable to start sample timer: %s\n", strerror(errno));
+        timer_delete(sample_timer);
+        sigaction(SIGRTMIN, &sample_saveact, NULL);
+        return -1;
+    }
+
+    sample_due = 0;
+    sample_timer_active = 1;
+    return 0;
+}
+
+void stopSampleTimer() {
+    /* purpose: stop the timer started by startSampleTimer */
+    if (sample_timer_active) {
+        timer_delete(sample_timer);
+        sigaction(SIGRTMIN, &sample_saveact, NULL);
+        sample_timer_active = 0;
+        sample_due = 0;
+    }
+}
+
+int sampleDue() {
+    /* purpose: check if the timer has expired since the last call
+     * returns: 1 if it is time to take a sample, 0 otherwise
+     */
+    if (sample_due) {
+        sample_due = 0;
+        return 1;
+    }
+    return 0;
+}
+
+/* Read the offset, access mode and inode of a descriptor */
+static int readFDInfo(pid_t pid, const char *fd, uint64_t *pos, int *flags, uint64_t *ino) {
+    char path[sizeof("/proc//fdinfo/") + 3 * sizeof(pid_t) + NAME_MAX];
+    if (snprintf(path, sizeof(path), "/proc/%d/fdinfo/%s", pid, fd) >= (int) sizeof(path)) {
+        return -1;
+    }
+
+    int f = open(path, O_RDONLY);
+    if (f < 0) {
+        return -1;
+    }
+    char buf[512];
+    ssize_t n = read(f, buf, sizeof(buf) - 1);
+    close(f);
+    if (n <= 0) {
+        return -1;
+    }
+    buf[n] = '\0';
+
+    *ino = 0;
+    int found = 0;
+    for (char *line = buf; line != NULL && *line; ) {
+        if (strncmp(line, "pos:", 4) == 0) {
+            *pos = strtoull(line + 4, NULL, 10);
+            found |= 1;
+        } else if (strncmp(line, "flags:", 6) == 0) {
+            *flags = strtol(line + 6, NULL, 8);
+            found |= 2;
+        } else if (strncmp(line, "ino:", 4) == 0) {
+            *ino = strtoull(line + 4, NULL, 10);
+        }
+        line = strchr(line, '\n');
+        if (line != NULL) {
+            line++;
+        }
+    }
+
+    return found == 3 ? 0 : -1;
+}
+
+/* Check if pid is a thread other than the main thread of its process */
+static int isThread(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/status", pid);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return 0;
+    }
+    char line[256];
+    pid_t tgid = pid;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "Tgid: %d", &tgid) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return tgid != pid;
+}
+
+/* Get the entry for a file, adding it to the process if necessary */
+static FileInfo *sampleFile(ProcInfo *p, const char *filename) {
+    FileInfo *file = findFileInfo(p, filename);
+    if (file != NULL) {
+        return file;
+    }
+
+    file = (FileInfo *)calloc(1, sizeof(FileInfo));
+    if (file == NULL) {
+        printerr("calloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    file->filename = strdup(filename);
+    if (file->filename == NULL) {
+        printerr("strdup: %s\n", strerror(errno));
+        free(file);
+        return NULL;
+    }
+    if (addFileInfo(p, file) < 0) {
+        free(file->filename);
+        free(file);
+        return NULL;
+    }
+    return file;
+}
+
+int sampleFileInfo(ProcInfo *p, int initial) {
+    /* purpose: sample the open files of a process and add the I/O since
+     *          the last sample to its FileInfo entries
+     * paramtr: p (IO): process to sample
+     *          initial (IN): true for the first sample of a process
+     * returns: 0 on success, -1 if the process could not be sampled
+     */
+    if (initial) {
+        p->samples.elemsize = sizeof(FileSample);
+
+        /* Threads share the descriptors of their process */
+        if (isThread(p->pid)) {
+            p->nosample = 1;
+        }
+    }
+    if (p->nosample) {
+        return 0;
+    }
+
+    char dirname[64];
+    snprintf(dirname, sizeof(dirname), "/proc/%d/fd", p->pid);
+    DIR *fddir = opendir(dirname);
+    if (fddir == NULL) {
+        return -1;
+    }
+
+    uint32_t seen = ++p->nsamples;
+
+    struct dirent *d;
+    while ((d = readdir(fddir)) != NULL) {
+        if (d->d_name[0] == '.') {
+            continue;
+        }
+
+        char link[sizeof(dirname) + NAME_MAX + 1];
+        char filename[BUFSIZ];
+        if (snprintf(link, sizeof(link), "%s/%s", dirname, d->d_name) >= (int) sizeof(link)) {
+            continue;
+        }
+        ssize_t len = readlink(link, filename, sizeof(filename) - 1);
+        if (len <= 0 || filename[0] != '/') {
+            /* Pipes, sockets and the like */
+            continue;
+        }
+        filename[len] = '\0';
+
+        uint64_t pos = 0, ino = 0;
+        int flags = 0;
+        if (readFDInfo(p->pid, d->d_name, &pos, &flags, &ino) < 0) {
+            continue;
+        }
+
+        /* The offset of an O_APPEND descriptor stays where it was until
+         * the next write moves it to the end of the file, so only count
+         * the growth of the file */
+        if (flags & O_APPEND) {
+            struct stat st;
+            if (stat(link, &st) < 0) {
+                continue;
+            }
+            pos = st.st_size;
+        }
+
+        FileSample *s = (FileSample *)getFDEntry(&p->samples, atoi(d->d_name));
+        if (s == NULL) {
+            continue;
+        }
+
+        /* A new descriptor, or one that was closed and reused. Its offset
+         * when first seen is the baseline, it may have been inherited or
+         * seeked before this process did any I/O on it */
+        if (s->file == NULL || s->ino != ino || strcmp(s->file->filename, filename) != 0) {
+            s->file = sampleFile(p, filename);
+            if (s->file == NULL) {
+                continue;
+            }
+            s->ino = ino;
+            s->pos = pos;
+            s->write = (flags & O_ACCMODE) != O_RDONLY;
+        }
+        s->seen = seen;
+
+        if (pos > s->pos) {
+            if (s->write) {
+                s->file->bwrite += pos - s->pos;
+            } else {
+                s->file->bread += pos - s->pos;
+            }
+        } else if (pos < s->pos) {
+            s->file->bseek += s->pos - pos;
+            s->file->nseek += 1;
+        }
+        s->pos = pos;
+    }
+
+    closedir(fddir);
+
+    /* Forget the descriptors that were closed */
+    for (int fd = nextFDEntry(&p->samples, 0); fd >= 0; fd = nextFDEntry(&p->samples, fd + 1)) {
+        FileSample *s = (FileSample *)findFDEntry(&p->samples, fd);
+        if (s->file != NULL && s->seen != seen) {
+            s->file = NULL;
+        }
+    }
+
+    return 0;
+}
+
+/* Append v to the series as a zigzag varint: small deltas of either
+ * sign take one or two bytes */
+static void putDelta(SampleSeries *s, int64_t v) {
+    uint64_t z = ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+    while (z >= 0x80) {
+        s->data[s->size++] = (uint8_t)(z | 0x80);
+        z >>= 7;
+    }
+    s->data[s->size++] = (uint8_t)z;
+}
+
+static int64_t getDelta(const uint8_t **p) {
+    uint64_t z = 0;
+    int shift = 0;
+    while (**p & 0x80) {
+        z |= (uint64_t)(**p & 0x7f) << shift;
+        shift += 7;
+        (*p)++;
+    }
+    z |= (uint64_t)**p << shift;
+    (*p)++;
+    return (int64_t)(z >> 1) ^ -(int64_t)(z & 1);
+}
+
+/* Longest encoding of a point */
+#define SERIES_POINT_MAX (6 * 10)
+
+static int appendPoint(SampleSeries *s, const SeriesPoint *point) {
+    if (s->capacity - s->size < SERIES_POINT_MAX) {
+        uint32_t capacity = s->capacity == 0 ? 256 : s->capacity * 2;
+        uint8_t *data = realloc(s->data, capacity);
+        if (data == NULL) {
+            printerr("realloc: %s\n", strerror(errno));
+            return -1;
+        }
+        s->data = data;
+        s->capacity = capacity;
+    }
+    putDelta(s, point->time - s->last.time);
+    putDelta(s, point->utime - s->last.utime);
+    putDelta(s, point->stime - s->last.stime);
+    putDelta(s, point->rss - s->last.rss);
+    putDelta(s, point->read_bytes - s->last.read_bytes);
+    putDelta(s, point->write_bytes - s->last.write_bytes);
+    s->last = *point;
+    s->npoints++;
+    return 0;
+}
+
+/* Merge each pair of points into one. The counters are cumulative, so
+ * the later point of a pair is kept, with the larger rss of the two. */
+static void compactSeries(SampleSeries *s) {
+    SeriesPoint points[SERIES_MAX_POINTS];
+    uint32_t n = readSeries(s, points);
+
+    s->npoints = 0;
+    s->size = 0;
+    memset(&s->last, 0, sizeof(SeriesPoint));
+    for (uint32_t i = 0; i < n; i += 2) {
+        SeriesPoint point = points[i];
+        if (i + 1 < n) {
+            point = points[i + 1];
+            if (points[i].rss > point.rss) {
+                point.rss = points[i].rss;
+            }
+        }
+        /* Never grows, so this does not fail */
+        appendPoint(s, &point);
+    }
+    s->stride *= 2;
+}
+
+int addSeriesPoint(ProcInfo *p, const SeriesPoint *point, int final) {
+    /* purpose: add a sample of the resource usage of a process to its
+     *          series
+     * paramtr: p (IO): the process
+     *          point (IN): the sample, rss is the current size
+     *          final (IN): true for the sample taken when the process
+     *          exits, which is always kept
+     * returns: 0 on success, -1 on error
+     */
+    SampleSeries *s = p->series;
+    if (s == NULL) {
+        s = (SampleSeries *)calloc(1, sizeof(SampleSeries));
+        if (s == NULL) {
+            printerr("calloc: %s\n", strerror(errno));
+            return -1;
+        }
+        s->stride = 1;
+        p->series = s;
+    }
+
+    if (point->rss > s->pending_rss) {
+        s->pending_rss = point->rss;
+    }
+    if (++s->pending < s->stride && !final) {
+        return 0;
+    }
+
+    if (s->npoints == SERIES_MAX_POINTS) {
+        compactSeries(s);
+    }
+    SeriesPoint kept = *point;
+    kept.rss = s->pending_rss;
+    s->pending = 0;
+    s->pending_rss = 0;
+    return appendPoint(s, &kept);
+}
+
+int readSeries(const SampleSeries *series, SeriesPoint *points) {
+    /* purpose: decode a series
+     * paramtr: series (IN): the series
+     *          points (OUT): room for SERIES_MAX_POINTS points
+     * returns: the number of points
+     */
+    const uint8_t *p = series->data;
+    SeriesPoint last;
+    memset(&last, 0, sizeof(last));
+    for (uint32_t i = 0; i < series->npoints; i++) {
+        last.time += getDelta(&p);
+        last.utime += getDelta(&p);
+        last.stime += getDelta(&p);
+        last.rss += getDelta(&p);
+        last.read_bytes += getDelta(&p);
+        last.write_bytes += getDelta(&p);
+        points[i] = last;
+    }
+    return series->npoints;
+}
+
+#endif /* HAS_PTRACE */
@@ -0,0 +1,74 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _SAMPLER_H
+#define _SAMPLER_H
+
+#include "ptrace.h"
+
+#ifdef HAS_PTRACE
+
+#include <stdint.h>
+
+#include "procinfo.h"
+
+/* State of one descriptor of a process between two samples */
+typedef struct {
+    FileInfo *file;         /* File open on the descriptor, or NULL */
+    uint64_t ino;           /* Inode of the file */
+    uint64_t pos;           /* Offset at the last sample */
+    uint32_t seen;          /* Sample in which the descriptor was last seen */
+    int write;              /* Was the file opened for writing? */
+} FileSample;
+
+/* One point of the resource usage series of a process */
+typedef struct {
+    uint64_t time;          /* Milliseconds since the process started */
+    uint64_t utime;         /* Time in user mode in milliseconds */
+    uint64_t stime;         /* Time in kernel mode in milliseconds */
+    uint64_t rss;           /* Peak resident size since the last point in KB */
+    uint64_t read_bytes;    /* File bytes read so far */
+    uint64_t write_bytes;   /* File bytes written so far */
+} SeriesPoint;
+
+/* Most points kept for a process. When a series is full, pairs of
+ * neighbouring points are merged and from then on only every other
+ * sample is kept, so a long running process has a coarser series
+ * instead of a longer one. */
+#define SERIES_MAX_POINTS 64
+
+/* Points are stored as variable length deltas from the previous point */
+struct _SampleSeries {
+    uint32_t npoints;       /* Number of points in data */
+    uint32_t stride;        /* Samples per point */
+    uint32_t pending;       /* Samples since the last point that was kept */
+    uint32_t size;          /* Bytes used in data */
+    uint32_t capacity;      /* Bytes allocated for data */
+    uint8_t *data;
+    uint64_t pending_rss;   /* Peak rss of the samples since the last point */
+    SeriesPoint last;       /* Last point, the base of the next delta */
+};
+
+double getSampleInterval();
+double getSeriesInterval();
+int startSampleTimer(double interval);
+void stopSampleTimer();
+int sampleDue();
+int sampleFileInfo(ProcInfo *p, int initial);
+int addSeriesPoint(ProcInfo *p, const SeriesPoint *point, int final);
+int readSeries(const SampleSeries *series, SeriesPoint *points);
+
+#endif /* HAS_PTRACE */
+
+#endif /* _SAMPLER_H */
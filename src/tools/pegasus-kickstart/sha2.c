@@ -81,6 +81,7 @@
 
 #include "sha2.h"
 #include "brg_endian.h"
+#include "sha256x86.h"
 
 #if defined(__cplusplus)
 extern "C"
@@ -308,6 +309,23 @@ VOID_RETURN sha256_hash(const unsigned char data[], unsigned long len, sha256_ct
     if((ctx->count[0] += len) < len)
         ++(ctx->count[1]);
 
+#if defined(HAS_SHA256_X86)
+    /* complete a partial block, then hash whole blocks directly from */
+    /* data[] if the CPU has the SHA extensions                        */
+    if(pos && len >= space)
+    {
+        memcpy(((unsigned char*)ctx->wbuf) + pos, sp, space);
+        sp += space; len -= space; space = SHA256_BLOCK_SIZE; pos = 0;
+        bsw_32(ctx->wbuf, SHA256_BLOCK_SIZE >> 2)
+        sha256_compile(ctx);
+    }
+    if(!pos)
+    {   unsigned long done = (unsigned long)sha256_x86_blocks(ctx->hash, sp,
+                                len / SHA256_BLOCK_SIZE) * SHA256_BLOCK_SIZE;
+        sp += done; len -= done;
+    }
+#endif
+
     while(len >= space)     /* tranfer whole blocks while possible  */
     {
         memcpy(((unsigned char*)ctx->wbuf) + pos, sp, space);
@@ -0,0 +1,114 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#include "sha256x86.h"
+
+#ifdef HAS_SHA256_X86
+
+#include <cpuid.h>
+#include <immintrin.h>
+
+/* Round constants from sha2.c */
+extern const uint32_t k256[64];
+
+/* -1 if not checked yet, 0 or 1 afterwards */
+static int sha_ext = -1;
+
+static int has_sha_ext() {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx)) {
+        return 0;
+    }
+    /* SSSE3 and SSE4.1 */
+    if (!(ecx & (1 << 9)) || !(ecx & (1 << 19))) {
+        return 0;
+    }
+    if (__get_cpuid_max(0, NULL) < 7) {
+        return 0;
+    }
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    /* SHA */
+    return (ebx & (1 << 29)) != 0;
+}
+
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha256_ni(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+    /* The instructions want the state as ABEF and CDGH */
+    __m128i tmp = _mm_loadu_si128((const __m128i *)&state[0]);
+    __m128i state1 = _mm_loadu_si128((const __m128i *)&state[4]);
+    tmp = _mm_shuffle_epi32(tmp, 0xB1);
+    state1 = _mm_shuffle_epi32(state1, 0x1B);
+    __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+    state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+    while (blocks--) {
+        __m128i abef = state0;
+        __m128i cdgh = state1;
+        __m128i w[4];
+
+        for (int i = 0; i < 4; i++) {
+            w[i] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(data + 16 * i)), MASK);
+        }
+
+        /* 16 groups of 4 rounds. w holds the last four groups of the
+         * message schedule, w[i & 3] is the current one. */
+        for (int i = 0; i < 16; i++) {
+            if (i >= 4) {
+                __m128i m = _mm_sha256msg1_epu32(w[i & 3], w[(i + 1) & 3]);
+                m = _mm_add_epi32(m, _mm_alignr_epi8(w[(i + 3) & 3], w[(i + 2) & 3], 4));
+                w[i & 3] = _mm_sha256msg2_epu32(m, w[(i + 3) & 3]);
+            }
+            __m128i msg = _mm_add_epi32(w[i & 3], _mm_loadu_si128((const __m128i *)&k256[4 * i]));
+            state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+            msg = _mm_shuffle_epi32(msg, 0x0E);
+            state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+        }
+
+        state0 = _mm_add_epi32(state0, abef);
+        state1 = _mm_add_epi32(state1, cdgh);
+        data += 64;
+    }
+
+    tmp = _mm_shuffle_epi32(state0, 0x1B);
+    state1 = _mm_shuffle_epi32(state1, 0xB1);
+    state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+    state1 = _mm_alignr_epi8(state1, tmp, 8);
+    _mm_storeu_si128((__m128i *)&state[0], state0);
+    _mm_storeu_si128((__m128i *)&state[4], state1);
+}
+
+size_t sha256_x86_blocks(uint32_t state[8], const unsigned char *data, size_t blocks) {
+    /* purpose: hash whole 64-byte blocks with the SHA extensions
+     * paramtr: state (IO): hash state, as in sha256_ctx
+     *          data (IN): message blocks, in the original byte order
+     *          blocks (IN): number of blocks in data
+     * returns: the number of blocks that were hashed, which is 0 if
+     *          the CPU does not have the SHA extensions
+     */
+    int ext = __atomic_load_n(&sha_ext, __ATOMIC_RELAXED);
+    if (ext < 0) {
+        ext = has_sha_ext();
+        __atomic_store_n(&sha_ext, ext, __ATOMIC_RELAXED);
+    }
+    if (!ext || blocks == 0) {
+        return 0;
+    }
+
+    sha256_ni(state, data, blocks);
+    return blocks;
+}
+
+#endif /* HAS_SHA256_X86 */
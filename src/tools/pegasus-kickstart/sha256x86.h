@@ -0,0 +1,34 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _SHA256X86_H
+#define _SHA256X86_H
+
+/* SHA-256 block function that uses the SHA extensions of x86 CPUs. It is
+ * used by sha256_hash in sha2.c for whole blocks when the CPU supports it.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && \
+    (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9) || defined(__clang__))
+#define HAS_SHA256_X86
+#endif
+
+#ifdef HAS_SHA256_X86
+extern size_t sha256_x86_blocks(uint32_t state[8], const unsigned char *data, size_t blocks);
+#endif
+
+#endif /* _SHA256X86_H */
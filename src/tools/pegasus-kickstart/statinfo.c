@@ -26,13 +26,34 @@
 #include <fcntl.h>
 #include <grp.h>
 #include <pwd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
 
 #include "statinfo.h"
 #include "utils.h"
 #include "checksum.h"
+#include "uring.h"
 #include "error.h"
 
 size_t data_section_size = 262144ul;
+size_t capture_memory_size = 0;
+
+/* Upper limit for the number of threads used by initStatInfoList. A stat
+ * waits on the file system, not on the CPU, so this does not depend on
+ * the number of CPUs. */
+#define STAT_MAX_THREADS 16
+
+/* Below this number of files, starting threads costs more than it saves */
+#define STAT_MIN_PARALLEL 8
+
+typedef struct {
+    StatInfo* infos;
+    const char** names;
+    size_t n;
+    size_t next;                  /* next record to initialize */
+    int stat;                     /* initialize the records */
+    int resolve;                  /* resolve the real paths */
+} StatBatch;
 
 int forcefd(const StatInfo* info, int fd) {
     /* purpose: force open a file on a certain fd
@@ -140,6 +161,141 @@ error:
     return -1;
 }
 
+int initStatInfoAsMemory(StatInfo* statinfo, char* pattern) {
+    /* purpose: Initialize a stat info buffer with an anonymous memory file,
+     *          or with a temporary file if that is not possible
+     * paramtr: statinfo (OUT): the newly initialized buffer
+     *          pattern (IO): mkstemp() pattern for the temporary file
+     * returns: a value of -1 indicates an error
+     */
+#ifdef SYS_memfd_create
+    char name[64];
+    const char* base = strrchr(pattern, '/');
+    size_t len;
+    int fd, flags;
+
+    if (capture_memory_size == 0) {
+        return initStatInfoAsTemp(statinfo, pattern);
+    }
+
+    base = (base == NULL ? pattern : base + 1);
+    fd = syscall(SYS_memfd_create, base, 0);
+    if (fd < 0) {
+        return initStatInfoAsTemp(statinfo, pattern);
+    }
+
+    memset(statinfo, 0, sizeof(StatInfo));
+
+    /* same modes as a temporary file, see above */
+    flags = fcntl(fd, F_GETFL);
+    if (flags != -1) {
+        fcntl(fd, F_SETFL, flags | O_APPEND);
+    }
+    flags = fcntl(fd, F_GETFD);
+    if (flags != -1) {
+        fcntl(fd, F_SETFD, flags | FD_CLOEXEC);
+    }
+
+    /* the name is only shown in the record, the file has no path */
+    len = strcspn(base, "X");
+    while (len > 0 && base[len-1] == '.') {
+        len--;
+    }
+    snprintf(name, sizeof(name), "memfd:%.*s", (int) len, base);
+    statinfo->source = IS_TEMP;
+    statinfo->file.descriptor = fd;
+    statinfo->file.name = strdup(name);
+    statinfo->spill = strdup(pattern);
+    if (statinfo->file.name == NULL || statinfo->spill == NULL) {
+        printerr("strdup: %s\n", strerror(errno));
+        goto error;
+    }
+
+    errno = 0;
+    if (fstat(fd, &statinfo->info) < 0) {
+        printerr("fstat: %s\n", strerror(errno));
+        goto error;
+    }
+
+    return 0;
+
+error:
+    statinfo->source = IS_INVALID;
+    statinfo->error = errno;
+
+    return -1;
+#else
+    return initStatInfoAsTemp(statinfo, pattern);
+#endif
+}
+
+int spillStatInfo(StatInfo* statinfo) {
+    /* purpose: move a memory file that has grown beyond capture_memory_size
+     *          to a temporary file. The descriptor number does not change,
+     *          so the next job writes to the temporary file.
+     * paramtr: statinfo (IO): the buffer to check
+     * returns: 1 if the file was moved, 0 if not, -1 on error
+     */
+    char buffer[65536];
+    struct stat st;
+    off_t offset = 0;
+    ssize_t rsize;
+    char* filename;
+    int fd, flags;
+
+    if (statinfo->source != IS_TEMP || statinfo->spill == NULL ||
+        fstat(statinfo->file.descriptor, &st) != 0 ||
+        (size_t) st.st_size <= capture_memory_size) {
+        return 0;
+    }
+
+    fd = mkstemp(statinfo->spill);
+    if (fd < 0) {
+        printerr("mkstemp: %s\n", strerror(errno));
+        return -1;
+    }
+
+    while ((rsize = pread(statinfo->file.descriptor, buffer, sizeof(buffer), offset)) > 0) {
+        ssize_t wsize, done = 0;
+        while (done < rsize && (wsize = write(fd, buffer + done, rsize - done)) > 0) {
+            done += wsize;
+        }
+        if (done < rsize) {
+            rsize = -1;
+            break;
+        }
+        offset += rsize;
+    }
+    if (rsize < 0) {
+        printerr("Unable to move %s to %s: %s\n", statinfo->file.name,
+                 statinfo->spill, strerror(errno));
+        close(fd);
+        unlink(statinfo->spill);
+        return -1;
+    }
+
+    /* replace the memory file, which frees its pages */
+    flags = fcntl(fd, F_GETFL);
+    if (flags != -1) {
+        fcntl(fd, F_SETFL, flags | O_APPEND);
+    }
+    if (dup2(fd, statinfo->file.descriptor) < 0) {
+        printerr("dup2: %s\n", strerror(errno));
+        close(fd);
+        unlink(statinfo->spill);
+        return -1;
+    }
+    close(fd);
+    fcntl(statinfo->file.descriptor, F_SETFD, FD_CLOEXEC);
+
+    filename = statinfo->spill;
+    statinfo->spill = NULL;
+    free((void*) statinfo->file.name);
+    statinfo->file.name = filename;
+
+    return 1;
+}
+
 static int preserveFile(const char* fn) {
     /* purpose: preserve the given file by renaming it with a backup extension.
      * paramtr: fn (IN): name of the file
@@ -295,6 +451,89 @@ int updateStatInfo(StatInfo* statinfo) {
     return result;
 }
 
+static int initStatInfoUring(StatInfo* infos, const char** names, size_t n) {
+    /* purpose: initialize the records like initStatInfoFromName, with
+     *          batches of io_uring requests instead of threads
+     * returns: 0, or -1 if io_uring is not available */
+    UringStat* results = calloc(n, sizeof(UringStat));
+    size_t i;
+
+    if (results == NULL || uringStatFiles(names, n, results) != 0) {
+        free(results);
+        return -1;
+    }
+    for (i = 0; i < n; i++) {
+        StatInfo* info = infos + i;
+        memset(info, 0, sizeof(StatInfo));
+        info->source = IS_FILE;
+        info->file.descriptor = O_RDONLY;
+        info->file.name = strdup(names[i]);
+        if (info->file.name == NULL) {
+            printerr("strdup: %s\n", strerror(errno));
+            info->error = errno;
+            continue;
+        }
+        info->info = results[i].info;
+        info->error = results[i].error;
+    }
+    free(results);
+    return 0;
+}
+
+static void* statBatchThread(void* arg) {
+    StatBatch* batch = (StatBatch*) arg;
+    size_t i;
+    while ((i = __sync_fetch_and_add(&batch->next, 1)) < batch->n) {
+        if (batch->stat) {
+            initStatInfoFromName(batch->infos+i, batch->names[i], O_RDONLY, 0);
+        }
+        if (batch->resolve) {
+            batch->infos[i].real = realpath(batch->names[i], NULL);
+        }
+    }
+    return NULL;
+}
+
+void initStatInfoList(StatInfo* infos, const char** names, size_t n,
+                      int resolve) {
+    /* purpose: initialize stat info buffers for many files at once. The
+     *          files are stat'ed with batches of io_uring requests, or by
+     *          a few threads, so that the round trips to a remote file
+     *          system overlap.
+     * paramtr: infos (OUT): n buffers to initialize, in the order of names
+     *          names (IN): the filenames to stat
+     *          n (IN): number of files
+     *          resolve (IN): whether to also resolve the real path of each
+     *                        file, for records that are printed right away
+     */
+    pthread_t threads[STAT_MAX_THREADS];
+    StatBatch batch = { infos, names, n, 0, 1, resolve };
+    size_t nthreads = 0, started, i;
+
+    if (n >= STAT_MIN_PARALLEL && initStatInfoUring(infos, names, n) == 0) {
+        /* only realpath is left, which io_uring cannot do */
+        batch.stat = 0;
+        if (!resolve) {
+            return;
+        }
+    }
+    if (n >= STAT_MIN_PARALLEL) {
+        nthreads = n < STAT_MAX_THREADS ? n : STAT_MAX_THREADS;
+    }
+    for (started = 0; started < nthreads; started++) {
+        if (pthread_create(&threads[started], NULL, statBatchThread, &batch) != 0) {
+            break;
+        }
+    }
+    /* If no thread was started, do the work here */
+    if (started == 0) {
+        statBatchThread(&batch);
+    }
+    for (i = 0; i < started; i++) {
+        pthread_join(threads[i], NULL);
+    }
+}
+
 int initStatInfoFromHandle(StatInfo* statinfo, int descriptor) {
     /* purpose: Initialize a stat info buffer with a filename to point to
      * paramtr: statinfo (OUT): the newly initialized buffer
@@ -341,6 +580,37 @@ int addLFNToStatInfo(StatInfo* info, const char* lfn) {
     return 0;
 }
 
+/* The files of a job usually all belong to the same user and group, and
+ * every lookup can be a round trip to a directory service, so the last
+ * answer is remembered. */
+static const char* userName(uid_t uid) {
+    static int valid = 0;
+    static uid_t last;
+    static char* name = NULL;
+    if (!valid || uid != last) {
+        struct passwd* pw = getpwuid(uid);
+        free(name);
+        name = pw ? strdup(pw->pw_name) : NULL;
+        last = uid;
+        valid = 1;
+    }
+    return name;
+}
+
+static const char* groupName(gid_t gid) {
+    static int valid = 0;
+    static gid_t last;
+    static char* name = NULL;
+    if (!valid || gid != last) {
+        struct group* gr = getgrgid(gid);
+        free(name);
+        name = gr ? strdup(gr->gr_name) : NULL;
+        last = gid;
+        valid = 1;
+    }
+    return name;
+}
+
 size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
                         const StatInfo* info, int includeData, int useCDATA,
                         int allowTruncate) {
@@ -365,7 +635,7 @@ size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
     }
 
     if (info->error != 0) {
-        fprintf(out, "%*serror: %d\n", indent+2, "", info->error);
+        yamlint(out, indent+2, "error", info->error);
     }
     if (info->lfn != NULL) {
         fprintf(out, "%*slfn: \"%s\"\n", indent+2, "", info->lfn);
@@ -408,8 +678,9 @@ size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
             break;
 
         case IS_FILE: /* <file> element */
-            real = realpath(info->file.name, NULL);
-            fprintf(out, "%*sfile_name: %s\n", indent+2, "", real ? real : info->file.name);
+            real = info->real ? NULL : realpath(info->file.name, NULL);
+            yamlstr(out, indent+2, "file_name",
+                    info->real ? info->real : real ? real : info->file.name);
             if (real) {
                 free((void*) real);
             }
@@ -429,39 +700,39 @@ size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
     if (info->error == 0 && info->source != IS_INVALID) {
         /* <stat> subrecord */
         char my[32];
-        struct passwd* user = getpwuid(info->info.st_uid);
-        struct group* group = getgrgid(info->info.st_gid);
+        const char* user = userName(info->info.st_uid);
+        const char* group = groupName(info->info.st_gid);
 
         fprintf(out, "%*smode: 0o%o\n", indent+2, "", info->info.st_mode);
 
         /* Grmblftz, are we in 32bit, 64bit LFS on 32bit, or 64bit on 64 */
         sizer(my, sizeof(my), sizeof(info->info.st_size), &info->info.st_size);
-        fprintf(out, "%*ssize: %s\n", indent+2, "", my);
+        yamlstr(out, indent+2, "size", my);
 
         sizer(my, sizeof(my), sizeof(info->info.st_ino), &info->info.st_ino);
-        fprintf(out, "%*sinode: %s\n", indent+2, "", my);
+        yamlstr(out, indent+2, "inode", my);
 
         sizer(my, sizeof(my), sizeof(info->info.st_nlink), &info->info.st_nlink);
-        fprintf(out, "%*snlink: %s\n", indent+2, "", my);
+        yamlstr(out, indent+2, "nlink", my);
 
         sizer(my, sizeof(my), sizeof(info->info.st_blksize), &info->info.st_blksize);
-        fprintf(out, "%*sblksize: %s\n", indent+2, "", my);
+        yamlstr(out, indent+2, "blksize", my);
 
         /* st_blocks is new in iv-1.8 */
         sizer(my, sizeof(my), sizeof(info->info.st_blocks), &info->info.st_blocks);
-        fprintf(out, "%*sblocks: %s\n", indent+2, "", my);
+        yamlstr(out, indent+2, "blocks", my);
 
-        fprintf(out, "%*smtime: %s\n", indent+2, "", fmtisodate(info->info.st_mtime, -1));
-        fprintf(out, "%*satime: %s\n", indent+2, "", fmtisodate(info->info.st_atime, -1));
-        fprintf(out, "%*sctime: %s\n", indent+2, "", fmtisodate(info->info.st_ctime, -1));
+        yamlstr(out, indent+2, "mtime", fmtisodate(info->info.st_mtime, -1));
+        yamlstr(out, indent+2, "atime", fmtisodate(info->info.st_atime, -1));
+        yamlstr(out, indent+2, "ctime", fmtisodate(info->info.st_ctime, -1));
 
-        fprintf(out, "%*suid: %d\n", indent+2, "", info->info.st_uid);
+        yamlint(out, indent+2, "uid", (int) info->info.st_uid);
         if (user) {
-            fprintf(out, "%*suser: %s\n", indent+2, "", user->pw_name);
+            yamlstr(out, indent+2, "user", user);
         }
-        fprintf(out, "%*sgid: %d\n", indent+2, "", info->info.st_gid);
+        yamlint(out, indent+2, "gid", (int) info->info.st_gid);
         if (group) {
-            fprintf(out, "%*sgroup: %s\n", indent+2, "", group->gr_name);
+            yamlstr(out, indent+2, "group", group);
         }
     }
 
@@ -472,10 +743,10 @@ size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
          fprintf(out, "%*soutput: True\n", indent+2, "");
         size_t result = 0;
         char chksum_xml[2048];
-        real = realpath(info->file.name, NULL);
-        result = pegasus_integrity_yaml(real, chksum_xml);
+        real = info->real ? NULL : realpath(info->file.name, NULL);
+        result = pegasus_integrity_yaml(info->real ? info->real : real, chksum_xml);
         if (result == 1) {
-            fprintf(out, "%s", chksum_xml);
+            fputs(chksum_xml, out);
         }
         else {
             fprintf(out, "%*sintegrity_error: failed creating a checksum\n", indent+2, "");
@@ -507,12 +778,16 @@ size_t printYAMLStatInfo(FILE *out, int indent, const char* id,
         fprintf(out, "%*sdata: |\n", indent+2, "");
         if (fsize > 0) {
             /* initial indent */
-            fprintf(out, "%*s", indent+4, "");
+            yamlindent(out, indent+4);
 
             wint_t c;
             size_t ccount = 0;
             size_t cskip = 0;
-            int fd = dup(info->file.descriptor);
+            int fd = -1;
+            /* single pass over the file, if the encoding is supported */
+            if (yamltail(info->file.descriptor, out, indent+4, dsize) != 0) {
+                fd = dup(info->file.descriptor);
+            }
             if (fd != -1) {
                 /* as utf8 can be multibyte, we have to walk the file twice - once
                 * to figure out how many characters to skip, and once to output */
@@ -551,13 +826,23 @@ void deleteStatInfo(StatInfo* statinfo) {
 
         if (statinfo->source == IS_TEMP || statinfo->source == IS_FIFO) {
             close(statinfo->file.descriptor);
-            unlink(statinfo->file.name);
+            if (statinfo->spill == NULL) {
+                unlink(statinfo->file.name);
+            }
+        }
+        if (statinfo->spill) {
+            free(statinfo->spill);
+            statinfo->spill = NULL;
         }
 
         if (statinfo->file.name) {
             free((void*) statinfo->file.name);
             statinfo->file.name = NULL; /* avoid double free */
         }
+        if (statinfo->real) {
+            free((void*) statinfo->real);
+            statinfo->real = NULL;
+        }
     }
 
     /* invalidate */
@@ -45,15 +45,26 @@ typedef struct {
     } client;
     struct stat info;
     const char* lfn;              /* from -s/-S option */
+    const char* real;             /* IS_FILE: resolved name, if known */
+    char* spill;                  /* IS_TEMP in memory: mkstemp() pattern */
 } StatInfo;
 
 /* size of the <data> section returned for stdout and stderr. */
 extern size_t data_section_size;
 
+/* stdout and stderr of the jobs are kept in memory up to this size,
+ * and moved to a temporary file after the job that exceeds it. Zero,
+ * the default, always uses temporary files. */
+extern size_t capture_memory_size;
+
 extern int forcefd(const StatInfo* info, int fd);
 extern int initStatInfoAsTemp(StatInfo* statinfo, char* pattern);
+extern int initStatInfoAsMemory(StatInfo* statinfo, char* pattern);
+extern int spillStatInfo(StatInfo* statinfo);
 extern int initStatInfoFromName(StatInfo* statinfo, const char* filename,
                                 int openmode, int flag);
+extern void initStatInfoList(StatInfo* infos, const char** names, size_t n,
+                             int resolve);
 extern int initStatInfoFromHandle(StatInfo* statinfo, int descriptor);
 extern int updateStatInfo(StatInfo* statinfo);
 extern int addLFNToStatInfo(StatInfo* info, const char* lfn);
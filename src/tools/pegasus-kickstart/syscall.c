@@ -5,8 +5,13 @@
 #include <dirent.h>
 #include <sys/stat.h>
 #include <errno.h>
+#include <limits.h>
+#include <stddef.h>
+#include <sys/prctl.h>
+#include <sys/syscall.h>
 
 #include "syscall.h"
+#include "uring.h"
 #include "error.h"
 
 #ifdef HAS_PTRACE
@@ -20,9 +25,22 @@
 # include <linux/net.h> /* for SYS_SOCKET, etc subcalls */
 #endif
 
+/* seccomp filters that can return SECCOMP_RET_TRACE appeared in 3.5 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3,5,0)
+# include <linux/filter.h>
+# include <linux/seccomp.h>
+# include <linux/audit.h>
+# include <linux/capability.h>
+# define HAS_SECCOMP_FILTER
+# ifdef __i386__
+#  define SC_AUDIT_ARCH AUDIT_ARCH_I386
+# else
+#  define SC_AUDIT_ARCH AUDIT_ARCH_X86_64
+# endif
+#endif
+
 /* TODO Unit tests
  * Multiple threads (verify I/O correct and reported)
- * Lots of files (verify data structure performance)
  * Sockets and other funny descriptors (verify no errors)
  * Open the same file twice (with and without closing in-between)
  */
@@ -30,7 +48,6 @@
 /* TODO
  * Improve error handling for each function
  * Handle failures gracefully by untracing the children
- * Develop better data structures for the file lookup and descriptor table
  * Stat on file open and close (verify reopens too)?
  * Handle file access modes (read, write, append, create, delete)
  * Check max file path length
@@ -40,29 +57,19 @@
  * Filter out /proc, /lib*, /usr/lib*, /etc, ... ? Or optionally?
  */
 
-static void addFileInfo(ProcInfo *c, FileInfo *f) {
-    if (c->files == NULL) {
-        c->files = f;
-        return;
+static void setFileInfo(ProcInfo *c, long fd, FileInfo *file) {
+    FileInfo **slot = NULL;
+    if (fd >= 0 && fd <= INT_MAX) {
+        slot = (FileInfo **)getFDEntry(&c->fds, fd);
     }
-
-    FileInfo *i;
-    for (i=c->files; i->next!=NULL; i=i->next);
-    i->next = f;
-    f->next = NULL;
-}
-
-static FileInfo *findFileInfo(ProcInfo *c, char *filename) {
-    FileInfo *i;
-    for (i=c->files; i!=NULL; i=i->next) {
-        if (strcmp(i->filename, filename) == 0) {
-            return i;
-        }
+    if (slot == NULL) {
+        printerr("WARNING: Unable to track descriptor %ld of process %d\n", fd, c->pid);
+        return;
     }
-    return NULL;
+    *slot = file;
 }
 
-static FileInfo *openFileInfo(ProcInfo *c, int fd, char *filename) {
+static FileInfo *openFileInfo(ProcInfo *c, long fd, char *filename) {
     // If we have opened it before, then get it
     FileInfo *file = findFileInfo(c, filename);
 
@@ -78,33 +85,29 @@ static FileInfo *openFileInfo(ProcInfo *c, int fd, char *filename) {
             printerr("strdup: %s\n", strerror(errno));
             exit(1);
         }
-        addFileInfo(c, file);
-    }
-
-    // XXX Fix with dynamic array
-    if (fd >= 1024) {
-        printerr("ERROR: Too many file descriptors (>1024) for process %d\n", c->pid);
-        exit(1);
+        if (addFileInfo(c, file) < 0) {
+            exit(1);
+        }
     }
 
     // Update the descriptor table
-    c->fds[fd] = file;
+    setFileInfo(c, fd, file);
     return file;
 }
 
-static FileInfo *getFileInfo(ProcInfo *c, int fd) {
-    // XXX Fix with dynamic array
-    if (fd >= 1024) {
-        printerr("ERROR: Too many file descriptors (>1024) for process %d\n", c->pid);
-        exit(1);
+static FileInfo *getFileInfo(ProcInfo *c, long fd) {
+    if (fd < 0 || fd > INT_MAX) {
+        return NULL;
     }
-
-    return c->fds[fd];
+    FileInfo **slot = (FileInfo **)findFDEntry(&c->fds, fd);
+    return slot == NULL ? NULL : *slot;
 }
 
-static FileInfo *closeFileInfo(ProcInfo *c, int fd) {
+static FileInfo *closeFileInfo(ProcInfo *c, long fd) {
     FileInfo *file = getFileInfo(c, fd);
-    c->fds[fd] = NULL;
+    if (file != NULL) {
+        setFileInfo(c, fd, NULL);
+    }
     return file;
 }
 
@@ -145,9 +148,48 @@ int initFileInfo(ProcInfo *c) {
     return 0;
 }
 
+/* Below this number of files, finiFileInfo uses plain stat calls */
+#define FINI_MIN_BATCH 8
+
+static int finiFileInfoUring(ProcInfo *c) {
+    /* purpose: update the file sizes with one batch of statx requests
+     * returns: 0, or -1 if io_uring is not available */
+    FileInfo *i;
+    size_t n = 0, j;
+    for (i = c->files; i != NULL; i = i->next) {
+        n++;
+    }
+    if (n < FINI_MIN_BATCH) {
+        return -1;
+    }
+
+    const char **names = malloc(n * sizeof(char *));
+    UringStat *results = malloc(n * sizeof(UringStat));
+    int rc = -1;
+    if (names != NULL && results != NULL) {
+        for (i = c->files, j = 0; i != NULL; i = i->next, j++) {
+            names[j] = i->filename;
+        }
+        rc = uringStatFiles(names, n, results);
+        if (rc == 0) {
+            for (i = c->files, j = 0; i != NULL; i = i->next, j++) {
+                if (results[j].error == 0) {
+                    i->size = results[j].info.st_size;
+                }
+            }
+        }
+    }
+    free(names);
+    free(results);
+    return rc;
+}
+
 int finiFileInfo(ProcInfo *c) {
     FileInfo *i;
     struct stat s;
+    if (finiFileInfoUring(c) == 0) {
+        return 0;
+    }
     for (i = c->files; i != NULL; i = i->next) {
         int rc = stat(i->filename, &s);
         if (rc == 0) {
@@ -231,7 +273,7 @@ static int handle_dup(ProcInfo *c) {
     long rc = c->sc_rval;
     if (DEBUG_SYSCALL) fprintf(stderr, "PID %d: dup(%ld) = %ld\n", c->pid, oldfd, newfd);
     if (rc >= 0) {
-        c->fds[newfd] = closeFileInfo(c, oldfd);
+        setFileInfo(c, newfd, closeFileInfo(c, oldfd));
     }
     return 0;
 }
@@ -242,7 +284,7 @@ static int handle_dup2(ProcInfo *c) {
     long rc = c->sc_rval;
     if (DEBUG_SYSCALL) fprintf(stderr, "PID %d: dup2(%ld, %ld) = %ld\n", c->pid, oldfd, newfd, rc);
     if (rc >= 0) {
-        c->fds[newfd] = closeFileInfo(c, oldfd);
+        setFileInfo(c, newfd, closeFileInfo(c, oldfd));
     }
     return 0;
 }
@@ -256,4 +298,109 @@ const struct syscallent syscalls[] = {
 #endif
 };
 
+#ifdef HAS_SECCOMP_FILTER
+/* Did the user ask for the filter even if it needs no_new_privs? */
+static int filterOptIn() {
+    char *env = getenv("KICKSTART_SYSCALL_FILTER");
+    return env != NULL && strcmp(env, "0") != 0;
+}
+
+/* Can this process install a seccomp filter without setting the
+ * no_new_privs flag? That requires CAP_SYS_ADMIN, or the flag is
+ * already set anyway. */
+static int filterWithoutNoNewPrivs() {
+    if (prctl(PR_GET_NO_NEW_PRIVS, 0, 0, 0, 0) == 1) {
+        return 1;
+    }
+
+    FILE *status = fopen("/proc/self/status", "r");
+    if (status == NULL) {
+        return 0;
+    }
+    char line[256];
+    unsigned long long caps = 0;
+    while (fgets(line, sizeof(line), status) != NULL) {
+        if (sscanf(line, "CapEff: %llx", &caps) == 1) {
+            break;
+        }
+    }
+    fclose(status);
+
+    return (caps >> CAP_SYS_ADMIN) & 1;
+}
+#endif
+
+int useSyscallFilter() {
+    /* purpose: decide whether the system calls of the job should be
+     *          selected with a seccomp filter instead of stopping the job
+     *          on every system call with PTRACE_SYSCALL
+     * returns: 1 if the filter should be used, 0 otherwise
+     */
+#if defined(HAS_SECCOMP_FILTER) && defined(SYS_seccomp) && defined(SECCOMP_GET_ACTION_AVAIL)
+    char *env = getenv("KICKSTART_SYSCALL_FILTER");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        return 0;
+    }
+
+    /* This also requires Linux 4.14, which is newer than 4.8 where the
+     * seccomp stop was moved after the syscall-enter stop. The event loop
+     * relies on that order to get the system call exit stop. */
+    uint32_t action = SECCOMP_RET_TRACE;
+    if (syscall(SYS_seccomp, SECCOMP_GET_ACTION_AVAIL, 0, &action) != 0) {
+        return 0;
+    }
+
+    /* no_new_privs would stop setuid programs in the job from working,
+     * so by default the job is only filtered if that is not needed */
+    if (filterOptIn() || filterWithoutNoNewPrivs()) {
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+int installSyscallFilter() {
+    /* purpose: install a seccomp filter in the current process that
+     *          passes the system calls that have a handler to the tracer
+     *          and allows all others. This is called in the job right
+     *          before exec, and the filter is inherited by all children.
+     * returns: 0 on success, -1 on error
+     */
+#ifdef HAS_SECCOMP_FILTER
+    struct sock_filter filter[2 * (MAX_SYSCALL + 1) + 4];
+    int n = 0;
+
+    /* System calls of other architectures are not in the table */
+    filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, arch));
+    filter[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, SC_AUDIT_ARCH, 1, 0);
+    filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+
+    filter[n++] = (struct sock_filter) BPF_STMT(BPF_LD|BPF_W|BPF_ABS, offsetof(struct seccomp_data, nr));
+    for (int nr = 0; nr <= MAX_SYSCALL; nr++) {
+        if (syscalls[nr].handler != NULL) {
+            filter[n++] = (struct sock_filter) BPF_JUMP(BPF_JMP|BPF_JEQ|BPF_K, nr, 0, 1);
+            filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_TRACE);
+        }
+    }
+    filter[n++] = (struct sock_filter) BPF_STMT(BPF_RET|BPF_K, SECCOMP_RET_ALLOW);
+
+    struct sock_fprog prog = { .len = n, .filter = filter };
+
+    if (prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0) {
+        return 0;
+    }
+
+    /* Without CAP_SYS_ADMIN the filter requires no_new_privs, which is
+     * only set if the user asked for it */
+    if (errno == EACCES && filterOptIn() &&
+        prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) == 0 &&
+        prctl(PR_SET_SECCOMP, SECCOMP_MODE_FILTER, &prog) == 0) {
+        return 0;
+    }
+
+    printerr("Unable to install system call filter: %s\n", strerror(errno));
+#endif
+    return -1;
+}
+
 #endif
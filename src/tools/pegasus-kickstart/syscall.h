@@ -39,6 +39,8 @@ extern const struct syscallent syscalls[];
 
 int initFileInfo(ProcInfo *c);
 int finiFileInfo(ProcInfo *c);
+int useSyscallFilter();
+int installSyscallFilter();
 
 #define handle_none 0
 
@@ -0,0 +1,127 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+/* Memory footprint of the descriptor table used by the tracers.
+ *
+ * With no arguments it fills tables the way a traced process would and
+ * prints how much memory they use, both for the ptrace tracer (one pointer
+ * per descriptor) and for libinterpose (one Descriptor per descriptor).
+ *
+ * With "rss N" it opens N descriptors spread over the descriptor limit and
+ * prints the peak RSS of the process, so that it can be run with and
+ * without LD_PRELOAD=libinterpose.so.
+ */
+#include <sys/types.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "../fdtable.h"
+
+/* Same size as the Descriptor in interpose.c */
+#define DESCRIPTOR_SIZE 88
+
+static int maxfds;
+
+static void footprint(const char *label, int nfds, int spread) {
+    FDTable ptrace_fds = { sizeof(void *), 0, { NULL } };
+    FDTable interpose_fds = { DESCRIPTOR_SIZE, 0, { NULL } };
+
+    for (int i = 0; i < nfds; i++) {
+        int fd = spread ? (int)((long)i * (maxfds - 1) / (nfds > 1 ? nfds - 1 : 1)) : i;
+        getFDEntry(&ptrace_fds, fd);
+        getFDEntry(&interpose_fds, fd);
+    }
+
+    printf("%-28s ptrace %8zu bytes   libinterpose %9zu bytes\n", label,
+           sizeOfFDTable(&ptrace_fds), sizeOfFDTable(&interpose_fds));
+
+    deleteFDTable(&ptrace_fds);
+    deleteFDTable(&interpose_fds);
+}
+
+static long peak_rss(void) {
+    FILE *f = fopen("/proc/self/status", "r");
+    if (f == NULL) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        if (sscanf(line, "VmHWM: %ld", &kb) == 1) {
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
+static int rss(int nfds) {
+    struct rlimit nofile;
+    getrlimit(RLIMIT_NOFILE, &nofile);
+    long limit = nofile.rlim_cur;
+
+    int fd = open("/dev/null", O_RDONLY);
+    if (fd < 0) {
+        perror("open /dev/null");
+        return 1;
+    }
+
+    /* Spread the descriptors from 10 to the limit so that the sparse
+     * table has to allocate one chunk per descriptor in the worst case */
+    for (int i = 0; i < nfds; i++) {
+        long target = 10 + (long)i * (limit - 11) / (nfds > 1 ? nfds - 1 : 1);
+        int newfd = open("/dev/null", O_RDONLY);
+        if (newfd < 0) {
+            perror("open /dev/null");
+            return 1;
+        }
+        if (dup2(newfd, target) < 0) {
+            perror("dup2");
+            return 1;
+        }
+        close(newfd);
+    }
+
+    printf("limit %ld descriptors, %d open, peak RSS %ld KB\n", limit, nfds, peak_rss());
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc > 2 && strcmp(argv[1], "rss") == 0) {
+        return rss(atoi(argv[2]));
+    }
+
+    FDTable t = { sizeof(void *), 0, { NULL } };
+    initFDTable(&t, sizeof(void *));
+    maxfds = t.maxfds;
+    printf("descriptor limit %d, %d per chunk\n", t.maxfds, FDTABLE_CHUNK);
+    deleteFDTable(&t);
+
+    footprint("empty", 0, 0);
+    footprint("stdio only (3 fds)", 3, 0);
+    footprint("100 sequential fds", 100, 0);
+    footprint("1000 sequential fds", 1000, 0);
+    footprint("10000 sequential fds", 10000, 0);
+    footprint("16 fds spread over limit", 16, 1);
+
+    printf("previous fixed ptrace table: %zu bytes, at most 1024 fds\n",
+           1024 * sizeof(void *));
+
+    return 0;
+}
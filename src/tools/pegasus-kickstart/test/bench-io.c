@@ -0,0 +1,144 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+/* Microbenchmark for the per-call overhead of libinterpose. It does a
+ * large number of tiny write() and read() calls on a temporary file and
+ * reports the average time per call, followed by the less common calls
+ * that move data without a user buffer (preadv2, copy_file_range, mmap)
+ * and syscall(). Run it once normally and once with
+ * LD_PRELOAD=libinterpose.so to see what the tracing costs.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int main(int argc, char *argv[]) {
+    long calls = 1000000;
+    size_t bsize = 16;
+    if (argc > 1) {
+        calls = atol(argv[1]);
+    }
+    if (argc > 2) {
+        bsize = atol(argv[2]);
+    }
+    if (calls <= 0 || bsize <= 0 || bsize > 65536) {
+        fprintf(stderr, "Usage: %s [calls [blocksize]]\n", argv[0]);
+        return 1;
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench-io.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "mkstemp: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    unlink(path);
+
+    char *buf = calloc(1, bsize);
+
+    double start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        if (write(fd, buf, bsize) != (ssize_t)bsize) {
+            fprintf(stderr, "write: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    double wtime = now_ns() - start;
+
+    lseek(fd, 0, SEEK_SET);
+
+    start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        if (read(fd, buf, bsize) != (ssize_t)bsize) {
+            fprintf(stderr, "read: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    double rtime = now_ns() - start;
+
+    struct iovec iov = { buf, bsize };
+    start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        if (preadv2(fd, &iov, 1, i * bsize, 0) != (ssize_t)bsize) {
+            fprintf(stderr, "preadv2: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    double prtime = now_ns() - start;
+
+    /* copy into a second file, it grows by bsize per call */
+    snprintf(path, sizeof(path), "%s/bench-io.XXXXXX", tmpdir ? tmpdir : "/tmp");
+    int out = mkstemp(path);
+    if (out < 0) {
+        fprintf(stderr, "mkstemp: %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    unlink(path);
+    start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        off64_t off = i * bsize;
+        if (copy_file_range(fd, &off, out, NULL, bsize, 0) != (ssize_t)bsize) {
+            fprintf(stderr, "copy_file_range: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    double cptime = now_ns() - start;
+    close(out);
+
+    start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        void *map = mmap(NULL, bsize, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            fprintf(stderr, "mmap: %s\n", strerror(errno));
+            return 1;
+        }
+        munmap(map, bsize);
+    }
+    double mtime = now_ns() - start;
+
+    start = now_ns();
+    for (long i = 0; i < calls; i++) {
+        syscall(SYS_getppid);
+    }
+    double stime = now_ns() - start;
+
+    close(fd);
+    free(buf);
+
+    printf("write:           %8.1f ns/call\n", wtime / calls);
+    printf("read:            %8.1f ns/call\n", rtime / calls);
+    printf("preadv2:         %8.1f ns/call\n", prtime / calls);
+    printf("copy_file_range: %8.1f ns/call\n", cptime / calls);
+    printf("mmap+munmap:     %8.1f ns/call\n", mtime / calls);
+    printf("syscall:         %8.1f ns/call\n", stime / calls);
+
+    return 0;
+}
@@ -0,0 +1,137 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+
+/* Microbenchmark for the per-character overhead of the stdio wrappers in
+ * libinterpose. Each function writes and then reads back the same number
+ * of characters on a temporary file, and the average time per character
+ * is reported. The functions are called through pointers so that the
+ * compiler does not inline the _unlocked variants. Run it once normally
+ * and once with LD_PRELOAD=libinterpose.so to see what the tracing costs.
+ */
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <wchar.h>
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static const struct {
+    const char *name;
+    int (*put)(int, FILE *);
+    int (*get)(FILE *);
+} narrow[] = {
+    { "fputc/fgetc", fputc, fgetc },
+    { "putc/getc", putc, getc },
+    { "putc_unlocked/getc_unlocked", putc_unlocked, getc_unlocked },
+    { NULL, NULL, NULL }
+};
+
+static FILE *open_temp(const char *tmpdir) {
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/bench-stdio.XXXXXX", tmpdir);
+    int fd = mkstemp(path);
+    if (fd < 0) {
+        fprintf(stderr, "mkstemp: %s: %s\n", path, strerror(errno));
+        exit(1);
+    }
+    /* libinterpose traces the descriptor from mkstemp on */
+    FILE *f = fdopen(fd, "w+");
+    unlink(path);
+    return f;
+}
+
+int main(int argc, char *argv[]) {
+    long chars = 10000000;
+    if (argc > 1) {
+        chars = atol(argv[1]);
+    }
+    if (chars <= 0) {
+        fprintf(stderr, "Usage: %s [characters]\n", argv[0]);
+        return 1;
+    }
+
+    const char *tmpdir = getenv("TMPDIR");
+    if (tmpdir == NULL) {
+        tmpdir = "/tmp";
+    }
+
+    for (int i = 0; narrow[i].name != NULL; i++) {
+        FILE *f = open_temp(tmpdir);
+
+        double start = now_ns();
+        for (long n = 0; n < chars; n++) {
+            if (narrow[i].put('a' + n % 26, f) == EOF) {
+                fprintf(stderr, "%s: %s\n", narrow[i].name, strerror(errno));
+                return 1;
+            }
+        }
+        double wtime = now_ns() - start;
+
+        rewind(f);
+
+        start = now_ns();
+        for (long n = 0; n < chars; n++) {
+            if (narrow[i].get(f) == EOF) {
+                fprintf(stderr, "%s: unexpected end of file\n", narrow[i].name);
+                return 1;
+            }
+        }
+        double rtime = now_ns() - start;
+
+        fclose(f);
+        printf("%-28s %6.1f ns/put %6.1f ns/get\n", narrow[i].name,
+               wtime / chars, rtime / chars);
+    }
+
+    /* wide characters in the C locale are single bytes */
+    FILE *f = open_temp(tmpdir);
+    wint_t (*put)(wchar_t, FILE *) = fputwc;
+    wint_t (*get)(FILE *) = fgetwc;
+
+    double start = now_ns();
+    for (long n = 0; n < chars; n++) {
+        if (put(L'a' + n % 26, f) == WEOF) {
+            fprintf(stderr, "fputwc: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    double wtime = now_ns() - start;
+
+    rewind(f);
+
+    start = now_ns();
+    for (long n = 0; n < chars; n++) {
+        if (get(f) == WEOF) {
+            fprintf(stderr, "fgetwc: unexpected end of file\n");
+            return 1;
+        }
+    }
+    double rtime = now_ns() - start;
+
+    fclose(f);
+    printf("%-28s %6.1f ns/put %6.1f ns/get\n", "fputwc/fgetwc",
+           wtime / chars, rtime / chars);
+
+    return 0;
+}
@@ -0,0 +1,131 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+/* Cost of writing the <proc> section of an invocation record.
+ *
+ * Builds a synthetic tree of PROCS processes with FILES files each and a
+ * socket for every tenth process, and prints it with printYAMLProcInfo and
+ * printYAMLUseInfo REPEAT times into a stream with the same buffering as
+ * printAppInfo. With "dump" it writes
+ * the record once to stdout instead, so that the output of two builds can
+ * be compared.
+ */
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../procinfo.h"
+#include "../useinfo.h"
+#include "../utils.h"
+
+static ProcInfo *synthesize(int nprocs, int nfiles) {
+    ProcInfo *procs = NULL;
+    int i, j;
+    for (i = nprocs; i > 0; i--) {
+        ProcInfo *p = calloc(1, sizeof(ProcInfo));
+        char buf[256];
+        p->pid = 10000 + i;
+        p->ppid = 10000 + i / 2;
+        snprintf(buf, sizeof(buf), "/usr/local/bin/tool-%d", i % 17);
+        p->exe = strdup(buf);
+        snprintf(buf, sizeof(buf), "tool-%d --input \"in.%d\"\t--level=%d", i % 17, i, i % 9);
+        p->cmd = strdup(buf);
+        p->start = 1760000000.0 + i * 0.0123457;
+        p->stop = p->start + i * 0.5000004;
+        p->utime = i * 0.0015;
+        p->stime = i * 0.00025;
+        p->iowait = (i % 7) * 0.0105;
+        p->fin_threads = 1;
+        p->max_threads = 1 + i % 8;
+        p->tot_threads = 1 + i % 13;
+        p->vmpeak = 100000 + i * 37;
+        p->rsspeak = 20000 + i * 11;
+        p->rchar = (uint64_t) i * 123456789;
+        p->wchar = (uint64_t) i * 98765;
+        p->read_bytes = (uint64_t) i * 4096;
+        p->write_bytes = (uint64_t) i * 8192;
+        p->syscr = i * 3;
+        p->syscw = i * 5;
+        for (j = nfiles; j > 0; j--) {
+            FileInfo *f = calloc(1, sizeof(FileInfo));
+            snprintf(buf, sizeof(buf), "/scratch/run/%d/data.%d", i, j);
+            f->filename = strdup(buf);
+            f->size = f->bread = (uint64_t) j * 65536;
+            f->nread = j * 16;
+            f->next = p->files;
+            p->files = f;
+        }
+        if (i % 10 == 0) {
+            SockInfo *s = calloc(1, sizeof(SockInfo));
+            s->address = strdup("192.168.1.10");
+            s->port = 8000 + i;
+            s->brecv = (uint64_t) i * 1500;
+            s->nrecv = i;
+            p->sockets = s;
+        }
+        p->next = procs;
+        procs = p;
+    }
+    return procs;
+}
+
+int main(int argc, char **argv) {
+    int nprocs = argc > 2 ? atoi(argv[2]) : 1000;
+    int nfiles = argc > 3 ? atoi(argv[3]) : 10;
+    int repeat = argc > 4 ? atoi(argv[4]) : 20;
+    ProcInfo *procs = synthesize(nprocs, nfiles);
+    struct rusage use;
+    memset(&use, 0, sizeof(use));
+    use.ru_utime.tv_sec = 12;
+    use.ru_utime.tv_usec = 345678;
+    use.ru_stime.tv_usec = 4500;
+    use.ru_maxrss = 123456;
+    use.ru_minflt = 98765;
+    use.ru_nvcsw = 321;
+
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        printYAMLUseInfo(stdout, 2, "usage", &use);
+        printYAMLProcInfo(stdout, 4, procs);
+        return 0;
+    }
+
+    /* size of one record */
+    FILE *out = tmpfile();
+    printYAMLUseInfo(out, 2, "usage", &use);
+    printYAMLProcInfo(out, 4, procs);
+    long size = ftell(out) * repeat;
+    fclose(out);
+
+    out = fopen("/dev/null", "w");
+    setvbuf(out, NULL, _IOFBF, 1024*1024);
+    struct timeval start, stop;
+    int i;
+    gettimeofday(&start, NULL);
+    for (i = 0; i < repeat; i++) {
+        printYAMLUseInfo(out, 2, "usage", &use);
+        printYAMLProcInfo(out, 4, procs);
+    }
+    fflush(out);
+    gettimeofday(&stop, NULL);
+
+    double elapsed = doubletime(stop) - doubletime(start);
+    printf("%d procs, %d files: %.3f ms per record, %.1f MB/s\n",
+           nprocs, nfiles, elapsed * 1000 / repeat, size / elapsed / 1e6);
+    fclose(out);
+    deleteProcInfo(procs);
+    return 0;
+}
@@ -0,0 +1,143 @@
+#!/bin/bash
+# Microbenchmarks for kickstart and libinterpose. These are not run as
+# part of the regular tests because the numbers depend on the machine.
+
+cd "$(dirname "$0")"
+
+CC=${CC:-gcc}
+LIBINTERPOSE=$(cd .. && pwd)/libinterpose.so
+TMPDIR=${TMPDIR:-/tmp}
+export TMPDIR
+
+function build {
+    $CC -O2 -Wall -std=gnu99 -o "$1" "$1.c" "${@:2}" || exit 1
+}
+
+function bench_io {
+    build bench-io
+    CALLS=${BENCH_CALLS:-1000000}
+
+    echo "# I/O per-call overhead ($CALLS calls of 16 bytes)"
+    echo "untraced:"
+    ./bench-io $CALLS 16 | sed 's/^/    /'
+
+    if [ -f "$LIBINTERPOSE" ]; then
+        PREFIX=$(mktemp -d $TMPDIR/bench.XXXXXX)
+        echo "traced:"
+        LD_PRELOAD=$LIBINTERPOSE KICKSTART_PREFIX=$PREFIX/trace \
+            ./bench-io $CALLS 16 | sed 's/^/    /'
+        rm -rf "$PREFIX"
+    else
+        echo "traced: skipped, $LIBINTERPOSE not found"
+    fi
+}
+
+function bench_stdio {
+    build bench-stdio
+    CHARS=${BENCH_CHARS:-10000000}
+
+    echo "# stdio per-character overhead ($CHARS characters)"
+    echo "untraced:"
+    ./bench-stdio $CHARS | sed 's/^/    /'
+
+    if [ -f "$LIBINTERPOSE" ]; then
+        PREFIX=$(mktemp -d $TMPDIR/bench.XXXXXX)
+        echo "traced:"
+        LD_PRELOAD=$LIBINTERPOSE KICKSTART_PREFIX=$PREFIX/trace \
+            ./bench-stdio $CHARS | sed 's/^/    /'
+        rm -rf "$PREFIX"
+    else
+        echo "traced: skipped, $LIBINTERPOSE not found"
+    fi
+}
+
+function bench_fdtable {
+    build bench-fdtable ../fdtable.c
+    NFDS=${BENCH_FDS:-64}
+
+    echo "# descriptor table memory footprint"
+    ./bench-fdtable | sed 's/^/    /'
+
+    echo "# peak RSS with $NFDS descriptors spread over the limit"
+    echo "untraced:"
+    ./bench-fdtable rss $NFDS | sed 's/^/    /'
+
+    if [ -f "$LIBINTERPOSE" ]; then
+        PREFIX=$(mktemp -d $TMPDIR/bench.XXXXXX)
+        echo "traced:"
+        LD_PRELOAD=$LIBINTERPOSE KICKSTART_PREFIX=$PREFIX/trace \
+            ./bench-fdtable rss $NFDS | sed 's/^/    /'
+        rm -rf "$PREFIX"
+    else
+        echo "traced: skipped, $LIBINTERPOSE not found"
+    fi
+}
+
+function bench_checksum {
+    NFILES=${BENCH_FILES:-4}
+    SIZE=${BENCH_SIZE:-64}
+    DIR=$(mktemp -d $TMPDIR/bench.XXXXXX)
+    ARGS=
+    for i in $(seq $NFILES); do
+        head -c $((SIZE * 1024 * 1024)) /dev/urandom > $DIR/out.$i
+        ARGS="$ARGS -s $DIR/out.$i"
+    done
+
+    echo "# checksums of $NFILES outputs of $SIZE MB"
+    START=$(date +%s.%N)
+    ../pegasus-kickstart $ARGS /bin/true | grep -E "checksum_(timing|throughput)" | \
+        paste - - | awk '{print "    " $2 " s, " $4 " GB/s"}'
+    END=$(date +%s.%N)
+    awk "BEGIN { printf \"    total %.3f s\\n\", $END - $START }"
+
+    echo "# again with a checksum cache, cold and warm"
+    sleep 3
+    for run in cold warm; do
+        START=$(date +%s.%N)
+        KICKSTART_CHECKSUM_CACHE=$DIR/cache ../pegasus-kickstart $ARGS /bin/true >/dev/null
+        END=$(date +%s.%N)
+        awk "BEGIN { printf \"    $run %.3f s\\n\", $END - $START }"
+    done
+    rm -rf "$DIR"
+}
+
+function bench_yaml {
+    # links the objects of the last build, run make first
+    build bench-yaml ../procinfo.o ../utils.o ../useinfo.o ../hashtable.o \
+        ../fdtable.o ../sampler.o ../syscall.o ../tracereader.o \
+        ../checksum.o ../checksumcache.o ../uring.o ../procfs.o \
+        ../sha2.o ../sha256x86.o -lm -pthread -lrt
+    NPROCS=${BENCH_PROCS:-1000}
+
+    echo "# invocation record with $NPROCS processes"
+    ./bench-yaml time $NPROCS 0 | sed 's/^/    /'
+    ./bench-yaml time $NPROCS 10 | sed 's/^/    /'
+}
+
+function bench_startup {
+    RUNS=${BENCH_RUNS:-2000}
+    DIR=$(mktemp -d $TMPDIR/bench.XXXXXX)
+
+    echo "# kickstart overhead around /bin/true ($RUNS runs)"
+    for i in $(seq $RUNS); do
+        KICKSTART_SELF_TIMING=1 ../pegasus-kickstart /bin/true
+    done | awk -v dir=$DIR '
+        /^  overhead:/ { inside = 1; next }
+        inside && /^    [a-z]+:/ { key = substr($1, 1, length($1) - 1); print $2 > (dir "/" key); next }
+        { inside = 0 }'
+
+    for phase in total startup tempfiles machine interface limits final record; do
+        sort -g $DIR/$phase | awk -v phase=$phase '
+            { v[NR] = $1 }
+            END { printf "    %-10s p50 %8.3f ms  p99 %8.3f ms\n", phase,
+                         1000 * v[int(NR * 0.50 + 0.5)], 1000 * v[int(NR * 0.99 + 0.5)] }'
+    done
+    rm -rf "$DIR"
+}
+
+bench_io
+bench_stdio
+bench_fdtable
+bench_checksum
+bench_yaml
+bench_startup
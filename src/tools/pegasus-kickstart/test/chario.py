@@ -0,0 +1,33 @@
+#!/usr/bin/env python3
+# Writes and reads back two files one character at a time through the
+# libc stdio functions, so that libinterpose sees every call:
+#   chario.py NARROW WIDE COUNT
+import ctypes
+import sys
+
+libc = ctypes.CDLL(None)
+libc.fopen.restype = ctypes.c_void_p
+libc.fopen.argtypes = [ctypes.c_char_p, ctypes.c_char_p]
+libc.fclose.argtypes = [ctypes.c_void_p]
+for name in ("putc_unlocked", "fputwc"):
+    getattr(libc, name).argtypes = [ctypes.c_int, ctypes.c_void_p]
+for name in ("getc", "fgetwc_unlocked"):
+    getattr(libc, name).argtypes = [ctypes.c_void_p]
+    getattr(libc, name).restype = ctypes.c_uint
+
+
+def copy(path, put, get, eof, count):
+    f = libc.fopen(path.encode(), b"w")
+    for i in range(count):
+        put(ord("a"), f)
+    libc.fclose(f)
+
+    f = libc.fopen(path.encode(), b"r")
+    while get(f) != eof:
+        pass
+    libc.fclose(f)
+
+
+count = int(sys.argv[3])
+copy(sys.argv[1], libc.putc_unlocked, libc.getc, 0xFFFFFFFF, count)
+copy(sys.argv[2], libc.fputwc, libc.fgetwc_unlocked, 0xFFFFFFFF, count)
@@ -0,0 +1,8 @@
+#!/bin/bash
+# Create and then read back $2 files in directory $1
+for ((i=0; i<$2; i++)); do
+    echo $i > $1/file$i
+done
+for ((i=0; i<$2; i++)); do
+    read x < $1/file$i
+done
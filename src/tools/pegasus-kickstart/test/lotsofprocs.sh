@@ -1,4 +1,4 @@
 #!/bin/bash
-for ((i=0; i<1000; i++)); do
+for ((i=0; i<${1:-1000}; i++)); do
     /bin/date
 done
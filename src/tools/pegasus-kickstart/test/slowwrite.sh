@@ -0,0 +1,11 @@
+#!/bin/bash
+# Append 5 lines to $1 with a pause before and after each of them and
+# close it before exiting
+exec 3>>$1
+sleep 0.2
+for ((i=0; i<5; i++)); do
+    echo 0123456789 >&3
+    sleep 0.2
+done
+exec 3>&-
+sleep 0.2
@@ -49,6 +49,22 @@ function lotsofprocs_trace_buffer {
     return $?
 }
 
+# Trace enough processes to make the proc lookups show up
+function lotsofprocs_trace_stress {
+    kickstart -t ./lotsofprocs.sh 5000
+    RC=$?
+    if [ $RC -ne 0 ]; then
+        return $RC
+    fi
+    # The script and every date process
+    PROCS=$(grep -c "^ *ppid:" test.out)
+    if [ $PROCS -lt 5001 ]; then
+        echo "Expected at least 5001 procs, got $PROCS"
+        return 1
+    fi
+    return 0
+}
+
 # This should succeed
 function argfile {
     kickstart -I bindate.arg
@@ -393,6 +409,472 @@ function test_failure_environment {
     return 0
 }
 
+function test_libtrace {
+    OUTFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    # The proc records are not valid YAML yet, so don't use kickstart here
+    env KICKSTART_TRACE_ALL=1 TMPDIR=$START_DIR "$@" $KICKSTART -Z /bin/sh -c \
+        "echo hello > $OUTFILE; cat $OUTFILE $OUTFILE >/dev/null" >test.out 2>test.err
+    rc=$?
+    rm -f $OUTFILE
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    if ! grep -q "<file name=\"$OUTFILE\" bread=\"12\" nread=\"2\"" test.out; then
+        echo "Expected a trace record for $OUTFILE"
+        return 1
+    fi
+
+    if ls -d $START_DIR/ks.trace.* >/dev/null 2>&1; then
+        echo "Trace files were not cleaned up"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_libtrace_perf {
+    # Hardware counters are reported if the machine has them
+    $KICKSTART -Z awk 'BEGIN { for (i = 0; i < 1000000; i++) s += i }' >test.out 2>test.err
+    rc=$?
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+    if grep -q "instructions:" test.out; then
+        ipc=$(awk '/ ipc:/ { print $2; exit }' test.out)
+        if ! awk "BEGIN { exit !($ipc > 0) }"; then
+            echo "Expected instructions per cycle, got '$ipc'"
+            return 1
+        fi
+    fi
+
+    env KICKSTART_PERF_COUNTERS=0 $KICKSTART -Z /bin/true >test.out 2>test.err
+    if grep -q "instructions:" test.out; then
+        echo "Expected no counters with KICKSTART_PERF_COUNTERS=0"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_libtrace_checksum {
+    SEQFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    MODFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    # The first file is hashed while it is written, the second one is
+    # modified by another process and has to be read again
+    env KICKSTART_STREAM_CHECKSUMS=1 TMPDIR=$START_DIR "$@" $KICKSTART -Z -s $SEQFILE -s $MODFILE /bin/sh -c \
+        "dd if=/dev/urandom of=$SEQFILE bs=65536 count=40 status=none;
+         dd if=/dev/urandom of=$MODFILE bs=65536 count=4 status=none;
+         dd if=/dev/zero of=$MODFILE bs=1 count=10 seek=100 conv=notrunc status=none" >test.out 2>test.err
+    rc=$?
+
+    for f in $SEQFILE $MODFILE; do
+        sum=$(sha256sum $f | cut -d' ' -f1)
+        if ! grep -q "sha256: $sum" test.out; then
+            echo "Missing/incorrect checksum for $f"
+            rc=1
+        fi
+    done
+    rm -f $SEQFILE $MODFILE
+
+    return $rc
+}
+
+function test_libtrace_copy {
+    INFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    OUTFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    head -c 100000 /dev/urandom > $INFILE
+    # cp copies with copy_file_range if it can
+    env KICKSTART_TRACE_ALL=1 TMPDIR=$START_DIR $KICKSTART -Z cp $INFILE $OUTFILE >test.out 2>test.err
+    rc=$?
+    rm -f $INFILE $OUTFILE
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    if ! grep -q "<file name=\"$INFILE\" bread=\"100000\"" test.out; then
+        echo "Expected a read record for $INFILE"
+        return 1
+    fi
+    if ! grep -q "<file name=\"$OUTFILE\" .* bwrite=\"100000\"" test.out; then
+        echo "Expected a write record for $OUTFILE"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_libtrace_chario {
+    NARROW=$(mktemp $START_DIR/libtrace.XXXXXX)
+    WIDE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    # One character per call, more than one batch of the stdio cache
+    env KICKSTART_TRACE_ALL=1 KICKSTART_STREAM_CHECKSUMS=1 TMPDIR=$START_DIR $KICKSTART -Z -s $NARROW \
+        python3 chario.py $NARROW $WIDE 10000 >test.out 2>test.err
+    rc=$?
+
+    for f in $NARROW $WIDE; do
+        if ! grep -q "<file name=\"$f\" bread=\"10000\" nread=\"10000\" bwrite=\"10000\" nwrite=\"10000\"" test.out; then
+            echo "Expected 10000 single character reads and writes for $f"
+            rc=1
+        fi
+    done
+    sum=$(sha256sum $NARROW | cut -d' ' -f1)
+    if ! grep -q "sha256: $sum" test.out; then
+        echo "Missing/incorrect checksum for $NARROW"
+        rc=1
+    fi
+    rm -f $NARROW $WIDE
+
+    return $rc
+}
+
+function test_libtrace_mmap {
+    INFILE=$(mktemp $START_DIR/libtrace.XXXXXX)
+    head -c 100000 /dev/urandom > $INFILE
+    # A mapping that only touches one page is not a read of the whole file
+    env KICKSTART_TRACE_ALL=1 TMPDIR=$START_DIR $KICKSTART -Z python3 -c \
+        "import mmap; f = open('$INFILE', 'rb'); m = mmap.mmap(f.fileno(), 0, prot=mmap.PROT_READ); m[0]" \
+        >test.out 2>test.err
+    rc=$?
+    rm -f $INFILE
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    if ! grep -q "<file name=\"$INFILE\" bread=\"0\" .* bmap=\"100000\"" test.out; then
+        echo "Expected the mapping of $INFILE to be counted as bmap only"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_syscall_high_fd {
+    OUTFILE=$(mktemp $START_DIR/syscall.XXXXXX)
+    # Descriptors above 1024 used to abort the syscall tracer
+    env "$@" $KICKSTART -z /bin/bash -c "exec 2000>$OUTFILE; echo hello >&2000" >test.out 2>test.err
+    rc=$?
+    rm -f $OUTFILE
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    if ! grep -q "<file name=\"$OUTFILE\" .* bwrite=\"6\" nwrite=\"1\"" test.out; then
+        echo "Expected a write record for $OUTFILE"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_syscall_no_filter {
+    test_syscall_high_fd KICKSTART_SYSCALL_FILTER=0
+}
+
+function test_syscall_filter_privs {
+    # An unprivileged kickstart only sets no_new_privs on the job if asked
+    # to. Root drops its privileges, anyone else already runs without them.
+    NOBODY=
+    if [ $(id -u) -eq 0 ]; then
+        NOBODY="setpriv --reuid=65534 --regid=65534 --clear-groups"
+    fi
+
+    (cd / && $NOBODY $KICKSTART -z /bin/grep NoNewPrivs /proc/self/status) >test.out 2>test.err
+    if ! grep -q "NoNewPrivs:.0" test.out; then
+        echo "Expected no_new_privs not to be set by default"
+        return 1
+    fi
+
+    (cd / && KICKSTART_SYSCALL_FILTER=1 $NOBODY $KICKSTART -z /bin/grep NoNewPrivs /proc/self/status) >test.out 2>test.err
+    if ! grep -q "NoNewPrivs:.1" test.out; then
+        echo "Expected no_new_privs with KICKSTART_SYSCALL_FILTER=1"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_syscall_lotsoffiles {
+    FILEDIR=$(mktemp -d $START_DIR/syscall.XXXXXX)
+    # The file records are not valid YAML yet, so don't use kickstart here
+    $KICKSTART -z ./lotsoffiles.sh $FILEDIR 20000 >test.out 2>test.err
+    rc=$?
+    rm -rf $FILEDIR
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    # Every file is opened twice, but must only be reported once
+    FILES=$(grep -c "<file name=\"$FILEDIR/" test.out)
+    if [ $FILES -ne 20000 ]; then
+        echo "Expected 20000 file records, got $FILES"
+        return 1
+    fi
+
+    if ! grep -q "<file name=\"$FILEDIR/file19999\" bread=\"6\" nread=\"1\" bwrite=\"6\" nwrite=\"1\"" test.out; then
+        echo "Expected reads and writes to be merged"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_sample_io {
+    OUTFILE=$(mktemp $START_DIR/sample.XXXXXX)
+    # Only what the job appends counts, not the data already in the file
+    head -c 1000 /dev/zero > $OUTFILE
+    # The file records are not valid YAML yet, so don't use kickstart here
+    env KICKSTART_SAMPLE_INTERVAL=0.05 $KICKSTART -t ./slowwrite.sh $OUTFILE >test.out 2>test.err
+    rc=$?
+    rm -f $OUTFILE
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    # The file is closed before the script exits, so only the samples see it
+    if ! grep -q "<file name=\"$OUTFILE\" bread=\"0\" nread=\"0\" bwrite=\"55\"" test.out; then
+        echo "Expected a sampled write record for $OUTFILE"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_series {
+    # Sampled ten times as often as a series can hold, so it is merged
+    env KICKSTART_SERIES_INTERVAL=0.01 $KICKSTART -t /bin/sleep 1.5 >test.out 2>test.err
+    rc=$?
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    points=$(grep -c '^ *- \[' test.out)
+    if [ $points -lt 8 ] || [ $points -gt 64 ]; then
+        echo "Expected between 8 and 64 points in the series, got $points"
+        return 1
+    fi
+    if ! grep '^ *- \[' test.out | tr -d '[],-' | awk '
+            $1 < last || NF != 6 { exit 1 } { last = $1 } END { exit !(last >= 1.5) }'; then
+        echo "Expected a series that covers the whole process"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_cgroup {
+    # A fork-heavy job, accounted as a whole in a cgroup, or traced with
+    # ptrace if kickstart is not allowed to create one
+    $KICKSTART -g /bin/sh -c 'for i in 1 2 3 4 5; do awk "BEGIN { for (i = 0; i < 500000; i++) s += i }"; done' >test.out 2>test.err
+    rc=$?
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+
+    if grep -q "Unable to .* cgroup" test.err; then
+        if [ $(grep -c '^ *ppid:' test.out) -lt 6 ]; then
+            echo "Expected the job to be traced without a cgroup"
+            return 1
+        fi
+    elif ! sed -n '/^ *cgroup:/,/^ *status:/p' test.out | awk '$1 == "utime:" && $2 > 0 { found = 1 } END { exit !found }'; then
+        echo "Expected the cgroup to account the CPU time of the job"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_machine_info {
+    # The fast mode only reports the system-wide task counts
+    KICKSTART_MACHINE_INFO=fast kickstart /bin/true
+    if grep -q "procs_total:" test.out || ! grep -q "task_total:" test.out; then
+        echo "Expected task counts without a process scan"
+        return 1
+    fi
+
+    # The second kickstart reuses the CPU description of the first one,
+    # but counts the processes again
+    CACHE=$START_DIR/machine.cache
+    rm -f $CACHE
+    KICKSTART_MACHINE_CACHE=$CACHE kickstart /bin/true
+    grep "cpu_" test.out > test.first
+    if [ ! -s $CACHE ]; then
+        echo "Expected the machine cache to be written"
+        return 1
+    fi
+    KICKSTART_MACHINE_CACHE=$CACHE kickstart /bin/true
+    grep "cpu_" test.out > test.second
+    rm -f $CACHE
+    if ! grep -q "cpu_model:" test.first || ! cmp -s test.first test.second; then
+        echo "Expected the cached CPU description"
+        return 1
+    fi
+    if ! grep -q "procs_total:" test.out; then
+        echo "Expected current process counts with the machine cache"
+        return 1
+    fi
+    rm -f test.first test.second
+
+    return 0
+}
+
+function test_self_timing {
+    KICKSTART_SELF_TIMING=1 kickstart /bin/sleep 0.5
+    if ! sed -n '/^  overhead:/,$p' test.out | awk '
+            $1 == "total:" { found = 1; if ($2 < 0 || $2 > 0.5) exit 1 } END { exit !found }'; then
+        echo "Expected the overhead of kickstart without the job"
+        return 1
+    fi
+
+    kickstart /bin/true
+    if grep -q "^  overhead:" test.out; then
+        echo "Expected no overhead section by default"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_host_cache {
+    # The address and name of the host are taken from a recent cache
+    CACHE=$START_DIR/host.cache
+    echo "10.1.2.3 fake0 fake.example.org" > $CACHE
+    KICKSTART_HOST_CACHE=$CACHE kickstart /bin/true
+    rc=$?
+    rm -f $CACHE
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+    if ! grep -q "^  interface: fake0" test.out || ! grep -q "^  hostaddr: 10.1.2.3" test.out ||
+            ! grep -q "^  hostname: fake.example.org" test.out; then
+        echo "Expected the host from the cache"
+        return 1
+    fi
+
+    # Without a lookup, nothing is cached
+    KICKSTART_HOST_CACHE=$CACHE KICKSTART_RESOLVE_TIMEOUT=0 kickstart /bin/true
+    if grep -q "^  hostname:" test.out || [ -f $CACHE ]; then
+        echo "Expected no host name lookup"
+        rm -f $CACHE
+        return 1
+    fi
+
+    return 0
+}
+
+function test_capture_memory {
+    # stdout is kept in memory and printed from there
+    KICKSTART_CAPTURE_MEMORY=65536 kickstart /bin/echo captured
+    if ! grep -q "temporary_name: memfd:ks.out" test.out || ! grep -q "^ *captured$" test.out; then
+        echo "Expected stdout to be captured in memory"
+        return 1
+    fi
+
+    # Output beyond the limit is moved to a temporary file, which is removed
+    KICKSTART_CAPTURE_MEMORY=100 TMPDIR=$START_DIR kickstart -B all /bin/sh -c \
+        'seq 1 1000'
+    if ! grep -q "temporary_name: $START_DIR/ks.out" test.out || ! grep -q "^ *1000$" test.out; then
+        echo "Expected stdout to be moved to a temporary file"
+        return 1
+    fi
+    if ls $START_DIR/ks.out.* >/dev/null 2>&1; then
+        echo "Expected the temporary file to be removed"
+        return 1
+    fi
+
+    # By default, and with a limit of 0, temporary files are used
+    kickstart /bin/true
+    if grep -q "temporary_name: memfd:" test.out; then
+        echo "Expected stdout in a temporary file by default"
+        return 1
+    fi
+    KICKSTART_CAPTURE_MEMORY=0 kickstart /bin/true
+    if grep -q "temporary_name: memfd:" test.out; then
+        echo "Expected stdout in a temporary file"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_proc_stats {
+    # The fields of /proc/<pid>/stat are counted from the end of the
+    # command name, which can contain spaces and parentheses
+    BUSY="$START_DIR/busy) x"
+    cp $(command -v awk) "$BUSY"
+    $KICKSTART -t "$BUSY" 'BEGIN { for (i = 0; i < 5000000; i++) s += i }' >test.out 2>test.err
+    rc=$?
+    rm -f "$BUSY"
+
+    if [ $rc -ne 0 ]; then
+        echo "Expected job to succeed"
+        return 1
+    fi
+    if ! grep -q "exe: $BUSY\$" test.out; then
+        echo "Expected the exe of the traced process"
+        return 1
+    fi
+    utime=$(grep -A6 "exe: $BUSY\$" test.out | awk '/utime:/ { print $2 }')
+    if ! awk "BEGIN { exit !($utime > 0) }"; then
+        echo "Expected the user time of the traced process, got '$utime'"
+        return 1
+    fi
+    if ! grep -A12 "exe: $BUSY\$" test.out | grep -q "vmpeak: [1-9]"; then
+        echo "Expected the peak memory of the traced process"
+        return 1
+    fi
+
+    return 0
+}
+
+function test_libtrace_ring {
+    test_libtrace KICKSTART_TRACE_RING=1 || return 1
+
+    # A process that writes to the ring does not create a trace file, so
+    # the trace directory is empty when the job looks at it. Without the
+    # ring, the files of the job and its children are there.
+    LISTING=$(mktemp $START_DIR/listing.XXXXXX)
+    for ring in 1 0; do
+        env KICKSTART_TRACE_RING=$ring TMPDIR=$START_DIR $KICKSTART -Z ./tracedir.sh $LISTING \
+            >test.out 2>test.err
+        if [ $? -ne 0 ]; then
+            rm -f $LISTING
+            echo "Expected job to succeed"
+            return 1
+        fi
+        if [ $ring -eq 1 ] && [ -s $LISTING ]; then
+            cat $LISTING
+            rm -f $LISTING
+            echo "Expected the records to go through the ring"
+            return 1
+        fi
+        if [ $ring -eq 0 ] && ! grep -q "^trace" $LISTING; then
+            rm -f $LISTING
+            echo "Expected trace files without the ring"
+            return 1
+        fi
+    done
+    rm -f $LISTING
+
+    return 0
+}
+
 function test_quote_env_var {
     KICKSTART_SAVE=$KICKSTART
     KICKSTART="env GIDEON\"=juve $KICKSTART"
@@ -519,6 +1001,96 @@ function test_integrity_failure {
     return $rc
 }
 
+function test_integrity_parallel {
+    # several outputs are checksummed in parallel
+    for i in 1 2 3 4 5; do
+        head -c $((i * 3000001)) /dev/urandom > testintegrity.$i
+    done
+    kickstart -s testintegrity.1 -s testintegrity.2 -s testintegrity.3 \
+              -s testintegrity.4 -s testintegrity.5 /bin/true
+    rc=$?
+    for i in 1 2 3 4 5; do
+        sum=$(sha256sum testintegrity.$i | cut -d' ' -f1)
+        if ! grep -q "sha256: $sum" test.out; then
+            echo "Missing/incorrect checksum for testintegrity.$i"
+            rc=1
+        fi
+    done
+    if ! grep -q "checksum_throughput:" test.out; then
+        echo "Missing checksum throughput in kickstart record"
+        rc=1
+    fi
+    rm -f testintegrity.[1-5]
+    return $rc
+}
+
+function test_many_outputs {
+    # many outputs are stat'ed in parallel and printed in the given order
+    ARGS="-s testoutput.missing"
+    for i in $(seq 40); do
+        echo $i > testoutput.$i
+        ARGS="$ARGS -s testoutput.$i"
+    done
+    rc=0
+    # with io_uring, if the kernel allows it, and with plain system calls
+    for uring in 1 0; do
+        KICKSTART_IO_URING=$uring kickstart $ARGS /bin/true || rc=1
+        expected="testoutput.missing $(seq -f testoutput.%g -s ' ' 40)"
+        actual=$(grep -o "^    testoutput\.[a-z0-9]*" test.out | xargs)
+        if [ "$actual" != "$expected" ]; then
+            echo "Outputs are not in the order they were given: $actual"
+            rc=1
+        fi
+        if [ $(grep -c "sha256:" test.out) -ne 40 ]; then
+            echo "Missing checksums in kickstart record"
+            rc=1
+        fi
+        if ! grep -A1 "^    testoutput.missing:" test.out | grep -q "error: 2"; then
+            echo "Missing error for missing output"
+            rc=1
+        fi
+    done
+    rm -f testoutput.*
+    return $rc
+}
+
+function test_checksum_cache {
+    # checksums of unchanged files are reused from the cache
+    export KICKSTART_CHECKSUM_CACHE=$(pwd)/testcache.db
+    rm -f testcache.db
+    head -c 5000000 /dev/urandom > testcache.data
+    # files that changed in the last seconds are not cached
+    sleep 3
+    kickstart -s testcache.data /bin/true
+    rc=$?
+    kickstart -s testcache.data /bin/true || rc=1
+    if ! grep -q "sha256: $(sha256sum testcache.data | cut -d' ' -f1)" test.out; then
+        echo "Missing/incorrect checksum from the cache"
+        rc=1
+    fi
+    if grep -q "checksum_throughput:" test.out; then
+        echo "Checksum was computed again instead of using the cache"
+        rc=1
+    fi
+    # a modified file is hashed again
+    echo more >> testcache.data
+    kickstart -s testcache.data /bin/true || rc=1
+    if ! grep -q "sha256: $(sha256sum testcache.data | cut -d' ' -f1)" test.out; then
+        echo "Stale checksum from the cache"
+        rc=1
+    fi
+    # a file that is not a cache is ignored
+    head -c 4096 /dev/urandom > testcache.db
+    kickstart -s testcache.data /bin/true || rc=1
+    if ! grep -q "sha256: $(sha256sum testcache.data | cut -d' ' -f1)" test.out; then
+        echo "Missing checksum with an invalid cache"
+        rc=1
+    fi
+    unset KICKSTART_CHECKSUM_CACHE
+    rm -f testcache.db testcache.data
+    return $rc
+}
+
 function test_integrity_yaml_inc {
     # do this test multiple times
     for I in `seq 100`; do
@@ -560,6 +1132,19 @@ function test_locale {
     return $ec
 }
 
+function test_stdout_tail {
+    # only the last 262144 characters of stdout are included
+    kickstart seq 100000
+    rc=$?
+    expected=$(seq 100000 | tail -c 262144 | sed 's/^/        /')
+    actual=$(sed -n '/data_truncated: true/,$p' test.out | sed -n '3,43693p')
+    if [ "$expected" != "$actual" ]; then
+        echo "Expected the tail of stdout in the data section"
+        return 1
+    fi
+    return $rc
+}
+
 function test_special_charts {
     kickstart cat progress-bar.txt
     ec=$?
@@ -585,6 +1170,29 @@ run_test lotsofprocs_buffer
 if [ `uname -s` == "Linux" ]; then
     run_test lotsofprocs_trace
     run_test lotsofprocs_trace_buffer
+    run_test lotsofprocs_trace_stress
+    run_test test_syscall_high_fd
+    run_test test_syscall_no_filter
+    if [ $(id -u) -ne 0 ] || which setpriv >/dev/null 2>&1; then
+        run_test test_syscall_filter_privs
+    else
+        echo "Skipping test_syscall_filter_privs: requires setpriv when run as root"
+    fi
+    run_test test_syscall_lotsoffiles
+    run_test test_sample_io
+    run_test test_proc_stats
+    run_test test_series
+    run_test test_cgroup
+    run_test test_machine_info
+    if [ -f ../libinterpose.so ]; then
+        run_test test_libtrace
+        run_test test_libtrace_ring
+        run_test test_libtrace_checksum
+        run_test test_libtrace_perf
+        run_test test_libtrace_copy
+        run_test test_libtrace_mmap
+        run_test test_libtrace_chario
+    fi
 fi
 run_test argfile
 run_test argfile_after
@@ -622,8 +1230,15 @@ run_test test_metadata
 run_test test_integrity
 #run_test test_integrity_callout_failure
 run_test test_integrity_failure
+run_test test_integrity_parallel
+run_test test_many_outputs
+run_test test_checksum_cache
 run_test test_integrity_yaml_inc
 run_test test_w_with_rel_exec
 run_test test_locale
 run_test test_special_charts
+run_test test_stdout_tail
+run_test test_host_cache
+run_test test_self_timing
+run_test test_capture_memory
 
@@ -0,0 +1,4 @@
+#!/bin/bash
+# List the trace directory of kickstart into $1 after a child has exited
+cat /dev/null
+ls "${KICKSTART_PREFIX%/*}" > $1
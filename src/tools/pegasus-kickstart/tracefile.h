@@ -0,0 +1,194 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _TRACEFILE_H
+#define _TRACEFILE_H
+
+/* Binary record format used by libinterpose to report to kickstart.
+ *
+ * A trace file is a sequence of records. Every record starts with a
+ * TraceHeader, followed by a fixed-size body that depends on the type,
+ * followed by an optional string (a path, address or command line) whose
+ * length is given in the body. The string is not NUL-terminated. The size
+ * in the header covers the whole record and is rounded up to a multiple
+ * of TRACE_ALIGN so that the next header is aligned. A record is never
+ * split between two write() calls, so a trace file only ends in the middle
+ * of a record if the process was killed while writing.
+ *
+ * Both ends are built from the same source tree, so the records use the
+ * native byte order and there is no versioning. The layouts must only
+ * contain fixed-width types.
+ */
+
+#include <stdint.h>
+
+#define TRACE_ALIGN 8
+
+/* Maximum size of a record, including the string. This is large enough
+ * for any path that libinterpose can produce (BUFSIZ). */
+#define TRACE_MAX_RECORD 16384
+
+#define TRACE_ROUND(n) (((n) + TRACE_ALIGN - 1) & ~(TRACE_ALIGN - 1))
+
+enum {
+    TRACE_START = 1,    /* TraceStart: process started */
+    TRACE_CMD,          /* TraceString: command line */
+    TRACE_EXE,          /* TraceString: executable path */
+    TRACE_FILE,         /* TraceFile + path */
+    TRACE_SOCKET,       /* TraceSocket + address */
+    TRACE_MEMORY,       /* TraceMemory: peak memory usage */
+    TRACE_THREADS,      /* TraceThreads: thread counts */
+    TRACE_CPU,          /* TraceCPU: CPU usage */
+    TRACE_IO,           /* TraceIO: counters from /proc/self/io */
+    TRACE_COUNTER,      /* TraceCounter + counter name (PAPI, perf) */
+    TRACE_FORK,         /* no body: process is a forked child */
+    TRACE_STOP,         /* TraceStop: process finished */
+    TRACE_CHECKSUM,     /* TraceChecksum + path */
+    TRACE_PAD           /* no body: unused space at the end of the ring */
+};
+
+typedef struct {
+    uint32_t size;      /* Size of the entire record, a multiple of TRACE_ALIGN */
+    uint16_t type;      /* One of the TRACE_* types */
+    uint16_t flags;     /* Reserved, must be 0 */
+    int32_t pid;        /* Process that generated the record */
+    uint32_t reserved;
+} TraceHeader;
+
+typedef struct {
+    TraceHeader h;
+    double time;        /* Start time in seconds from the epoch */
+    int32_t ppid;       /* Parent pid */
+    uint32_t pad;
+} TraceStart;
+
+typedef struct {
+    TraceHeader h;
+    uint32_t len;       /* Length of the string that follows */
+    uint32_t pad;
+} TraceString;
+
+typedef struct {
+    TraceHeader h;
+    uint64_t size;      /* Size of the file when it was closed */
+    uint64_t bread;
+    uint64_t bwrite;
+    uint64_t nread;
+    uint64_t nwrite;
+    uint64_t bseek;
+    uint64_t nseek;
+    uint64_t bmap;      /* Bytes mapped into memory */
+    uint32_t len;       /* Length of the path that follows */
+    uint32_t pad;
+} TraceFile;
+
+typedef struct {
+    TraceHeader h;
+    uint64_t brecv;
+    uint64_t bsend;
+    uint64_t nrecv;
+    uint64_t nsend;
+    int32_t port;
+    uint32_t len;       /* Length of the address that follows */
+} TraceSocket;
+
+typedef struct {
+    TraceHeader h;
+    int32_t vmpeak;     /* Peak virtual memory in KB */
+    int32_t rsspeak;    /* Peak resident set size in KB */
+} TraceMemory;
+
+typedef struct {
+    TraceHeader h;
+    int32_t fin_threads;
+    int32_t max_threads;
+    int32_t tot_threads;
+    uint32_t pad;
+} TraceThreads;
+
+typedef struct {
+    TraceHeader h;
+    double utime;
+    double stime;
+    double iowait;
+} TraceCPU;
+
+typedef struct {
+    TraceHeader h;
+    uint64_t rchar;
+    uint64_t wchar;
+    uint64_t syscr;
+    uint64_t syscw;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+    uint64_t cancelled_write_bytes;
+} TraceIO;
+
+typedef struct {
+    TraceHeader h;
+    int64_t value;
+    uint32_t len;       /* Length of the counter name that follows */
+    uint32_t pad;
+} TraceCounter;
+
+typedef struct {
+    TraceHeader h;
+    double time;        /* Stop time in seconds from the epoch */
+} TraceStop;
+
+/* Digest of a file that was written sequentially from the start while
+ * it was open. The size and modification time are the ones at close, so
+ * that kickstart can tell whether the file changed afterwards. */
+typedef struct {
+    TraceHeader h;
+    uint64_t size;      /* Number of bytes hashed, the size at close */
+    int64_t mtime_sec;  /* Modification time at close */
+    int64_t mtime_nsec;
+    double duration;    /* Seconds spent hashing */
+    uint8_t sha256[32];
+    uint32_t len;       /* Length of the path that follows */
+    uint32_t pad;
+} TraceChecksum;
+
+/* Shared-memory trace ring.
+ *
+ * Instead of trace files, kickstart can create a ring buffer in shared
+ * memory and pass the descriptor to the job in KICKSTART_TRACE_FD. Every
+ * traced process appends records to the ring, and kickstart consumes them
+ * while the job is running. The ring is a TraceRing header followed by
+ * size bytes of data, where size is a power of two.
+ *
+ * head and tail are byte counters that are never wrapped, the position
+ * of a record in the data is the counter modulo size. A producer reserves
+ * space by advancing head with compare-and-swap. It then fills in the
+ * record and stores the size in the header last: a record is complete
+ * when its size is not zero. A record never wraps around the end of the
+ * data. If it does not fit, the rest of the data is filled with a
+ * TRACE_PAD record first. The consumer zeroes every record it has read
+ * and then advances tail. A producer that cannot reserve space because
+ * the ring is full falls back to the trace file for the rest of its life.
+ */
+
+#define TRACE_RING_MAGIC 0x4b53545241434521ULL
+
+typedef struct {
+    uint64_t magic;     /* TRACE_RING_MAGIC */
+    uint64_t size;      /* Size of the data, a power of two */
+    uint64_t head __attribute__((aligned(64)));  /* Next byte to reserve */
+    uint64_t tail __attribute__((aligned(64)));  /* Next byte to consume */
+} __attribute__((aligned(64))) TraceRing;
+
+#define TRACE_RING_DATA(ring) ((char *)(ring) + sizeof(TraceRing))
+
+#endif /* _TRACEFILE_H */
@@ -0,0 +1,718 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+
+/* This module reads the records that libinterpose generates for every
+ * traced process, either from the trace files that are left in the trace
+ * directory when the job is done, or from a shared-memory ring that is
+ * consumed by a thread while the job is running. The records are sorted
+ * into one stream per pid, which is turned into a list of ProcInfo.
+ */
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <errno.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "tracereader.h"
+#include "checksum.h"
+#include "error.h"
+
+static void readTraceFileRecord(const TraceFile *r, const char *filename, ProcInfo *proc) {
+    /* Look for a duplicate file */
+    FileInfo *file = findFileInfo(proc, filename);
+
+    if (file == NULL) {
+        /* No duplicate found */
+        file = (FileInfo *)calloc(sizeof(FileInfo), 1);
+        if (file == NULL) {
+            printerr("calloc: %s\n", strerror(errno));
+            return;
+        }
+        char *temp = strdup(filename);
+        if (temp == NULL) {
+            free(file);
+            printerr("strdup: %s\n", strerror(errno));
+            return;
+        }
+        file->filename = temp;
+        file->size = r->size;
+        file->bread = r->bread;
+        file->bwrite = r->bwrite;
+        file->nread = r->nread;
+        file->nwrite = r->nwrite;
+        file->bseek = r->bseek;
+        file->nseek = r->nseek;
+        file->bmap = r->bmap;
+
+        if (addFileInfo(proc, file) < 0) {
+            free(temp);
+            free(file);
+        }
+    } else {
+        /* Duplicate found, increment counters */
+        file->size = file->size > r->size ? file->size : r->size; /* max */
+        file->bread += r->bread;
+        file->bwrite += r->bwrite;
+        file->nread += r->nread;
+        file->nwrite += r->nwrite;
+        file->bseek += r->bseek;
+        file->nseek += r->nseek;
+        file->bmap += r->bmap;
+    }
+}
+
+static SockInfo *readTraceSocketRecord(const TraceSocket *r, const char *address, SockInfo *sockets) {
+    /* Look for a duplicate socket in list of sockets */
+    SockInfo *sock = NULL;
+    SockInfo *last = NULL;
+    for (sock = sockets; sock != NULL; sock = sock->next) {
+        if (r->port == sock->port && strcmp(address, sock->address) == 0) {
+            /* Found a duplicate */
+            break;
+        }
+
+        /* Keep track of the last socket in the list */
+        last = sock;
+    }
+
+    if (sock == NULL) {
+        /* No duplicate found */
+        sock = (SockInfo *)calloc(sizeof(SockInfo), 1);
+        if (sock == NULL) {
+            printerr("calloc: %s\n", strerror(errno));
+            return sockets;
+        }
+        char *temp = strdup(address);
+        if (temp == NULL) {
+            free(sock);
+            printerr("strdup: %s\n", strerror(errno));
+            return sockets;
+        }
+        sock->address = temp;
+        sock->port = r->port;
+        sock->brecv = r->brecv;
+        sock->bsend = r->bsend;
+        sock->nrecv = r->nrecv;
+        sock->nsend = r->nsend;
+
+        if (sockets == NULL) {
+            /* List was empty */
+            sockets = sock;
+        } else {
+            /* Add to end of list */
+            last->next = sock;
+        }
+    } else {
+        /* Duplicate found, increment counters */
+        sock->brecv += r->brecv;
+        sock->bsend += r->bsend;
+        sock->nrecv += r->nrecv;
+        sock->nsend += r->nsend;
+    }
+
+    return sockets;
+}
+
+/* Get the string that follows the fixed part of a record. The string is
+ * copied into str, which must hold at least TRACE_MAX_RECORD bytes.
+ * Returns 0 on success, or -1 if the string does not fit in the record */
+static int readTraceString(const char *record, size_t fixed, uint32_t len, char *str) {
+    const TraceHeader *h = (const TraceHeader *)record;
+    if (fixed > h->size || len > h->size - fixed) {
+        return -1;
+    }
+    memcpy(str, record + fixed, len);
+    str[len] = '\0';
+    return 0;
+}
+
+/* Add the value of a PAPI, perf_event or io_uring counter to proc */
+static void readTraceCounter(ProcInfo *proc, const char *name, long long value) {
+    if (strcmp(name, "PAPI_TOT_INS") == 0) {
+        proc->PAPI_TOT_INS += value;
+    } else if (strcmp(name, "PAPI_LD_INS") == 0) {
+        proc->PAPI_LD_INS += value;
+    } else if (strcmp(name, "PAPI_SR_INS") == 0) {
+        proc->PAPI_SR_INS += value;
+    } else if (strcmp(name, "PAPI_FP_INS") == 0) {
+        proc->PAPI_FP_INS += value;
+    } else if (strcmp(name, "PAPI_FP_OPS") == 0) {
+        proc->PAPI_FP_OPS += value;
+    } else if (strcmp(name, "PAPI_L3_TCM") == 0) {
+        proc->PAPI_L3_TCM += value;
+    } else if (strcmp(name, "PAPI_L2_TCM") == 0) {
+        proc->PAPI_L2_TCM += value;
+    } else if (strcmp(name, "PAPI_L1_TCM") == 0) {
+        proc->PAPI_L1_TCM += value;
+    } else if (strcmp(name, "PERF_CYCLES") == 0) {
+        proc->cycles += value;
+    } else if (strcmp(name, "PERF_INSTRUCTIONS") == 0) {
+        proc->instructions += value;
+    } else if (strcmp(name, "PERF_CACHE_MISSES") == 0) {
+        proc->cache_misses += value;
+    } else if (strcmp(name, "PERF_BRANCH_MISSES") == 0) {
+        proc->branch_misses += value;
+    } else if (strcmp(name, "IO_URING_ENTER") == 0) {
+        proc->uring_enters += value;
+    } else if (strcmp(name, "IO_URING_SQES") == 0) {
+        proc->uring_sqes += value;
+    } else {
+        printerr("Unrecognized counter in libinterpose record: %s\n", name);
+    }
+}
+
+/* Size of the minimum fixed part of each record type, indexed by type */
+static const size_t trace_record_size[] = {
+    [TRACE_START] = sizeof(TraceStart),
+    [TRACE_CMD] = sizeof(TraceString),
+    [TRACE_EXE] = sizeof(TraceString),
+    [TRACE_FILE] = sizeof(TraceFile),
+    [TRACE_SOCKET] = sizeof(TraceSocket),
+    [TRACE_MEMORY] = sizeof(TraceMemory),
+    [TRACE_THREADS] = sizeof(TraceThreads),
+    [TRACE_CPU] = sizeof(TraceCPU),
+    [TRACE_IO] = sizeof(TraceIO),
+    [TRACE_COUNTER] = sizeof(TraceCounter),
+    [TRACE_FORK] = sizeof(TraceHeader),
+    [TRACE_STOP] = sizeof(TraceStop),
+    [TRACE_CHECKSUM] = sizeof(TraceChecksum),
+};
+
+#define TRACE_NTYPES (sizeof(trace_record_size) / sizeof(size_t))
+
+/* Check that a record has a valid header and fits in avail bytes */
+static int validTraceRecord(const TraceHeader *h, size_t avail) {
+    return h->size >= sizeof(TraceHeader) && h->size <= TRACE_MAX_RECORD &&
+           h->size <= avail && h->size % TRACE_ALIGN == 0 &&
+           h->type > 0 && h->type < TRACE_NTYPES && h->type != TRACE_PAD &&
+           h->size >= trace_record_size[h->type];
+}
+
+void initTraceDecoder(TraceDecoder *decoder) {
+    /* purpose: initialize a decoder for libinterpose records
+     * paramtr: decoder (OUT): decoder to initialize
+     */
+    memset(decoder, 0, sizeof(TraceDecoder));
+}
+
+static int streamMatch(const void *value, const void *key) {
+    return ((const TraceStream *)value)->pid == *(const pid_t *)key;
+}
+
+/* Find the stream for pid, or add a new one */
+static TraceStream *getTraceStream(TraceDecoder *decoder, pid_t pid) {
+    uint64_t hash = hashInteger(pid);
+    TraceStream *stream = (TraceStream *)findHashEntry(&decoder->index, hash, streamMatch, &pid);
+    if (stream != NULL) {
+        return stream;
+    }
+
+    stream = (TraceStream *)calloc(sizeof(TraceStream), 1);
+    if (stream == NULL) {
+        printerr("calloc: %s\n", strerror(errno));
+        return NULL;
+    }
+    stream->pid = pid;
+
+    if (addHashEntry(&decoder->index, hash, stream) < 0) {
+        printerr("calloc: %s\n", strerror(errno));
+        free(stream);
+        return NULL;
+    }
+
+    if (decoder->last == NULL) {
+        decoder->streams = stream;
+    } else {
+        decoder->last->next = stream;
+    }
+    decoder->last = stream;
+
+    return stream;
+}
+
+/* Add one record to the stream of the process that generated it. The
+ * record must have been checked with validTraceRecord. */
+static int decodeTraceRecord(TraceDecoder *decoder, const char *record) {
+    const TraceHeader *h = (const TraceHeader *)record;
+    char str[TRACE_MAX_RECORD];
+
+    TraceStream *stream = getTraceStream(decoder, h->pid);
+    if (stream == NULL) {
+        return -1;
+    }
+
+    decoder->records++;
+
+    ProcInfo *proc = stream->proc;
+    if (proc == NULL) {
+        proc = (ProcInfo *)calloc(sizeof(ProcInfo), 1);
+        if (proc == NULL) {
+            printerr("calloc: %s\n", strerror(errno));
+            return -1;
+        }
+        proc->fds.elemsize = sizeof(FileInfo *);
+        stream->fork = 0;
+        stream->proc = proc;
+
+        if (stream->last == NULL) {
+            stream->procs = proc;
+        } else {
+            stream->last->next = proc;
+        }
+        proc->prev = stream->last;
+        stream->last = proc;
+    }
+
+    switch (h->type) {
+    case TRACE_FILE: {
+        const TraceFile *r = (const TraceFile *)record;
+        if (readTraceString(record, sizeof(TraceFile), r->len, str) == 0) {
+            readTraceFileRecord(r, str, proc);
+            if (r->nwrite > 0) {
+                pegasus_integrity_writer(str);
+            }
+        }
+        break;
+    }
+    case TRACE_CHECKSUM: {
+        const TraceChecksum *r = (const TraceChecksum *)record;
+        if (readTraceString(record, sizeof(TraceChecksum), r->len, str) == 0) {
+            pegasus_integrity_streamed(str, r->sha256, r->size, r->mtime_sec,
+                                       r->mtime_nsec, r->duration);
+        }
+        break;
+    }
+    case TRACE_SOCKET: {
+        const TraceSocket *r = (const TraceSocket *)record;
+        if (readTraceString(record, sizeof(TraceSocket), r->len, str) == 0) {
+            proc->sockets = readTraceSocketRecord(r, str, proc->sockets);
+        }
+        break;
+    }
+    case TRACE_EXE: {
+        const TraceString *r = (const TraceString *)record;
+        if (readTraceString(record, sizeof(TraceString), r->len, str) == 0) {
+            proc->exe = strdup(str);
+            if (proc->exe == NULL) {
+                printerr("strdup: %s\n", strerror(errno));
+                return -1;
+            }
+        }
+        break;
+    }
+    case TRACE_CMD: {
+        const TraceString *r = (const TraceString *)record;
+        if (readTraceString(record, sizeof(TraceString), r->len, str) == 0) {
+            proc->cmd = strdup(str);
+        }
+        break;
+    }
+    case TRACE_START: {
+        const TraceStart *r = (const TraceStart *)record;
+        proc->pid = h->pid;
+        proc->ppid = r->ppid;
+        /* Only set the start time if it is not already set.
+         * This handles cases where fork() is called. */
+        if (proc->start == 0) {
+            proc->start = r->time;
+        }
+        break;
+    }
+    case TRACE_MEMORY: {
+        const TraceMemory *r = (const TraceMemory *)record;
+        proc->vmpeak = r->vmpeak;
+        proc->rsspeak = r->rsspeak;
+        break;
+    }
+    case TRACE_THREADS: {
+        const TraceThreads *r = (const TraceThreads *)record;
+        proc->fin_threads = r->fin_threads;
+        proc->max_threads = r->max_threads;
+        proc->tot_threads = r->tot_threads;
+        break;
+    }
+    case TRACE_CPU: {
+        const TraceCPU *r = (const TraceCPU *)record;
+        proc->utime = r->utime;
+        proc->stime = r->stime;
+        proc->iowait = r->iowait;
+        break;
+    }
+    case TRACE_IO: {
+        const TraceIO *r = (const TraceIO *)record;
+        proc->rchar = r->rchar;
+        proc->wchar = r->wchar;
+        proc->syscr = r->syscr;
+        proc->syscw = r->syscw;
+        proc->read_bytes = r->read_bytes;
+        proc->write_bytes = r->write_bytes;
+        proc->cancelled_write_bytes = r->cancelled_write_bytes;
+        break;
+    }
+    case TRACE_COUNTER: {
+        const TraceCounter *r = (const TraceCounter *)record;
+        if (readTraceString(record, sizeof(TraceCounter), r->len, str) == 0) {
+            readTraceCounter(proc, str, r->value);
+        }
+        break;
+    }
+    case TRACE_FORK:
+        stream->fork = 1;
+        break;
+    case TRACE_STOP: {
+        const TraceStop *r = (const TraceStop *)record;
+        proc->stop = r->time;
+        if (stream->fork == 0) {
+            /* Reset the pointer so that it creates a new object */
+            stream->proc = NULL;
+        } else {
+            /* We skipped one exec, reset fork so we don't skip another */
+            stream->fork = 0;
+        }
+        break;
+    }
+    }
+
+    return 0;
+}
+
+static void processTraceFile(TraceDecoder *decoder, const char *fullpath) {
+    int trace = open(fullpath, O_RDONLY);
+    if (trace < 0) {
+        printerr("Unable to open trace file '%s': %s\n",
+                fullpath, strerror(errno));
+        return;
+    }
+
+    /* Read the records from the trace file. The buffer holds [head, tail)
+     * of unprocessed data and is refilled when it does not contain a
+     * complete record. Records are aligned, so the buffer is as well. */
+    static uint64_t buffer[65536 / sizeof(uint64_t)];
+    char *buf = (char *)buffer;
+    size_t head = 0;
+    size_t tail = 0;
+    int records = 0;
+    while (1) {
+        if (tail - head < sizeof(TraceHeader) ||
+                tail - head < ((TraceHeader *)(buf + head))->size) {
+            /* Move the partial record to the front and read more */
+            memmove(buf, buf + head, tail - head);
+            tail -= head;
+            head = 0;
+            ssize_t rc = read(trace, buf + tail, sizeof(buffer) - tail);
+            if (rc < 0) {
+                printerr("Error reading trace file '%s': %s\n",
+                        fullpath, strerror(errno));
+                break;
+            }
+            if (rc == 0) {
+                if (tail > 0) {
+                    printerr("Truncated record in trace file '%s'\n", fullpath);
+                }
+                break;
+            }
+            tail += rc;
+            continue;
+        }
+
+        const char *record = buf + head;
+        if (!validTraceRecord((const TraceHeader *)record, tail - head)) {
+            printerr("Invalid record in trace file '%s'\n", fullpath);
+            break;
+        }
+        head += ((const TraceHeader *)record)->size;
+        records++;
+
+        if (decodeTraceRecord(decoder, record) < 0) {
+            break;
+        }
+    }
+
+    close(trace);
+
+    /* Remove the file */
+    unlink(fullpath);
+
+    /* Empty file? */
+    if (records == 0) {
+        printerr("Empty trace file: %s\n", fullpath);
+    }
+}
+
+void processTraceFiles(TraceDecoder *decoder, const char *tracedir) {
+    /* purpose: read all the trace files in tracedir, which is a directory
+     *          that only contains the trace files of this job, and remove it
+     * paramtr: decoder (IO): decoder to add the records to
+     *          tracedir (IN): directory with the trace files
+     */
+    /* Sort the files so that the processes are always reported in the
+     * same order, readdir order depends on the file system */
+    struct dirent **names;
+    int n = scandir(tracedir, &names, NULL, alphasort);
+    if (n < 0) {
+        printerr("Unable to open trace file directory: %s", tracedir);
+        return;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (names[i]->d_name[0] != '.') {
+            char fullpath[BUFSIZ];
+            snprintf(fullpath, BUFSIZ, "%s/%s", tracedir, names[i]->d_name);
+            processTraceFile(decoder, fullpath);
+        }
+        free(names[i]);
+    }
+
+    free(names);
+
+    if (rmdir(tracedir) < 0) {
+        printerr("Unable to remove trace file directory %s: %s\n",
+                tracedir, strerror(errno));
+    }
+}
+
+ProcInfo *finishTraceDecoder(TraceDecoder *decoder) {
+    /* purpose: get the processes decoded from all the records
+     * paramtr: decoder (IO): decoder to finish, it is empty afterwards
+     * returns: list of processes in the order they were first seen
+     */
+    ProcInfo *procs = NULL;
+    ProcInfo *lastproc = NULL;
+
+    TraceStream *stream = decoder->streams;
+    while (stream != NULL) {
+        if (stream->procs != NULL) {
+            stream->procs->prev = lastproc;
+            if (procs == NULL) {
+                procs = stream->procs;
+            } else {
+                lastproc->next = stream->procs;
+            }
+            lastproc = stream->last;
+        }
+
+        TraceStream *next = stream->next;
+        free(stream);
+        stream = next;
+    }
+
+    deleteHashTable(&decoder->index);
+    initTraceDecoder(decoder);
+
+    return procs;
+}
+
+/* Create the file that backs the ring. This is an anonymous memory file
+ * if the system supports it, and an unlinked file in tracedir if not. */
+static int createRingFile(const char *tracedir) {
+#ifdef SYS_memfd_create
+    /* The descriptor has to survive exec, so no MFD_CLOEXEC */
+    int fd = syscall(SYS_memfd_create, "kickstart-trace", 0);
+    if (fd >= 0) {
+        return fd;
+    }
+#endif
+
+    char path[BUFSIZ];
+    snprintf(path, BUFSIZ, "%s/ring.XXXXXX", tracedir);
+    int fd2 = mkstemp(path);
+    if (fd2 < 0) {
+        printerr("Unable to create trace ring %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    unlink(path);
+
+    return fd2;
+}
+
+int initTraceChannel(TraceChannel *channel, size_t size, const char *tracedir) {
+    /* purpose: create a shared-memory ring for libinterpose records
+     * paramtr: channel (OUT): channel to initialize
+     *          size (IN): minimum size of the ring in bytes
+     *          tracedir (IN): directory for the ring if we need a file
+     * returns: 0 on success, -1 on failure
+     */
+    memset(channel, 0, sizeof(TraceChannel));
+    channel->fd = -1;
+
+    /* The ring must be a power of two, and hold at least a few records */
+    size_t ringsize = 4 * TRACE_MAX_RECORD;
+    while (ringsize < size) {
+        ringsize *= 2;
+    }
+
+    int fd = createRingFile(tracedir);
+    if (fd < 0) {
+        return -1;
+    }
+
+    size_t mapsize = sizeof(TraceRing) + ringsize;
+    if (ftruncate(fd, mapsize) < 0) {
+        printerr("Unable to resize trace ring: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printerr("Unable to map trace ring: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    /* The file is zero-filled, which is what an empty ring looks like */
+    channel->ring = (TraceRing *)map;
+    channel->ring->size = ringsize;
+    channel->ring->magic = TRACE_RING_MAGIC;
+    channel->mapsize = mapsize;
+    channel->fd = fd;
+
+    return 0;
+}
+
+/* Decode all the complete records in the ring. Returns the number
+ * of records read, or -1 if the ring is corrupt */
+static int drainTraceRing(TraceChannel *channel) {
+    TraceRing *ring = channel->ring;
+    char *data = TRACE_RING_DATA(ring);
+    uint64_t mask = ring->size - 1;
+    uint64_t tail = ring->tail;
+    int records = 0;
+
+    while (1) {
+        char *record = data + (tail & mask);
+        TraceHeader *h = (TraceHeader *)record;
+        uint32_t size = __atomic_load_n(&h->size, __ATOMIC_ACQUIRE);
+        if (size == 0) {
+            /* Next record is not complete yet */
+            break;
+        }
+
+        size_t avail = ring->size - (tail & mask);
+        if (h->type == TRACE_PAD) {
+            if (size != avail) {
+                printerr("Invalid padding in trace ring\n");
+                return -1;
+            }
+        } else {
+            if (!validTraceRecord(h, avail)) {
+                printerr("Invalid record in trace ring\n");
+                return -1;
+            }
+            decodeTraceRecord(channel->decoder, record);
+            records++;
+        }
+
+        /* Clear the space for the producers and release it */
+        memset(record, 0, size);
+        tail += size;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return records;
+}
+
+/* Thread that consumes the ring while the job is running */
+static void *traceConsumer(void *arg) {
+    TraceChannel *channel = (TraceChannel *)arg;
+
+    /* Poll the ring. Back off when it is empty, and get back to full
+     * speed as soon as there is something to read. */
+    long delay = 0;
+    while (!__atomic_load_n(&channel->stop, __ATOMIC_ACQUIRE)) {
+        int records = drainTraceRing(channel);
+        if (records < 0) {
+            return NULL;
+        }
+        if (records > 0) {
+            delay = 0;
+            continue;
+        }
+        delay = delay == 0 ? 100000 : delay * 2;
+        if (delay > 10000000) {
+            delay = 10000000;
+        }
+        struct timespec ts = { 0, delay };
+        nanosleep(&ts, NULL);
+    }
+
+    /* All the processes are gone, get whatever is left */
+    drainTraceRing(channel);
+
+    return NULL;
+}
+
+int startTraceConsumer(TraceChannel *channel, TraceDecoder *decoder) {
+    /* purpose: start a thread that decodes the ring while the job runs
+     * paramtr: channel (IO): channel created by initTraceChannel
+     *          decoder (IO): decoder to add the records to
+     * returns: 0 on success, -1 on failure
+     */
+    channel->decoder = decoder;
+    channel->stop = 0;
+
+    int err = pthread_create(&channel->consumer, NULL, traceConsumer, channel);
+    if (err != 0) {
+        printerr("Unable to start trace consumer: %s\n", strerror(err));
+        return -1;
+    }
+    channel->running = 1;
+
+    return 0;
+}
+
+void stopTraceConsumer(TraceChannel *channel) {
+    /* purpose: stop the consumer thread after the job is done. This also
+     *          reads any records that are left in the ring.
+     * paramtr: channel (IO): channel with a running consumer
+     */
+    if (channel->running) {
+        __atomic_store_n(&channel->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(channel->consumer, NULL);
+        channel->running = 0;
+    } else if (channel->decoder != NULL) {
+        drainTraceRing(channel);
+    }
+
+    /* A process that was killed while writing a record leaves a
+     * hole that we can't get past */
+    TraceRing *ring = channel->ring;
+    if (ring != NULL && ring->head != ring->tail) {
+        printerr("Lost %lu bytes of records in trace ring\n",
+                (unsigned long)(ring->head - ring->tail));
+    }
+}
+
+void deleteTraceChannel(TraceChannel *channel) {
+    /* purpose: free the ring
+     * paramtr: channel (IO): channel created by initTraceChannel
+     */
+    if (channel->ring != NULL) {
+        munmap(channel->ring, channel->mapsize);
+        channel->ring = NULL;
+    }
+    if (channel->fd >= 0) {
+        close(channel->fd);
+        channel->fd = -1;
+    }
+}
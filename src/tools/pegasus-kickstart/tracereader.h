@@ -0,0 +1,63 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _TRACEREADER_H
+#define _TRACEREADER_H
+
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "procinfo.h"
+#include "tracefile.h"
+
+/* The records of one pid. A process can exec several times, and a pid can
+ * be reused, so a stream can produce several ProcInfo entries. */
+typedef struct _TraceStream {
+    pid_t pid;
+    ProcInfo *procs;        /* List of procs decoded from this stream */
+    ProcInfo *last;         /* Last proc in the list */
+    ProcInfo *proc;         /* Proc that records are added to, or NULL */
+    int fork;               /* Skip the next stop record */
+    struct _TraceStream *next;
+} TraceStream;
+
+/* Decodes libinterpose records from the trace ring and trace files */
+typedef struct {
+    TraceStream *streams;   /* Streams in the order they were first seen */
+    TraceStream *last;
+    HashTable index;        /* Index of streams by pid */
+    uint64_t records;       /* Number of records decoded */
+} TraceDecoder;
+
+/* Shared-memory ring that the job writes its records to */
+typedef struct {
+    int fd;                 /* Descriptor passed to the job */
+    TraceRing *ring;
+    size_t mapsize;
+    TraceDecoder *decoder;
+    pthread_t consumer;
+    int running;            /* Is the consumer thread running? */
+    int stop;               /* Tell the consumer to stop */
+} TraceChannel;
+
+extern void initTraceDecoder(TraceDecoder *decoder);
+extern ProcInfo *finishTraceDecoder(TraceDecoder *decoder);
+extern void processTraceFiles(TraceDecoder *decoder, const char *tracedir);
+
+extern int initTraceChannel(TraceChannel *channel, size_t size, const char *tracedir);
+extern int startTraceConsumer(TraceChannel *channel, TraceDecoder *decoder);
+extern void stopTraceConsumer(TraceChannel *channel);
+extern void deleteTraceChannel(TraceChannel *channel);
+
+#endif /* _TRACEREADER_H */
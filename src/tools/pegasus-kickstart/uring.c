@@ -0,0 +1,490 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#define _GNU_SOURCE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "uring.h"
+
+#if defined(LINUX) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAS_IO_URING 1
+#endif
+#endif
+
+#ifdef HAS_IO_URING
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#include <linux/io_uring.h>
+
+/* Number of requests in flight in uringStatFiles */
+#define URING_ENTRIES 64
+
+typedef struct {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    unsigned sqe_tail;          /* Next SQE to fill, published by submit */
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    void *cq_ptr;
+    size_t sq_len;
+    size_t cq_len;
+    size_t sqes_len;
+} Ring;
+
+struct _UringReader {
+    Ring ring;
+    int fd;
+    size_t bufsize;
+    unsigned char *buf[2];
+    int next;                   /* Buffer of the read in flight */
+    int pending;                /* Whether a read is in flight */
+    off_t offset;               /* Offset of the read in flight */
+};
+
+static int ring_init(Ring *ring, unsigned entries) {
+    struct io_uring_params p;
+    memset(ring, 0, sizeof(Ring));
+    memset(&p, 0, sizeof(p));
+
+    ring->fd = syscall(__NR_io_uring_setup, entries, &p);
+    if (ring->fd < 0) {
+        return -1;
+    }
+    ring->entries = p.sq_entries;
+
+    ring->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (ring->cq_len > ring->sq_len) {
+            ring->sq_len = ring->cq_len;
+        }
+        ring->cq_len = 0;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_len, PROT_READ|PROT_WRITE,
+                        MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        goto error;
+    }
+    if (ring->cq_len == 0) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_len, PROT_READ|PROT_WRITE,
+                            MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            munmap(ring->sq_ptr, ring->sq_len);
+            goto error;
+        }
+    }
+    ring->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ|PROT_WRITE,
+                      MAP_SHARED|MAP_POPULATE, ring->fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        munmap(ring->sq_ptr, ring->sq_len);
+        if (ring->cq_len) {
+            munmap(ring->cq_ptr, ring->cq_len);
+        }
+        goto error;
+    }
+
+    ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+    ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)((char *)ring->sq_ptr + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+    ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+    ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)((char *)ring->cq_ptr + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr + p.cq_off.cqes);
+    ring->sqe_tail = *ring->sq_tail;
+    return 0;
+
+error:
+    close(ring->fd);
+    ring->fd = -1;
+    return -1;
+}
+
+static void ring_close(Ring *ring) {
+    munmap(ring->sqes, ring->sqes_len);
+    if (ring->cq_len) {
+        munmap(ring->cq_ptr, ring->cq_len);
+    }
+    munmap(ring->sq_ptr, ring->sq_len);
+    close(ring->fd);
+}
+
+/* Returns a cleared SQE, or NULL if the submission queue is full */
+static struct io_uring_sqe *ring_sqe(Ring *ring) {
+    unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    if (ring->sqe_tail - head >= ring->entries) {
+        return NULL;
+    }
+    unsigned index = ring->sqe_tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[index] = index;
+    ring->sqe_tail++;
+    return sqe;
+}
+
+/* Submits the queued SQEs and waits for at least wait completions */
+static int ring_submit(Ring *ring, unsigned wait) {
+    unsigned tail = *ring->sq_tail;
+    unsigned count = ring->sqe_tail - tail;
+    __atomic_store_n(ring->sq_tail, ring->sqe_tail, __ATOMIC_RELEASE);
+    for (;;) {
+        int rc = syscall(__NR_io_uring_enter, ring->fd, count, wait,
+                         wait ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+        if (rc >= 0) {
+            return 0;
+        }
+        if (errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+            return -1;
+        }
+        /* the kernel consumed the SQEs that it accepted */
+        count = ring->sqe_tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+    }
+}
+
+/* Removes the next completion from the queue, returns 0 if there is none */
+static int ring_reap(Ring *ring, uint64_t *user_data, int *res) {
+    unsigned head = *ring->cq_head;
+    if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    *user_data = cqe->user_data;
+    *res = cqe->res;
+    __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+/* Queues the requests for item i, returns how many were queued */
+typedef int (*BatchPrep)(Ring *ring, void *ctx, size_t i);
+/* Handles the completion of one request */
+typedef void (*BatchDone)(void *ctx, uint64_t user_data, int res);
+
+static int ring_batch(Ring *ring, size_t n, unsigned per_item,
+                      BatchPrep prep, BatchDone done, void *ctx) {
+    /* purpose: run prep for n items and wait for all their completions,
+     *          with at most a ring full of requests in flight
+     * returns: 0, or -1 if the ring failed
+     */
+    size_t i = 0;
+    unsigned inflight = 0;
+    while (i < n || inflight > 0) {
+        while (i < n && inflight + per_item <= ring->entries) {
+            inflight += prep(ring, ctx, i++);
+        }
+        if (ring_submit(ring, inflight > 0 ? 1 : 0) != 0) {
+            return -1;
+        }
+        uint64_t user_data;
+        int res;
+        while (ring_reap(ring, &user_data, &res)) {
+            done(ctx, user_data, res);
+            inflight--;
+        }
+    }
+    return 0;
+}
+
+int uringAvailable(void) {
+    /* purpose: check once whether io_uring can be used for the requests
+     *          that kickstart needs
+     * returns: 1 if it can, 0 if not
+     */
+    static int available = -1;
+    if (available >= 0) {
+        return available;
+    }
+    available = 0;
+
+    const char *env = getenv("KICKSTART_IO_URING");
+    if (env != NULL && strcmp(env, "0") == 0) {
+        return 0;
+    }
+
+    Ring ring;
+    if (ring_init(&ring, 2) != 0) {
+        return 0;
+    }
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    if (probe != NULL &&
+            syscall(__NR_io_uring_register, ring.fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        static const int ops[] = {
+            IORING_OP_STATX, IORING_OP_READ
+        };
+        size_t i;
+        available = 1;
+        for (i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] >= probe->ops_len ||
+                    !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                available = 0;
+            }
+        }
+    }
+    free(probe);
+    ring_close(&ring);
+    return available;
+}
+
+typedef struct {
+    const char **names;
+    UringStat *results;
+    struct statx *stx;
+} StatxBatch;
+
+static int prep_statx(Ring *ring, void *ctx, size_t i) {
+    StatxBatch *b = ctx;
+    struct io_uring_sqe *sqe = ring_sqe(ring);
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uintptr_t) b->names[i];
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uintptr_t) &b->stx[i];
+    sqe->user_data = i;
+    return 1;
+}
+
+static void done_statx(void *ctx, uint64_t i, int res) {
+    StatxBatch *b = ctx;
+    UringStat *r = &b->results[i];
+    struct statx *x = &b->stx[i];
+    if (res < 0) {
+        r->error = -res;
+        return;
+    }
+    r->info.st_dev = makedev(x->stx_dev_major, x->stx_dev_minor);
+    r->info.st_ino = x->stx_ino;
+    r->info.st_mode = x->stx_mode;
+    r->info.st_nlink = x->stx_nlink;
+    r->info.st_uid = x->stx_uid;
+    r->info.st_gid = x->stx_gid;
+    r->info.st_rdev = makedev(x->stx_rdev_major, x->stx_rdev_minor);
+    r->info.st_size = x->stx_size;
+    r->info.st_blksize = x->stx_blksize;
+    r->info.st_blocks = x->stx_blocks;
+    r->info.st_atim.tv_sec = x->stx_atime.tv_sec;
+    r->info.st_atim.tv_nsec = x->stx_atime.tv_nsec;
+    r->info.st_mtim.tv_sec = x->stx_mtime.tv_sec;
+    r->info.st_mtim.tv_nsec = x->stx_mtime.tv_nsec;
+    r->info.st_ctim.tv_sec = x->stx_ctime.tv_sec;
+    r->info.st_ctim.tv_nsec = x->stx_ctime.tv_nsec;
+}
+
+int uringStatFiles(const char **names, size_t n, UringStat *results) {
+    /* purpose: stat many files with batches of statx requests
+     * paramtr: names (IN): the files to stat, following symbolic links
+     *          n (IN): number of files
+     *          results (OUT): n results, in the order of names
+     * returns: 0, or -1 if io_uring is not available or failed
+     */
+    StatxBatch b;
+    Ring ring;
+    size_t i;
+    int result = -1;
+
+    if (!uringAvailable()) {
+        errno = ENOSYS;
+        return -1;
+    }
+    memset(&b, 0, sizeof(b));
+    b.names = names;
+    b.results = results;
+    b.stx = calloc(n, sizeof(struct statx));
+    if (b.stx == NULL) {
+        goto exit;
+    }
+    for (i = 0; i < n; i++) {
+        memset(&results[i], 0, sizeof(UringStat));
+    }
+    if (ring_init(&ring, URING_ENTRIES) != 0) {
+        goto exit;
+    }
+
+    if (ring_batch(&ring, n, 1, prep_statx, done_statx, &b) == 0) {
+        result = 0;
+    }
+    ring_close(&ring);
+
+exit:
+    free(b.stx);
+    if (result != 0) {
+        errno = ENOSYS;
+    }
+    return result;
+}
+
+static int reader_queue(UringReader *r) {
+    struct io_uring_sqe *sqe = ring_sqe(&r->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->addr = (uintptr_t) r->buf[r->next];
+    sqe->len = r->bufsize;
+    sqe->off = r->offset;
+    if (ring_submit(&r->ring, 0) != 0) {
+        return -1;
+    }
+    r->pending = 1;
+    return 0;
+}
+
+UringReader *uringOpenReader(int fd, size_t bufsize) {
+    /* purpose: start reading a regular file from the beginning, with one
+     *          block read ahead
+     * paramtr: fd (IN): the open file, which the reader does not close
+     *          bufsize (IN): size of the blocks
+     * returns: the reader, or NULL if io_uring is not available
+     */
+    UringReader *r;
+
+    if (!uringAvailable()) {
+        errno = ENOSYS;
+        return NULL;
+    }
+    r = calloc(1, sizeof(UringReader));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->fd = fd;
+    r->bufsize = bufsize;
+    if (posix_memalign((void **)&r->buf[0], 4096, bufsize) != 0) {
+        r->buf[0] = NULL;
+        goto error;
+    }
+    if (posix_memalign((void **)&r->buf[1], 4096, bufsize) != 0) {
+        r->buf[1] = NULL;
+        goto error;
+    }
+    if (ring_init(&r->ring, 2) != 0) {
+        goto error;
+    }
+    if (reader_queue(r) != 0) {
+        ring_close(&r->ring);
+        goto error;
+    }
+    return r;
+
+error:
+    free(r->buf[0]);
+    free(r->buf[1]);
+    free(r);
+    errno = ENOSYS;
+    return NULL;
+}
+
+ssize_t uringRead(UringReader *r, const unsigned char **data) {
+    /* purpose: return the next block of the file and start reading the
+     *          one after it
+     * paramtr: r (IO): the reader
+     *          data (OUT): the block, valid until the next call
+     * returns: the size of the block, 0 at the end of the file, -1 on error
+     */
+    uint64_t user_data;
+    int res;
+
+    while (r->pending) {
+        if (!ring_reap(&r->ring, &user_data, &res)) {
+            if (ring_submit(&r->ring, 1) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        r->pending = 0;
+        if (res == -EINTR || res == -EAGAIN) {
+            if (reader_queue(r) != 0) {
+                return -1;
+            }
+            continue;
+        }
+        if (res < 0) {
+            errno = -res;
+            return -1;
+        }
+        if (res == 0) {
+            return 0;
+        }
+
+        *data = r->buf[r->next];
+        r->offset += res;
+        r->next ^= 1;
+        if (reader_queue(r) != 0) {
+            return -1;
+        }
+        return res;
+    }
+    return 0;
+}
+
+void uringCloseReader(UringReader *r) {
+    /* purpose: free the reader, after the read in flight is done */
+    uint64_t user_data;
+    int res;
+
+    while (r->pending) {
+        if (ring_reap(&r->ring, &user_data, &res)) {
+            r->pending = 0;
+        } else if (ring_submit(&r->ring, 1) != 0) {
+            break;
+        }
+    }
+    ring_close(&r->ring);
+    free(r->buf[0]);
+    free(r->buf[1]);
+    free(r);
+}
+
+#else /* HAS_IO_URING */
+
+int uringAvailable(void) {
+    return 0;
+}
+
+int uringStatFiles(const char **names, size_t n, UringStat *results) {
+    errno = ENOSYS;
+    return -1;
+}
+
+UringReader *uringOpenReader(int fd, size_t bufsize) {
+    errno = ENOSYS;
+    return NULL;
+}
+
+ssize_t uringRead(UringReader *reader, const unsigned char **data) {
+    errno = ENOSYS;
+    return -1;
+}
+
+void uringCloseReader(UringReader *reader) {
+}
+
+#endif /* HAS_IO_URING */
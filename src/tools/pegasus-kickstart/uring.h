@@ -0,0 +1,53 @@
+/*
+ * This file or a portion of this file is licensed under the terms of
+ * the Globus Toolkit Public License, found in file GTPL, or at
+ * http://www.globus.org/toolkit/download/license.html. This notice must
+ * appear in redistributions of this file, with or without modification.
+ *
+ * Redistributions of this Software, with or without modification, must
+ * reproduce the GTPL in: (1) the Software, or (2) the Documentation or
+ * some other similar material which is provided with the Software (if
+ * any).
+ *
+ * Copyright 1999-2004 University of Chicago and The University of
+ * Southern California. All rights reserved.
+ */
+#ifndef _URING_H
+#define _URING_H
+
+/* Batched file I/O with io_uring, used after the job to stat, open and
+ * read the files it touched. Many requests are queued and submitted with
+ * one system call, so on a network file system the latency is a few round
+ * trips instead of one per file. The ring is driven with the raw system
+ * calls, there is no dependency on liburing.
+ *
+ * Every function returns -1 with errno set to ENOSYS if io_uring is not
+ * available: when kickstart was built without <linux/io_uring.h>, when the
+ * kernel does not support it or forbids it (seccomp, the io_uring_disabled
+ * sysctl), or when KICKSTART_IO_URING is set to 0. The callers then use
+ * the plain system calls.
+ */
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Results of uringStatFiles for one file */
+typedef struct {
+    struct stat info;
+    int error;                      /* errno of the stat, 0 on success */
+} UringStat;
+
+extern int uringAvailable(void);
+extern int uringStatFiles(const char **names, size_t n, UringStat *results);
+
+/* Sequential reader that keeps the next block in flight while the caller
+ * processes the current one. */
+typedef struct _UringReader UringReader;
+
+extern UringReader *uringOpenReader(int fd, size_t bufsize);
+extern ssize_t uringRead(UringReader *reader, const unsigned char **data);
+extern void uringCloseReader(UringReader *reader);
+
+#endif /* _URING_H */
@@ -26,14 +26,12 @@ int printYAMLUseInfo(FILE *out, int indent, const char* id,
      *          use (IN): struct rusage info
      * returns: number of characters put into buffer (buffer length)
      */
-    char b[4][32];
-
     /* <usage> */
     fprintf(out, "%*s%s:\n", indent, "", id);
-    fprintf(out, "%*s  utime: %.3f\n", indent, "", doubletime(use->ru_utime));
-    fprintf(out, "%*s  stime: %.3f\n", indent, "", doubletime(use->ru_stime));
+    yamlfixed(out, indent+2, "utime", doubletime(use->ru_utime), 3);
+    yamlfixed(out, indent+2, "stime", doubletime(use->ru_stime), 3);
 
-    fprintf(out, "%*s  maxrss: %lu\n", indent, "", 
+    yamluint(out, indent+2, "maxrss", (unsigned long)
 #ifdef DARWIN
             /* On Mac OS X this is in bytes */
             use->ru_maxrss / 1024
@@ -43,23 +41,20 @@ int printYAMLUseInfo(FILE *out, int indent, const char* id,
 #endif
     );
 
-    fprintf(out, "%*s  minflt: %s\n%*s  majflt: %s\n%*s  nswap: %s\n",
-            indent, "", sizer(b[0], 32, sizeof(use->ru_minflt), &(use->ru_minflt)),
-            indent, "", sizer(b[1], 32, sizeof(use->ru_majflt), &(use->ru_majflt)),
-            indent, "", sizer(b[2], 32, sizeof(use->ru_nswap), &(use->ru_nswap)));
+    /* the counters are longs, but have always been printed unsigned */
+    yamluint(out, indent+2, "minflt", (unsigned long) use->ru_minflt);
+    yamluint(out, indent+2, "majflt", (unsigned long) use->ru_majflt);
+    yamluint(out, indent+2, "nswap", (unsigned long) use->ru_nswap);
 
-    fprintf(out, "%*s  inblock: %s\n%*s  outblock: %s\n",
-            indent, "", sizer(b[0], 32, sizeof(use->ru_inblock), &(use->ru_inblock)),
-            indent, "", sizer(b[1], 32, sizeof(use->ru_oublock), &(use->ru_oublock)));
+    yamluint(out, indent+2, "inblock", (unsigned long) use->ru_inblock);
+    yamluint(out, indent+2, "outblock", (unsigned long) use->ru_oublock);
 
-    fprintf(out, "%*s  msgsnd: %s\n%*s  msgrcv: %s\n",
-            indent, "", sizer(b[2], 32, sizeof(use->ru_msgsnd), &(use->ru_msgsnd)),
-            indent, "", sizer(b[3], 32, sizeof(use->ru_msgrcv), &(use->ru_msgrcv)));
+    yamluint(out, indent+2, "msgsnd", (unsigned long) use->ru_msgsnd);
+    yamluint(out, indent+2, "msgrcv", (unsigned long) use->ru_msgrcv);
 
-    fprintf(out, "%*s  nsignals: %s\n%*s  nvcsw: %s\n%*s  nivcsw: %s\n",
-            indent, "", sizer(b[0], 32, sizeof(use->ru_nsignals), &(use->ru_nsignals)),
-            indent, "", sizer(b[1], 32, sizeof(use->ru_nvcsw), &(use->ru_nvcsw)),
-            indent, "", sizer(b[2], 32, sizeof(use->ru_nivcsw), &(use->ru_nivcsw)));
+    yamluint(out, indent+2, "nsignals", (unsigned long) use->ru_nsignals);
+    yamluint(out, indent+2, "nvcsw", (unsigned long) use->ru_nvcsw);
+    yamluint(out, indent+2, "nivcsw", (unsigned long) use->ru_nivcsw);
 
     return 0;
 }
@@ -27,6 +27,9 @@
 #include <sys/poll.h>
 #include <wchar.h>
 #include <locale.h>
+#include <langinfo.h>
+#include <stdint.h>
+#include <math.h>
 
 #include "utils.h"
 
@@ -62,6 +65,26 @@ int yamlprintable(wint_t c)
 }
 
 
+/* Unlocked stdio for the YAML writers. A record is written by a single
+ * thread, so the per-call locking of fwrite/fputs is pure overhead. */
+#ifdef __GLIBC__
+#define YAML_WRITE(s, n, out) fwrite_unlocked((s), 1, (n), (out))
+#define YAML_PUTC(c, out) putc_unlocked((c), (out))
+#else
+#define YAML_WRITE(s, n, out) fwrite((s), 1, (n), (out))
+#define YAML_PUTC(c, out) putc((c), (out))
+#endif
+
+/* Indentation is written from this string instead of formatting "%*s" */
+static const char yamlspaces[] =
+    "                                                                "
+    "                                                                ";
+
+/* Powers of ten for yamlfixed */
+static const double yamlpow10[] = {
+    1E0, 1E1, 1E2, 1E3, 1E4, 1E5, 1E6, 1E7, 1E8, 1E9
+};
+
 void yamlquote(FILE *out, const char* msg, size_t msglen) {
     /* purpose: write a possibly binary message to the stream with YAML
      * paramtr: out (IO): stream to write the quoted yaml to
@@ -69,20 +92,212 @@ void yamlquote(FILE *out, const char* msg, size_t msglen) {
      *          mlen (IN): length of message area to append
      * returns: nada
      */
-    size_t i;
+    size_t i, run = 0;
     for (i=0; i<msglen; ++i) {
         /* We assume that all the characters that need to be escaped fall
          * in the ASCII range. Anything outside that range, we assume to
-         * be UTF-8 encoded.
+         * be UTF-8 encoded. Characters that map to themselves are copied
+         * in runs.
          */
         unsigned char j = (unsigned char) msg[i];
-        if (j < 128) {
-            fputs(asciilookup[j], out);
-        } else {
-            /* FIXME */
-            fputc(msg[i], out);
+        if (j >= 128 || (asciilookup[j][0] == j && asciilookup[j][1] == '\0')) {
+            continue;
         }
+        YAML_WRITE(msg + run, i - run, out);
+        fputs(asciilookup[j], out);
+        run = i + 1;
+    }
+    YAML_WRITE(msg + run, msglen - run, out);
+}
+
+void yamlindent(FILE *out, int indent) {
+    /* purpose: write indentation, like fprintf(out, "%*s", indent, "")
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     */
+    while (indent > 0) {
+        int n = indent < (int) sizeof(yamlspaces) - 1 ? indent : (int) sizeof(yamlspaces) - 1;
+        YAML_WRITE(yamlspaces, n, out);
+        indent -= n;
+    }
+}
+
+void yamlkey(FILE *out, int indent, const char *key) {
+    /* purpose: start a "key: " pair at the given indentation
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     */
+    yamlindent(out, indent);
+    YAML_WRITE(key, strlen(key), out);
+    YAML_WRITE(": ", 2, out);
+}
+
+static void yamlline(FILE *out, int indent, const char *key,
+                     const char *value, size_t vlen) {
+    /* purpose: write "key: value\n", assembled in one buffer if it fits
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): formatted value, without the newline
+     *          vlen (IN): length of value
+     */
+    char line[256];
+    size_t klen = strlen(key);
+    if (indent < 0) {
+        indent = 0;
     }
+    if (indent + klen + vlen + 3 > sizeof(line) || indent >= (int) sizeof(yamlspaces)) {
+        yamlkey(out, indent, key);
+        YAML_WRITE(value, vlen, out);
+        YAML_PUTC('\n', out);
+        return;
+    }
+    char *p = line;
+    memcpy(p, yamlspaces, indent);
+    p += indent;
+    memcpy(p, key, klen);
+    p += klen;
+    *p++ = ':';
+    *p++ = ' ';
+    memcpy(p, value, vlen);
+    p += vlen;
+    *p++ = '\n';
+    YAML_WRITE(line, p - line, out);
+}
+
+void yamlstr(FILE *out, int indent, const char *key, const char *value) {
+    /* purpose: write "key: value" without quoting the value
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): string to write as is
+     */
+    yamlline(out, indent, key, value, strlen(value));
+}
+
+void yamlquoted(FILE *out, int indent, const char *key, const char *value) {
+    /* purpose: write "key: \"value\"" with the value quoted by yamlquote
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): string to quote
+     */
+    yamlkey(out, indent, key);
+    YAML_PUTC('"', out);
+    yamlquote(out, value, strlen(value));
+    YAML_WRITE("\"\n", 2, out);
+}
+
+char *fmtuint(char *end, uint64_t value) {
+    /* purpose: format an unsigned integer like %llu, from the end backwards
+     * paramtr: end (OUT): end of the area, which must have room for 20 digits
+     *          value (IN): value to format
+     * returns: start of the digits, they are not NUL-terminated
+     */
+    do {
+        *--end = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+void yamluint(FILE *out, int indent, const char *key, uint64_t value) {
+    /* purpose: write "key: value" for an unsigned integer
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): value to format like %llu
+     */
+    char buf[24];
+    char *s = fmtuint(buf + sizeof(buf), value);
+    yamlline(out, indent, key, s, buf + sizeof(buf) - s);
+}
+
+void yamlint(FILE *out, int indent, const char *key, int64_t value) {
+    /* purpose: write "key: value" for a signed integer
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): value to format like %lld
+     */
+    char buf[24];
+    char *s = fmtuint(buf + sizeof(buf),
+                      value < 0 ? -(uint64_t) value : (uint64_t) value);
+    if (value < 0) {
+        *--s = '-';
+    }
+    yamlline(out, indent, key, s, buf + sizeof(buf) - s);
+}
+
+static size_t fmtfixed(char *buf, size_t size, double value, int decimals) {
+    /* purpose: format a double like "%.*f" does, without the printf engine
+     * paramtr: buf (OUT): area to format into, at least 48 bytes
+     *          size (IN): capacity of buf
+     *          value (IN): value to format
+     *          decimals (IN): number of digits after the point, 0..9
+     * returns: number of characters in buf
+     */
+    static int point = -1;
+    if (point < 0) {
+        /* the locale is set once at startup, see main() */
+        const char *dp = localeconv()->decimal_point;
+        point = dp[0] == '.' && dp[1] == '\0';
+    }
+
+    /* The integer part of a double below 2^53 is exact, and so is the
+     * difference to the fraction. The fraction scaled by at most 1E9 is
+     * accurate to about 1E-7, so only values that are very close to a
+     * rounding tie need the exact decimal expansion of printf. */
+    double mag = fabs(value);
+    if (point && decimals >= 0 && decimals <= 9 && mag < 9007199254740992.0) {
+        double ip = floor(mag);
+        double scaled = (mag - ip) * yamlpow10[decimals];
+        double digits = floor(scaled);
+        double rest = scaled - digits;
+        if (fabs(rest - 0.5) > 1E-6) {
+            uint64_t whole = (uint64_t) ip;
+            uint64_t frac = (uint64_t) digits + (rest > 0.5);
+            if (frac >= (uint64_t) yamlpow10[decimals]) {
+                frac -= (uint64_t) yamlpow10[decimals];
+                whole++;
+            }
+
+            char tmp[48];
+            char *end = tmp + sizeof(tmp);
+            char *s = end;
+            if (decimals > 0) {
+                int i;
+                for (i = 0; i < decimals; i++) {
+                    *--s = '0' + frac % 10;
+                    frac /= 10;
+                }
+                *--s = '.';
+            }
+            s = fmtuint(s, whole);
+            if (signbit(value)) {
+                *--s = '-';
+            }
+            memcpy(buf, s, end - s);
+            return end - s;
+        }
+    }
+
+    int n = snprintf(buf, size, "%.*f", decimals, value);
+    return n < 0 ? 0 : (size_t) n < size ? (size_t) n : size - 1;
+}
+
+void yamlfixed(FILE *out, int indent, const char *key, double value, int decimals) {
+    /* purpose: write "key: value" for a double with a fixed number of decimals
+     * paramtr: out (IO): stream to write to
+     *          indent (IN): number of spaces
+     *          key (IN): name of the key
+     *          value (IN): value to format like "%.*f"
+     *          decimals (IN): number of digits after the point
+     */
+    char buf[512];
+    size_t n = fmtfixed(buf, sizeof(buf), value, decimals);
+    yamlline(out, indent, key, buf, n);
 }
 
 void yamldump(FILE *in, FILE *out, const int indent) {
@@ -115,6 +330,267 @@ void yamldump(FILE *in, FILE *out, const int indent) {
     }
 }
 
+/* Block size for reading files in yamltail */
+#define TAIL_BLOCK 65536
+
+/* Encodings that yamltail understands */
+enum {
+    TAIL_ASCII,
+    TAIL_UTF8
+};
+
+static int tail_decode(int encoding, const unsigned char *s, size_t avail, uint32_t *value) {
+    /* purpose: decode one character like fgetwc does in the C or a UTF-8
+     *          locale: overlong forms and surrogates are invalid, but
+     *          sequences of up to 6 bytes are accepted
+     * paramtr: encoding (IN): TAIL_ASCII or TAIL_UTF8
+     *          s (IN): bytes to decode
+     *          avail (IN): number of bytes in s, at least 1
+     *          value (OUT): the character
+     * returns: the length of the character, 0 if it is invalid, or -1 if
+     *          more than avail bytes are needed to decide
+     */
+    static const uint32_t minimum[7] = { 0, 0, 0x80, 0x800, 0x10000, 0x200000, 0x4000000 };
+    unsigned char c = s[0];
+    size_t len, i;
+    uint32_t v;
+
+    if (c < 0x80) {
+        *value = c;
+        return 1;
+    }
+    if (encoding == TAIL_ASCII || c < 0xC2 || c > 0xFD) {
+        return 0;
+    }
+    if (c < 0xE0) {
+        len = 2;
+        v = c & 0x1F;
+    } else if (c < 0xF0) {
+        len = 3;
+        v = c & 0x0F;
+    } else if (c < 0xF8) {
+        len = 4;
+        v = c & 0x07;
+    } else if (c < 0xFC) {
+        len = 5;
+        v = c & 0x03;
+    } else {
+        len = 6;
+        v = c & 0x01;
+    }
+    for (i = 1; i < len; i++) {
+        if (i >= avail) {
+            return -1;
+        }
+        if ((s[i] & 0xC0) != 0x80) {
+            return 0;
+        }
+        v = (v << 6) | (s[i] & 0x3F);
+    }
+    if (v < minimum[len] || (v >= 0xD800 && v <= 0xDFFF)) {
+        return 0;
+    }
+    *value = v;
+    return (int)len;
+}
+
+static ssize_t tail_read(int fd, unsigned char *buf, size_t size, off_t offset) {
+    ssize_t n;
+    do {
+        n = pread(fd, buf, size, offset);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+static int tail_scan(int fd, int encoding, unsigned char *buf, off_t *end, size_t *chars) {
+    /* purpose: find the end of the part of a file that fgetwc can read,
+     *          which is the first invalid or incomplete character
+     * paramtr: fd (IN): file to scan
+     *          encoding (IN): TAIL_ASCII or TAIL_UTF8
+     *          buf (IO): buffer of TAIL_BLOCK bytes
+     *          end (OUT): offset of the end of the readable part
+     *          chars (OUT): number of characters in the readable part
+     * returns: 0 on success, -1 on read error
+     */
+    off_t offset = 0;       /* file offset of buf[0] */
+    size_t len = 0;         /* bytes in buf */
+    size_t i = 0;           /* next byte to decode */
+    size_t count = 0;
+    int eof = 0;
+    uint32_t c;
+
+    for (;;) {
+        /* Keep enough bytes for the longest character in the buffer */
+        while (!eof && len - i < 6) {
+            memmove(buf, buf + i, len - i);
+            offset += i;
+            len -= i;
+            i = 0;
+            ssize_t n = tail_read(fd, buf + len, TAIL_BLOCK - len, offset + len);
+            if (n < 0) {
+                return -1;
+            }
+            if (n == 0) {
+                eof = 1;
+            }
+            len += n;
+        }
+        if (i == len) {
+            break;
+        }
+
+        /* Characters that start before limit are complete in buf */
+        size_t limit = eof ? len : len - 5;
+        while (i < limit) {
+            /* Skip ASCII 8 bytes at a time */
+            while (i + 8 <= len) {
+                uint64_t w;
+                memcpy(&w, buf + i, 8);
+                if (w & 0x8080808080808080ULL) {
+                    break;
+                }
+                i += 8;
+                count += 8;
+            }
+            if (i >= limit) {
+                break;
+            }
+
+            int n = tail_decode(encoding, buf + i, len - i, &c);
+            if (n <= 0) {
+                /* Invalid, or incomplete at the end of the file */
+                *end = offset + i;
+                *chars = count;
+                return 0;
+            }
+            i += n;
+            count++;
+        }
+    }
+
+    *end = offset + i;
+    *chars = count;
+    return 0;
+}
+
+static off_t tail_start(int fd, unsigned char *buf, off_t end, size_t skip) {
+    /* purpose: find the offset of the last skip characters before end.
+     *          All the data before end is valid, so every byte that is
+     *          not a continuation byte starts a character.
+     * returns: the offset, or -1 on read error
+     */
+    off_t pos = end;
+    while (skip > 0 && pos > 0) {
+        size_t size = pos > TAIL_BLOCK ? TAIL_BLOCK : (size_t)pos;
+        ssize_t n = tail_read(fd, buf, size, pos - size);
+        if (n != (ssize_t)size) {
+            return -1;
+        }
+        size_t i = size;
+        while (i > 0) {
+            i--;
+            if ((buf[i] & 0xC0) != 0x80 && --skip == 0) {
+                return pos - size + i;
+            }
+        }
+        pos -= size;
+    }
+    return pos;
+}
+
+int yamltail(int fd, FILE *out, const int indent, size_t maxchars) {
+    /* purpose: write the last maxchars characters of a file to yaml as a
+     *          literal. The output is the same as reading the file with
+     *          fgetwc, skipping all but the last maxchars characters, and
+     *          calling yamldump on the rest, but it is much faster.
+     * paramtr: fd (IN): file to read, the offset is not changed
+     *          out (IO): stream to write the literal to
+     *          indent: indentation of the lines
+     *          maxchars (IN): maximum number of characters to write
+     * returns: 0 on success, -1 if the encoding of the locale is not
+     *          supported or the file can not be read. Nothing has been
+     *          written in that case.
+     */
+    const char *codeset = nl_langinfo(CODESET);
+    int encoding;
+    if (strcmp(codeset, "UTF-8") == 0) {
+        encoding = TAIL_UTF8;
+    } else if (strcmp(codeset, "ANSI_X3.4-1968") == 0) {
+        encoding = TAIL_ASCII;
+    } else {
+        return -1;
+    }
+
+    unsigned char *buf = malloc(TAIL_BLOCK);
+    if (buf == NULL) {
+        return -1;
+    }
+
+    off_t end, start;
+    size_t chars;
+    if (tail_scan(fd, encoding, buf, &end, &chars) < 0) {
+        free(buf);
+        return -1;
+    }
+    start = chars > maxchars ? tail_start(fd, buf, end, maxchars) : 0;
+    if (start < 0) {
+        free(buf);
+        return -1;
+    }
+
+    /* Same rules as yamldump, but runs of printable characters are
+     * copied as they are. They are valid, so %lc would produce the same
+     * bytes. */
+    int first_line = 1;
+    off_t offset = start;
+    while (offset < end) {
+        size_t size = end - offset > TAIL_BLOCK ? TAIL_BLOCK : (size_t)(end - offset);
+        ssize_t n = tail_read(fd, buf, size, offset);
+        if (n <= 0) {
+            break;
+        }
+        size = n;
+
+        size_t i = 0, run = 0;
+        while (i < size) {
+            uint32_t c;
+            int len = tail_decode(encoding, buf + i, size - i, &c);
+            if (len <= 0) {
+                /* Split by the block, start the next block here */
+                break;
+            }
+            if (c >= 0x20 && c <= 0x7E && !first_line) {
+                i++;
+                continue;
+            }
+            if (i > run) {
+                fwrite(buf + run, 1, i - run, out);
+            }
+            if (first_line && (c == 0x20 || c == 0x9 || c == 0xD)) {
+                /* first line can not have leading white spaces */
+            } else if (c == 0xA || c == 0xD) {
+                fprintf(out, "\n%*s", indent, "");
+            } else if (yamlprintable(c)) {
+                fwrite(buf + i, 1, len, out);
+                first_line = 0;
+            }
+            i += len;
+            run = i;
+        }
+        if (i > run) {
+            fwrite(buf + run, 1, i - run, out);
+        }
+        if (i == 0) {
+            /* The file changed since it was scanned */
+            break;
+        }
+        offset += i;
+    }
+
+    free(buf);
+    return 0;
+}
+
 static int isExtended = 1;     /* timestamp format concise or extended */
 static int isLocal = 1;        /* timestamp time zone, UTC or local */
 static char __isodate[32];
@@ -189,6 +665,15 @@ void now(struct timeval* t) {
     while (gettimeofday(t, 0) == -1 && timeout < 10) timeout++;
 }
 
+double monotime(void) {
+    /* purpose: read a clock that is not affected by changes of the time
+     *          of day, to measure intervals
+     * returns: seconds since an arbitrary point in the past */
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1E9;
+}
+
 static int isWriteableDir(const char* tmp) {
     /* purpose: Check that the given dir exists and is writable for us
      * paramtr: tmp (IN): designates a directory location
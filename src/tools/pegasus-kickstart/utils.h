@@ -19,12 +19,23 @@
 #include <sys/types.h>
 #include <sys/time.h>
 #include <time.h>
+#include <stdint.h>
 
 extern void yamlquote(FILE *out, const char* msg, size_t msglen);
+extern void yamlindent(FILE *out, int indent);
+extern void yamlkey(FILE *out, int indent, const char *key);
+extern void yamlstr(FILE *out, int indent, const char *key, const char *value);
+extern void yamlquoted(FILE *out, int indent, const char *key, const char *value);
+extern void yamluint(FILE *out, int indent, const char *key, uint64_t value);
+extern void yamlint(FILE *out, int indent, const char *key, int64_t value);
+extern void yamlfixed(FILE *out, int indent, const char *key, double value, int decimals);
 extern void yamldump(FILE *in, FILE *out, const int indent);
+extern int yamltail(int fd, FILE *out, const int indent, size_t maxchars);
+extern char* fmtuint(char *end, uint64_t value);
 extern char* fmtisodate(time_t seconds, long micros);
 extern double doubletime(const struct timeval t);
 extern void now(struct timeval* t);
+extern double monotime(void);
 extern const char* getTempDir(void);
 extern char* sizer(char* buffer, size_t capacity, size_t vsize, const void* value);
 